@@ -51,6 +51,7 @@
 #include "vscp-projdefs.h"
 
 #include "vscp-droplet.h"
+#include "eventref.h"
 #include "tcpsrv.h"
 #include "main.h"
 
@@ -94,7 +95,7 @@ vscp_link_callback_welcome(const void *pdata)
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
   sprintf(pbuf, TCPSRV_WELCOME_MSG, g_persistent.nodeName);
-  send(pctx->sock, pbuf, strlen(pbuf), 0);
+  tcpsrv_send(pctx, pbuf, strlen(pbuf));
 
   VSCP_FREE(pbuf);
   return VSCP_ERROR_SUCCESS;
@@ -112,7 +113,7 @@ vscp_link_callback_write_client(const void *pdata, const char *msg)
   }
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
-  send(pctx->sock, (uint8_t *) msg, strlen(msg), 0);
+  tcpsrv_send(pctx, (uint8_t *) msg, strlen(msg));
   return VSCP_ERROR_SUCCESS;
 }
 
@@ -131,10 +132,12 @@ vscp_link_callback_quit(const void *pdata)
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
   // Confirm quit
-  send(pctx->sock, VSCP_LINK_MSG_GOODBY, strlen(VSCP_LINK_MSG_GOODBY), 0);
+  tcpsrv_send(pctx, VSCP_LINK_MSG_GOODBY, strlen(VSCP_LINK_MSG_GOODBY));
 
-  // Disconnect from client
-  close(pctx->sock);
+  // Disconnect from client, a failed write has already done it
+  if (pctx->sock) {
+    close(pctx->sock);
+  }
 
   // Set context defaults (and socket to zero to terminate working thread)
   tcpsrv_setContextDefaults(pctx);
@@ -154,7 +157,7 @@ vscp_link_callback_help(const void *pdata, const char *arg)
   }
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
-  send(pctx->sock, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK), 0);
+  tcpsrv_send(pctx, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK));
   return VSCP_ERROR_SUCCESS;
 }
 
@@ -215,7 +218,7 @@ vscp_link_callback_check_user(const void *pdata, const char *arg)
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
   strncpy(pctx->user, (char *) p, VSCP_LINK_MAX_USER_NAME_LENGTH);
-  send(pctx->sock, VSCP_LINK_MSG_USENAME_OK, strlen(VSCP_LINK_MSG_USENAME_OK), 0);
+  tcpsrv_send(pctx, VSCP_LINK_MSG_USENAME_OK, strlen(VSCP_LINK_MSG_USENAME_OK));
   return VSCP_ERROR_SUCCESS;
 }
 
@@ -234,7 +237,7 @@ vscp_link_callback_check_password(const void *pdata, const char *arg)
 
   // Must have a username before a password
   if (*(pctx->user) == '\0') {
-    send(pctx->sock, VSCP_LINK_MSG_NEED_USERNAME, strlen(VSCP_LINK_MSG_NEED_USERNAME), 0);
+    tcpsrv_send(pctx, VSCP_LINK_MSG_NEED_USERNAME, strlen(VSCP_LINK_MSG_NEED_USERNAME));
     return VSCP_ERROR_SUCCESS;
   }
 
@@ -261,11 +264,11 @@ vscp_link_callback_check_password(const void *pdata, const char *arg)
     pctx->user[0]    = '\0';
     pctx->bValidated = false;
     pctx->privLevel  = 0;
-    send(pctx->sock, VSCP_LINK_MSG_PASSWORD_ERROR, strlen(VSCP_LINK_MSG_PASSWORD_ERROR), 0);
+    tcpsrv_send(pctx, VSCP_LINK_MSG_PASSWORD_ERROR, strlen(VSCP_LINK_MSG_PASSWORD_ERROR));
     return VSCP_ERROR_SUCCESS;
   }
 
-  send(pctx->sock, VSCP_LINK_MSG_PASSWORD_OK, strlen(VSCP_LINK_MSG_PASSWORD_OK), 0);
+  tcpsrv_send(pctx, VSCP_LINK_MSG_PASSWORD_OK, strlen(VSCP_LINK_MSG_PASSWORD_OK));
   return VSCP_ERROR_SUCCESS;
 }
 
@@ -302,7 +305,7 @@ vscp_link_callback_challenge(const void *pdata, const char *arg)
   }
 
   strcat((char *) buf, "\r\n");
-  send(pctx->sock, buf, strlen((const char *) buf), 0);
+  tcpsrv_send(pctx, buf, strlen((const char *) buf));
   return VSCP_ERROR_SUCCESS;
 }
 
@@ -359,7 +362,7 @@ vscp_link_callback_test(const void *pdata, const char *arg)
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
-  send(pctx->sock, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK), 0);
+  tcpsrv_send(pctx, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK));
   return 0;
 }
 
@@ -413,7 +416,7 @@ vscp_link_callback_chkData(const void *pdata, uint16_t *pcount)
   }
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
-  *pcount         = uxQueueMessagesWaiting(pctx->queueClient);
+  *pcount         = tcpsrv_countEvents(pctx);
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -429,14 +432,16 @@ vscp_link_callback_retr(const void *pdata, vscpEvent **pev)
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  vscpctx_t *pctx = (vscpctx_t *) pdata;
+  vscpctx_t *pctx  = (vscpctx_t *) pdata;
+  eventref_t *pref = tcpsrv_takeEvent(pctx);
 
-  if (pdTRUE == xSemaphoreTake(pctx->mutexQueue, 10 / portTICK_PERIOD_MS)) {
-    if (pdTRUE != xQueueReceive(pctx->queueClient, pev, 0)) {
-      xSemaphoreGive(pctx->mutexQueue);
-      return VSCP_ERROR_RCV_EMPTY; // Yes receive
-    }
-    xSemaphoreGive(pctx->mutexQueue);
+  if (NULL == pref) {
+    return VSCP_ERROR_RCV_EMPTY; // Yes receive
+  }
+
+  // Caller frees the event
+  if (NULL == (*pev = eventref_take(pref))) {
+    return VSCP_ERROR_MEMORY;
   }
 
   // Update receive statistics
@@ -461,6 +466,7 @@ vscp_link_callback_enable_rcvloop(const void *pdata, int bEnable)
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
   pctx->bRcvLoop          = bEnable;
+  pctx->bBinary           = 0; // rcvloop is text, quitloop also ends brcvloop
   pctx->last_rcvloop_time = esp_timer_get_time();
 
   return VSCP_ERROR_SUCCESS;
@@ -498,17 +504,7 @@ vscp_link_callback_clrAll(const void *pdata)
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
-  vscpEvent *pev;
-  if (pdTRUE == xSemaphoreTake(pctx->mutexQueue, 10 / portTICK_PERIOD_MS)) {
-
-    while (pdTRUE == xQueueReceive(pctx->queueClient, &(pev), 0)) {
-      vscp_fwhlp_deleteEvent(&pev);
-    }
-    xSemaphoreGive(pctx->mutexQueue);
-  }
-  else {
-    return VSCP_ERROR_ERROR;
-  }
+  tcpsrv_clearEvents(pctx);
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -600,6 +596,7 @@ vscp_link_callback_setFilter(const void *pdata, vscpEventFilter *pfilter)
   pctx->filter.filter_type     = pfilter->filter_type;
   pctx->filter.filter_priority = pfilter->filter_priority;
   memcpy(pctx->filter.filter_GUID, pfilter->filter_GUID, 16);
+  tcpsrv_compileFilter(pctx);
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -621,6 +618,7 @@ vscp_link_callback_setMask(const void *pdata, vscpEventFilter *pfilter)
   pctx->filter.mask_type     = pfilter->mask_type;
   pctx->filter.mask_priority = pfilter->mask_priority;
   memcpy(pctx->filter.mask_GUID, pfilter->mask_GUID, 16);
+  tcpsrv_compileFilter(pctx);
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -675,24 +673,26 @@ vscp_link_callback_rcvloop(const void *pdata, vscpEvent **pev)
 
   vscpctx_t *pctx = (vscpctx_t *) pdata;
 
+  // In brcvloop mode the server task writes events and keep alive
+  if (pctx->bBinary) {
+    return VSCP_ERROR_RCV_EMPTY;
+  }
+
   // Every second output '+OK\r\n' in rcvloop mode
   if ((esp_timer_get_time() - pctx->last_rcvloop_time) > 1000000l) {
     pctx->last_rcvloop_time = esp_timer_get_time();
     return VSCP_ERROR_TIMEOUT;
   }
 
-  if (pdTRUE == xSemaphoreTake(pctx->mutexQueue, 0)) {
-    if (pdTRUE != xQueueReceive(pctx->queueClient, pev, 0)) {
-      xSemaphoreGive(pctx->mutexQueue);
-      return VSCP_ERROR_RCV_EMPTY;
-    }
-    xSemaphoreGive(pctx->mutexQueue);
-  }
-  else {
-    return VSCP_ERROR_TIMEOUT;
+  eventref_t *pref = tcpsrv_takeEvent(pctx);
+  if (NULL == pref) {
+    return VSCP_ERROR_RCV_EMPTY;
   }
 
-  xSemaphoreGive(pctx->mutexQueue);
+  // Caller frees the event
+  if (NULL == (*pev = eventref_take(pref))) {
+    return VSCP_ERROR_MEMORY;
+  }
 
   // Update receive statistics
   pctx->statistics.cntReceiveFrames++;
@@ -776,6 +776,9 @@ vscp_link_callback_restart(const void *pdata)
 ///////////////////////////////////////////////////////////////////////////////
 // vscp_link_callback_bretr
 //
+// Queued events are written as batches of binary frames (linkbin.h)
+// ended by a batch with no frames and then '+OK'.
+//
 
 int
 vscp_link_callback_bretr(const void *pdata)
@@ -785,16 +788,23 @@ vscp_link_callback_bretr(const void *pdata)
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // vscpctx_t *pctx = (vscpctx_t *) pdata;
+  vscpctx_t *pctx = (vscpctx_t *) pdata;
 
-  esp_restart(); // Restart
+  int rv = tcpsrv_binaryRetrieve(pctx);
+  if (VSCP_ERROR_SUCCESS != rv) {
+    return rv;
+  }
 
+  tcpsrv_send(pctx, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK));
   return VSCP_ERROR_SUCCESS;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // vscp_link_callback_bsend
 //
+// The command is followed by a batch of binary frames (linkbin.h). The
+// server task reads them and replies '+OK' when all are sent.
+//
 
 int
 vscp_link_callback_bsend(const void *pdata)
@@ -804,9 +814,10 @@ vscp_link_callback_bsend(const void *pdata)
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // vscpctx_t *pctx = (vscpctx_t *) pdata;
+  vscpctx_t *pctx = (vscpctx_t *) pdata;
 
-  esp_restart(); // Restart
+  pctx->bsendLeft   = -1; // Frame count comes first
+  pctx->bsendFailed = 0;
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -814,6 +825,10 @@ vscp_link_callback_bsend(const void *pdata)
 ///////////////////////////////////////////////////////////////////////////////
 // vscp_link_callback_brcvloop
 //
+// As rcvloop but events are written as batches of binary frames
+// (linkbin.h). A batch with no frames is sent every second as keep
+// alive. Ended with 'quitloop'.
+//
 
 int
 vscp_link_callback_brcvloop(const void *pdata)
@@ -823,9 +838,13 @@ vscp_link_callback_brcvloop(const void *pdata)
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // vscpctx_t *pctx = (vscpctx_t *) pdata;
+  vscpctx_t *pctx = (vscpctx_t *) pdata;
 
-  esp_restart(); // Restart
+  tcpsrv_send(pctx, VSCP_LINK_MSG_OK, strlen(VSCP_LINK_MSG_OK));
+
+  pctx->bRcvLoop          = 1;
+  pctx->bBinary           = 1;
+  pctx->last_rcvloop_time = esp_timer_get_time();
 
   return VSCP_ERROR_SUCCESS;
 }
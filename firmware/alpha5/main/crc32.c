@@ -0,0 +1,51 @@
+/*
+  File: crc32.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  CRC-32 for data kept in flash
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include "crc32.h"
+
+// Four bits at a time, a table of 64 bytes
+static const uint32_t s_crcTable[16] = { 0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+                                         0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+                                         0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
+
+///////////////////////////////////////////////////////////////////////////////
+// crc32_update
+//
+
+uint32_t
+crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+  while (len--) {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ s_crcTable[crc & 0x0f];
+    crc = (crc >> 4) ^ s_crcTable[crc & 0x0f];
+  }
+
+  return crc;
+}
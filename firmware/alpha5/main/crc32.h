@@ -0,0 +1,52 @@
+/*
+  File: crc32.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  CRC-32 for data kept in flash
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_CRC32__
+#define __VSCP_CRC32__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @fn crc32_update
+ * @brief CRC-32 (polynomial 0xedb88320) over a block of data
+ *
+ * Start with crc = 0xffffffff, call once for each block and invert
+ * the result.
+ *
+ * @param crc CRC so far
+ * @param buf Data
+ * @param len Length of data
+ * @return Updated CRC
+ */
+
+uint32_t
+crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+
+#endif
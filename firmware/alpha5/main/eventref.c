@@ -0,0 +1,122 @@
+/*
+  File: eventref.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Reference counted events shared by the VSCP link clients
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <vscp.h>
+#include <vscp-firmware-helper.h>
+
+#include "eventref.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// eventref_new
+//
+
+eventref_t *
+eventref_new(const vscpEvent *pev)
+{
+  if (NULL == pev) {
+    return NULL;
+  }
+
+  eventref_t *pref = VSCP_MALLOC(sizeof(eventref_t));
+  if (NULL == pref) {
+    return NULL;
+  }
+
+  memcpy(&pref->ev, pev, sizeof(vscpEvent));
+  pref->ev.pdata = NULL;
+
+  if (pev->sizeData) {
+    pref->ev.pdata = VSCP_MALLOC(pev->sizeData);
+    if (NULL == pref->ev.pdata) {
+      VSCP_FREE(pref);
+      return NULL;
+    }
+    memcpy(pref->ev.pdata, pev->pdata, pev->sizeData);
+  }
+
+  atomic_init(&pref->refs, 1);
+
+  return pref;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventref_get
+//
+
+eventref_t *
+eventref_get(eventref_t *pref)
+{
+  atomic_fetch_add(&pref->refs, 1);
+  return pref;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventref_put
+//
+
+void
+eventref_put(eventref_t *pref)
+{
+  if (NULL == pref) {
+    return;
+  }
+
+  if (1 == atomic_fetch_sub(&pref->refs, 1)) {
+    vscpEvent *pev = &pref->ev;
+    vscp_fwhlp_deleteEvent(&pev);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventref_take
+//
+
+vscpEvent *
+eventref_take(eventref_t *pref)
+{
+  if (NULL == pref) {
+    return NULL;
+  }
+
+  // No one else can get a new reference so a count of one stays one
+  if (1 == atomic_load(&pref->refs)) {
+    return &pref->ev;
+  }
+
+  vscpEvent *pnew = vscp_fwhlp_mkEventCopy(&pref->ev);
+  eventref_put(pref);
+
+  return pnew;
+}
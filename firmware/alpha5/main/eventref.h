@@ -0,0 +1,94 @@
+/*
+  File: eventref.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Reference counted events shared by the VSCP link clients
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_EVENTREF__
+#define __VSCP_EVENTREF__
+
+#include <stdatomic.h>
+
+#include <vscp.h>
+
+/*
+  A received event is stored once and queued by pointer to every
+  consumer. The event is first in the struct and its data is allocated
+  on its own so the last owner can hand it on as a normal heap event,
+  freed with vscp_fwhlp_deleteEvent, as the link protocol code expects.
+  Events are never changed after they are created.
+*/
+typedef struct _eventref {
+  vscpEvent ev;     // Must be first
+  atomic_uint refs; // Number of owners
+} eventref_t;
+
+/**
+ * @fn eventref_new
+ * @brief Create a shared event from an event
+ *
+ * The caller owns the one reference the event is created with.
+ *
+ * @param pev Event to copy. pdata may point to memory that is not kept.
+ * @return eventref_t* Pointer to shared event or NULL if out of memory.
+ */
+eventref_t *
+eventref_new(const vscpEvent *pev);
+
+/**
+ * @fn eventref_get
+ * @brief Add an owner to a shared event
+ *
+ * @param pref Pointer to shared event
+ * @return eventref_t* Same pointer
+ */
+eventref_t *
+eventref_get(eventref_t *pref);
+
+/**
+ * @fn eventref_put
+ * @brief Drop an owner of a shared event. The event is freed by the last one.
+ *
+ * @param pref Pointer to shared event. Can be NULL.
+ */
+void
+eventref_put(eventref_t *pref);
+
+/**
+ * @fn eventref_take
+ * @brief Turn a reference into an event that is owned by the caller
+ *
+ * The last owner gets the shared event itself. Others get a copy and
+ * their reference is dropped. The result is freed with vscp_fwhlp_deleteEvent.
+ *
+ * @param pref Pointer to shared event
+ * @return vscpEvent* Event owned by the caller or NULL if a copy could not
+ *         be allocated (the reference is dropped anyway).
+ */
+vscpEvent *
+eventref_take(eventref_t *pref);
+
+#endif
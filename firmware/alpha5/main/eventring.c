@@ -0,0 +1,163 @@
+/*
+  File: eventring.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Lock free single producer, single consumer event rings
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <vscp.h>
+
+#include "eventring.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// eventring_init
+//
+
+int
+eventring_init(eventring_t *pring, uint32_t size, eventring_policy_t policy)
+{
+  if (NULL == pring) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (!size || (size & (size - 1))) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  pring->slots = VSCP_MALLOC(size * sizeof(pring->slots[0]));
+  if (NULL == pring->slots) {
+    return VSCP_ERROR_MEMORY;
+  }
+
+  for (uint32_t i = 0; i < size; i++) {
+    atomic_init(&pring->slots[i], NULL);
+  }
+
+  pring->mask   = size - 1;
+  pring->policy = policy;
+  atomic_init(&pring->head, 0);
+  atomic_init(&pring->tail, 0);
+  atomic_init(&pring->nOverruns, 0);
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventring_free
+//
+
+void
+eventring_free(eventring_t *pring)
+{
+  if ((NULL == pring) || (NULL == pring->slots)) {
+    return;
+  }
+
+  VSCP_FREE(pring->slots);
+  pring->slots = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventring_push
+//
+
+bool
+eventring_push(eventring_t *pring, void *item, void **pdropped)
+{
+  unsigned head = atomic_load_explicit(&pring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&pring->tail, memory_order_acquire);
+
+  *pdropped = NULL;
+
+  while ((head - tail) > pring->mask) {
+
+    if (EVENTRING_DROP_NEWEST == pring->policy) {
+      atomic_fetch_add_explicit(&pring->nOverruns, 1, memory_order_relaxed);
+      *pdropped = item;
+      return false;
+    }
+
+    // Race the consumer for the oldest item
+    void *oldest = atomic_load_explicit(&pring->slots[tail & pring->mask], memory_order_relaxed);
+    if (atomic_compare_exchange_weak_explicit(&pring->tail,
+                                              &tail,
+                                              tail + 1,
+                                              memory_order_acq_rel,
+                                              memory_order_acquire)) {
+      atomic_fetch_add_explicit(&pring->nOverruns, 1, memory_order_relaxed);
+      *pdropped = oldest;
+      break;
+    }
+
+    // The consumer took an item (or the swap failed spuriously), tail is reloaded
+  }
+
+  atomic_store_explicit(&pring->slots[head & pring->mask], item, memory_order_relaxed);
+  atomic_store_explicit(&pring->head, head + 1, memory_order_release);
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventring_pop
+//
+
+bool
+eventring_pop(eventring_t *pring, void **pitem)
+{
+  unsigned tail = atomic_load_explicit(&pring->tail, memory_order_acquire);
+
+  do {
+    if (tail == atomic_load_explicit(&pring->head, memory_order_acquire)) {
+      return false;
+    }
+    *pitem = atomic_load_explicit(&pring->slots[tail & pring->mask], memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&pring->tail,
+                                                  &tail,
+                                                  tail + 1,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire));
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// eventring_count
+//
+
+uint32_t
+eventring_count(eventring_t *pring)
+{
+  unsigned head = atomic_load_explicit(&pring->head, memory_order_acquire);
+  unsigned tail = atomic_load_explicit(&pring->tail, memory_order_acquire);
+
+  return head - tail;
+}
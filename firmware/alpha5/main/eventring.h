@@ -0,0 +1,113 @@
+/*
+  File: eventring.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Lock free single producer, single consumer event rings
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_EVENTRING__
+#define __VSCP_EVENTRING__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+  A ring of pointers with one producer task and one consumer task and
+  no locks. When the ring is full the producer either drops the new
+  item (EVENTRING_DROP_NEWEST) or takes the oldest item back and drops
+  that (EVENTRING_DROP_OLDEST). To allow the latter the consumer claims
+  an item with a compare and swap on tail so an item is either consumed
+  or dropped, never both.
+*/
+
+typedef enum eventring_policy {
+  EVENTRING_DROP_NEWEST = 0, // Full ring keeps what it has
+  EVENTRING_DROP_OLDEST,     // Full ring drops its oldest item
+} eventring_policy_t;
+
+typedef struct _eventring {
+  _Atomic(void *) *slots;    // Items
+  uint32_t mask;             // Number of slots - 1
+  eventring_policy_t policy; // What to drop when full
+  atomic_uint head;          // Next slot to write, only moved by producer
+  atomic_uint tail;          // Next slot to read
+  atomic_uint nOverruns;     // Items dropped because the ring was full
+} eventring_t;
+
+/**
+ * @brief Initialize a ring
+ *
+ * @param pring Ring to initialize
+ * @param size Number of slots, must be a power of two
+ * @param policy What to drop when the ring is full
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_PARAMETER for a bad size or
+ *         VSCP_ERROR_MEMORY.
+ */
+int
+eventring_init(eventring_t *pring, uint32_t size, eventring_policy_t policy);
+
+/**
+ * @brief Free the slots of a ring. Items left in it are not freed.
+ *
+ * @param pring Ring
+ */
+void
+eventring_free(eventring_t *pring);
+
+/**
+ * @brief Add an item. Producer only.
+ *
+ * @param pring Ring
+ * @param item Item to add
+ * @param pdropped Set to the item dropped to make room, the item itself
+ *        if it was dropped or NULL if nothing was dropped. The caller
+ *        owns the dropped item.
+ * @return true if the item was added.
+ */
+bool
+eventring_push(eventring_t *pring, void *item, void **pdropped);
+
+/**
+ * @brief Take the oldest item. Consumer only.
+ *
+ * @param pring Ring
+ * @param pitem Set to the item
+ * @return true if an item was taken, false if the ring is empty.
+ */
+bool
+eventring_pop(eventring_t *pring, void **pitem);
+
+/**
+ * @brief Number of items in the ring. Exact only from the consumer
+ *        when the producer is idle.
+ *
+ * @param pring Ring
+ * @return Number of items
+ */
+uint32_t
+eventring_count(eventring_t *pring);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+  File: linkbin.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Binary event frames for the VSCP link protocol (bretr/bsend/brcvloop)
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <vscp.h>
+
+#include "linkbin.h"
+
+// CRC-CCITT (0x1021) four bits at a time
+static const uint16_t s_crcTable[16] = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+                                         0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef };
+
+///////////////////////////////////////////////////////////////////////////////
+// linkbin_crc
+//
+
+static uint16_t
+linkbin_crc(const uint8_t *buf, size_t len)
+{
+  uint16_t crc = 0xffff;
+
+  while (len--) {
+    crc = (crc << 4) ^ s_crcTable[(crc >> 12) ^ (*buf >> 4)];
+    crc = (crc << 4) ^ s_crcTable[(crc >> 12) ^ (*buf & 0x0f)];
+    buf++;
+  }
+
+  return crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// linkbin_write_frame
+//
+
+size_t
+linkbin_write_frame(uint8_t *buf, size_t len, const vscpEvent *pev)
+{
+  if ((NULL == buf) || (NULL == pev) || (pev->sizeData > LINKBIN_MAX_DATA) || (pev->sizeData && (NULL == pev->pdata))) {
+    return 0;
+  }
+
+  size_t size = LINKBIN_FRAME_LEN(pev->sizeData);
+  if (size > len) {
+    return 0;
+  }
+
+  buf[LINKBIN_POS_PKTTYPE]       = 0;
+  buf[LINKBIN_POS_HEAD]          = (pev->head >> 8) & 0xff;
+  buf[LINKBIN_POS_HEAD + 1]      = pev->head & 0xff;
+  buf[LINKBIN_POS_TIMESTAMP]     = (pev->timestamp >> 24) & 0xff;
+  buf[LINKBIN_POS_TIMESTAMP + 1] = (pev->timestamp >> 16) & 0xff;
+  buf[LINKBIN_POS_TIMESTAMP + 2] = (pev->timestamp >> 8) & 0xff;
+  buf[LINKBIN_POS_TIMESTAMP + 3] = pev->timestamp & 0xff;
+  buf[LINKBIN_POS_YEAR]          = (pev->year >> 8) & 0xff;
+  buf[LINKBIN_POS_YEAR + 1]      = pev->year & 0xff;
+  buf[LINKBIN_POS_MONTH]         = pev->month;
+  buf[LINKBIN_POS_DAY]           = pev->day;
+  buf[LINKBIN_POS_HOUR]          = pev->hour;
+  buf[LINKBIN_POS_MINUTE]        = pev->minute;
+  buf[LINKBIN_POS_SECOND]        = pev->second;
+  buf[LINKBIN_POS_CLASS]         = (pev->vscp_class >> 8) & 0xff;
+  buf[LINKBIN_POS_CLASS + 1]     = pev->vscp_class & 0xff;
+  buf[LINKBIN_POS_TYPE]          = (pev->vscp_type >> 8) & 0xff;
+  buf[LINKBIN_POS_TYPE + 1]      = pev->vscp_type & 0xff;
+  memcpy(buf + LINKBIN_POS_GUID, pev->GUID, 16);
+  buf[LINKBIN_POS_SIZE]     = (pev->sizeData >> 8) & 0xff;
+  buf[LINKBIN_POS_SIZE + 1] = pev->sizeData & 0xff;
+  if (pev->sizeData) {
+    memcpy(buf + LINKBIN_POS_DATA, pev->pdata, pev->sizeData);
+  }
+
+  uint16_t crc                              = linkbin_crc(buf + 1, LINKBIN_POS_DATA - 1 + pev->sizeData);
+  buf[LINKBIN_POS_DATA + pev->sizeData]     = (crc >> 8) & 0xff;
+  buf[LINKBIN_POS_DATA + pev->sizeData + 1] = crc & 0xff;
+
+  return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// linkbin_read_frame
+//
+
+int
+linkbin_read_frame(vscpEvent *pev, uint8_t *buf, size_t len, size_t *pused)
+{
+  if ((NULL == pev) || (NULL == buf) || (NULL == pused)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (len < LINKBIN_POS_DATA) {
+    return VSCP_ERROR_BUFFER_TO_SMALL;
+  }
+
+  // Only unencrypted events
+  if (0 != buf[LINKBIN_POS_PKTTYPE]) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  uint16_t sizeData = ((uint16_t) buf[LINKBIN_POS_SIZE] << 8) + buf[LINKBIN_POS_SIZE + 1];
+  if (sizeData > LINKBIN_MAX_DATA) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  if (len < (size_t) LINKBIN_FRAME_LEN(sizeData)) {
+    return VSCP_ERROR_BUFFER_TO_SMALL;
+  }
+
+  uint16_t crc = ((uint16_t) buf[LINKBIN_POS_DATA + sizeData] << 8) + buf[LINKBIN_POS_DATA + sizeData + 1];
+  if (crc != linkbin_crc(buf + 1, LINKBIN_POS_DATA - 1 + sizeData)) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  pev->head       = ((uint16_t) buf[LINKBIN_POS_HEAD] << 8) + buf[LINKBIN_POS_HEAD + 1];
+  pev->timestamp  = ((uint32_t) buf[LINKBIN_POS_TIMESTAMP] << 24) + ((uint32_t) buf[LINKBIN_POS_TIMESTAMP + 1] << 16) +
+                   ((uint32_t) buf[LINKBIN_POS_TIMESTAMP + 2] << 8) + buf[LINKBIN_POS_TIMESTAMP + 3];
+  pev->year       = ((uint16_t) buf[LINKBIN_POS_YEAR] << 8) + buf[LINKBIN_POS_YEAR + 1];
+  pev->month      = buf[LINKBIN_POS_MONTH];
+  pev->day        = buf[LINKBIN_POS_DAY];
+  pev->hour       = buf[LINKBIN_POS_HOUR];
+  pev->minute     = buf[LINKBIN_POS_MINUTE];
+  pev->second     = buf[LINKBIN_POS_SECOND];
+  pev->vscp_class = ((uint16_t) buf[LINKBIN_POS_CLASS] << 8) + buf[LINKBIN_POS_CLASS + 1];
+  pev->vscp_type  = ((uint16_t) buf[LINKBIN_POS_TYPE] << 8) + buf[LINKBIN_POS_TYPE + 1];
+  memcpy(pev->GUID, buf + LINKBIN_POS_GUID, 16);
+  pev->sizeData = sizeData;
+  pev->pdata    = sizeData ? (buf + LINKBIN_POS_DATA) : NULL;
+  pev->obid     = 0;
+  pev->crc      = 0;
+
+  *pused = LINKBIN_FRAME_LEN(sizeData);
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// linkbin_write_count
+//
+
+void
+linkbin_write_count(uint8_t *buf, uint16_t cnt)
+{
+  buf[0] = (cnt >> 8) & 0xff;
+  buf[1] = cnt & 0xff;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// linkbin_read_count
+//
+
+uint16_t
+linkbin_read_count(const uint8_t *buf)
+{
+  return ((uint16_t) buf[0] << 8) + buf[1];
+}
@@ -0,0 +1,130 @@
+/*
+  File: linkbin.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Binary event frames for the VSCP link protocol (bretr/bsend/brcvloop)
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_LINKBIN__
+#define __VSCP_LINKBIN__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vscp.h>
+
+/*
+  An event is sent as a VSCP binary frame. All values are MSB first.
+
+  0      Packet type. High nibble 0 (event), low nibble 0 (not encrypted)
+  1-2    head
+  3-6    timestamp
+  7-8    year
+  9      month
+  10     day
+  11     hour
+  12     minute
+  13     second
+  14-15  class
+  16-17  type
+  18-33  GUID
+  34-35  Size of data
+  36-    Data
+  n+1-2  CRC-CCITT over byte 1 to the end of data
+
+  Frames go in batches. A batch is a two byte frame count followed by
+  the frames. A batch with a zero count ends a bretr response and is the
+  keep alive in brcvloop mode.
+*/
+
+#define LINKBIN_POS_PKTTYPE   0
+#define LINKBIN_POS_HEAD      1
+#define LINKBIN_POS_TIMESTAMP 3
+#define LINKBIN_POS_YEAR      7
+#define LINKBIN_POS_MONTH     9
+#define LINKBIN_POS_DAY       10
+#define LINKBIN_POS_HOUR      11
+#define LINKBIN_POS_MINUTE    12
+#define LINKBIN_POS_SECOND    13
+#define LINKBIN_POS_CLASS     14
+#define LINKBIN_POS_TYPE      16
+#define LINKBIN_POS_GUID      18
+#define LINKBIN_POS_SIZE      34
+#define LINKBIN_POS_DATA      36
+
+#define LINKBIN_MAX_DATA  512 // Max data of a level II event
+#define LINKBIN_CRC_LEN   2   // CRC after data
+#define LINKBIN_BATCH_LEN 2   // Frame count before the frames of a batch
+
+// Frame length for an event with n data bytes
+#define LINKBIN_FRAME_LEN(n) (LINKBIN_POS_DATA + (n) + LINKBIN_CRC_LEN)
+
+/**
+ * @brief Write an event as a binary frame
+ *
+ * @param buf Buffer to write frame to
+ * @param len Size of buffer
+ * @param pev Event to write
+ * @return Length of frame or zero if it does not fit or pev is invalid.
+ */
+size_t
+linkbin_write_frame(uint8_t *buf, size_t len, const vscpEvent *pev);
+
+/**
+ * @brief Read an event from a binary frame
+ *
+ * The data of the event points into the buffer so the buffer must be
+ * kept as long as the event is used.
+ *
+ * @param pev Event to fill in
+ * @param buf Buffer holding the frame
+ * @param len Number of bytes in buffer
+ * @param pused Set to length of the frame
+ * @return VSCP_ERROR_SUCCESS if a frame was read, VSCP_ERROR_BUFFER_TO_SMALL
+ *         if more bytes are needed, VSCP_ERROR_INVALID_FRAME if the frame is
+ *         encrypted, of an unknown type, too large or has a bad CRC.
+ */
+int
+linkbin_read_frame(vscpEvent *pev, uint8_t *buf, size_t len, size_t *pused);
+
+/**
+ * @brief Write the frame count of a batch
+ *
+ * @param buf Buffer of at least LINKBIN_BATCH_LEN bytes
+ * @param cnt Number of frames that follow
+ */
+void
+linkbin_write_count(uint8_t *buf, uint16_t cnt);
+
+/**
+ * @brief Read the frame count of a batch
+ *
+ * @param buf Buffer of at least LINKBIN_BATCH_LEN bytes
+ * @return Number of frames that follow
+ */
+uint16_t
+linkbin_read_count(const uint8_t *buf);
+
+#endif
@@ -241,6 +241,10 @@ node_persistent_config_t g_persistent = {
   .mqttRetain       = 0,
   .mqttSub          = "vscp/{{guid}}/pub/#",
   .mqttPub          = "vscp/{{guid}}/{{class}}/{{type}}/{{index}}",
+  .mqttFormat       = 0, // JSON
+  .mqttDeadband     = 0, // Publish filter off
+  .mqttMinInterval  = 0,
+  .mqttMaxAge       = 0,
   .mqttVerification = { 0 },
   .mqttLwTopic      = { 0 },
   .mqttLwMessage    = { 0 },
@@ -309,6 +313,9 @@ droplet_receive_cb(const vscpEvent *pev, void *userdata)
     return;
   }
 
+  // The event is a view on the droplet receive slot. MQTT publishes it
+  // right away. VSCP link clients share one stored copy.
+
   // Disable if no broker URL defined
   if (g_persistent.mqttEnable && (g_persistent.mqttUrl)) {
     // Send event to MQTT broker
@@ -354,261 +361,318 @@ setAccessPointParameters(void)
   return esp_wifi_set_config(WIFI_IF_AP, &wifi_cfg);
 }
 
+// Keys the configuration was stored under before it was kept as one
+// blob. They are read once to carry the configuration over and are
+// then erased.
+
+typedef struct {
+  const char *key;
+  nvs_type_t type;
+  uint16_t offset; // Of field in node_persistent_config_t
+  uint16_t size;   // Of field
+} legacy_key_t;
+
+#define LEGACY_KEY(key, type, field)                                                                                   \
+  { key, type, offsetof(node_persistent_config_t, field), sizeof(((node_persistent_config_t *) 0)->field) }
+
+static const legacy_key_t s_legacyKeys[] = {
+  LEGACY_KEY("node_name", NVS_TYPE_STR, nodeName),
+  LEGACY_KEY("start_delay", NVS_TYPE_U8, startDelay),
+  LEGACY_KEY("lkey", NVS_TYPE_BLOB, lkey),
+  LEGACY_KEY("pmk", NVS_TYPE_BLOB, pmk),
+  LEGACY_KEY("guid", NVS_TYPE_BLOB, nodeGuid),
+  LEGACY_KEY("log_stdout", NVS_TYPE_U8, logwrite2Stdout),
+  LEGACY_KEY("log_level", NVS_TYPE_U8, logLevel),
+  LEGACY_KEY("log_type", NVS_TYPE_U8, logType),
+  LEGACY_KEY("log_retries", NVS_TYPE_U8, logRetries),
+  LEGACY_KEY("log_url", NVS_TYPE_STR, logUrl),
+  LEGACY_KEY("log_port", NVS_TYPE_U16, logPort),
+  LEGACY_KEY("log_mqtt_topic", NVS_TYPE_STR, logMqttTopic),
+  LEGACY_KEY("vscp_enable", NVS_TYPE_U8, vscplinkEnable),
+  LEGACY_KEY("vscp_url", NVS_TYPE_STR, vscplinkUrl),
+  LEGACY_KEY("vscp_port", NVS_TYPE_U16, vscplinkPort),
+  LEGACY_KEY("vscp_key", NVS_TYPE_BLOB, vscpLinkKey),
+  LEGACY_KEY("vscp_user", NVS_TYPE_STR, vscplinkUsername),
+  LEGACY_KEY("vscp_password", NVS_TYPE_STR, vscplinkPassword),
+  LEGACY_KEY("mqtt_enable", NVS_TYPE_U8, mqttEnable),
+  LEGACY_KEY("mqtt_url", NVS_TYPE_STR, mqttUrl),
+  LEGACY_KEY("mqtt_port", NVS_TYPE_U16, mqttPort),
+  LEGACY_KEY("mqtt_cid", NVS_TYPE_STR, mqttClientid),
+  LEGACY_KEY("mqtt_user", NVS_TYPE_STR, mqttUsername),
+  LEGACY_KEY("mqtt_password", NVS_TYPE_STR, mqttPassword),
+  LEGACY_KEY("mqtt_sub", NVS_TYPE_STR, mqttSub),
+  LEGACY_KEY("mqtt_pub", NVS_TYPE_STR, mqttPub),
+  LEGACY_KEY("mqtt_fmt", NVS_TYPE_U8, mqttFormat),
+  LEGACY_KEY("mqtt_db", NVS_TYPE_U32, mqttDeadband),
+  LEGACY_KEY("mqtt_minint", NVS_TYPE_U16, mqttMinInterval),
+  LEGACY_KEY("mqtt_maxage", NVS_TYPE_U16, mqttMaxAge),
+  LEGACY_KEY("web_enable", NVS_TYPE_U8, webEnable),
+  LEGACY_KEY("web_port", NVS_TYPE_U16, webPort),
+  LEGACY_KEY("web_user", NVS_TYPE_STR, webUsername),
+  LEGACY_KEY("web_password", NVS_TYPE_STR, webPassword),
+  LEGACY_KEY("drop_enable", NVS_TYPE_U8, dropletEnable),
+  LEGACY_KEY("drop_lr", NVS_TYPE_U8, dropletLongRange),
+  LEGACY_KEY("drop_ch", NVS_TYPE_U8, dropletChannel),
+  LEGACY_KEY("drop_qsize", NVS_TYPE_U8, dropletSizeQueue),
+  LEGACY_KEY("drop_ttl", NVS_TYPE_U8, dropletTtl),
+  LEGACY_KEY("drop_fw", NVS_TYPE_U8, dropletForwardEnable),
+  LEGACY_KEY("drop_enc", NVS_TYPE_U8, dropletEncryption),
+  LEGACY_KEY("drop_filt", NVS_TYPE_U8, dropletFilterAdjacentChannel),
+  LEGACY_KEY("drop_swchf", NVS_TYPE_U8, dropletForwardSwitchChannel),
+  LEGACY_KEY("drop_rssi", NVS_TYPE_I8, dropletFilterWeakSignal),
+};
+
+// Keys that were written under a misspelled name and never read
+static const char *s_legacyStrayKeys[] = { "mwtt_enable", "log:retries" };
+
 ///////////////////////////////////////////////////////////////////////////////
-// readPersistentConfigs
+// isZero
 //
 
-esp_err_t
-readPersistentConfigs(void)
+static bool
+isZero(const uint8_t *p, size_t len)
 {
-  esp_err_t rv;
-  char buf[80];
-  size_t length = sizeof(buf);
-  uint8_t val;
-
-  // Set default primary key
-  vscp_fwhlp_hex2bin(g_persistent.vscpLinkKey, 32, VSCP_DEFAULT_KEY32);
+  while (len--) {
+    if (*p++) {
+      return false;
+    }
+  }
 
-  // boot counter
-  rv = nvs_get_u32(g_nvsHandle, "boot_counter", &g_persistent.bootCnt);
-  switch (rv) {
+  return true;
+}
 
-    case ESP_OK:
-      ESP_LOGI(TAG, "Boot counter = %d", (int) g_persistent.bootCnt);
-      break;
+///////////////////////////////////////////////////////////////////////////////
+// readLegacyConfigs
+//
+// Fields with no key keep their defaults. Returns number of keys found.
+//
 
-    case ESP_ERR_NVS_NOT_FOUND:
-      ESP_LOGE(TAG, "The boot counter is not initialized yet!");
-      break;
+static int
+readLegacyConfigs(void)
+{
+  esp_err_t rv;
+  size_t length;
+  int cnt = 0;
 
-    default:
-      ESP_LOGE(TAG, "Error (%s) reading boot counter!", esp_err_to_name(rv));
-      break;
-  }
+  for (size_t i = 0; i < sizeof(s_legacyKeys) / sizeof(s_legacyKeys[0]); i++) {
+    const legacy_key_t *plk = &s_legacyKeys[i];
+    void *pfield            = (uint8_t *) &g_persistent + plk->offset;
 
-  // Update and write back boot counter
-  g_persistent.bootCnt++;
-  rv = nvs_set_u32(g_nvsHandle, "boot_counter", g_persistent.bootCnt);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to update boot counter");
-  }
+    length = plk->size;
+    switch (plk->type) {
 
-  // Node name
-  rv = nvs_get_str(g_nvsHandle, "node_name", buf, &length);
-  switch (rv) {
-    case ESP_OK:
-      strncpy(g_persistent.nodeName, buf, sizeof(g_persistent.nodeName));
-      ESP_LOGI(TAG, "Node Name = %s", g_persistent.nodeName);
-      break;
+      case NVS_TYPE_U8:
+        rv = nvs_get_u8(g_nvsHandle, plk->key, (uint8_t *) pfield);
+        break;
 
-    case ESP_ERR_NVS_NOT_FOUND:
-      rv = nvs_set_str(g_nvsHandle, "node_name", "Alpha Node");
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update node name");
-      }
-      break;
+      case NVS_TYPE_I8:
+        rv = nvs_get_i8(g_nvsHandle, plk->key, (int8_t *) pfield);
+        break;
 
-    default:
-      ESP_LOGE(TAG, "Error (%s) reading 'node_name'!", esp_err_to_name(rv));
-      break;
-  }
+      case NVS_TYPE_U16:
+        rv = nvs_get_u16(g_nvsHandle, plk->key, (uint16_t *) pfield);
+        break;
 
-  // Start Delay (seconds)
-  rv = nvs_get_u8(g_nvsHandle, "start_delay", &g_persistent.startDelay);
-  switch (rv) {
+      case NVS_TYPE_U32:
+        rv = nvs_get_u32(g_nvsHandle, plk->key, (uint32_t *) pfield);
+        break;
 
-    case ESP_OK:
-      ESP_LOGI(TAG, "Start delay = %d", g_persistent.startDelay);
-      break;
+      case NVS_TYPE_STR:
+        rv = nvs_get_str(g_nvsHandle, plk->key, (char *) pfield, &length);
+        break;
 
-    case ESP_ERR_NVS_NOT_FOUND:
-      rv = nvs_set_u8(g_nvsHandle, "start_delay", 2);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update start delay");
-      }
-      break;
+      default:
+        rv = nvs_get_blob(g_nvsHandle, plk->key, pfield, &length);
+        break;
+    }
 
-    default:
-      ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(rv));
-      break;
+    if (ESP_OK == rv) {
+      cnt++;
+    }
+    else if (ESP_ERR_NVS_NOT_FOUND != rv) {
+      ESP_LOGE(TAG, "Error (%s) reading '%s', default is used", esp_err_to_name(rv), plk->key);
+    }
   }
 
-  // Logging ------------------------------------------------------------------
+  return cnt;
+}
 
-  // logwrite2Stdout
-  rv = nvs_get_u8(g_nvsHandle, "log_stdout", &g_persistent.logwrite2Stdout);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "log_stdout", g_persistent.logwrite2Stdout);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update log-stdout");
-    }
-  }
+///////////////////////////////////////////////////////////////////////////////
+// eraseLegacyConfigs
+//
 
-  // logLevel
-  esp_log_level_set("*", ESP_LOG_INFO);
-  rv = nvs_get_u8(g_nvsHandle, "log_level", &g_persistent.logLevel);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "log_level", g_persistent.logLevel);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update log-level");
-    }
-  }
+static void
+eraseLegacyConfigs(void)
+{
+  esp_err_t rv;
 
-  // logType
-  rv = nvs_get_u8(g_nvsHandle, "log_type", &g_persistent.logType);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "log_type", g_persistent.logType);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update log-type");
+  for (size_t i = 0; i < sizeof(s_legacyKeys) / sizeof(s_legacyKeys[0]); i++) {
+    rv = nvs_erase_key(g_nvsHandle, s_legacyKeys[i].key);
+    if ((ESP_OK != rv) && (ESP_ERR_NVS_NOT_FOUND != rv)) {
+      ESP_LOGE(TAG, "Error (%s) erasing '%s'", esp_err_to_name(rv), s_legacyKeys[i].key);
     }
   }
 
-  // logRetries
-  rv = nvs_get_u8(g_nvsHandle, "log_retries", &g_persistent.logRetries);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "log:retries", g_persistent.logRetries);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update log-retries");
-    }
+  for (size_t i = 0; i < sizeof(s_legacyStrayKeys) / sizeof(s_legacyStrayKeys[0]); i++) {
+    nvs_erase_key(g_nvsHandle, s_legacyStrayKeys[i]);
   }
 
-  // logUrl
-  length = sizeof(g_persistent.logUrl);
-  rv     = nvs_get_str(g_nvsHandle, "log_url", g_persistent.logUrl, &length);
+  rv = nvs_commit(g_nvsHandle);
   if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'log URL' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "log_url", g_persistent.logUrl);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save log URL");
-    }
+    ESP_LOGE(TAG, "Failed to commit updates to nvs");
   }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readConfigBlob
+//
 
-  // logPort
-  rv = nvs_get_u16(g_nvsHandle, "log_port", &g_persistent.logPort);
+static esp_err_t
+readConfigBlob(void)
+{
+  esp_err_t rv;
+  size_t length = 0;
+  uint8_t *pblob;
+  int rc;
+
+  // Ask for the size first, a blob written by newer firmware can be larger
+  rv = nvs_get_blob(g_nvsHandle, "cfg", NULL, &length);
   if (ESP_OK != rv) {
-    rv = nvs_set_u16(g_nvsHandle, "log_port", g_persistent.logPort);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update log_port");
-    }
+    return rv;
   }
 
-  // logMqttTopic
-  length = sizeof(g_persistent.logMqttTopic);
-  rv     = nvs_get_str(g_nvsHandle, "log_mqtt_topic", g_persistent.logMqttTopic, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'log MQTT topic' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "log_mqtt_topic", g_persistent.logMqttTopic);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save log MQTT topic");
+  pblob = malloc(length);
+  if (NULL == pblob) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  rv = nvs_get_blob(g_nvsHandle, "cfg", pblob, &length);
+  if (ESP_OK == rv) {
+    rc = nodecfg_unpack(&g_persistent, pblob, length);
+    if (VSCP_ERROR_SUCCESS != rc) {
+      ESP_LOGE(TAG, "Stored configuration can not be used. rc=%d", rc);
+      rv = ESP_ERR_INVALID_STATE;
     }
   }
 
-  // VSCP Link ----------------------------------------------------------------
+  free(pblob);
+  return rv;
+}
 
-  // VSCP Link enable
-  rv = nvs_get_u8(g_nvsHandle, "vscp_enable", &val);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'VSCP link enable' will be set to default. ret=%d", rv);
-    val = (uint8_t) g_persistent.vscplinkEnable;
-    rv  = nvs_set_u8(g_nvsHandle, "vscp_enable", g_persistent.vscplinkEnable);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCP link enable");
-    }
+///////////////////////////////////////////////////////////////////////////////
+// writePersistentConfigs
+//
+
+esp_err_t
+writePersistentConfigs(void)
+{
+  esp_err_t rv;
+  size_t length;
+  uint8_t *pblob;
+
+  pblob = malloc(NODECFG_BLOB_LEN);
+  if (NULL == pblob) {
+    return ESP_ERR_NO_MEM;
   }
-  else {
-    g_persistent.vscplinkEnable = (bool) val;
+
+  length = nodecfg_pack(pblob, NODECFG_BLOB_LEN, &g_persistent);
+  rv     = nvs_set_blob(g_nvsHandle, "cfg", pblob, length);
+  if (ESP_OK == rv) {
+    rv = nvs_commit(g_nvsHandle);
   }
+  free(pblob);
 
-  // VSCP Link host
-  length = sizeof(g_persistent.vscplinkUrl);
-  rv     = nvs_get_str(g_nvsHandle, "vscp_url", g_persistent.vscplinkUrl, &length);
   if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'VSCP link host' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "vscp_url", DEFAULT_TCPIP_USER);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCP link host");
-    }
+    ESP_LOGE(TAG, "Error (%s) writing configuration to nvs", esp_err_to_name(rv));
   }
 
-  // VSCP link port
-  rv = nvs_get_u16(g_nvsHandle, "vscp_port", &g_persistent.vscplinkPort);
+  return rv;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// readPersistentConfigs
+//
+
+esp_err_t
+readPersistentConfigs(void)
+{
+  esp_err_t rv;
+  bool bLegacy = false;
+  bool bSave   = false;
+  int cnt;
+
+  // Set default primary key
+  vscp_fwhlp_hex2bin(g_persistent.vscpLinkKey, 32, VSCP_DEFAULT_KEY32);
+
+  esp_log_level_set("*", ESP_LOG_INFO);
+
+  // Configuration
+  rv = readConfigBlob();
   if (ESP_OK != rv) {
-    rv = nvs_set_u16(g_nvsHandle, "vscp_port", g_persistent.vscplinkPort);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update VSCP link port");
+
+    if (ESP_ERR_NVS_NOT_FOUND != rv) {
+      ESP_LOGE(TAG, "Error (%s) reading configuration", esp_err_to_name(rv));
     }
-  }
 
-  // VSCP Link key
-  length = sizeof(g_persistent.vscpLinkKey);
-  rv     = nvs_get_blob(g_nvsHandle, "vscp_key", (char *) g_persistent.vscpLinkKey, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'VSCP link_key' will be set to default. ret=%d", rv);
-    rv = nvs_set_blob(g_nvsHandle, "vscp_key", g_persistent.vscpLinkKey, sizeof(g_persistent.vscpLinkKey));
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCL link key");
+    // First boot, or first boot after an update from firmware that
+    // stored each setting under a key of its own
+    cnt = readLegacyConfigs();
+    if (cnt) {
+      ESP_LOGI(TAG, "Configuration carried over from %d nvs keys", cnt);
     }
+    bLegacy = true;
+    bSave   = true;
   }
 
-  // VSCP Link Username
-  length = sizeof(g_persistent.vscplinkUsername);
-  rv     = nvs_get_str(g_nvsHandle, "vscp_user", g_persistent.vscplinkUsername, &length);
+  // boot counter
+  rv = nvs_get_u32(g_nvsHandle, "boot_counter", &g_persistent.bootCnt);
+  switch (rv) {
+
+    case ESP_OK:
+      ESP_LOGI(TAG, "Boot counter = %d", (int) g_persistent.bootCnt);
+      break;
+
+    case ESP_ERR_NVS_NOT_FOUND:
+      g_persistent.bootCnt = 0;
+      ESP_LOGE(TAG, "The boot counter is not initialized yet!");
+      break;
+
+    default:
+      ESP_LOGE(TAG, "Error (%s) reading boot counter!", esp_err_to_name(rv));
+      break;
+  }
+
+  // Update and write back boot counter
+  g_persistent.bootCnt++;
+  rv = nvs_set_u32(g_nvsHandle, "boot_counter", g_persistent.bootCnt);
   if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'VSCP Username' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "vscp_user", DEFAULT_TCPIP_USER);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCP username");
-    }
+    ESP_LOGE(TAG, "Failed to update boot counter");
   }
 
-  // VSCP Link password
-  length = sizeof(g_persistent.vscplinkPassword);
-  rv     = nvs_get_str(g_nvsHandle, "vscp_password", g_persistent.vscplinkPassword, &length);
+  rv = nvs_commit(g_nvsHandle);
   if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'VSCP password' will be set to default. ret=%d", rv);
-    nvs_set_str(g_nvsHandle, "vscp_password", DEFAULT_TCPIP_PASSWORD);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCP password");
-    }
+    ESP_LOGE(TAG, "Failed to commit updates to nvs");
   }
-  // ESP_LOGI(TAG, "VSCP Password: %s", buf);
+
+  ESP_LOGI(TAG, "Node Name = %s", g_persistent.nodeName);
 
   // lkey (Local key)
-  length = 32;
-  rv     = nvs_get_blob(g_nvsHandle, "lkey", g_persistent.lkey, &length);
-  if (rv != ESP_OK) {
+  if (isZero(g_persistent.lkey, sizeof(g_persistent.lkey))) {
 
     // We need to generate a new lkey
     esp_fill_random(g_persistent.lkey, sizeof(g_persistent.lkey));
     ESP_LOGW(TAG, "----------> New lkey generated <----------");
-
-    rv = nvs_set_blob(g_nvsHandle, "lkey", g_persistent.lkey, 32);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to write node lkey to nvs. rv=%d", rv);
-    }
+    bSave = true;
   }
 
   // pmk (Primary key)
-  length = 32;
-  rv     = nvs_get_blob(g_nvsHandle, "pmk", g_persistent.pmk, &length);
-  if (rv != ESP_OK) {
-    const char key[] = VSCP_DEFAULT_KEY32;
-    const char *pos  = key;
-    for (int i = 0; i < 32; i++) {
-      sscanf(pos, "%2hhx", &g_persistent.pmk[i]);
-      pos += 2;
-    }
-    rv = nvs_set_blob(g_nvsHandle, "pmk", g_persistent.pmk, 32);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to write node pmk to nvs. rv=%d", rv);
-    }
+  if (isZero(g_persistent.pmk, sizeof(g_persistent.pmk))) {
+    vscp_fwhlp_hex2bin(g_persistent.pmk, 32, VSCP_DEFAULT_KEY32);
+    bSave = true;
   }
 
   // GUID
-  length = 16;
-  rv     = nvs_get_blob(g_nvsHandle, "guid", g_persistent.nodeGuid, &length);
-
-  if (rv != ESP_OK) {
+  if (isZero(g_persistent.nodeGuid, sizeof(g_persistent.nodeGuid))) {
     // FF:FF:FF:FF:FF:FF:FF:FE:MAC1:MAC2:MAC3:MAC4:MAC5:MAC6:NICKNAME1:NICKNAME2
     memset(g_persistent.nodeGuid + 6, 0xff, 7);
     g_persistent.nodeGuid[7] = 0xfe;
@@ -619,11 +683,7 @@ readPersistentConfigs(void)
     if (rv != ESP_OK) {
       ESP_LOGE(TAG, "esp_efuse_mac_get_default failed to get GUID. rv=%d", rv);
     }
-
-    rv = nvs_set_blob(g_nvsHandle, "guid", g_persistent.nodeGuid, 16);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to write node GUID to nvs. rv=%d", rv);
-    }
+    bSave = true;
   }
   ESP_LOGI(TAG,
            "GUID for node: %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
@@ -644,260 +704,9 @@ readPersistentConfigs(void)
            g_persistent.nodeGuid[14],
            g_persistent.nodeGuid[15]);
 
-  // MQTT ----------------------------------------------------------------
-
-  // VSCP Link enable
-  rv = nvs_get_u8(g_nvsHandle, "mqtt_enable", &val);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT enable' will be set to default. ret=%d", rv);
-    val = (uint8_t) g_persistent.mqttEnable;
-    rv  = nvs_set_u8(g_nvsHandle, "mwtt_enable", g_persistent.mqttEnable);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT enable");
-    }
-  }
-  else {
-    g_persistent.mqttEnable = (bool) val;
-  }
-
-  // MQTT host
-  length = sizeof(g_persistent.mqttUrl);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_url", g_persistent.mqttUrl, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT host' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "mqtt_url", g_persistent.mqttUrl);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT host");
-    }
-  }
-
-  // MQTT port
-  rv = nvs_get_u16(g_nvsHandle, "mqtt_port", &g_persistent.mqttPort);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u16(g_nvsHandle, "mqtt_port", g_persistent.mqttPort);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update MQTT port");
-    }
-  }
-
-  // MQTT client
-  length = sizeof(g_persistent.mqttClientid);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_cid", g_persistent.mqttClientid, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT clientid' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "mqtt_cid", g_persistent.mqttClientid);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT clientid");
-    }
-  }
-
-  // MQTT Link Username
-  length = sizeof(g_persistent.mqttUsername);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_user", g_persistent.mqttUsername, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT user' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "mqtt_user", DEFAULT_TCPIP_USER);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT username");
-    }
-  }
-
-  // MQTT password
-  length = sizeof(g_persistent.mqttPassword);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_password", g_persistent.mqttPassword, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT password' will be set to default. ret=%d", rv);
-    nvs_set_str(g_nvsHandle, "mqtt_password", DEFAULT_TCPIP_PASSWORD);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT password");
-    }
-  }
-
-  // MQTT subscribe
-  length = sizeof(g_persistent.mqttSub);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_sub", g_persistent.mqttSub, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT sub' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "mqtt_sub", g_persistent.mqttSub);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT sub");
-    }
-  }
-
-  // MQTT publish
-  length = sizeof(g_persistent.mqttPub);
-  rv     = nvs_get_str(g_nvsHandle, "mqtt_pub", g_persistent.mqttPub, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'MQTT pub' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "mqtt_pub", g_persistent.mqttPub);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save MQTT pub");
-    }
-  }
-
-  // WEB server ----------------------------------------------------------------
-
-  // WEB enable
-  rv = nvs_get_u8(g_nvsHandle, "web_enable", &val);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'web enable' will be set to default. ret=%d", rv);
-    val = (uint8_t) g_persistent.webEnable;
-    rv  = nvs_set_u8(g_nvsHandle, "web_enable", g_persistent.webEnable);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save web enable");
-    }
-  }
-  else {
-    g_persistent.webEnable = (bool) val;
-  }
-
-  // WEB port
-  rv = nvs_get_u16(g_nvsHandle, "web_port", &g_persistent.webPort);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u16(g_nvsHandle, "web_port", g_persistent.webPort);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update Web server port");
-    }
-  }
-
-  // WEB Username
-  length = sizeof(g_persistent.webUsername);
-  rv     = nvs_get_str(g_nvsHandle, "web_user", g_persistent.webUsername, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'Web server user' will be set to default. ret=%d", rv);
-    rv = nvs_set_str(g_nvsHandle, "web_user", DEFAULT_TCPIP_USER);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save Web Server username");
-    }
-  }
-
-  // WEB password
-  length = sizeof(g_persistent.webPassword);
-  rv     = nvs_get_str(g_nvsHandle, "web_password", g_persistent.webPassword, &length);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'Web server password' will be set to default. ret=%d", rv);
-    nvs_set_str(g_nvsHandle, "web_password", DEFAULT_TCPIP_PASSWORD);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save Web server password");
-    }
-  }
-
-  // Droplet ----------------------------------------------------------------
-
-  // VSCP Link enable
-  rv = nvs_get_u8(g_nvsHandle, "drop_enable", &val);
-  if (rv != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to read 'Droplet enable' will be set to default. ret=%d", rv);
-    val = (uint8_t) g_persistent.dropletEnable;
-    rv  = nvs_set_u8(g_nvsHandle, "drop_enable", g_persistent.dropletEnable);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to save VSCP link enable");
-    }
-  }
-  else {
-    g_persistent.dropletEnable = (bool) val;
-  }
-
-  // Long Range
-  rv = nvs_get_u8(g_nvsHandle, "drop_lr", &val);
-  if (ESP_OK != rv) {
-    val = (uint8_t) g_persistent.dropletLongRange;
-    rv  = nvs_set_u8(g_nvsHandle, "drop_lr", g_persistent.dropletLongRange);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet long range");
-    }
-  }
-  else {
-    g_persistent.dropletLongRange = (bool) val;
-  }
-
-  // Channel
-  rv = nvs_get_u8(g_nvsHandle, "drop_ch", &g_persistent.dropletChannel);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "drop_ch", g_persistent.dropletChannel);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet channel");
-    }
-  }
-
-  // Default queue size
-  rv = nvs_get_u8(g_nvsHandle, "drop_qsize", &g_persistent.dropletSizeQueue);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "drop_qsize", g_persistent.dropletSizeQueue);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet queue size");
-    }
-  }
-
-  // Default ttl
-  rv = nvs_get_u8(g_nvsHandle, "drop_ttl", &g_persistent.dropletTtl);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "drop_ttl", g_persistent.dropletTtl);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet ttl");
-    }
-  }
-
-  // Forward
-  rv = nvs_get_u8(g_nvsHandle, "drop_fw", &val);
-  if (ESP_OK != rv) {
-    val = (uint8_t) g_persistent.dropletForwardEnable;
-    rv  = nvs_set_u8(g_nvsHandle, "drop_fw", g_persistent.dropletForwardEnable);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet forward");
-    }
-  }
-  else {
-    g_persistent.dropletForwardEnable = (bool) val;
-  }
-
-  // Encryption
-  rv = nvs_get_u8(g_nvsHandle, "drop_enc", &g_persistent.dropletEncryption);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "drop_enc", g_persistent.dropletEncryption);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet encryption");
-    }
-  }
-
-  // Adj filter channel
-  rv = nvs_get_u8(g_nvsHandle, "drop_filt", &val);
-  if (ESP_OK != rv) {
-    val = (uint8_t) g_persistent.dropletFilterAdjacentChannel;
-    rv  = nvs_set_u8(g_nvsHandle, "drop_filt", g_persistent.dropletFilterAdjacentChannel);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet adj channel filter");
-    }
-  }
-  else {
-    g_persistent.dropletFilterAdjacentChannel = (bool) val;
-  }
-
-  // Allow switching channel on forward
-  rv = nvs_get_u8(g_nvsHandle, "drop_swchf", &val);
-  if (ESP_OK != rv) {
-    val = (uint8_t) g_persistent.dropletForwardSwitchChannel;
-    rv  = nvs_set_u8(g_nvsHandle, "drop_swchf", g_persistent.dropletForwardSwitchChannel);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet shitch channel on forward");
-    }
-  }
-  else {
-    g_persistent.dropletFilterAdjacentChannel = (bool) val;
-  }
-
-  // RSSI limit
-  rv = nvs_get_i8(g_nvsHandle, "drop_rssi", &g_persistent.dropletFilterWeakSignal);
-  if (ESP_OK != rv) {
-    rv = nvs_set_u8(g_nvsHandle, "drop_rssi", g_persistent.dropletFilterWeakSignal);
-    if (rv != ESP_OK) {
-      ESP_LOGE(TAG, "Failed to update droplet RSSI");
-    }
-  }
-
-  rv = nvs_commit(g_nvsHandle);
-  if (rv != ESP_OK) {
-    ESP_LOGI(TAG, "Failed to commit updates to nvs\n");
+  // Keys are erased only when the blob that replaces them is written
+  if (bSave && (ESP_OK == writePersistentConfigs()) && bLegacy) {
+    eraseLegacyConfigs();
   }
 
   return ESP_OK;
@@ -1408,29 +1217,12 @@ getMilliSeconds(void)
 bool
 get_device_guid(uint8_t *pguid)
 {
-  esp_err_t rv;
-  size_t length = 16;
-
   // Check pointer
   if (NULL == pguid) {
     return false;
   }
 
-  rv = nvs_get_blob(g_nvsHandle, "guid", pguid, &length);
-  switch (rv) {
-
-    case ESP_OK:
-      break;
-
-    case ESP_ERR_NVS_NOT_FOUND:
-      printf("GUID not found in nvs\n");
-      return false;
-
-    default:
-      printf("Error (%s) reading GUID from nvs!\n", esp_err_to_name(rv));
-      return false;
-  }
-
+  memcpy(pguid, g_persistent.nodeGuid, 16);
   return true;
 }
 
@@ -2046,9 +1838,9 @@ app_main(void)
   // Start the VSCP Link Protocol Server
   if (g_persistent.vscplinkEnable) {
 #ifdef CONFIG_EXAMPLE_IPV6
-    xTaskCreate(&tcpsrv_task, "vscp_tcpsrv_task", 4096, (void *) AF_INET6, 5, NULL);
+    xTaskCreate(&tcpsrv_task, "vscp_tcpsrv_task", 8 * 1024, (void *) AF_INET6, 5, NULL);
 #else
-    xTaskCreate(&tcpsrv_task, "vscp_tcpsrv_task", 4096, (void *) AF_INET, 5, NULL);
+    xTaskCreate(&tcpsrv_task, "vscp_tcpsrv_task", 8 * 1024, (void *) AF_INET, 5, NULL);
 #endif
   }
 
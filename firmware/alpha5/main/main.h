@@ -38,6 +38,8 @@
 #include <vscp.h>
 #include <vscp-droplet.h>
 
+#include "nodecfg.h"
+
 #define CONNECTED_LED_GPIO_NUM 2
 #define ACTIVE_LED_GPIO_NUM    3
 #define GPIO_OUTPUT_PIN_SEL    ((1ULL << CONNECTED_LED_GPIO_NUM) | (1ULL << ACTIVE_LED_GPIO_NUM))
@@ -125,69 +127,6 @@ typedef enum {
   ALPHA_LOG_VSCP  /*!< VSCP */
 } alpha_log_output_t;
 
-typedef struct {
-
-  // Module
-  char nodeName[32];    // User name for node
-  uint8_t lkey[32];     // Local key (16 (EAS128)/24(AES192)/32(AES256))
-  uint8_t pmk[32];      // Primary key (16 (EAS128)/24(AES192)/32(AES256)) 
-  uint8_t nodeGuid[16]; // GUID for node (default: Constructed from MAC address)
-  uint8_t startDelay;   // Delay before wifi is enabled (to charge cap)
-  uint32_t bootCnt;     // Number of restarts (not editable)
-
-  // Logging
-  uint8_t logwrite2Stdout; // Enable write Logging to STDOUT
-  uint8_t logLevel;        // 'ERROR' is default
-  uint8_t logType;         // STDOUT / UDP / TCP / HTTP / MQTT /VSCP
-  uint8_t logRetries;      // Number of log log retries
-  char logUrl[32];         // For UDP/TCP/HTML
-  uint16_t logPort;        // Port for UDP
-  char logMqttTopic[64];   //  MQTT topic
-
-  // VSCP Link
-  bool vscplinkEnable;
-  char vscplinkUrl[32];      // URL VSCP tcp/ip Link host (set to blank yto disable)
-  uint16_t vscplinkPort;     // Port on VSCP tcp/ip Link host
-  char vscplinkUsername[32]; // Username for VSCP tcp/ip Link host
-  char vscplinkPassword[32]; // Password for VSCP tcp/ip Link host
-  uint8_t vscpLinkKey[32];   // Security key (16 (EAS128)/24(AES192)/32(AES256))
-
-  // Droplet
-  bool dropletEnable;
-  bool dropletLongRange;             // Enable long range mode
-  uint8_t dropletSizeQueue;          // Input queue size
-  uint8_t dropletChannel;           // Channel to use (zero is current)
-  uint8_t dropletTtl;                // Default ttl
-  bool dropletForwardEnable;         // Forward when packets are received
-  uint8_t dropletEncryption;         // 0=no encryption, 1=AES-128, 2=AES-192, 3=AES-256
-  bool dropletFilterAdjacentChannel; // Don't receive if from other channel
-  bool dropletForwardSwitchChannel;  // Allow switching channel on forward
-  int8_t dropletFilterWeakSignal;    // Filter on RSSI (zero is no rssi filtering)
-
-  // Web server
-  bool webEnable;
-  uint16_t webPort;     // Port web server listens on
-  char webUsername[32]; // Basic Auth username
-  char webPassword[32]; // Basic Auth password
-
-  // MQTT  (mqtt[s]://[username][:password]@host.domain[:port])
-  bool mqttEnable;
-  char mqttUrl[32];
-  uint16_t mqttPort;
-  char mqttClientid[64];
-  char mqttUsername[32];
-  char mqttPassword[32];
-  int mqttQos;
-  int mqttRetain;
-  char mqttSub[128];
-  char mqttPub[128];
-  char mqttVerification[32*1024];   // For server certificate
-  char mqttLwTopic[128];
-  char mqttLwMessage[128];
-  uint8_t mqttLwQos;
-  bool mqttLwRetain;
-} node_persistent_config_t;
-
 // ----------------------------------------------------------------------------
 
 /*!
@@ -278,6 +217,18 @@ droplet_receive_cb(const vscpEvent *pev, void *userdata);
 esp_err_t
 setAccessPointParameters(void);
 
+/**
+ * @fn writePersistentConfigs
+ * @brief Write the configuration in g_persistent to nvs
+ *
+ * The whole configuration is written as one blob, so it is either
+ * all saved or not at all.
+ *
+ * @return esp_err_t ESP_OK on success, errorcode otherwise.
+ */
+esp_err_t
+writePersistentConfigs(void);
+
 /**
  * @brief Read processor on chip temperature
  * @return Temperature as floating point value
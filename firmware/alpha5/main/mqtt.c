@@ -31,10 +31,15 @@
 #include "vscp-projdefs.h"
 
 #include <stdio.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
 #include <esp_system.h>
 #include <esp_partition.h>
 #include <spi_flash_mmap.h>
@@ -46,6 +51,7 @@
 #include <esp_tls.h>
 #include <esp_ota_ops.h>
 #include <esp_mac.h> // esp_base_mac_addr_get
+#include <esp_timer.h>
 #include <sys/param.h>
 
 #include <vscp.h>
@@ -53,6 +59,8 @@
 
 #include <main.h>
 #include "mqtt.h"
+#include "mqttfmt.h"
+#include "outbox.h"
 
 // Global stuff
 extern node_persistent_config_t g_persistent;        // main
@@ -62,6 +70,38 @@ static const char *TAG = "MQTT";
 
 esp_mqtt_client_handle_t g_mqtt_client;
 
+// Compiled publish topic (g_persistent.mqttPub), double buffered
+static mqttfmt_topic_t s_pubTopic[2];
+static atomic_int s_pubTopicIdx;
+
+// Payload, any format fits. The client copies it into its outbox on enqueue.
+static uint8_t s_payloadBuf[MQTTFMT_JSON_MAX];
+
+// Publish filter for measurements on the configured topic (droplet receive task only)
+static pubfilter_entry_t s_pubFilterTable[PRJDEF_MQTT_PUBFILTER_SIZE];
+static pubfilter_t s_pubFilter;
+
+// Subscriptions (g_persistent.mqttSub). Compiled and used in the MQTT task only.
+static mqttfmt_route_t s_routes[DROPLET_MQTT_MAX_SUBSCRIPTIONS];
+static int s_nRoutes;
+
+// Received event, reused for every message (MQTT task only)
+static vscpEvent s_rxEvent;
+static uint8_t s_rxData[MQTTFMT_MAX_DATA];
+
+// Flash outbox for messages published while the broker is away. Written
+// from the droplet receive task, drained by mqtt_outbox_task.
+static outbox_t s_outbox;
+static SemaphoreHandle_t s_outboxMutex;
+static bool s_bOutbox;
+static atomic_bool s_bConnected;
+static uint8_t s_drainBuf[OUTBOX_MAX_BODY + 1]; // mqtt_outbox_task only
+
+// Statistics
+static mqtt_stats_t s_stats;
+static int64_t s_rateStart;
+static uint32_t s_rateCount;
+
 // #if CONFIG_BROKER_CERTIFICATE_OVERRIDDEN == 1
 // static const uint8_t mqtt_eclipseprojects_io_pem_start[] =
 //   "-----BEGIN CERTIFICATE-----\n" CONFIG_BROKER_CERTIFICATE_OVERRIDE "\n-----END CERTIFICATE-----";
@@ -91,6 +131,123 @@ extern const uint8_t mqtt_eclipse_io_pem_end[] asm("_binary_mqtt_eclipse_io_pem_
 //   ESP_LOGI(TAG, "binary sent with msg_id=%d", msg_id);
 // }
 
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_compile_topic
+//
+
+void
+mqtt_compile_topic(void)
+{
+  int rv;
+
+  // Publishing keeps using the one in use while the other is compiled
+  int idx = !atomic_load(&s_pubTopicIdx);
+  if (VSCP_ERROR_SUCCESS != (rv = mqttfmt_compile_topic(&s_pubTopic[idx],
+                                                         g_persistent.mqttPub,
+                                                         g_persistent.nodeName,
+                                                         g_persistent.nodeGuid))) {
+    ESP_LOGE(TAG, "Failed to compile MQTT publish topic rv = %d topic=%s", rv, g_persistent.mqttPub);
+    return;
+  }
+
+  atomic_store(&s_pubTopicIdx, idx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_outbox_store
+//
+// Keep a message in flash until the broker can take it
+//
+
+static int
+mqtt_outbox_store(const char *topic, const uint8_t *payload, size_t len)
+{
+  int rv;
+
+  if (pdTRUE != xSemaphoreTake(s_outboxMutex, pdMS_TO_TICKS(200))) {
+    s_stats.nOutboxErr++;
+    return VSCP_ERROR_TIMEOUT;
+  }
+
+  rv = outbox_append(&s_outbox, topic, payload, len, g_persistent.mqttQos, g_persistent.mqttRetain);
+  xSemaphoreGive(s_outboxMutex);
+
+  if (VSCP_ERROR_SUCCESS != rv) {
+    ESP_LOGE(TAG, "Failed to store MQTT message in outbox rv=%d topic=%s", rv, topic);
+    s_stats.nOutboxErr++;
+    return rv;
+  }
+
+  ESP_LOGD(TAG, "MQTT message stored in outbox topic=%s", topic);
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_outbox_pending
+//
+// True if messages wait in the outbox. If the outbox can't be locked it
+// is taken as waiting so nothing overtakes what is stored.
+//
+
+static bool
+mqtt_outbox_pending(void)
+{
+  bool bPending;
+
+  if (pdTRUE != xSemaphoreTake(s_outboxMutex, pdMS_TO_TICKS(200))) {
+    return true;
+  }
+
+  bPending = (0 != outbox_count(&s_outbox));
+  xSemaphoreGive(s_outboxMutex);
+
+  return bPending;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_outbox_task
+//
+// Publish what was stored in the outbox while the broker was away, a
+// batch at a time so the backlog does not crowd out live traffic.
+//
+
+static void
+mqtt_outbox_task(void *pvParameters)
+{
+  outbox_msg_t msg;
+  int rv;
+
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(PRJDEF_MQTT_OUTBOX_DRAIN_INTERVAL));
+
+    for (int i = 0; (i < PRJDEF_MQTT_OUTBOX_DRAIN_BATCH) && atomic_load(&s_bConnected); i++) {
+
+      // Only flash access is locked, not the publish
+      xSemaphoreTake(s_outboxMutex, portMAX_DELAY);
+      rv = outbox_peek(&s_outbox, &msg, s_drainBuf, sizeof(s_drainBuf));
+      xSemaphoreGive(s_outboxMutex);
+      if (VSCP_ERROR_SUCCESS != rv) {
+        break;
+      }
+
+      int msgid = esp_mqtt_client_publish(g_mqtt_client,
+                                          msg.topic,
+                                          (const char *) msg.payload,
+                                          msg.len,
+                                          msg.qos,
+                                          msg.bRetain);
+      if (-1 == msgid) {
+        ESP_LOGW(TAG, "Failed to publish from outbox, trying again later. topic=%s", msg.topic);
+        break;
+      }
+
+      xSemaphoreTake(s_outboxMutex, portMAX_DELAY);
+      outbox_pop(&s_outbox, msg.id);
+      xSemaphoreGive(s_outboxMutex);
+    }
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // mqtt_send_vscp_event
 //
@@ -99,7 +256,10 @@ int
 mqtt_send_vscp_event(const char *topic, const vscpEvent *pev)
 {
   int rv;
-  const char *pTopic = topic;
+  size_t len;
+  const mqttfmt_topic_t *pTopic;
+  mqttfmt_topic_t compiled;
+  char newTopic[MQTTFMT_TOPIC_MAX];
 
   // Check event pointer
   if (NULL == pev) {
@@ -108,95 +268,216 @@ mqtt_send_vscp_event(const char *topic, const vscpEvent *pev)
 
   // If no topic set. Use configured topic
   if (NULL == topic) {
-    pTopic = g_persistent.mqttPub;
+    pubfilter_cfg_t cfg = { .deadband    = g_persistent.mqttDeadband / 1000.0,
+                            .minInterval = g_persistent.mqttMinInterval * 1000000LL,
+                            .maxAge      = g_persistent.mqttMaxAge * 1000000LL };
+    if (!pubfilter_check(&s_pubFilter, &cfg, pev, esp_timer_get_time())) {
+      ESP_LOGV(TAG, "Measurement held back by publish filter");
+      return VSCP_ERROR_SUCCESS;
+    }
+    pTopic = &s_pubTopic[atomic_load(&s_pubTopicIdx)];
+  }
+  else {
+    if (VSCP_ERROR_SUCCESS !=
+        (rv = mqttfmt_compile_topic(&compiled, topic, g_persistent.nodeName, g_persistent.nodeGuid))) {
+      ESP_LOGE(TAG, "Failed to compile MQTT topic rv = %d topic=%s", rv, topic);
+      return rv;
+    }
+    pTopic = &compiled;
   }
 
-  // We publish VSCP event on JSON form
-  char *pbuf = VSCP_MALLOC(2048);
-  if (NULL == pbuf) {
-    ESP_LOGE(TAG, "Unable to allocate JSON buffer for conversion");
-    return VSCP_ERROR_MEMORY;
+  if (!mqttfmt_render_topic(newTopic, sizeof(newTopic), pTopic, pev)) {
+    ESP_LOGE(TAG, "MQTT topic does not fit");
+    return VSCP_ERROR_BUFFER_TO_SMALL;
   }
 
-  if (VSCP_ERROR_SUCCESS != (rv = vscp_fwhlp_create_json(pbuf, 2048, pev))) {
-    VSCP_FREE(pbuf);
-    ESP_LOGE(TAG, "Failed to convert event to JSON rv = %d", rv);
-    return rv;
+  // We publish VSCP event on the configured form
+  if (!(len = mqttfmt_write_payload(s_payloadBuf, sizeof(s_payloadBuf), pev, g_persistent.mqttFormat))) {
+    ESP_LOGE(TAG, "Failed to convert event to payload format %d", g_persistent.mqttFormat);
+    return VSCP_ERROR_PARAMETER;
   }
 
   ESP_LOGV(TAG, "converted");
 
-  /*
-    {{node}}        - Node name
-    {{guid}}        - Node GUID
-    {{evguid}}      - Event GUID
-    {{class}}       - Event class
-    {{type}}        - Event type
-    {{nickname}}    - Node nickname (16-bit)
-    {{sindex}}      - Sensor index (if any)
-
-    Typical topic
-    vscp/FF:FF:FF:FF:FF:FF:FF:F5:01:00:00:00:00:00:00:02/20/9/2
-    vscp/{{guid}}/{{class}}/{{type}}/{{index}}
-  */
+  // Keeps order, nothing goes straight out while older messages wait
+  if (s_bOutbox && (!atomic_load(&s_bConnected) || mqtt_outbox_pending())) {
+    return mqtt_outbox_store(newTopic, s_payloadBuf, len);
+  }
+
+  int msgid = esp_mqtt_client_enqueue(g_mqtt_client,
+                                      newTopic,
+                                      (const char *) s_payloadBuf,
+                                      len,
+                                      g_persistent.mqttQos,
+                                      g_persistent.mqttRetain,
+                                      true);
+  if (-1 == msgid) {
+    ESP_LOGE(TAG, "Failed to publish MQTT message. id=%d Topic=%s", msgid, newTopic);
+    if (s_bOutbox) {
+      return mqtt_outbox_store(newTopic, s_payloadBuf, len);
+    }
+  }
+  else {
+    ESP_LOGI(TAG, "Published MQTT message. id=%d topic=%s", msgid, newTopic);
+  }
 
-  char newTopic[128], saveTopic[128], workbuf[48];
+  return VSCP_ERROR_SUCCESS;
+}
 
-  // Node name
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), pTopic, "{{node}}", g_persistent.nodeName);
-  strcpy(saveTopic, newTopic);
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_get_stats
+//
 
-  // GUID
-  vscp_fwhlp_writeGuidToString(workbuf, g_persistent.nodeGuid);
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{guid}}", workbuf);
-  strcpy(saveTopic, newTopic);
+void
+mqtt_get_stats(mqtt_stats_t *pstats)
+{
+  if (NULL != pstats) {
+    memcpy(pstats, &s_stats, sizeof(mqtt_stats_t));
+    memcpy(&pstats->pub, &s_pubFilter.stats, sizeof(pubfilter_stats_t));
+    if (s_bOutbox) {
+      xSemaphoreTake(s_outboxMutex, portMAX_DELAY);
+      pstats->nOutbox = outbox_count(&s_outbox);
+      memcpy(&pstats->outbox, &s_outbox.stats, sizeof(outbox_stats_t));
+      xSemaphoreGive(s_outboxMutex);
+    }
+  }
+}
 
-  // GUID
-  vscp_fwhlp_writeGuidToString(workbuf, pev->GUID);
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{evguid}}", workbuf);
-  strcpy(saveTopic, newTopic);
-
-  // Class
-  sprintf(workbuf, "%d", pev->vscp_class);
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{class}}", workbuf);
-  strcpy(saveTopic, newTopic);
-
-  // Type
-  sprintf(workbuf, "%d", pev->vscp_type);
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{type}}", workbuf);
-  strcpy(saveTopic, newTopic);
-
-  // nickname
-  sprintf(workbuf, "%d", ((pev->GUID[14] << 8) + (pev->GUID[15])));
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{nickname}}", workbuf);
-  strcpy(saveTopic, newTopic);
-
-  // sensor index
-  if (VSCP_ERROR_SUCCESS == vscp_fwhlp_isMeasurement(pev)) {
-    sprintf(workbuf, "%d", vscp_fwhlp_getMeasurementSensorIndex(pev));
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_compile_routes
+//
+// One route for each topic filter in g_persistent.mqttSub
+//
+
+static void
+mqtt_compile_routes(void)
+{
+  int rv;
+  char tmpl[MQTTFMT_TOPIC_MAX];
+  const char *p = g_persistent.mqttSub;
+
+  s_nRoutes = 0;
+
+  while (*p) {
+
+    size_t len = strcspn(p, " ");
+    if (len && (len < sizeof(tmpl))) {
+      memcpy(tmpl, p, len);
+      tmpl[len] = '\0';
+
+      if (s_nRoutes >= DROPLET_MQTT_MAX_SUBSCRIPTIONS) {
+        ESP_LOGE(TAG, "Too many subscriptions, %s is not used", tmpl);
+      }
+      else if (VSCP_ERROR_SUCCESS != (rv = mqttfmt_compile_route(&s_routes[s_nRoutes],
+                                                                  tmpl,
+                                                                  g_persistent.nodeName,
+                                                                  g_persistent.nodeGuid))) {
+        ESP_LOGE(TAG, "Failed to compile subscription rv = %d topic=%s", rv, tmpl);
+      }
+      else {
+        s_nRoutes++;
+      }
+    }
+    else if (len) {
+      ESP_LOGE(TAG, "Subscription is too long");
+    }
+
+    p += len;
+    p += strspn(p, " ");
   }
-  else {
-    memset(workbuf, 0, sizeof(workbuf));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqtt_ingress
+//
+// Send an event received on a subscribed topic on the droplet network.
+// Runs in the MQTT task and never waits for the droplet send queue.
+//
+
+static void
+mqtt_ingress(esp_mqtt_event_handle_t event)
+{
+  int rv;
+  int i;
+  esp_err_t ret;
+  int64_t start = esp_timer_get_time();
+  uint16_t vscp_class;
+  uint16_t vscp_type;
+  static const uint8_t zeroGuid[16] = { 0 };
+
+  // Later parts of a message that came in parts (counted with the first)
+  if (event->current_data_offset) {
+    return;
   }
-  vscp_fwhlp_strsubst(newTopic, sizeof(newTopic), saveTopic, "{{sindex}}", workbuf);
-  strcpy(saveTopic, newTopic);
 
-  // int msg_id =
-  //   esp_mqtt_client_publish(g_mqtt_client, newTopic, pbuf, strlen(pbuf), g_persistent.mqttQos, g_persistent.mqttRetain);
-  // ESP_LOGI(TAG, "Published VSCP event to MQTT broker with msg_id=%d topic=%s", msg_id, newTopic);
+  s_stats.nRxMsg++;
 
-  int msgid = 
-  esp_mqtt_client_enqueue(g_mqtt_client, newTopic, pbuf, strlen(pbuf), g_persistent.mqttQos, g_persistent.mqttRetain, true);
-  if (-1 == msgid) {
-    ESP_LOGE(TAG, "Failed to publish MQTT message. id=%d Topic=%s", msgid, newTopic);
+  // Rate over the last (about) one second
+  s_rateCount++;
+  if ((start - s_rateStart) >= 1000000) {
+    s_stats.rxRate = ((int64_t) s_rateCount * 1000000) / (start - s_rateStart);
+    s_rateStart    = start;
+    s_rateCount    = 0;
   }
-  else {
-    ESP_LOGI(TAG, "Published MQTT message. id=%d topic=%s", msgid, newTopic);
+
+  // Messages larger than the client buffer come in parts
+  if (event->data_len != event->total_data_len) {
+    ESP_LOGW(TAG, "MQTT message too large (%d bytes)", event->total_data_len);
+    s_stats.nRxParseErr++;
+    return;
   }
 
-  VSCP_FREE(pbuf);
+  for (i = 0; i < s_nRoutes; i++) {
+    if (mqttfmt_match_route(&s_routes[i], event->topic, event->topic_len, &vscp_class, &vscp_type)) {
+      break;
+    }
+  }
 
-  return VSCP_ERROR_SUCCESS;
+  if (i >= s_nRoutes) {
+    ESP_LOGD(TAG, "No subscription for topic %.*s", event->topic_len, event->topic);
+    s_stats.nRxNoRoute++;
+    return;
+  }
+
+  s_rxEvent.pdata = s_rxData;
+  rv = mqttfmt_parse_payload(&s_rxEvent, sizeof(s_rxData), (const uint8_t *) event->data, event->data_len);
+  if (VSCP_ERROR_SUCCESS != rv) {
+    ESP_LOGW(TAG, "MQTT message is not a VSCP event rv=%d topic=%.*s", rv, event->topic_len, event->topic);
+    s_stats.nRxParseErr++;
+    return;
+  }
+
+  // Class and type from the topic win
+  if (MQTTFMT_LEVEL_NONE != s_routes[i].classLevel) {
+    s_rxEvent.vscp_class = vscp_class;
+  }
+  if (MQTTFMT_LEVEL_NONE != s_routes[i].typeLevel) {
+    s_rxEvent.vscp_type = vscp_type;
+  }
+
+  // No GUID, the event is from this node
+  if (0 == memcmp(s_rxEvent.GUID, zeroGuid, 16)) {
+    memcpy(s_rxEvent.GUID, g_persistent.nodeGuid, 16);
+  }
+
+  if (ESP_OK != (ret = droplet_sendEvent(DROPLET_ADDR_BROADCAST, &s_rxEvent, NULL, 0))) {
+    ESP_LOGW(TAG, "Failed to queue MQTT event for droplet ret=%X", ret);
+    s_stats.nRxSendErr++;
+    return;
+  }
+
+  s_stats.nRxSent++;
+
+  uint32_t latency = esp_timer_get_time() - start;
+  if (latency > s_stats.maxRxLatency) {
+    s_stats.maxRxLatency = latency;
+  }
+  if (!s_stats.rxLatency) {
+    s_stats.rxLatency = latency;
+  }
+  else {
+    s_stats.rxLatency += ((int32_t) latency - (int32_t) s_stats.rxLatency) / 8;
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -222,11 +503,14 @@ mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
   switch ((esp_mqtt_event_id_t) event_id) {
     case MQTT_EVENT_CONNECTED:
       ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-      msg_id =
-        esp_mqtt_client_subscribe(client,
-                                  /*"/topic/qos0"*/ "vscp/FF:FF:FF:FF:FF:FF:FF:FE:B8:27:EB:CF:3A:15:00:01/10/6/1/0",
-                                  0);
-      ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+      atomic_store(&s_bConnected, true);
+
+      // Compiled here so changed subscriptions are used on the next connect
+      mqtt_compile_routes();
+      for (int i = 0; i < s_nRoutes; i++) {
+        msg_id = esp_mqtt_client_subscribe(client, s_routes[i].filter, g_persistent.mqttQos);
+        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d topic=%s", msg_id, s_routes[i].filter);
+      }
 
       // msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
       // ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
@@ -237,12 +521,11 @@ mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
 
     case MQTT_EVENT_DISCONNECTED:
       ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+      atomic_store(&s_bConnected, false);
       break;
 
     case MQTT_EVENT_SUBSCRIBED:
       ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-      msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-      ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
       break;
 
     case MQTT_EVENT_UNSUBSCRIBED:
@@ -254,13 +537,8 @@ mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
       break;
 
     case MQTT_EVENT_DATA:
-      ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-      printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-      printf("DATA=%.*s\r\n", event->data_len, event->data);
-      if (strncmp(event->data, "send binary please", event->data_len) == 0) {
-        ESP_LOGI(TAG, "Sending the binary");
-        // send_binary(client);
-      }
+      ESP_LOGD(TAG, "MQTT_EVENT_DATA");
+      mqtt_ingress(event);
       break;
 
     case MQTT_EVENT_ERROR:
@@ -294,6 +572,32 @@ mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id,
 void
 mqtt_start(void)
 {
+  mqtt_compile_topic();
+
+  // Once, streams are kept over a restart of the client
+  if (NULL == s_pubFilter.pentries) {
+    pubfilter_init(&s_pubFilter, s_pubFilterTable, PRJDEF_MQTT_PUBFILTER_SIZE);
+  }
+
+  // Once, messages stored in an earlier run are published as well
+  if (NULL == s_outboxMutex) {
+    const esp_partition_t *part =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PRJDEF_MQTT_OUTBOX_PARTITION);
+    if (NULL == part) {
+      ESP_LOGW(TAG, "No MQTT outbox partition, messages are lost while the broker is away");
+    }
+    else if (VSCP_ERROR_SUCCESS != outbox_open(&s_outbox, part)) {
+      ESP_LOGE(TAG, "Failed to open MQTT outbox");
+    }
+    else if (NULL == (s_outboxMutex = xSemaphoreCreateMutex())) {
+      ESP_LOGE(TAG, "Failed to create MQTT outbox mutex");
+    }
+    else {
+      xTaskCreate(&mqtt_outbox_task, "mqtt_outbox_task", 4 * 1024, NULL, 4, NULL);
+      s_bOutbox = true;
+    }
+  }
+
   // Set client id from mac
   uint8_t mac[8];
   ESP_ERROR_CHECK(esp_base_mac_addr_get(mac));
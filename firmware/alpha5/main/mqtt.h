@@ -32,12 +32,39 @@
 
 #include <vscp.h>
 
+#include "outbox.h"
+#include "pubfilter.h"
+
 #define DROPLET_MQTT_STATISTIC_PUBLISH_INTERVAL 60000
 
+// Max topic filters in mqttSub (separated by space)
+#define DROPLET_MQTT_MAX_SUBSCRIPTIONS 4
+
 // Topics for send and receive statistics
 #define DROPLET_MQTT_TOPIC_STATS_RECV_CNT "droplet/alpha/statistics/rcvcnt"
 #define DROPLET_MQTT_TOPIC_STATS_TX_CNT   "droplet/alpha/statistics/txcnt"
 
+/**
+ * @brief Statistics
+ *
+ * Messages received on subscribed topics and sent on as events on the
+ * droplet network, the publish filter and the flash outbox.
+ */
+typedef struct {
+  uint32_t nRxMsg;       // Messages received
+  uint32_t nRxSent;      // Events queued for sending on droplet
+  uint32_t nRxNoRoute;   // Messages on a topic no subscription matches
+  uint32_t nRxParseErr;  // Messages that are not a valid event in any payload format (or too large)
+  uint32_t nRxSendErr;   // Events dropped because the droplet send queue was full
+  uint32_t rxRate;       // Messages per second over the last second
+  uint32_t rxLatency;    // Smoothed receive to droplet send queue latency (us)
+  uint32_t maxRxLatency; // Highest receive to droplet send queue latency (us)
+  pubfilter_stats_t pub; // Measurements published and held back
+  uint32_t nOutbox;      // Messages waiting in the flash outbox
+  uint32_t nOutboxErr;   // Messages lost because the outbox could not take them
+  outbox_stats_t outbox; // Flash outbox
+} mqtt_stats_t;
+
 /**
  * @fn mqtt_start
  * @brief Start MQTT client
@@ -56,9 +83,36 @@ mqtt_start(void);
 void
 mqtt_stop(void);
 
+/**
+ * @fn mqtt_compile_topic
+ * @brief Compile the configured publish topic
+ *
+ * Call when the publish topic, node name or node GUID is changed.
+ */
+
+void
+mqtt_compile_topic(void);
+
+/**
+ * @fn mqtt_get_stats
+ * @brief Get statistics
+ *
+ * @param pstats Filled in with the current counters
+ */
+
+void
+mqtt_get_stats(mqtt_stats_t *pstats);
+
 /**
  * @fn mqtt_send_vscp_event
  * @brief Send VSCP event on configured topic
+ *
+ * Not reentrant, events are published from one task (droplet receive).
+ * Measurements sent on the configured topic go through the deadband
+ * filter (mqttDeadband, mqttMinInterval, mqttMaxAge) and are dropped
+ * when they carry no news. While the broker is away, and until what was
+ * stored then has been published, messages go to the flash outbox.
+ *
  * @param topic Topic to publish event on. 
  *        If set to NULL configured topic will be used.
  * @param pev Pointer to event to publish
@@ -0,0 +1,1190 @@
+/*
+  File: mqttfmt.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  MQTT topic templates and JSON event payloads without heap allocation
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <vscp.h>
+#include <vscp-firmware-helper.h>
+
+#include "linkbin.h"
+#include "mqttfmt.h"
+
+// Output to a fixed buffer. Once something does not fit the writer
+// stays full and the result is dropped.
+typedef struct _mqttfmt_writer {
+  char *buf;   // Output
+  size_t size; // Size of output, room for terminating zero kept
+  size_t len;  // Characters written
+  bool bFull;  // Something did not fit
+} mqttfmt_writer_t;
+
+// Literal strings are written without strlen
+#define MQTTFMT_PUT_LIT(pw, str) mqttfmt_put((pw), (str), sizeof(str) - 1)
+
+static const char s_hex[] = "0123456789ABCDEF";
+
+// Placeholder names, in mqttfmt_tok_t order
+static const char *const s_tokNames[] = { NULL, "evguid", "class", "type", "nickname", "sindex" };
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_put
+//
+
+static void
+mqttfmt_put(mqttfmt_writer_t *pw, const char *str, size_t len)
+{
+  if (pw->bFull || ((pw->size - pw->len) <= len)) {
+    pw->bFull = true;
+    return;
+  }
+
+  memcpy(pw->buf + pw->len, str, len);
+  pw->len += len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_put_uint
+//
+// Zero padded to at least width digits
+//
+
+static void
+mqttfmt_put_uint(mqttfmt_writer_t *pw, uint32_t value, int width)
+{
+  char digits[10];
+  int n = 0;
+
+  do {
+    digits[sizeof(digits) - ++n] = '0' + (value % 10);
+    value /= 10;
+  } while (value || (n < width));
+
+  mqttfmt_put(pw, digits + sizeof(digits) - n, n);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_put_guid
+//
+// Same form as vscp_fwhlp_writeGuidToString
+//
+
+static void
+mqttfmt_put_guid(mqttfmt_writer_t *pw, const uint8_t *pguid)
+{
+  char str[47];
+  char *p = str;
+
+  for (int i = 0; i < 16; i++) {
+    if (i) {
+      *p++ = ':';
+    }
+    *p++ = s_hex[pguid[i] >> 4];
+    *p++ = s_hex[pguid[i] & 0x0f];
+  }
+
+  mqttfmt_put(pw, str, sizeof(str));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_end
+//
+
+static size_t
+mqttfmt_end(mqttfmt_writer_t *pw)
+{
+  if (pw->bFull) {
+    if (pw->size) {
+      pw->buf[0] = '\0';
+    }
+    return 0;
+  }
+
+  pw->buf[pw->len] = '\0';
+  return pw->len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_add_text
+//
+
+static int
+mqttfmt_add_text(mqttfmt_topic_t *ptopic, size_t *ptextLen, const char *str, size_t len)
+{
+  mqttfmt_token_t *ptok = ptopic->nTokens ? &ptopic->tokens[ptopic->nTokens - 1] : NULL;
+
+  if (!len) {
+    return VSCP_ERROR_SUCCESS;
+  }
+
+  if ((*ptextLen + len) >= sizeof(ptopic->text)) {
+    return VSCP_ERROR_BUFFER_TO_SMALL;
+  }
+
+  memcpy(ptopic->text + *ptextLen, str, len);
+
+  // Text after text goes in the same token
+  if ((NULL == ptok) || (MQTTFMT_TOK_TEXT != ptok->type)) {
+    if (ptopic->nTokens >= MQTTFMT_MAX_TOKENS) {
+      return VSCP_ERROR_BUFFER_TO_SMALL;
+    }
+    ptok       = &ptopic->tokens[ptopic->nTokens++];
+    ptok->type = MQTTFMT_TOK_TEXT;
+    ptok->pos  = *ptextLen;
+    ptok->len  = 0;
+  }
+
+  ptok->len += len;
+  *ptextLen += len;
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_compile_topic
+//
+
+int
+mqttfmt_compile_topic(mqttfmt_topic_t *ptopic, const char *tmpl, const char *nodeName, const uint8_t *nodeGuid)
+{
+  int rv;
+  size_t textLen = 0;
+  char guid[48];
+
+  if ((NULL == ptopic) || (NULL == tmpl) || (NULL == nodeName) || (NULL == nodeGuid)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  memset(ptopic, 0, sizeof(mqttfmt_topic_t));
+
+  mqttfmt_writer_t w = { guid, sizeof(guid), 0, false };
+  mqttfmt_put_guid(&w, nodeGuid);
+
+  while (*tmpl) {
+
+    const char *pstart = strstr(tmpl, "{{");
+    const char *pend   = (NULL != pstart) ? strstr(pstart + 2, "}}") : NULL;
+
+    if (NULL == pend) {
+      return mqttfmt_add_text(ptopic, &textLen, tmpl, strlen(tmpl));
+    }
+
+    if (VSCP_ERROR_SUCCESS != (rv = mqttfmt_add_text(ptopic, &textLen, tmpl, pstart - tmpl))) {
+      return rv;
+    }
+
+    const char *pname = pstart + 2;
+    size_t nameLen    = pend - pname;
+    tmpl              = pend + 2;
+
+    if ((4 == nameLen) && (0 == memcmp(pname, "node", 4))) {
+      rv = mqttfmt_add_text(ptopic, &textLen, nodeName, strlen(nodeName));
+    }
+    else if ((4 == nameLen) && (0 == memcmp(pname, "guid", 4))) {
+      rv = mqttfmt_add_text(ptopic, &textLen, guid, w.len);
+    }
+    else {
+      int tok;
+      for (tok = MQTTFMT_TOK_EVGUID; tok <= MQTTFMT_TOK_SINDEX; tok++) {
+        if ((strlen(s_tokNames[tok]) == nameLen) && (0 == memcmp(pname, s_tokNames[tok], nameLen))) {
+          break;
+        }
+      }
+
+      if (tok > MQTTFMT_TOK_SINDEX) {
+        // Not ours, keep it as it is
+        rv = mqttfmt_add_text(ptopic, &textLen, pstart, tmpl - pstart);
+      }
+      else if (ptopic->nTokens >= MQTTFMT_MAX_TOKENS) {
+        rv = VSCP_ERROR_BUFFER_TO_SMALL;
+      }
+      else {
+        ptopic->tokens[ptopic->nTokens++].type = tok;
+      }
+    }
+
+    if (VSCP_ERROR_SUCCESS != rv) {
+      return rv;
+    }
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_render_topic
+//
+
+size_t
+mqttfmt_render_topic(char *buf, size_t size, const mqttfmt_topic_t *ptopic, const vscpEvent *pev)
+{
+  mqttfmt_writer_t w = { buf, size, 0, false };
+
+  if ((NULL == buf) || (NULL == ptopic) || (NULL == pev)) {
+    return 0;
+  }
+
+  for (int i = 0; i < ptopic->nTokens; i++) {
+
+    const mqttfmt_token_t *ptok = &ptopic->tokens[i];
+
+    switch (ptok->type) {
+
+      case MQTTFMT_TOK_TEXT:
+        mqttfmt_put(&w, ptopic->text + ptok->pos, ptok->len);
+        break;
+
+      case MQTTFMT_TOK_EVGUID:
+        mqttfmt_put_guid(&w, pev->GUID);
+        break;
+
+      case MQTTFMT_TOK_CLASS:
+        mqttfmt_put_uint(&w, pev->vscp_class, 1);
+        break;
+
+      case MQTTFMT_TOK_TYPE:
+        mqttfmt_put_uint(&w, pev->vscp_type, 1);
+        break;
+
+      case MQTTFMT_TOK_NICKNAME:
+        mqttfmt_put_uint(&w, (pev->GUID[14] << 8) + pev->GUID[15], 1);
+        break;
+
+      case MQTTFMT_TOK_SINDEX:
+        if (VSCP_ERROR_SUCCESS == vscp_fwhlp_isMeasurement(pev)) {
+          mqttfmt_put_uint(&w, vscp_fwhlp_getMeasurementSensorIndex(pev), 1);
+        }
+        break;
+    }
+  }
+
+  return mqttfmt_end(&w);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_write_json
+//
+
+size_t
+mqttfmt_write_json(char *buf, size_t size, const vscpEvent *pev)
+{
+  mqttfmt_writer_t w = { buf, size, 0, false };
+
+  if ((NULL == buf) || (NULL == pev) || (pev->sizeData > MQTTFMT_MAX_DATA) ||
+      (pev->sizeData && (NULL == pev->pdata))) {
+    return 0;
+  }
+
+  MQTTFMT_PUT_LIT(&w, "{\"vscpHead\":");
+  mqttfmt_put_uint(&w, pev->head, 1);
+  MQTTFMT_PUT_LIT(&w, ",\"vscpObId\":");
+  mqttfmt_put_uint(&w, pev->obid, 1);
+
+  // 2023-01-13T10:16:02Z
+  MQTTFMT_PUT_LIT(&w, ",\"vscpDateTime\":\"");
+  mqttfmt_put_uint(&w, pev->year, 4);
+  MQTTFMT_PUT_LIT(&w, "-");
+  mqttfmt_put_uint(&w, pev->month, 2);
+  MQTTFMT_PUT_LIT(&w, "-");
+  mqttfmt_put_uint(&w, pev->day, 2);
+  MQTTFMT_PUT_LIT(&w, "T");
+  mqttfmt_put_uint(&w, pev->hour, 2);
+  MQTTFMT_PUT_LIT(&w, ":");
+  mqttfmt_put_uint(&w, pev->minute, 2);
+  MQTTFMT_PUT_LIT(&w, ":");
+  mqttfmt_put_uint(&w, pev->second, 2);
+
+  MQTTFMT_PUT_LIT(&w, "Z\",\"vscpTimeStamp\":");
+  mqttfmt_put_uint(&w, pev->timestamp, 1);
+  MQTTFMT_PUT_LIT(&w, ",\"vscpClass\":");
+  mqttfmt_put_uint(&w, pev->vscp_class, 1);
+  MQTTFMT_PUT_LIT(&w, ",\"vscpType\":");
+  mqttfmt_put_uint(&w, pev->vscp_type, 1);
+  MQTTFMT_PUT_LIT(&w, ",\"vscpGuid\":\"");
+  mqttfmt_put_guid(&w, pev->GUID);
+
+  MQTTFMT_PUT_LIT(&w, "\",\"vscpData\":[");
+  for (int i = 0; i < pev->sizeData; i++) {
+    if (i) {
+      MQTTFMT_PUT_LIT(&w, ",");
+    }
+    mqttfmt_put_uint(&w, pev->pdata[i], 1);
+  }
+  MQTTFMT_PUT_LIT(&w, "]}");
+
+  return mqttfmt_end(&w);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_put_cbor
+//
+// Major type and argument, shortest form
+//
+
+static void
+mqttfmt_put_cbor(mqttfmt_writer_t *pw, uint8_t major, uint32_t value)
+{
+  char head[5];
+  size_t len;
+
+  major <<= 5;
+  if (value < 24) {
+    head[0] = major + value;
+    len     = 1;
+  }
+  else if (value <= 0xff) {
+    head[0] = major + 24;
+    head[1] = value;
+    len     = 2;
+  }
+  else if (value <= 0xffff) {
+    head[0] = major + 25;
+    head[1] = value >> 8;
+    head[2] = value;
+    len     = 3;
+  }
+  else {
+    head[0] = major + 26;
+    head[1] = value >> 24;
+    head[2] = value >> 16;
+    head[3] = value >> 8;
+    head[4] = value;
+    len     = 5;
+  }
+
+  mqttfmt_put(pw, head, len);
+}
+
+// CBOR major types
+#define MQTTFMT_CBOR_UINT  0
+#define MQTTFMT_CBOR_BYTES 2
+#define MQTTFMT_CBOR_TEXT  3
+#define MQTTFMT_CBOR_ARRAY 4
+#define MQTTFMT_CBOR_MAP   5
+#define MQTTFMT_CBOR_TAG   6
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_write_cbor
+//
+
+size_t
+mqttfmt_write_cbor(uint8_t *buf, size_t size, const vscpEvent *pev)
+{
+  char datetime[21];
+  mqttfmt_writer_t w = { (char *) buf, size, 0, false };
+  mqttfmt_writer_t d = { datetime, sizeof(datetime), 0, false };
+
+  if ((NULL == buf) || (NULL == pev) || (pev->sizeData > MQTTFMT_MAX_DATA) ||
+      (pev->sizeData && (NULL == pev->pdata))) {
+    return 0;
+  }
+
+  // 2023-01-13T10:16:02Z
+  mqttfmt_put_uint(&d, pev->year, 4);
+  MQTTFMT_PUT_LIT(&d, "-");
+  mqttfmt_put_uint(&d, pev->month, 2);
+  MQTTFMT_PUT_LIT(&d, "-");
+  mqttfmt_put_uint(&d, pev->day, 2);
+  MQTTFMT_PUT_LIT(&d, "T");
+  mqttfmt_put_uint(&d, pev->hour, 2);
+  MQTTFMT_PUT_LIT(&d, ":");
+  mqttfmt_put_uint(&d, pev->minute, 2);
+  MQTTFMT_PUT_LIT(&d, ":");
+  mqttfmt_put_uint(&d, pev->second, 2);
+  MQTTFMT_PUT_LIT(&d, "Z");
+
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_MAP, 8);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_HEAD);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, pev->head);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_OBID);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, pev->obid);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_DATETIME);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_TEXT, d.len);
+  mqttfmt_put(&w, datetime, d.len);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_TIMESTAMP);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, pev->timestamp);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_CLASS);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, pev->vscp_class);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_TYPE);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, pev->vscp_type);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_GUID);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_BYTES, 16);
+  mqttfmt_put(&w, (const char *) pev->GUID, 16);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_UINT, MQTTFMT_CBOR_DATA);
+  mqttfmt_put_cbor(&w, MQTTFMT_CBOR_BYTES, pev->sizeData);
+  if (pev->sizeData) {
+    mqttfmt_put(&w, (const char *) pev->pdata, pev->sizeData);
+  }
+
+  // Room for a terminating zero is kept but none is written
+  return w.bFull ? 0 : w.len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_write_payload
+//
+
+size_t
+mqttfmt_write_payload(uint8_t *buf, size_t size, const vscpEvent *pev, mqttfmt_format_t format)
+{
+  switch (format) {
+
+    case MQTTFMT_FORMAT_JSON:
+      return mqttfmt_write_json((char *) buf, size, pev);
+
+    case MQTTFMT_FORMAT_BINARY:
+      if ((NULL == pev) || (pev->sizeData > MQTTFMT_MAX_DATA)) {
+        return 0;
+      }
+      return linkbin_write_frame(buf, size, pev);
+
+    case MQTTFMT_FORMAT_CBOR:
+      return mqttfmt_write_cbor(buf, size, pev);
+
+    default:
+      return 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_compile_route
+//
+
+int
+mqttfmt_compile_route(mqttfmt_route_t *proute, const char *tmpl, const char *nodeName, const uint8_t *nodeGuid)
+{
+  int rv;
+  uint8_t level = 0;
+  mqttfmt_topic_t topic;
+
+  if ((NULL == proute) || (NULL == tmpl)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (VSCP_ERROR_SUCCESS != (rv = mqttfmt_compile_topic(&topic, tmpl, nodeName, nodeGuid))) {
+    return rv;
+  }
+
+  mqttfmt_writer_t w = { proute->filter, sizeof(proute->filter), 0, false };
+  proute->classLevel = MQTTFMT_LEVEL_NONE;
+  proute->typeLevel  = MQTTFMT_LEVEL_NONE;
+
+  for (int i = 0; i < topic.nTokens; i++) {
+
+    const mqttfmt_token_t *ptok = &topic.tokens[i];
+
+    if (MQTTFMT_TOK_TEXT == ptok->type) {
+      for (int j = 0; j < ptok->len; j++) {
+        if ('/' == topic.text[ptok->pos + j]) {
+          level++;
+        }
+      }
+      mqttfmt_put(&w, topic.text + ptok->pos, ptok->len);
+      continue;
+    }
+
+    // Wildcards must be a whole level
+    const mqttfmt_token_t *pnext = ((i + 1) < topic.nTokens) ? &topic.tokens[i + 1] : NULL;
+    if ((w.len && ('/' != w.buf[w.len - 1])) ||
+        ((NULL != pnext) && ((MQTTFMT_TOK_TEXT != pnext->type) || ('/' != topic.text[pnext->pos])))) {
+      return VSCP_ERROR_PARAMETER;
+    }
+
+    if (MQTTFMT_TOK_CLASS == ptok->type) {
+      proute->classLevel = level;
+    }
+    else if (MQTTFMT_TOK_TYPE == ptok->type) {
+      proute->typeLevel = level;
+    }
+
+    MQTTFMT_PUT_LIT(&w, "+");
+  }
+
+  return mqttfmt_end(&w) ? VSCP_ERROR_SUCCESS : VSCP_ERROR_BUFFER_TO_SMALL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_level_value
+//
+// Topic level as a 16-bit number
+//
+
+static bool
+mqttfmt_level_value(const char *str, const char *end, uint16_t *pvalue)
+{
+  uint32_t value = 0;
+
+  if ((str == end) || ((end - str) > 5)) {
+    return false;
+  }
+
+  while (str < end) {
+    if ((*str < '0') || (*str > '9')) {
+      return false;
+    }
+    value = (value * 10) + (*str++ - '0');
+  }
+
+  if (value > 0xffff) {
+    return false;
+  }
+
+  *pvalue = value;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_match_route
+//
+
+bool
+mqttfmt_match_route(const mqttfmt_route_t *proute, const char *topic, size_t len, uint16_t *pclass, uint16_t *ptype)
+{
+  const char *f   = proute->filter;
+  const char *t   = topic;
+  const char *end = topic + len;
+  uint8_t level   = 0;
+
+  while (true) {
+
+    // Multi level wildcard matches the rest, also if there is none
+    if ('#' == *f) {
+      return true;
+    }
+
+    const char *plevel = t;
+    while ((t < end) && ('/' != *t)) {
+      t++;
+    }
+
+    if ('+' == *f) {
+      if ((level == proute->classLevel) && !mqttfmt_level_value(plevel, t, pclass)) {
+        return false;
+      }
+      if ((level == proute->typeLevel) && !mqttfmt_level_value(plevel, t, ptype)) {
+        return false;
+      }
+      f++;
+    }
+    else {
+      while (*f && ('/' != *f)) {
+        if ((plevel == t) || (*plevel++ != *f++)) {
+          return false;
+        }
+      }
+      if (plevel != t) {
+        return false;
+      }
+    }
+
+    if ('\0' == *f) {
+      return (t == end);
+    }
+
+    // Filter has another level
+    if (t == end) {
+      return (0 == strcmp(f, "/#"));
+    }
+
+    f++;
+    t++;
+    level++;
+  }
+}
+
+// JSON input that need not be zero terminated
+typedef struct _mqttfmt_reader {
+  const char *p;   // Next character
+  const char *end; // End of input
+} mqttfmt_reader_t;
+
+// Max nesting of skipped values
+#define MQTTFMT_JSON_MAX_DEPTH 8
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_next
+//
+// Skip white space, returns the next character or zero at the end
+//
+
+static char
+mqttfmt_next(mqttfmt_reader_t *pr)
+{
+  while ((pr->p < pr->end) && ((' ' == *pr->p) || ('\t' == *pr->p) || ('\r' == *pr->p) || ('\n' == *pr->p))) {
+    pr->p++;
+  }
+
+  return (pr->p < pr->end) ? *pr->p : '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_expect
+//
+
+static bool
+mqttfmt_expect(mqttfmt_reader_t *pr, char c)
+{
+  if (c != mqttfmt_next(pr)) {
+    return false;
+  }
+
+  pr->p++;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_read_uint
+//
+
+static bool
+mqttfmt_read_uint(mqttfmt_reader_t *pr, uint32_t max, uint32_t *pvalue)
+{
+  uint64_t value = 0;
+  const char *start;
+
+  mqttfmt_next(pr);
+  start = pr->p;
+
+  while ((pr->p < pr->end) && (*pr->p >= '0') && (*pr->p <= '9')) {
+    value = (value * 10) + (*pr->p++ - '0');
+    if (value > max) {
+      return false;
+    }
+  }
+
+  *pvalue = value;
+  return (pr->p != start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_read_string
+//
+// Escapes are skipped, not decoded. None of the fields read needs them.
+//
+
+static bool
+mqttfmt_read_string(mqttfmt_reader_t *pr, const char **pstr, size_t *plen)
+{
+  if (!mqttfmt_expect(pr, '"')) {
+    return false;
+  }
+
+  *pstr = pr->p;
+  while ((pr->p < pr->end) && ('"' != *pr->p)) {
+    if ('\\' == *pr->p) {
+      pr->p++;
+    }
+    pr->p++;
+  }
+
+  if (pr->p >= pr->end) {
+    return false;
+  }
+
+  *plen = pr->p++ - *pstr;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_skip_value
+//
+
+static bool
+mqttfmt_skip_value(mqttfmt_reader_t *pr, int depth)
+{
+  const char *str;
+  size_t len;
+  char c = mqttfmt_next(pr);
+
+  if ('"' == c) {
+    return mqttfmt_read_string(pr, &str, &len);
+  }
+
+  if (('{' == c) || ('[' == c)) {
+    char close = ('{' == c) ? '}' : ']';
+
+    if (depth >= MQTTFMT_JSON_MAX_DEPTH) {
+      return false;
+    }
+
+    pr->p++;
+    if (mqttfmt_expect(pr, close)) {
+      return true;
+    }
+
+    do {
+      if (('}' == close) && (!mqttfmt_read_string(pr, &str, &len) || !mqttfmt_expect(pr, ':'))) {
+        return false;
+      }
+      if (!mqttfmt_skip_value(pr, depth + 1)) {
+        return false;
+      }
+    } while (mqttfmt_expect(pr, ','));
+
+    return mqttfmt_expect(pr, close);
+  }
+
+  // Number, true, false or null
+  const char *start = pr->p;
+  while ((pr->p < pr->end) && (NULL == strchr(",}] \t\r\n", *pr->p))) {
+    pr->p++;
+  }
+
+  return (pr->p != start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_hex
+//
+
+static int
+mqttfmt_hex(char c)
+{
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+
+  c |= 0x20;
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_parse_guid
+//
+// FF:FF:FF:FF:FF:FF:FF:FE:00:08:DC:12:34:56:00:01, empty or "-" is zero
+//
+
+static bool
+mqttfmt_parse_guid(uint8_t *pguid, const char *str, size_t len)
+{
+  if (!len || ((1 == len) && ('-' == *str))) {
+    return true;
+  }
+
+  if (47 != len) {
+    return false;
+  }
+
+  for (int i = 0; i < 16; i++, str += 3) {
+    int hi = mqttfmt_hex(str[0]);
+    int lo = mqttfmt_hex(str[1]);
+    if ((hi < 0) || (lo < 0) || ((i < 15) && (':' != str[2]))) {
+      return false;
+    }
+    pguid[i] = (hi << 4) + lo;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_parse_datetime
+//
+// 2023-01-13T10:16:02Z, the Z is optional
+//
+
+static bool
+mqttfmt_parse_datetime(vscpEvent *pev, const char *str, size_t len)
+{
+  uint16_t v[6];
+
+  if ((19 != len) && (20 != len)) {
+    return false;
+  }
+
+  for (int i = 0; i < 6; i++) {
+    const char *p = str + ((0 == i) ? 0 : (2 + 3 * i));
+    int n         = (0 == i) ? 4 : 2;
+    if (!mqttfmt_level_value(p, p + n, &v[i])) {
+      return false;
+    }
+  }
+
+  pev->year   = v[0];
+  pev->month  = v[1];
+  pev->day    = v[2];
+  pev->hour   = v[3];
+  pev->minute = v[4];
+  pev->second = v[5];
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_parse_json
+//
+
+int
+mqttfmt_parse_json(vscpEvent *pev, uint16_t maxData, const char *json, size_t len)
+{
+  const char *key;
+  size_t keyLen;
+  const char *str;
+  size_t strLen;
+  uint32_t value;
+  bool bOk;
+  mqttfmt_reader_t r = { json, json + len };
+
+  if ((NULL == pev) || (NULL == json) || (maxData && (NULL == pev->pdata))) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  uint8_t *pdata = pev->pdata;
+  memset(pev, 0, sizeof(vscpEvent));
+  pev->pdata = pdata;
+
+  if (!mqttfmt_expect(&r, '{')) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  if (mqttfmt_expect(&r, '}')) {
+    return VSCP_ERROR_SUCCESS;
+  }
+
+  do {
+
+    if (!mqttfmt_read_string(&r, &key, &keyLen) || !mqttfmt_expect(&r, ':')) {
+      return VSCP_ERROR_INVALID_FRAME;
+    }
+
+#define MQTTFMT_KEY(name) ((sizeof(name) - 1 == keyLen) && (0 == memcmp(key, name, keyLen)))
+
+    if (MQTTFMT_KEY("vscpHead")) {
+      bOk       = mqttfmt_read_uint(&r, 0xffff, &value);
+      pev->head = value;
+    }
+    else if (MQTTFMT_KEY("vscpObId")) {
+      bOk       = mqttfmt_read_uint(&r, 0xffffffff, &value);
+      pev->obid = value;
+    }
+    else if (MQTTFMT_KEY("vscpTimeStamp")) {
+      bOk            = mqttfmt_read_uint(&r, 0xffffffff, &value);
+      pev->timestamp = value;
+    }
+    else if (MQTTFMT_KEY("vscpClass")) {
+      bOk             = mqttfmt_read_uint(&r, 0xffff, &value);
+      pev->vscp_class = value;
+    }
+    else if (MQTTFMT_KEY("vscpType")) {
+      bOk            = mqttfmt_read_uint(&r, 0xffff, &value);
+      pev->vscp_type = value;
+    }
+    else if (MQTTFMT_KEY("vscpGuid")) {
+      bOk = mqttfmt_read_string(&r, &str, &strLen) && mqttfmt_parse_guid(pev->GUID, str, strLen);
+    }
+    else if (MQTTFMT_KEY("vscpDateTime")) {
+      bOk = mqttfmt_read_string(&r, &str, &strLen) && mqttfmt_parse_datetime(pev, str, strLen);
+    }
+    else if (MQTTFMT_KEY("vscpData")) {
+      bOk = mqttfmt_expect(&r, '[');
+      if (bOk && !mqttfmt_expect(&r, ']')) {
+        do {
+          if (pev->sizeData >= maxData) {
+            return VSCP_ERROR_BUFFER_TO_SMALL;
+          }
+          if (!mqttfmt_read_uint(&r, 0xff, &value)) {
+            return VSCP_ERROR_INVALID_FRAME;
+          }
+          pev->pdata[pev->sizeData++] = value;
+        } while (mqttfmt_expect(&r, ','));
+        bOk = mqttfmt_expect(&r, ']');
+      }
+    }
+    else {
+      bOk = mqttfmt_skip_value(&r, 0);
+    }
+
+#undef MQTTFMT_KEY
+
+    if (!bOk) {
+      return VSCP_ERROR_INVALID_FRAME;
+    }
+
+  } while (mqttfmt_expect(&r, ','));
+
+  return mqttfmt_expect(&r, '}') ? VSCP_ERROR_SUCCESS : VSCP_ERROR_INVALID_FRAME;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_get_cbor
+//
+// Read major type and argument. 64-bit arguments and indefinite lengths
+// are not used by the CBOR form and are not accepted.
+//
+
+static bool
+mqttfmt_get_cbor(mqttfmt_reader_t *pr, uint8_t *pmajor, uint32_t *pvalue)
+{
+  const uint8_t *p = (const uint8_t *) pr->p;
+  size_t left      = pr->end - pr->p;
+  uint8_t info;
+  size_t n;
+
+  if (!left) {
+    return false;
+  }
+
+  *pmajor = *p >> 5;
+  info    = *p & 0x1f;
+
+  if (info < 24) {
+    *pvalue = info;
+    pr->p++;
+    return true;
+  }
+
+  if (info > 26) {
+    return false;
+  }
+
+  n = 1 << (info - 24);
+  if (left < (1 + n)) {
+    return false;
+  }
+
+  *pvalue = 0;
+  for (size_t i = 1; i <= n; i++) {
+    *pvalue = (*pvalue << 8) + p[i];
+  }
+
+  pr->p += 1 + n;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_skip_cbor
+//
+
+static bool
+mqttfmt_skip_cbor(mqttfmt_reader_t *pr, int depth)
+{
+  uint8_t major;
+  uint32_t value;
+
+  if ((depth >= MQTTFMT_JSON_MAX_DEPTH) || !mqttfmt_get_cbor(pr, &major, &value)) {
+    return false;
+  }
+
+  switch (major) {
+
+    case MQTTFMT_CBOR_BYTES:
+    case MQTTFMT_CBOR_TEXT:
+      if (value > (uint32_t) (pr->end - pr->p)) {
+        return false;
+      }
+      pr->p += value;
+      return true;
+
+    case MQTTFMT_CBOR_MAP:
+      if (value > (uint32_t) (pr->end - pr->p)) {
+        return false;
+      }
+      value *= 2;
+      // fall through
+
+    case MQTTFMT_CBOR_ARRAY:
+      while (value--) {
+        if (!mqttfmt_skip_cbor(pr, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+
+    case MQTTFMT_CBOR_TAG:
+      return mqttfmt_skip_cbor(pr, depth + 1);
+
+    default:
+      // Integers, simple values and floats are all in the head
+      return true;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_parse_cbor
+//
+
+int
+mqttfmt_parse_cbor(vscpEvent *pev, uint16_t maxData, const uint8_t *buf, size_t len)
+{
+  uint8_t major;
+  uint32_t nPairs;
+  uint32_t key;
+  uint32_t value;
+  bool bOk;
+  mqttfmt_reader_t r = { (const char *) buf, (const char *) buf + len };
+
+  if ((NULL == pev) || (NULL == buf) || (maxData && (NULL == pev->pdata))) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  uint8_t *pdata = pev->pdata;
+  memset(pev, 0, sizeof(vscpEvent));
+  pev->pdata = pdata;
+
+  if (!mqttfmt_get_cbor(&r, &major, &nPairs) || (MQTTFMT_CBOR_MAP != major)) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  while (nPairs--) {
+
+    const char *pkey = r.p;
+    if (!mqttfmt_get_cbor(&r, &major, &key)) {
+      return VSCP_ERROR_INVALID_FRAME;
+    }
+
+    // Keys that are not integers are not ours
+    if (MQTTFMT_CBOR_UINT != major) {
+      r.p = pkey;
+      if (!mqttfmt_skip_cbor(&r, 0) || !mqttfmt_skip_cbor(&r, 0)) {
+        return VSCP_ERROR_INVALID_FRAME;
+      }
+      continue;
+    }
+
+    const char *pvalue = r.p;
+    if (!mqttfmt_get_cbor(&r, &major, &value)) {
+      return VSCP_ERROR_INVALID_FRAME;
+    }
+
+    bOk = (MQTTFMT_CBOR_UINT == major);
+    switch (key) {
+
+      case MQTTFMT_CBOR_HEAD:
+        bOk       = bOk && (value <= 0xffff);
+        pev->head = value;
+        break;
+
+      case MQTTFMT_CBOR_OBID:
+        pev->obid = value;
+        break;
+
+      case MQTTFMT_CBOR_TIMESTAMP:
+        pev->timestamp = value;
+        break;
+
+      case MQTTFMT_CBOR_CLASS:
+        bOk             = bOk && (value <= 0xffff);
+        pev->vscp_class = value;
+        break;
+
+      case MQTTFMT_CBOR_TYPE:
+        bOk            = bOk && (value <= 0xffff);
+        pev->vscp_type = value;
+        break;
+
+      case MQTTFMT_CBOR_DATETIME:
+        bOk = (MQTTFMT_CBOR_TEXT == major) && (value <= (uint32_t) (r.end - r.p)) &&
+              mqttfmt_parse_datetime(pev, r.p, value);
+        r.p += bOk ? value : 0;
+        break;
+
+      case MQTTFMT_CBOR_GUID:
+        bOk = (MQTTFMT_CBOR_BYTES == major) && (16 == value) && (value <= (uint32_t) (r.end - r.p));
+        if (bOk) {
+          memcpy(pev->GUID, r.p, 16);
+          r.p += 16;
+        }
+        break;
+
+      case MQTTFMT_CBOR_DATA:
+        if ((MQTTFMT_CBOR_BYTES == major) && (value > maxData)) {
+          return VSCP_ERROR_BUFFER_TO_SMALL;
+        }
+        bOk = (MQTTFMT_CBOR_BYTES == major) && (value <= (uint32_t) (r.end - r.p));
+        if (bOk && value) {
+          memcpy(pev->pdata, r.p, value);
+          pev->sizeData = value;
+          r.p += value;
+        }
+        break;
+
+      default:
+        r.p = pvalue;
+        bOk = mqttfmt_skip_cbor(&r, 0);
+        break;
+    }
+
+    if (!bOk) {
+      return VSCP_ERROR_INVALID_FRAME;
+    }
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mqttfmt_parse_payload
+//
+
+int
+mqttfmt_parse_payload(vscpEvent *pev, uint16_t maxData, const uint8_t *buf, size_t len)
+{
+  int rv;
+  size_t used;
+
+  if ((NULL == pev) || (NULL == buf) || (maxData && (NULL == pev->pdata))) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (!len) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  // CBOR map
+  if ((buf[0] >> 5) == MQTTFMT_CBOR_MAP) {
+    return mqttfmt_parse_cbor(pev, maxData, buf, len);
+  }
+
+  // Binary frame, the data is copied out of the payload
+  if (0 == buf[0]) {
+    uint8_t *pdata = pev->pdata;
+    if (VSCP_ERROR_SUCCESS != (rv = linkbin_read_frame(pev, (uint8_t *) buf, len, &used))) {
+      pev->pdata = pdata;
+      return rv;
+    }
+    if (pev->sizeData > maxData) {
+      pev->pdata = pdata;
+      return VSCP_ERROR_BUFFER_TO_SMALL;
+    }
+    if (pev->sizeData) {
+      memcpy(pdata, pev->pdata, pev->sizeData);
+    }
+    pev->pdata = pdata;
+    return VSCP_ERROR_SUCCESS;
+  }
+
+  return mqttfmt_parse_json(pev, maxData, (const char *) buf, len);
+}
@@ -0,0 +1,261 @@
+/*
+  File: mqttfmt.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  MQTT topic templates and JSON event payloads without heap allocation
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_MQTTFMT__
+#define __VSCP_MQTTFMT__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vscp.h>
+
+/*
+  A publish topic template such as vscp/{{guid}}/{{class}}/{{type}}
+  is compiled once into a list of tokens. The node name ({{node}}) and
+  the node GUID ({{guid}}) are known at compile time and are folded into
+  the literal text. What depends on the event is written when the topic
+  is rendered, in one pass.
+
+    {{evguid}}      - Event GUID
+    {{class}}       - Event class
+    {{type}}        - Event type
+    {{nickname}}    - Node nickname (16-bit, two last bytes of event GUID)
+    {{sindex}}      - Sensor index (empty if not a measurement)
+
+  Anything else between braces is kept as text.
+*/
+
+#define MQTTFMT_TOPIC_MAX  128 // Rendered topic and compiled literals, with terminating zero
+#define MQTTFMT_MAX_TOKENS 16  // Max tokens in a compiled topic
+#define MQTTFMT_MAX_DATA   512 // Max VSCP data written to JSON
+
+// Largest JSON event, the fixed part is about 230 characters
+#define MQTTFMT_JSON_MAX (256 + (4 * MQTTFMT_MAX_DATA))
+
+/*
+  Subscriptions use the same placeholders. {{node}} and {{guid}} are
+  folded in, {{class}} and {{type}} become a single level wildcard (+)
+  whose value overrides the class and type of the received event, and
+  the other event placeholders become a wildcard. A placeholder must be
+  a whole topic level.
+
+    vscp/{{guid}}/pub/{{class}}/{{type}}  ->  vscp/FF:...:01/pub/+/+
+*/
+
+#define MQTTFMT_LEVEL_NONE 0xff // Route has no level for class or type
+
+/*
+  Payload formats. Received payloads are told apart by their first byte,
+  '{' (or white space) for JSON, 0x00 (packet type) for a binary frame
+  and 0xa0-0xbb (map) for CBOR.
+
+  The CBOR form is a map with these integer keys. Missing keys are zero
+  and unknown keys are skipped.
+
+    1 - head (uint)
+    2 - obid (uint)
+    3 - date/time (text, same form as JSON)
+    4 - timestamp (uint)
+    5 - class (uint)
+    6 - type (uint)
+    7 - GUID (bytes, 16)
+    8 - data (bytes)
+*/
+
+typedef enum mqttfmt_format {
+  MQTTFMT_FORMAT_JSON = 0, // VSCP JSON event
+  MQTTFMT_FORMAT_BINARY,   // Binary frame as for the VSCP link protocol (linkbin.h)
+  MQTTFMT_FORMAT_CBOR,     // CBOR map with integer keys
+  MQTTFMT_FORMAT_COUNT
+} mqttfmt_format_t;
+
+#define MQTTFMT_CBOR_HEAD      1
+#define MQTTFMT_CBOR_OBID      2
+#define MQTTFMT_CBOR_DATETIME  3
+#define MQTTFMT_CBOR_TIMESTAMP 4
+#define MQTTFMT_CBOR_CLASS     5
+#define MQTTFMT_CBOR_TYPE      6
+#define MQTTFMT_CBOR_GUID      7
+#define MQTTFMT_CBOR_DATA      8
+
+typedef enum mqttfmt_tok {
+  MQTTFMT_TOK_TEXT = 0, // Literal text
+  MQTTFMT_TOK_EVGUID,   // {{evguid}}
+  MQTTFMT_TOK_CLASS,    // {{class}}
+  MQTTFMT_TOK_TYPE,     // {{type}}
+  MQTTFMT_TOK_NICKNAME, // {{nickname}}
+  MQTTFMT_TOK_SINDEX,   // {{sindex}}
+} mqttfmt_tok_t;
+
+typedef struct _mqttfmt_token {
+  uint8_t type; // mqttfmt_tok_t
+  uint8_t pos;  // Start of literal in text
+  uint8_t len;  // Length of literal
+} mqttfmt_token_t;
+
+typedef struct _mqttfmt_topic {
+  uint8_t nTokens;                            // Tokens in use
+  mqttfmt_token_t tokens[MQTTFMT_MAX_TOKENS]; // Tokens in topic order
+  char text[MQTTFMT_TOPIC_MAX];               // Literals
+} mqttfmt_topic_t;
+
+typedef struct _mqttfmt_route {
+  char filter[MQTTFMT_TOPIC_MAX]; // Topic filter to subscribe to
+  uint8_t classLevel;             // Topic level holding the class or MQTTFMT_LEVEL_NONE
+  uint8_t typeLevel;              // Topic level holding the type or MQTTFMT_LEVEL_NONE
+} mqttfmt_route_t;
+
+/**
+ * @brief Compile a topic template
+ *
+ * @param ptopic Compiled topic
+ * @param tmpl Topic template
+ * @param nodeName Node name for {{node}}
+ * @param nodeGuid Node GUID for {{guid}}
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_INVALID_POINTER or
+ *         VSCP_ERROR_BUFFER_TO_SMALL if the template has too many
+ *         tokens or too much text.
+ */
+int
+mqttfmt_compile_topic(mqttfmt_topic_t *ptopic, const char *tmpl, const char *nodeName, const uint8_t *nodeGuid);
+
+/**
+ * @brief Render a compiled topic for an event
+ *
+ * @param buf Buffer for topic, zero terminated
+ * @param size Size of buffer
+ * @param ptopic Compiled topic
+ * @param pev Event
+ * @return Length of topic, zero if it does not fit.
+ */
+size_t
+mqttfmt_render_topic(char *buf, size_t size, const mqttfmt_topic_t *ptopic, const vscpEvent *pev);
+
+/**
+ * @brief Write an event as a JSON object
+ *
+ * Uses the field names of the VSCP JSON event form (vscpHead,
+ * vscpObId, vscpDateTime, vscpTimeStamp, vscpClass, vscpType,
+ * vscpGuid and vscpData).
+ *
+ * @param buf Buffer for JSON, zero terminated
+ * @param size Size of buffer, MQTTFMT_JSON_MAX always fits
+ * @param pev Event
+ * @return Length of JSON, zero if it does not fit.
+ */
+size_t
+mqttfmt_write_json(char *buf, size_t size, const vscpEvent *pev);
+
+/**
+ * @brief Write an event as a CBOR map
+ *
+ * @param buf Buffer for CBOR
+ * @param size Size of buffer
+ * @param pev Event
+ * @return Length of CBOR, zero if it does not fit.
+ */
+size_t
+mqttfmt_write_cbor(uint8_t *buf, size_t size, const vscpEvent *pev);
+
+/**
+ * @brief Write an event in a payload format
+ *
+ * @param buf Buffer for payload, MQTTFMT_JSON_MAX fits all formats
+ * @param size Size of buffer
+ * @param pev Event
+ * @param format Payload format
+ * @return Length of payload, zero if it does not fit or the format is unknown.
+ */
+size_t
+mqttfmt_write_payload(uint8_t *buf, size_t size, const vscpEvent *pev, mqttfmt_format_t format);
+
+/**
+ * @brief Compile a subscription template into a route
+ *
+ * @param proute Compiled route
+ * @param tmpl Subscription template
+ * @param nodeName Node name for {{node}}
+ * @param nodeGuid Node GUID for {{guid}}
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_INVALID_POINTER,
+ *         VSCP_ERROR_BUFFER_TO_SMALL or VSCP_ERROR_PARAMETER if a
+ *         placeholder is not a whole topic level.
+ */
+int
+mqttfmt_compile_route(mqttfmt_route_t *proute, const char *tmpl, const char *nodeName, const uint8_t *nodeGuid);
+
+/**
+ * @brief Match a received topic against a route
+ *
+ * @param proute Compiled route
+ * @param topic Received topic, need not be zero terminated
+ * @param len Length of topic
+ * @param pclass Set to the class level of the topic if the route has one
+ * @param ptype Set to the type level of the topic if the route has one
+ * @return True if the topic matches. A class or type level that is not
+ *         a number does not match.
+ */
+bool
+mqttfmt_match_route(const mqttfmt_route_t *proute, const char *topic, size_t len, uint16_t *pclass, uint16_t *ptype);
+
+/**
+ * @brief Read an event from a JSON object
+ *
+ * Reads the fields written by mqttfmt_write_json. Fields that are
+ * missing are zero and unknown fields are skipped. Nothing is
+ * allocated, the data goes to the buffer pev->pdata points at.
+ *
+ * @param pev Event, pdata must point to maxData bytes
+ * @param maxData Size of data buffer
+ * @param json JSON object, need not be zero terminated
+ * @param len Length of JSON
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_INVALID_POINTER,
+ *         VSCP_ERROR_BUFFER_TO_SMALL if there is more data than fits
+ *         or VSCP_ERROR_INVALID_FRAME if the JSON is malformed.
+ */
+int
+mqttfmt_parse_json(vscpEvent *pev, uint16_t maxData, const char *json, size_t len);
+
+/**
+ * @brief Read an event from a CBOR map
+ *
+ * Same as mqttfmt_parse_json for the CBOR form.
+ */
+int
+mqttfmt_parse_cbor(vscpEvent *pev, uint16_t maxData, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Read an event from a payload in any of the formats
+ *
+ * Same as mqttfmt_parse_json, the format is told by the first byte.
+ */
+int
+mqttfmt_parse_payload(vscpEvent *pev, uint16_t maxData, const uint8_t *buf, size_t len);
+
+#endif
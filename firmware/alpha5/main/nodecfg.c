@@ -0,0 +1,356 @@
+/*
+  File: nodecfg.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Node configuration stored as one versioned, CRC protected blob
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <vscp.h>
+
+#include "crc32.h"
+#include "nodecfg.h"
+
+#define NODECFG_MAGIC 0x31434e56 // "VNC1"
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length; // Image length
+  uint32_t crc;    // Over magic, version, length and image
+} nodecfg_hdr_t;
+
+// Field of the configuration in the stored image
+
+typedef struct {
+  uint16_t offset; // Of field in node_persistent_config_t
+  uint16_t size;   // Of field
+  bool bInteger;   // Stored little endian, else byte by byte
+} nodecfg_field_t;
+
+#define NODECFG_FIELD(field, bInteger)                                                                                 \
+  { offsetof(node_persistent_config_t, field), sizeof(((node_persistent_config_t *) 0)->field), bInteger }
+
+#define NODECFG_BYTES(field) NODECFG_FIELD(field, false)
+#define NODECFG_INT(field)   NODECFG_FIELD(field, true)
+
+// Stored fields in image order. New fields go at the end. The boot
+// counter has an NVS key of its own and is not stored.
+
+static const nodecfg_field_t s_nodecfgFields[] = {
+  NODECFG_BYTES(nodeName),
+  NODECFG_BYTES(lkey),
+  NODECFG_BYTES(pmk),
+  NODECFG_BYTES(nodeGuid),
+  NODECFG_BYTES(startDelay),
+  NODECFG_BYTES(logwrite2Stdout),
+  NODECFG_BYTES(logLevel),
+  NODECFG_BYTES(logType),
+  NODECFG_BYTES(logRetries),
+  NODECFG_BYTES(logUrl),
+  NODECFG_INT(logPort),
+  NODECFG_BYTES(logMqttTopic),
+  NODECFG_BYTES(vscplinkEnable),
+  NODECFG_BYTES(vscplinkUrl),
+  NODECFG_INT(vscplinkPort),
+  NODECFG_BYTES(vscplinkUsername),
+  NODECFG_BYTES(vscplinkPassword),
+  NODECFG_BYTES(vscpLinkKey),
+  NODECFG_BYTES(dropletEnable),
+  NODECFG_BYTES(dropletLongRange),
+  NODECFG_BYTES(dropletSizeQueue),
+  NODECFG_BYTES(dropletChannel),
+  NODECFG_BYTES(dropletTtl),
+  NODECFG_BYTES(dropletForwardEnable),
+  NODECFG_BYTES(dropletEncryption),
+  NODECFG_BYTES(dropletFilterAdjacentChannel),
+  NODECFG_BYTES(dropletForwardSwitchChannel),
+  NODECFG_BYTES(dropletFilterWeakSignal),
+  NODECFG_BYTES(webEnable),
+  NODECFG_INT(webPort),
+  NODECFG_BYTES(webUsername),
+  NODECFG_BYTES(webPassword),
+  NODECFG_BYTES(mqttEnable),
+  NODECFG_BYTES(mqttUrl),
+  NODECFG_INT(mqttPort),
+  NODECFG_BYTES(mqttClientid),
+  NODECFG_BYTES(mqttUsername),
+  NODECFG_BYTES(mqttPassword),
+  NODECFG_INT(mqttQos),
+  NODECFG_INT(mqttRetain),
+  NODECFG_BYTES(mqttSub),
+  NODECFG_BYTES(mqttPub),
+  NODECFG_BYTES(mqttFormat),
+  NODECFG_INT(mqttDeadband),
+  NODECFG_INT(mqttMinInterval),
+  NODECFG_INT(mqttMaxAge),
+  NODECFG_BYTES(mqttLwTopic),
+  NODECFG_BYTES(mqttLwMessage),
+  NODECFG_BYTES(mqttLwQos),
+  NODECFG_BYTES(mqttLwRetain),
+};
+
+#define NODECFG_NUM_FIELDS (sizeof(s_nodecfgFields) / sizeof(s_nodecfgFields[0]))
+
+// Version 1 images are the struct as laid out by the ESP32 compiler,
+// read by the offsets of the fields. The v1 reader depends on the
+// struct still having that layout. If one of these fails give the
+// reader the version 1 offsets instead of offsetof.
+
+#define NODECFG_V1_IMAGE_LEN 1130
+
+#define NODECFG_V1_OFFSET(field, offset)                                                                               \
+  _Static_assert(offsetof(node_persistent_config_t, field) == (offset), "Layout of version 1 has changed: " #field)
+
+NODECFG_V1_OFFSET(nodeName, 0);
+NODECFG_V1_OFFSET(lkey, 32);
+NODECFG_V1_OFFSET(pmk, 64);
+NODECFG_V1_OFFSET(nodeGuid, 96);
+NODECFG_V1_OFFSET(startDelay, 112);
+NODECFG_V1_OFFSET(logwrite2Stdout, 120);
+NODECFG_V1_OFFSET(logLevel, 121);
+NODECFG_V1_OFFSET(logType, 122);
+NODECFG_V1_OFFSET(logRetries, 123);
+NODECFG_V1_OFFSET(logUrl, 124);
+NODECFG_V1_OFFSET(logPort, 156);
+NODECFG_V1_OFFSET(logMqttTopic, 158);
+NODECFG_V1_OFFSET(vscplinkEnable, 222);
+NODECFG_V1_OFFSET(vscplinkUrl, 223);
+NODECFG_V1_OFFSET(vscplinkPort, 256);
+NODECFG_V1_OFFSET(vscplinkUsername, 258);
+NODECFG_V1_OFFSET(vscplinkPassword, 290);
+NODECFG_V1_OFFSET(vscpLinkKey, 322);
+NODECFG_V1_OFFSET(dropletEnable, 354);
+NODECFG_V1_OFFSET(dropletLongRange, 355);
+NODECFG_V1_OFFSET(dropletSizeQueue, 356);
+NODECFG_V1_OFFSET(dropletChannel, 357);
+NODECFG_V1_OFFSET(dropletTtl, 358);
+NODECFG_V1_OFFSET(dropletForwardEnable, 359);
+NODECFG_V1_OFFSET(dropletEncryption, 360);
+NODECFG_V1_OFFSET(dropletFilterAdjacentChannel, 361);
+NODECFG_V1_OFFSET(dropletForwardSwitchChannel, 362);
+NODECFG_V1_OFFSET(dropletFilterWeakSignal, 363);
+NODECFG_V1_OFFSET(webEnable, 364);
+NODECFG_V1_OFFSET(webPort, 366);
+NODECFG_V1_OFFSET(webUsername, 368);
+NODECFG_V1_OFFSET(webPassword, 400);
+NODECFG_V1_OFFSET(mqttEnable, 432);
+NODECFG_V1_OFFSET(mqttUrl, 433);
+NODECFG_V1_OFFSET(mqttPort, 466);
+NODECFG_V1_OFFSET(mqttClientid, 468);
+NODECFG_V1_OFFSET(mqttUsername, 532);
+NODECFG_V1_OFFSET(mqttPassword, 564);
+NODECFG_V1_OFFSET(mqttQos, 596);
+NODECFG_V1_OFFSET(mqttRetain, 600);
+NODECFG_V1_OFFSET(mqttSub, 604);
+NODECFG_V1_OFFSET(mqttPub, 732);
+NODECFG_V1_OFFSET(mqttFormat, 860);
+NODECFG_V1_OFFSET(mqttDeadband, 864);
+NODECFG_V1_OFFSET(mqttMinInterval, 868);
+NODECFG_V1_OFFSET(mqttMaxAge, 870);
+NODECFG_V1_OFFSET(mqttLwTopic, 872);
+NODECFG_V1_OFFSET(mqttLwMessage, 1000);
+NODECFG_V1_OFFSET(mqttLwQos, 1128);
+NODECFG_V1_OFFSET(mqttLwRetain, 1129);
+_Static_assert(sizeof(int) == 4, "Layout of version 1 has changed: int");
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_blob_crc
+//
+
+static uint32_t
+nodecfg_blob_crc(const uint8_t *blob, uint16_t length)
+{
+  uint32_t crc = 0xffffffff;
+
+  crc = crc32_update(crc, blob, offsetof(nodecfg_hdr_t, crc));
+  crc = crc32_update(crc, blob + NODECFG_HDR_LEN, length);
+
+  return ~crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_image_len
+//
+// Length of the image this firmware writes
+//
+
+static size_t
+nodecfg_image_len(void)
+{
+  size_t len = 0;
+
+  for (size_t i = 0; i < NODECFG_NUM_FIELDS; i++) {
+    len += s_nodecfgFields[i].size;
+  }
+
+  return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_put_field
+//
+
+static void
+nodecfg_put_field(uint8_t *p, const node_persistent_config_t *pcfg, const nodecfg_field_t *pfield)
+{
+  const uint8_t *pval = (const uint8_t *) pcfg + pfield->offset;
+  uint32_t val;
+
+  if (!pfield->bInteger) {
+    memcpy(p, pval, pfield->size);
+    return;
+  }
+
+  if (2 == pfield->size) {
+    uint16_t val16;
+    memcpy(&val16, pval, 2);
+    val = val16;
+  }
+  else {
+    memcpy(&val, pval, 4);
+  }
+
+  for (uint16_t i = 0; i < pfield->size; i++) {
+    p[i] = (val >> (8 * i)) & 0xff;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_get_field
+//
+
+static void
+nodecfg_get_field(node_persistent_config_t *pcfg, const uint8_t *p, const nodecfg_field_t *pfield)
+{
+  uint8_t *pval = (uint8_t *) pcfg + pfield->offset;
+  uint32_t val  = 0;
+
+  if (!pfield->bInteger) {
+    memcpy(pval, p, pfield->size);
+    return;
+  }
+
+  for (uint16_t i = 0; i < pfield->size; i++) {
+    val |= (uint32_t) p[i] << (8 * i);
+  }
+
+  if (2 == pfield->size) {
+    uint16_t val16 = (uint16_t) val;
+    memcpy(pval, &val16, 2);
+  }
+  else {
+    memcpy(pval, &val, 4);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_pack
+//
+
+size_t
+nodecfg_pack(uint8_t *buf, size_t size, const node_persistent_config_t *pcfg)
+{
+  nodecfg_hdr_t hdr;
+  size_t pos = NODECFG_HDR_LEN;
+
+  if ((NULL == buf) || (NULL == pcfg) || (size < (NODECFG_HDR_LEN + nodecfg_image_len()))) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < NODECFG_NUM_FIELDS; i++) {
+    nodecfg_put_field(buf + pos, pcfg, &s_nodecfgFields[i]);
+    pos += s_nodecfgFields[i].size;
+  }
+
+  hdr.magic   = NODECFG_MAGIC;
+  hdr.version = NODECFG_VERSION;
+  hdr.length  = pos - NODECFG_HDR_LEN;
+  memcpy(buf, &hdr, NODECFG_HDR_LEN);
+
+  hdr.crc = nodecfg_blob_crc(buf, hdr.length);
+  memcpy(buf + offsetof(nodecfg_hdr_t, crc), &hdr.crc, sizeof(hdr.crc));
+
+  return pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// nodecfg_unpack
+//
+
+int
+nodecfg_unpack(node_persistent_config_t *pcfg, const uint8_t *buf, size_t len)
+{
+  nodecfg_hdr_t hdr;
+  const uint8_t *image = buf + NODECFG_HDR_LEN;
+  size_t pos           = 0;
+
+  if ((NULL == pcfg) || (NULL == buf)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (len < NODECFG_HDR_LEN) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  memcpy(&hdr, buf, NODECFG_HDR_LEN);
+  if ((NODECFG_MAGIC != hdr.magic) || ((len - NODECFG_HDR_LEN) < hdr.length)) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  if (hdr.crc != nodecfg_blob_crc(buf, hdr.length)) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  // Fields that are not all in the image keep their defaults
+  switch (hdr.version) {
+
+    // Struct image. Fields are read where the struct had them, integers
+    // as they were in memory (the ESP32 is little endian).
+    case 1:
+      for (size_t i = 0; i < NODECFG_NUM_FIELDS; i++) {
+        const nodecfg_field_t *pfield = &s_nodecfgFields[i];
+        if (((size_t) pfield->offset + pfield->size) <= MIN(hdr.length, NODECFG_V1_IMAGE_LEN)) {
+          nodecfg_get_field(pcfg, image + pfield->offset, pfield);
+        }
+      }
+      break;
+
+    case NODECFG_VERSION:
+      for (size_t i = 0; (i < NODECFG_NUM_FIELDS) && ((pos + s_nodecfgFields[i].size) <= hdr.length); i++) {
+        nodecfg_get_field(pcfg, image + pos, &s_nodecfgFields[i]);
+        pos += s_nodecfgFields[i].size;
+      }
+      break;
+
+    default:
+      return VSCP_ERROR_NOT_SUPPORTED;
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/*
+  File: nodecfg.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Node configuration stored as one versioned, CRC protected blob
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_NODECFG__
+#define __VSCP_NODECFG__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  The node configuration is stored in NVS as one blob that is read once
+  at boot and written in one go when the configuration is changed.
+
+    blob  [header: magic, version, image length][crc][image]
+
+  The image holds the fields of the configuration one after the other
+  in the order of the field table in nodecfg.c, without padding and
+  with integers little endian, so it does not depend on how the
+  compiler lays out the struct. The server certificate buffer is not
+  stored. The CRC covers the header and the image, a blob that is
+  damaged is not used. NVS writes the new blob in full before it lets
+  go of the old one, so a power loss while saving leaves either the old
+  or the new configuration.
+
+  New fields are added at the end of the field table. A stored image
+  that is shorter than the current one leaves the new fields at their
+  defaults and one that is longer (written by newer firmware, before an
+  OTA rollback) has the extra bytes ignored. Any other change to the
+  table bumps NODECFG_VERSION and adds a conversion from the old image
+  to nodecfg_unpack.
+
+  Version 1 stored the struct as it is in memory. It is converted when
+  read, the layout it depends on is pinned in nodecfg.c.
+
+  The boot counter changes on every boot and is kept in an NVS key of
+  its own so the blob is only written when the configuration changes.
+*/
+
+#define NODECFG_VERSION 2
+#define NODECFG_HDR_LEN 12
+
+typedef struct {
+
+  // Module
+  char nodeName[32];    // User name for node
+  uint8_t lkey[32];     // Local key (16 (EAS128)/24(AES192)/32(AES256))
+  uint8_t pmk[32];      // Primary key (16 (EAS128)/24(AES192)/32(AES256)) 
+  uint8_t nodeGuid[16]; // GUID for node (default: Constructed from MAC address)
+  uint8_t startDelay;   // Delay before wifi is enabled (to charge cap)
+  uint32_t bootCnt;     // Number of restarts (not editable)
+
+  // Logging
+  uint8_t logwrite2Stdout; // Enable write Logging to STDOUT
+  uint8_t logLevel;        // 'ERROR' is default
+  uint8_t logType;         // STDOUT / UDP / TCP / HTTP / MQTT /VSCP
+  uint8_t logRetries;      // Number of log log retries
+  char logUrl[32];         // For UDP/TCP/HTML
+  uint16_t logPort;        // Port for UDP
+  char logMqttTopic[64];   //  MQTT topic
+
+  // VSCP Link
+  bool vscplinkEnable;
+  char vscplinkUrl[32];      // URL VSCP tcp/ip Link host (set to blank yto disable)
+  uint16_t vscplinkPort;     // Port on VSCP tcp/ip Link host
+  char vscplinkUsername[32]; // Username for VSCP tcp/ip Link host
+  char vscplinkPassword[32]; // Password for VSCP tcp/ip Link host
+  uint8_t vscpLinkKey[32];   // Security key (16 (EAS128)/24(AES192)/32(AES256))
+
+  // Droplet
+  bool dropletEnable;
+  bool dropletLongRange;             // Enable long range mode
+  uint8_t dropletSizeQueue;          // Input queue size
+  uint8_t dropletChannel;           // Channel to use (zero is current)
+  uint8_t dropletTtl;                // Default ttl
+  bool dropletForwardEnable;         // Forward when packets are received
+  uint8_t dropletEncryption;         // 0=no encryption, 1=AES-128, 2=AES-192, 3=AES-256
+  bool dropletFilterAdjacentChannel; // Don't receive if from other channel
+  bool dropletForwardSwitchChannel;  // Allow switching channel on forward
+  int8_t dropletFilterWeakSignal;    // Filter on RSSI (zero is no rssi filtering)
+
+  // Web server
+  bool webEnable;
+  uint16_t webPort;     // Port web server listens on
+  char webUsername[32]; // Basic Auth username
+  char webPassword[32]; // Basic Auth password
+
+  // MQTT  (mqtt[s]://[username][:password]@host.domain[:port])
+  bool mqttEnable;
+  char mqttUrl[32];
+  uint16_t mqttPort;
+  char mqttClientid[64];
+  char mqttUsername[32];
+  char mqttPassword[32];
+  int mqttQos;
+  int mqttRetain;
+  char mqttSub[128];
+  char mqttPub[128];
+  uint8_t mqttFormat;               // Publish payload format, 0=JSON, 1=binary, 2=CBOR (mqttfmt_format_t)
+  uint32_t mqttDeadband;            // Measurement change needed to publish, 1/1000 of unit (0 = any change)
+  uint16_t mqttMinInterval;         // Min seconds between publishes of a measurement (0 = no limit)
+  uint16_t mqttMaxAge;              // Publish an unchanged measurement after this many seconds (0 = never)
+  char mqttLwTopic[128];
+  char mqttLwMessage[128];
+  uint8_t mqttLwQos;
+  bool mqttLwRetain;
+
+  // Not stored, must stay last (see NODECFG_IMAGE_MAX)
+  char mqttVerification[32*1024];   // For server certificate
+} node_persistent_config_t;
+
+// Longest image this firmware writes. Stored fields have no padding so
+// they never take more room than the struct up to the certificate.
+#define NODECFG_IMAGE_MAX offsetof(node_persistent_config_t, mqttVerification)
+
+// Room for a blob written by this firmware
+#define NODECFG_BLOB_LEN (NODECFG_HDR_LEN + NODECFG_IMAGE_MAX)
+
+/**
+ * @fn nodecfg_pack
+ * @brief Write a configuration as a blob
+ *
+ * @param buf Buffer for the blob
+ * @param size Size of buffer, NODECFG_BLOB_LEN always fits
+ * @param pcfg Configuration
+ * @return Length of blob or zero if the buffer is too small
+ */
+
+size_t
+nodecfg_pack(uint8_t *buf, size_t size, const node_persistent_config_t *pcfg);
+
+/**
+ * @fn nodecfg_unpack
+ * @brief Read a configuration from a blob
+ *
+ * Fields that are not in the blob are left as they are, so pcfg
+ * should hold the defaults. Nothing is changed if the blob is not
+ * valid.
+ *
+ * @param pcfg Configuration
+ * @param buf Blob
+ * @param len Length of blob
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_INVALID_FRAME if the blob is
+ *         damaged or VSCP_ERROR_NOT_SUPPORTED if it has a version this
+ *         firmware does not know
+ */
+
+int
+nodecfg_unpack(node_persistent_config_t *pcfg, const uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,555 @@
+/*
+  File: outbox.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Flash backed store and forward outbox for MQTT messages
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include <vscp.h>
+
+#include "crc32.h"
+#include "outbox.h"
+
+#define OUTBOX_MAGIC 0x31584f56 // "VOX1"
+
+// Record states, each step clears bits
+#define OUTBOX_STATE_ERASED 0xffffffff // Not written or cut short
+#define OUTBOX_STATE_VALID  0x0000ffff // Waiting to be sent
+#define OUTBOX_STATE_SENT   0x00000000 // Done
+
+#define OUTBOX_FLAG_QOS    0x03
+#define OUTBOX_FLAG_RETAIN 0x04
+
+#define OUTBOX_ALIGN(n) (((n) + 3) & ~3)
+
+// Message id, sector sequence number and offset
+#define OUTBOX_ID(seq, offset) (((seq) << 12) | (offset))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t seqInv; // ~seq, a header cut short does not match
+  uint32_t reserved;
+} outbox_sector_hdr_t;
+
+typedef struct {
+  uint32_t state;
+  uint16_t len;      // Payload length
+  uint8_t topicLen;
+  uint8_t flags;
+  uint32_t crc;      // Over len, topicLen, flags, topic and payload
+} outbox_record_hdr_t;
+
+// Result of reading a record header
+#define OUTBOX_REC_END     0 // Erased, nothing more in sector
+#define OUTBOX_REC_OK      1
+#define OUTBOX_REC_INVALID 2 // Not readable, nothing more can be trusted in sector
+
+static const char *TAG = "outbox";
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_record_crc
+//
+
+static uint32_t
+outbox_record_crc(const outbox_record_hdr_t *prec, const uint8_t *topic, const uint8_t *payload)
+{
+  uint32_t crc = 0xffffffff;
+
+  crc = crc32_update(crc, (const uint8_t *) &prec->len, sizeof(prec->len));
+  crc = crc32_update(crc, &prec->topicLen, 1);
+  crc = crc32_update(crc, &prec->flags, 1);
+  crc = crc32_update(crc, topic, prec->topicLen);
+  crc = crc32_update(crc, payload, prec->len);
+
+  return ~crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_addr
+//
+
+static inline size_t
+outbox_addr(uint16_t sector, uint16_t offset)
+{
+  return ((size_t) sector * OUTBOX_SECTOR_SIZE) + offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_next_sector
+//
+
+static inline uint16_t
+outbox_next_sector(const outbox_t *pob, uint16_t sector)
+{
+  return (sector + 1) % pob->nSectors;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_read_sector
+//
+// True if the sector holds an outbox sector header
+//
+
+static bool
+outbox_read_sector(const outbox_t *pob, uint16_t sector, uint32_t *pseq)
+{
+  outbox_sector_hdr_t hdr;
+
+  if (ESP_OK != esp_partition_read(pob->part, outbox_addr(sector, 0), &hdr, sizeof(hdr))) {
+    return false;
+  }
+
+  if ((OUTBOX_MAGIC != hdr.magic) || (hdr.seq != ~hdr.seqInv)) {
+    return false;
+  }
+
+  *pseq = hdr.seq;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_read_record
+//
+
+static int
+outbox_read_record(const outbox_t *pob,
+                   uint16_t sector,
+                   uint16_t offset,
+                   outbox_record_hdr_t *prec,
+                   uint16_t *precLen)
+{
+  if ((offset + OUTBOX_RECORD_HDR_LEN) > OUTBOX_SECTOR_SIZE) {
+    return OUTBOX_REC_END;
+  }
+
+  if (ESP_OK != esp_partition_read(pob->part, outbox_addr(sector, offset), prec, sizeof(outbox_record_hdr_t))) {
+    return OUTBOX_REC_INVALID;
+  }
+
+  if ((OUTBOX_STATE_ERASED == prec->state) && (0xffff == prec->len) && (0xff == prec->topicLen) &&
+      (0xff == prec->flags) && (0xffffffff == prec->crc)) {
+    return OUTBOX_REC_END;
+  }
+
+  *precLen = OUTBOX_ALIGN(OUTBOX_RECORD_HDR_LEN + prec->topicLen + prec->len);
+  if (*precLen > (OUTBOX_SECTOR_SIZE - offset)) {
+    return OUTBOX_REC_INVALID;
+  }
+
+  return OUTBOX_REC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_find_head
+//
+// First record waiting to be sent at or after a position. Sets the head
+// to the write position if there is none.
+//
+
+static void
+outbox_find_head(outbox_t *pob, uint16_t sector, uint16_t offset)
+{
+  outbox_record_hdr_t rec;
+  uint16_t recLen;
+  uint32_t seq = 0;
+  bool bValid  = outbox_read_sector(pob, sector, &seq);
+
+  for (int n = 0; n < pob->nSectors;) {
+
+    if ((sector == pob->tailSector) && (offset >= pob->tailOffset)) {
+      break;
+    }
+
+    if (bValid && (OUTBOX_REC_OK == outbox_read_record(pob, sector, offset, &rec, &recLen))) {
+      if (OUTBOX_STATE_VALID == rec.state) {
+        pob->headSector = sector;
+        pob->headOffset = offset;
+        pob->headSeq    = seq;
+        return;
+      }
+      offset += recLen;
+      continue;
+    }
+
+    // Nothing more in this sector
+    if (sector == pob->tailSector) {
+      break;
+    }
+    sector = outbox_next_sector(pob, sector);
+    offset = OUTBOX_SECTOR_HDR_LEN;
+    bValid = outbox_read_sector(pob, sector, &seq);
+    n++;
+  }
+
+  pob->headSector = pob->tailSector;
+  pob->headOffset = pob->tailOffset;
+  pob->headSeq    = pob->tailSeq;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_mark
+//
+
+static int
+outbox_mark(outbox_t *pob, uint16_t sector, uint16_t offset, uint32_t state)
+{
+  if (ESP_OK != esp_partition_write(pob->part, outbox_addr(sector, offset), &state, sizeof(state))) {
+    pob->stats.nWriteErr++;
+    return VSCP_ERROR_ERROR;
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_open_sector
+//
+// Start writing in the next sector. Drops what is left in it if the
+// ring is full.
+//
+
+static int
+outbox_open_sector(outbox_t *pob)
+{
+  outbox_record_hdr_t rec;
+  outbox_sector_hdr_t hdr;
+  uint16_t recLen;
+  uint16_t sector = outbox_next_sector(pob, pob->tailSector);
+
+  if (pob->nPending && (sector == pob->headSector)) {
+    uint32_t nDropped = 0;
+    for (uint16_t offset = pob->headOffset;
+         OUTBOX_REC_OK == outbox_read_record(pob, sector, offset, &rec, &recLen);
+         offset += recLen) {
+      if (OUTBOX_STATE_VALID == rec.state) {
+        nDropped++;
+      }
+    }
+    ESP_LOGW(TAG, "Outbox full, %lu messages dropped", (unsigned long) nDropped);
+    pob->nPending -= (nDropped < pob->nPending) ? nDropped : pob->nPending;
+    pob->stats.nDropped += nDropped;
+    outbox_find_head(pob, outbox_next_sector(pob, sector), OUTBOX_SECTOR_HDR_LEN);
+  }
+
+  if (ESP_OK != esp_partition_erase_range(pob->part, outbox_addr(sector, 0), OUTBOX_SECTOR_SIZE)) {
+    pob->stats.nWriteErr++;
+    return VSCP_ERROR_ERROR;
+  }
+  pob->stats.nErased++;
+
+  hdr.magic    = OUTBOX_MAGIC;
+  hdr.seq      = pob->tailSeq + 1;
+  hdr.seqInv   = ~hdr.seq;
+  hdr.reserved = 0xffffffff;
+  if (ESP_OK != esp_partition_write(pob->part, outbox_addr(sector, 0), &hdr, sizeof(hdr))) {
+    pob->stats.nWriteErr++;
+    return VSCP_ERROR_ERROR;
+  }
+
+  pob->tailSector = sector;
+  pob->tailOffset = OUTBOX_SECTOR_HDR_LEN;
+  pob->tailSeq    = hdr.seq;
+
+  if (!pob->nPending) {
+    pob->headSector = pob->tailSector;
+    pob->headOffset = pob->tailOffset;
+    pob->headSeq    = pob->tailSeq;
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_open
+//
+
+int
+outbox_open(outbox_t *pob, const esp_partition_t *part)
+{
+  outbox_record_hdr_t rec;
+  uint16_t recLen;
+  uint16_t offset;
+  uint16_t oldest = 0;
+  uint32_t seq;
+  uint32_t minSeq = 0;
+  bool bAny       = false;
+  bool bHead      = false;
+  int rv;
+
+  if ((NULL == pob) || (NULL == part)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  memset(pob, 0, sizeof(outbox_t));
+  pob->part     = part;
+  pob->nSectors = part->size / OUTBOX_SECTOR_SIZE;
+  if (pob->nSectors < 2) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  // Newest sector is written to, oldest is where sending starts
+  for (uint16_t sector = 0; sector < pob->nSectors; sector++) {
+    if (!outbox_read_sector(pob, sector, &seq)) {
+      continue;
+    }
+    if (!bAny || (seq > pob->tailSeq)) {
+      pob->tailSector = sector;
+      pob->tailSeq    = seq;
+    }
+    if (!bAny || (seq < minSeq)) {
+      oldest = sector;
+      minSeq = seq;
+    }
+    bAny = true;
+  }
+
+  // Empty, the first message opens sector 0
+  if (!bAny) {
+    pob->tailSector = pob->nSectors - 1;
+    pob->tailOffset = OUTBOX_SECTOR_SIZE;
+    pob->headSector = pob->tailSector;
+    pob->headOffset = pob->tailOffset;
+    return VSCP_ERROR_SUCCESS;
+  }
+
+  // Write position. A damaged record closes the sector.
+  offset = OUTBOX_SECTOR_HDR_LEN;
+  while (OUTBOX_REC_OK == (rv = outbox_read_record(pob, pob->tailSector, offset, &rec, &recLen))) {
+    offset += recLen;
+  }
+  pob->tailOffset = (OUTBOX_REC_INVALID == rv) ? OUTBOX_SECTOR_SIZE : offset;
+
+  // Count what is waiting, oldest sector to newest
+  for (uint16_t sector = oldest, n = 0; n < pob->nSectors; sector = outbox_next_sector(pob, sector), n++) {
+    if (outbox_read_sector(pob, sector, &seq)) {
+      for (offset = OUTBOX_SECTOR_HDR_LEN;
+           ((sector != pob->tailSector) || (offset < pob->tailOffset)) &&
+           (OUTBOX_REC_OK == outbox_read_record(pob, sector, offset, &rec, &recLen));
+           offset += recLen) {
+        if (OUTBOX_STATE_VALID != rec.state) {
+          continue;
+        }
+        if (!bHead) {
+          pob->headSector = sector;
+          pob->headOffset = offset;
+          pob->headSeq    = seq;
+          bHead           = true;
+        }
+        pob->nPending++;
+      }
+    }
+    if (sector == pob->tailSector) {
+      break;
+    }
+  }
+
+  if (!bHead) {
+    pob->headSector = pob->tailSector;
+    pob->headOffset = pob->tailOffset;
+    pob->headSeq    = pob->tailSeq;
+  }
+
+  ESP_LOGI(TAG, "Outbox opened, %lu messages waiting", (unsigned long) pob->nPending);
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_append
+//
+
+int
+outbox_append(outbox_t *pob, const char *topic, const uint8_t *payload, uint16_t len, uint8_t qos, bool bRetain)
+{
+  outbox_record_hdr_t rec;
+  size_t topicLen;
+  size_t addr;
+  uint16_t recLen;
+  int rv;
+
+  if ((NULL == pob) || (NULL == pob->part) || (NULL == topic) || ((NULL == payload) && len)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  topicLen = strlen(topic);
+  if ((topicLen > 0xff) || ((topicLen + len) > OUTBOX_MAX_BODY)) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  recLen = OUTBOX_ALIGN(OUTBOX_RECORD_HDR_LEN + topicLen + len);
+  if ((pob->tailOffset + recLen) > OUTBOX_SECTOR_SIZE) {
+    if (VSCP_ERROR_SUCCESS != (rv = outbox_open_sector(pob))) {
+      return rv;
+    }
+  }
+
+  rec.state    = OUTBOX_STATE_ERASED;
+  rec.len      = len;
+  rec.topicLen = topicLen;
+  rec.flags    = (qos & OUTBOX_FLAG_QOS) | (bRetain ? OUTBOX_FLAG_RETAIN : 0);
+  rec.crc      = outbox_record_crc(&rec, (const uint8_t *) topic, payload);
+
+  addr = outbox_addr(pob->tailSector, pob->tailOffset);
+  pob->tailOffset += recLen;
+
+  // A record that is not fully written could read as erased and hide
+  // what comes after it, so the sector is closed
+  if ((ESP_OK != esp_partition_write(pob->part, addr, &rec, sizeof(rec))) ||
+      (ESP_OK != esp_partition_write(pob->part, addr + OUTBOX_RECORD_HDR_LEN, topic, topicLen)) ||
+      (len && (ESP_OK != esp_partition_write(pob->part, addr + OUTBOX_RECORD_HDR_LEN + topicLen, payload, len)))) {
+    pob->tailOffset = OUTBOX_SECTOR_SIZE;
+    pob->stats.nWriteErr++;
+    return VSCP_ERROR_ERROR;
+  }
+
+  // Valid from here
+  if (VSCP_ERROR_SUCCESS != (rv = outbox_mark(pob, pob->tailSector, pob->tailOffset - recLen, OUTBOX_STATE_VALID))) {
+    return rv;
+  }
+
+  if (!pob->nPending++) {
+    pob->headSector = pob->tailSector;
+    pob->headOffset = pob->tailOffset - recLen;
+    pob->headSeq    = pob->tailSeq;
+  }
+  pob->stats.nStored++;
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_peek
+//
+
+int
+outbox_peek(outbox_t *pob, outbox_msg_t *pmsg, uint8_t *buf, size_t size)
+{
+  outbox_record_hdr_t rec;
+  outbox_stats_t stats;
+  uint16_t recLen;
+  size_t addr;
+  bool bReopened = false;
+
+  if ((NULL == pob) || (NULL == pmsg) || (NULL == buf)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  while (pob->nPending) {
+
+    if ((OUTBOX_REC_OK != outbox_read_record(pob, pob->headSector, pob->headOffset, &rec, &recLen)) ||
+        (OUTBOX_STATE_VALID != rec.state)) {
+      // Should not happen, start over from flash once
+      if (bReopened) {
+        return VSCP_ERROR_ERROR;
+      }
+      ESP_LOGE(TAG, "Outbox head lost, reopening");
+      stats = pob->stats;
+      outbox_open(pob, pob->part);
+      pob->stats = stats;
+      bReopened  = true;
+      continue;
+    }
+
+    if (size < ((size_t) rec.topicLen + 1 + rec.len)) {
+      return VSCP_ERROR_BUFFER_TO_SMALL;
+    }
+
+    addr = outbox_addr(pob->headSector, pob->headOffset) + OUTBOX_RECORD_HDR_LEN;
+    if ((ESP_OK == esp_partition_read(pob->part, addr, buf, rec.topicLen)) &&
+        (ESP_OK == esp_partition_read(pob->part, addr + rec.topicLen, buf + rec.topicLen + 1, rec.len)) &&
+        (rec.crc == outbox_record_crc(&rec, buf, buf + rec.topicLen + 1))) {
+      buf[rec.topicLen] = 0;
+      pmsg->topic       = (const char *) buf;
+      pmsg->payload     = buf + rec.topicLen + 1;
+      pmsg->len         = rec.len;
+      pmsg->qos         = rec.flags & OUTBOX_FLAG_QOS;
+      pmsg->bRetain     = (rec.flags & OUTBOX_FLAG_RETAIN) ? true : false;
+      pmsg->id          = OUTBOX_ID(pob->headSeq, pob->headOffset);
+      return VSCP_ERROR_SUCCESS;
+    }
+
+    // Damaged, skip it
+    ESP_LOGW(TAG, "Outbox record with bad CRC skipped");
+    pob->stats.nCorrupt++;
+    outbox_mark(pob, pob->headSector, pob->headOffset, OUTBOX_STATE_SENT);
+    pob->nPending--;
+    outbox_find_head(pob, pob->headSector, pob->headOffset + recLen);
+  }
+
+  return VSCP_ERROR_RCV_EMPTY;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_pop
+//
+
+int
+outbox_pop(outbox_t *pob, uint32_t id)
+{
+  outbox_record_hdr_t rec;
+  uint16_t recLen;
+  int rv;
+
+  if (NULL == pob) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (!pob->nPending || (id != OUTBOX_ID(pob->headSeq, pob->headOffset))) {
+    return VSCP_ERROR_UNKNOWN_ITEM;
+  }
+
+  if (OUTBOX_REC_OK != outbox_read_record(pob, pob->headSector, pob->headOffset, &rec, &recLen)) {
+    return VSCP_ERROR_UNKNOWN_ITEM;
+  }
+
+  if (VSCP_ERROR_SUCCESS != (rv = outbox_mark(pob, pob->headSector, pob->headOffset, OUTBOX_STATE_SENT))) {
+    return rv;
+  }
+
+  pob->nPending--;
+  pob->stats.nDrained++;
+  outbox_find_head(pob, pob->headSector, pob->headOffset + recLen);
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// outbox_count
+//
+
+uint32_t
+outbox_count(const outbox_t *pob)
+{
+  return (NULL == pob) ? 0 : pob->nPending;
+}
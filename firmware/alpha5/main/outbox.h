@@ -0,0 +1,172 @@
+/*
+  File: outbox.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Flash backed store and forward outbox for MQTT messages
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_OUTBOX__
+#define __VSCP_OUTBOX__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_partition.h>
+
+/*
+  MQTT messages that can not be published are kept in a flash partition
+  until they can. The partition is a ring of sectors written as a log.
+
+    sector  [header: magic, sequence number][record][record]...[erased]
+    record  [state][length, topic length, flags][crc][topic][payload]
+
+  Records are only appended. A record is written with its state erased
+  and made valid by writing the state last, so a record cut short by a
+  power loss is never used. Sending a record clears more bits of the
+  state. Nothing is erased until the sector is needed again, so each
+  sector is erased once per turn of the ring and wear is spread evenly.
+
+  When the ring is full the oldest sector is reused and the messages
+  in it that were not sent are dropped (and counted). The outbox is
+  rebuilt from flash when opened, so messages survive a restart.
+*/
+
+#define OUTBOX_SECTOR_SIZE     4096
+#define OUTBOX_SECTOR_HDR_LEN  16
+#define OUTBOX_RECORD_HDR_LEN  12
+
+// Largest topic plus payload of one message
+#define OUTBOX_MAX_BODY (OUTBOX_SECTOR_SIZE - OUTBOX_SECTOR_HDR_LEN - OUTBOX_RECORD_HDR_LEN)
+
+/**
+ * @brief Outbox statistics
+ */
+typedef struct {
+  uint32_t nStored;   // Messages written to flash
+  uint32_t nDrained;  // Messages taken out after being published
+  uint32_t nDropped;  // Messages lost to a full outbox
+  uint32_t nCorrupt;  // Records skipped because of a bad CRC
+  uint32_t nErased;   // Sectors erased
+  uint32_t nWriteErr; // Failed flash writes and erases
+} outbox_stats_t;
+
+/**
+ * @brief A message read from the outbox
+ */
+typedef struct {
+  const char *topic;      // Zero terminated, in the buffer given to outbox_peek
+  const uint8_t *payload; // In the buffer given to outbox_peek
+  uint16_t len;           // Payload length
+  uint8_t qos;
+  bool bRetain;
+  uint32_t id;            // Give to outbox_pop
+} outbox_msg_t;
+
+/**
+ * @brief Outbox state
+ *
+ * Not thread safe, the caller serializes access.
+ */
+typedef struct {
+  const esp_partition_t *part;
+  uint16_t nSectors;
+  uint16_t headSector; // Oldest message not sent
+  uint16_t headOffset;
+  uint32_t headSeq;
+  uint16_t tailSector; // Where the next message is written
+  uint16_t tailOffset;
+  uint32_t tailSeq;
+  uint32_t nPending;   // Messages not sent
+  outbox_stats_t stats;
+} outbox_t;
+
+/**
+ * @fn outbox_open
+ * @brief Open the outbox in a partition and find the stored messages
+ *
+ * @param pob Outbox
+ * @param part Partition, at least two sectors
+ * @return VSCP_ERROR_SUCCESS or error code
+ */
+
+int
+outbox_open(outbox_t *pob, const esp_partition_t *part);
+
+/**
+ * @fn outbox_append
+ * @brief Store a message
+ *
+ * @param pob Outbox
+ * @param topic Topic
+ * @param payload Payload
+ * @param len Payload length
+ * @param qos QoS to publish with
+ * @param bRetain Retain flag to publish with
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_PARAMETER if the message is too
+ *         large or VSCP_ERROR_ERROR if flash could not be written
+ */
+
+int
+outbox_append(outbox_t *pob, const char *topic, const uint8_t *payload, uint16_t len, uint8_t qos, bool bRetain);
+
+/**
+ * @fn outbox_peek
+ * @brief Read the oldest message that is not sent
+ *
+ * @param pob Outbox
+ * @param pmsg Filled in with the message
+ * @param buf Buffer for topic and payload
+ * @param size Size of buffer, OUTBOX_MAX_BODY + 1 always fits
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_RCV_EMPTY if there is none or
+ *         VSCP_ERROR_BUFFER_TO_SMALL
+ */
+
+int
+outbox_peek(outbox_t *pob, outbox_msg_t *pmsg, uint8_t *buf, size_t size);
+
+/**
+ * @fn outbox_pop
+ * @brief Mark a message read with outbox_peek as sent
+ *
+ * @param pob Outbox
+ * @param id Id of message
+ * @return VSCP_ERROR_SUCCESS, VSCP_ERROR_UNKNOWN_ITEM if the message was
+ *         dropped since it was read or VSCP_ERROR_ERROR if flash could not
+ *         be written (the message is then sent again)
+ */
+
+int
+outbox_pop(outbox_t *pob, uint32_t id);
+
+/**
+ * @fn outbox_count
+ * @brief Number of messages not sent
+ */
+
+uint32_t
+outbox_count(const outbox_t *pob);
+
+#endif
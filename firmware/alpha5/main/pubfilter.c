@@ -0,0 +1,447 @@
+/*
+  File: pubfilter.c
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Deadband and rate limiting of published measurements
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <vscp.h>
+#include <vscp-firmware-helper.h>
+
+#include "pubfilter.h"
+
+// Measurement classes with a value that can be read
+#define PUBFILTER_CLASS1_MEASUREMENT       10
+#define PUBFILTER_CLASS1_MEASUREMENT64     60
+#define PUBFILTER_CLASS1_MEASUREZONE       65
+#define PUBFILTER_CLASS1_MEASUREMENT32     70
+#define PUBFILTER_CLASS2_MEASUREMENT_STR   1040
+#define PUBFILTER_CLASS2_MEASUREMENT_FLOAT 1060
+
+// Level I events sent over level II, data starts with a 16 byte GUID
+#define PUBFILTER_CLASS2_LEVEL1_START 512
+#define PUBFILTER_CLASS2_LEVEL1_END   1023
+
+// Level I data coding, bits 7-5 of the coding byte
+#define PUBFILTER_CODING_STRING     2
+#define PUBFILTER_CODING_INTEGER    3
+#define PUBFILTER_CODING_NORMALIZED 4
+#define PUBFILTER_CODING_FLOAT      5
+
+// Longest string value read as a number
+#define PUBFILTER_MAX_NUMSTR 32
+
+#define PUBFILTER_FNV_OFFSET 2166136261u
+#define PUBFILTER_FNV_PRIME  16777619u
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_fnv
+//
+
+static uint32_t
+pubfilter_fnv(uint32_t hash, const uint8_t *p, size_t len)
+{
+  while (len--) {
+    hash = (hash ^ *p++) * PUBFILTER_FNV_PRIME;
+  }
+
+  return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_be
+//
+// Big endian unsigned integer of up to eight bytes
+//
+
+static uint64_t
+pubfilter_get_be(const uint8_t *p, uint8_t len)
+{
+  uint64_t v = 0;
+
+  while (len--) {
+    v = (v << 8) | *p++;
+  }
+
+  return v;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_int
+//
+// Big endian two's complement integer of one to eight bytes
+//
+
+static int64_t
+pubfilter_get_int(const uint8_t *p, uint8_t len)
+{
+  uint64_t v = pubfilter_get_be(p, len);
+
+  if ((len < 8) && (p[0] & 0x80)) {
+    v |= ~(uint64_t) 0 << (8 * len);
+  }
+
+  return (int64_t) v;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_float
+//
+
+static double
+pubfilter_get_float(const uint8_t *p)
+{
+  uint32_t v = (uint32_t) pubfilter_get_be(p, 4);
+  float f;
+
+  memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_double
+//
+
+static double
+pubfilter_get_double(const uint8_t *p)
+{
+  uint64_t v = pubfilter_get_be(p, 8);
+  double d;
+
+  memcpy(&d, &v, sizeof(d));
+  return d;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_string
+//
+// Numeric string, not zero terminated
+//
+
+static bool
+pubfilter_get_string(double *pvalue, const uint8_t *p, uint16_t len)
+{
+  char buf[PUBFILTER_MAX_NUMSTR];
+  char *pend;
+
+  if (!len || (len >= sizeof(buf))) {
+    return false;
+  }
+
+  memcpy(buf, p, len);
+  buf[len] = 0;
+  *pvalue  = strtod(buf, &pend);
+
+  return (pend != buf);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_coded
+//
+// Level I value, coding byte followed by data
+//
+
+static bool
+pubfilter_get_coded(double *pvalue, uint8_t *punit, const uint8_t *p, uint16_t len)
+{
+  int64_t v;
+  uint8_t exp;
+
+  if (len < 2) {
+    return false;
+  }
+
+  *punit = (p[0] >> 3) & 0x03;
+
+  switch (p[0] >> 5) {
+
+    case PUBFILTER_CODING_STRING:
+      return pubfilter_get_string(pvalue, p + 1, len - 1);
+
+    case PUBFILTER_CODING_INTEGER:
+      if (len > 9) {
+        return false;
+      }
+      *pvalue = (double) pubfilter_get_int(p + 1, len - 1);
+      return true;
+
+    case PUBFILTER_CODING_NORMALIZED:
+      if ((len < 3) || (len > 10)) {
+        return false;
+      }
+      v       = pubfilter_get_int(p + 2, len - 2);
+      *pvalue = (double) v;
+      // Bit 7 set moves the decimal point left
+      exp = p[1] & 0x7f;
+      while (exp--) {
+        *pvalue = (p[1] & 0x80) ? (*pvalue / 10) : (*pvalue * 10);
+      }
+      return true;
+
+    case PUBFILTER_CODING_FLOAT:
+      if (len < 5) {
+        return false;
+      }
+      *pvalue = pubfilter_get_float(p + 1);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_get_value
+//
+
+bool
+pubfilter_get_value(double *pvalue, uint8_t *punit, const vscpEvent *pev)
+{
+  const uint8_t *p;
+  uint16_t len;
+  uint16_t vscp_class;
+
+  if ((NULL == pvalue) || (NULL == punit) || (NULL == pev) || (NULL == pev->pdata)) {
+    return false;
+  }
+
+  p          = pev->pdata;
+  len        = pev->sizeData;
+  vscp_class = pev->vscp_class;
+  *punit     = 0;
+
+  if ((vscp_class >= PUBFILTER_CLASS2_LEVEL1_START) && (vscp_class <= PUBFILTER_CLASS2_LEVEL1_END)) {
+    if (len < 16) {
+      return false;
+    }
+    p += 16;
+    len -= 16;
+    vscp_class -= PUBFILTER_CLASS2_LEVEL1_START;
+  }
+
+  switch (vscp_class) {
+
+    case PUBFILTER_CLASS1_MEASUREMENT:
+      return pubfilter_get_coded(pvalue, punit, p, len);
+
+    case PUBFILTER_CLASS1_MEASUREZONE:
+      // Index, zone, subzone then coded value
+      return (len > 3) && pubfilter_get_coded(pvalue, punit, p + 3, len - 3);
+
+    case PUBFILTER_CLASS1_MEASUREMENT32:
+      if (len < 4) {
+        return false;
+      }
+      *pvalue = pubfilter_get_float(p);
+      return true;
+
+    case PUBFILTER_CLASS1_MEASUREMENT64:
+      if (len < 8) {
+        return false;
+      }
+      *pvalue = pubfilter_get_double(p);
+      return true;
+
+    case PUBFILTER_CLASS2_MEASUREMENT_STR:
+      // Index, unit, zone, subzone then string
+      if (len < 5) {
+        return false;
+      }
+      *punit = p[1];
+      return pubfilter_get_string(pvalue, p + 4, len - 4);
+
+    case PUBFILTER_CLASS2_MEASUREMENT_FLOAT:
+      // Index, unit, zone, subzone then double
+      if (len < 12) {
+        return false;
+      }
+      *punit  = p[1];
+      *pvalue = pubfilter_get_double(p + 4);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_init
+//
+
+void
+pubfilter_init(pubfilter_t *pf, pubfilter_entry_t *pentries, uint16_t nEntries)
+{
+  if (NULL == pf) {
+    return;
+  }
+
+  pf->pentries = pentries;
+  pf->nEntries = (NULL == pentries) ? 0 : nEntries;
+  pubfilter_clear(pf);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_clear
+//
+
+void
+pubfilter_clear(pubfilter_t *pf)
+{
+  if (NULL == pf) {
+    return;
+  }
+
+  if (pf->nEntries) {
+    memset(pf->pentries, 0, pf->nEntries * sizeof(pubfilter_entry_t));
+  }
+  memset(&pf->stats, 0, sizeof(pf->stats));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pubfilter_check
+//
+
+bool
+pubfilter_check(pubfilter_t *pf, const pubfilter_cfg_t *pcfg, const vscpEvent *pev, int64_t now)
+{
+  pubfilter_entry_t *pe      = NULL;
+  pubfilter_entry_t *pvictim = NULL;
+  uint32_t hash;
+  uint32_t dataHash = 0;
+  uint8_t sensorIndex;
+  uint8_t unit = 0;
+  double value = 0;
+  double diff;
+  bool bValue;
+
+  if ((NULL == pf) || (NULL == pcfg) || (NULL == pev) || !pf->nEntries) {
+    return true;
+  }
+
+  // Filter off
+  if ((0 == pcfg->deadband) && !pcfg->minInterval && !pcfg->maxAge) {
+    return true;
+  }
+
+  if (VSCP_ERROR_SUCCESS != vscp_fwhlp_isMeasurement(pev)) {
+    return true;
+  }
+
+  sensorIndex = vscp_fwhlp_getMeasurementSensorIndex(pev);
+
+  hash = pubfilter_fnv(PUBFILTER_FNV_OFFSET, pev->GUID, 16);
+  hash = pubfilter_fnv(hash, (const uint8_t *) &pev->vscp_class, sizeof(pev->vscp_class));
+  hash = pubfilter_fnv(hash, (const uint8_t *) &pev->vscp_type, sizeof(pev->vscp_type));
+  hash = pubfilter_fnv(hash, &sensorIndex, 1);
+  if (!hash) {
+    hash = 1; // Zero marks a free entry
+  }
+
+  // Find the stream. Remember a free entry, or else the one seen least
+  // recently, in case it is new.
+  for (uint16_t i = 0; i < pf->nEntries; i++) {
+    pubfilter_entry_t *p = &pf->pentries[i];
+    if (!p->hash) {
+      if ((NULL == pvictim) || pvictim->hash) {
+        pvictim = p;
+      }
+      continue;
+    }
+    if ((p->hash == hash) && (p->vscp_class == pev->vscp_class) && (p->vscp_type == pev->vscp_type) &&
+        (p->sensorIndex == sensorIndex) && !memcmp(p->guid, pev->GUID, 16)) {
+      pe = p;
+      break;
+    }
+    if ((NULL == pvictim) || (pvictim->hash && (p->lastSeen < pvictim->lastSeen))) {
+      pvictim = p;
+    }
+  }
+
+  bValue = pubfilter_get_value(&value, &unit, pev);
+  if (!bValue && (NULL != pev->pdata)) {
+    dataHash = pubfilter_fnv(PUBFILTER_FNV_OFFSET, pev->pdata, pev->sizeData);
+  }
+
+  // New stream
+  if (NULL == pe) {
+    if (pvictim->hash) {
+      pf->stats.nEvicted++;
+    }
+    pe              = pvictim;
+    pe->hash        = hash;
+    pe->vscp_class  = pev->vscp_class;
+    pe->vscp_type   = pev->vscp_type;
+    pe->sensorIndex = sensorIndex;
+    memcpy(pe->guid, pev->GUID, 16);
+    goto publish;
+  }
+
+  pe->lastSeen = now;
+
+  if (pcfg->maxAge && ((now - pe->lastPublish) >= pcfg->maxAge)) {
+    pf->stats.nForced++;
+    goto publish;
+  }
+
+  if (pcfg->minInterval && ((now - pe->lastPublish) < pcfg->minInterval)) {
+    goto suppress;
+  }
+
+  if (bValue != pe->bValue) {
+    goto publish;
+  }
+
+  if (bValue) {
+    // Written so that NaN counts as a change
+    diff = value - pe->value;
+    if ((unit != pe->unit) || !((diff <= pcfg->deadband) && (diff >= -pcfg->deadband))) {
+      goto publish;
+    }
+  }
+  else if (dataHash != pe->dataHash) {
+    goto publish;
+  }
+
+suppress:
+  pf->stats.nSuppressed++;
+  return false;
+
+publish:
+  pe->bValue      = bValue;
+  pe->value       = value;
+  pe->unit        = unit;
+  pe->dataHash    = dataHash;
+  pe->lastPublish = now;
+  pe->lastSeen    = now;
+  pf->stats.nPassed++;
+  return true;
+}
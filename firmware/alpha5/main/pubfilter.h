@@ -0,0 +1,163 @@
+/*
+  File: pubfilter.h
+
+  VSCP Wireless CAN4VSCP Gateway (VSCP-WCANG)
+
+  Deadband and rate limiting of published measurements
+
+  The MIT License (MIT)
+  Copyright © 2022-2023 Ake Hedman, the VSCP project <info@vscp.org>
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#ifndef __VSCP_PUBFILTER__
+#define __VSCP_PUBFILTER__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vscp.h>
+
+/*
+  Measurement events are published when they carry news. The filter
+  keeps one entry per measurement stream, keyed on event GUID, class,
+  type and sensor index, holding the last published value and time.
+
+  A measurement is published when
+
+    - it is the first seen for its stream, or
+    - maxAge has passed since the last publish (forced refresh), or
+    - minInterval has passed and the value moved more than the
+      deadband (or the unit changed, or for values that can not be
+      read as a number, the data changed).
+
+  Events that are not measurements always pass. All limits zero turns
+  the filter off. When the table is full the stream seen least
+  recently is reused, so at worst a stream is published one time too
+  many.
+*/
+
+/**
+ * @brief Filter limits
+ *
+ * Deadband is in the unit of the measurement. Times are microseconds,
+ * zero means no limit.
+ */
+typedef struct {
+  double deadband;     // Change needed to publish
+  int64_t minInterval; // Shortest time between two publishes of a stream
+  int64_t maxAge;      // Publish at least this often while a stream reports
+} pubfilter_cfg_t;
+
+/**
+ * @brief One measurement stream
+ */
+typedef struct {
+  uint32_t hash;        // Hash of the key, zero for a free entry
+  uint8_t guid[16];     // Key, event GUID
+  uint16_t vscp_class;  // Key, event class
+  uint16_t vscp_type;   // Key, event type
+  uint8_t sensorIndex;  // Key, sensor index
+  uint8_t unit;         // Unit of last published value
+  bool bValue;          // Last published data could be read as a number
+  double value;         // Last published value
+  uint32_t dataHash;    // Last published data when not a number
+  int64_t lastPublish;  // Time of last publish
+  int64_t lastSeen;     // Time of last event, for reuse of entries
+} pubfilter_entry_t;
+
+/**
+ * @brief Filter statistics
+ */
+typedef struct {
+  uint32_t nPassed;     // Measurements published
+  uint32_t nSuppressed; // Measurements held back
+  uint32_t nForced;     // Of nPassed, published because of maxAge
+  uint32_t nEvicted;    // Streams dropped from a full table
+} pubfilter_stats_t;
+
+/**
+ * @brief Filter state
+ *
+ * Used from one task only (the task that publishes).
+ */
+typedef struct {
+  pubfilter_entry_t *pentries;
+  uint16_t nEntries;
+  pubfilter_stats_t stats;
+} pubfilter_t;
+
+/**
+ * @fn pubfilter_init
+ * @brief Initialize a filter with a caller owned table
+ *
+ * @param pf Filter
+ * @param pentries Table storage
+ * @param nEntries Number of entries in table
+ */
+
+void
+pubfilter_init(pubfilter_t *pf, pubfilter_entry_t *pentries, uint16_t nEntries);
+
+/**
+ * @fn pubfilter_clear
+ * @brief Forget all streams. The next measurement of each is published.
+ *
+ * @param pf Filter
+ */
+
+void
+pubfilter_clear(pubfilter_t *pf);
+
+/**
+ * @fn pubfilter_check
+ * @brief Decide if an event should be published
+ *
+ * Updates the stream of the event when it should.
+ *
+ * @param pf Filter
+ * @param pcfg Limits
+ * @param pev Event
+ * @param now Current time in microseconds
+ * @return true if the event should be published
+ */
+
+bool
+pubfilter_check(pubfilter_t *pf, const pubfilter_cfg_t *pcfg, const vscpEvent *pev, int64_t now);
+
+/**
+ * @fn pubfilter_get_value
+ * @brief Read the value of a measurement event as a number
+ *
+ * Handles the level I data coding (integer, normalized integer and
+ * float) of CLASS1.MEASUREMENT and CLASS1.MEASUREZONE, the floats of
+ * CLASS1.MEASUREMENT32/64 and CLASS2.MEASUREMENT_FLOAT, and level I
+ * events sent over level II.
+ *
+ * @param pvalue Set to the value
+ * @param punit Set to the unit
+ * @param pev Event
+ * @return true if the value could be read
+ */
+
+bool
+pubfilter_get_value(double *pvalue, uint8_t *punit, const vscpEvent *pev);
+
+#endif
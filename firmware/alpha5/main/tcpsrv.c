@@ -57,12 +57,15 @@
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
 
+#include <fcntl.h>
 #include <string.h>
 #include <sys/param.h>
 
 #include "main.h"
 #include <vscp.h>
 
+#include "eventref.h"
+#include "linkbin.h"
 #include "tcpsrv.h"
 
 #define KEEPALIVE_IDLE                                                                                                 \
@@ -95,6 +98,26 @@ static uint8_t cntClients = 0; // Holds current number of clients
 */
 static vscpctx_t g_ctx[MAX_TCP_CONNECTIONS]; // Socket context
 
+/*
+  The server task sleeps in select. Queueing an event for a client in
+  receive loop mode sends a byte from s_wakeTx to s_wakeRx so it wakes
+  up without polling.
+*/
+static int s_wakeRx = -1;             // Wake socket, read by server task
+static int s_wakeTx = -1;             // Wake socket, written by event producers
+static struct sockaddr_in s_wakeAddr; // Loopback address of s_wakeRx
+
+// Events for one rcvloop write. Only used by the server task.
+static char s_batchBuf[PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE];
+
+#if PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE < (LINKBIN_BATCH_LEN + LINKBIN_FRAME_LEN(LINKBIN_MAX_DATA))
+#error "PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE must hold a binary frame with max data"
+#endif
+
+#if TCPSRV_OUT_BUF_SIZE < PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE
+#error "TCPSRV_OUT_BUF_SIZE must hold a full rcvloop write"
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // tcpsrv_setContextDefaults
 //
@@ -106,51 +129,238 @@ tcpsrv_setContextDefaults(vscpctx_t *pctx)
   pctx->bValidated        = 0;
   pctx->privLevel         = 0;
   pctx->bRcvLoop          = 0;
+  pctx->bBinary           = 0;
+  pctx->bsendLeft         = 0;
+  pctx->bsendFailed       = 0;
   pctx->size              = 0;
+  pctx->outLen            = 0;
   pctx->last_rcvloop_time = esp_timer_get_time();
+  pctx->coalesce_start    = 0;
   memset(pctx->buf, 0, TCPIP_BUF_MAX_SIZE);
   memset(pctx->user, 0, VSCP_LINK_MAX_USER_NAME_LENGTH);
   // Filter: All events received
   memset(&pctx->filter, 0, sizeof(vscpEventFilter));
+  tcpsrv_compileFilter(pctx);
   memset(&pctx->statistics, 0, sizeof(VSCPStatistics));
   memset(&pctx->status, 0, sizeof(VSCPStatus));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_compileFilter
+//
+
+void
+tcpsrv_compileFilter(vscpctx_t *pctx)
+{
+  tcpsrv_filter_t rxfilter;
+  const vscpEventFilter *pf = &pctx->filter;
+
+  rxfilter.mask_class     = pf->mask_class;
+  rxfilter.value_class    = pf->filter_class & pf->mask_class;
+  rxfilter.mask_type      = pf->mask_type;
+  rxfilter.value_type     = pf->filter_type & pf->mask_type;
+  rxfilter.mask_priority  = pf->mask_priority;
+  rxfilter.value_priority = pf->filter_priority & pf->mask_priority;
+  rxfilter.bGuid          = 0;
+  for (int i = 0; i < 16; i++) {
+    rxfilter.mask_GUID[i]  = pf->mask_GUID[i];
+    rxfilter.value_GUID[i] = pf->filter_GUID[i] & pf->mask_GUID[i];
+    if (pf->mask_GUID[i]) {
+      rxfilter.bGuid = 1;
+    }
+  }
+  rxfilter.bAll = !rxfilter.bGuid && !rxfilter.mask_class && !rxfilter.mask_type && !rxfilter.mask_priority;
+
+  // The fan out keeps reading the one in use while the other is written
+  int idx             = !atomic_load(&pctx->rxfilterIdx);
+  pctx->rxfilter[idx] = rxfilter;
+  atomic_store(&pctx->rxfilterIdx, idx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_takeEvent
+//
+
+eventref_t *
+tcpsrv_takeEvent(vscpctx_t *pctx)
+{
+  eventref_t *pref = pctx->prefHeld;
+
+  if (NULL != pref) {
+    pctx->prefHeld = NULL;
+    return pref;
+  }
+
+  if ((NULL == pctx->ring.slots) || !eventring_pop(&pctx->ring, (void **) &pref)) {
+    return NULL;
+  }
+
+  return pref;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_countEvents
+//
+
+uint16_t
+tcpsrv_countEvents(vscpctx_t *pctx)
+{
+  if (NULL == pctx->ring.slots) {
+    return 0;
+  }
+
+  return eventring_count(&pctx->ring) + ((NULL != pctx->prefHeld) ? 1 : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_clearEvents
+//
+
+void
+tcpsrv_clearEvents(vscpctx_t *pctx)
+{
+  eventref_t *pref;
+
+  while (NULL != (pref = tcpsrv_takeEvent(pctx))) {
+    eventref_put(pref);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_filter_match
+//
+// True if an event passes the compiled filter of a client.
+//
+
+static inline bool
+tcpsrv_filter_match(const tcpsrv_filter_t *pf, const vscpEvent *pev)
+{
+  if (pf->bAll) {
+    return true;
+  }
+
+  if (((pev->vscp_class & pf->mask_class) != pf->value_class) ||
+      ((pev->vscp_type & pf->mask_type) != pf->value_type) ||
+      ((((pev->head >> 5) & 0x07) & pf->mask_priority) != pf->value_priority)) {
+    return false;
+  }
+
+  if (pf->bGuid) {
+    for (int i = 0; i < 16; i++) {
+      if ((pev->GUID[i] & pf->mask_GUID[i]) != pf->value_GUID[i]) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_wake
+//
+// Make the server loop leave select. A byte is sent to the wake socket
+// on the loopback interface. Wakes that come before the server runs are
+// handled as one.
+//
+
+static void
+tcpsrv_wake(void)
+{
+  if (s_wakeTx >= 0) {
+    sendto(s_wakeTx, "", 1, MSG_DONTWAIT, (struct sockaddr *) &s_wakeAddr, sizeof(s_wakeAddr));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_wake_init
+//
+
+static int
+tcpsrv_wake_init(void)
+{
+  socklen_t len = sizeof(s_wakeAddr);
+
+  memset(&s_wakeAddr, 0, sizeof(s_wakeAddr));
+  s_wakeAddr.sin_family      = AF_INET;
+  s_wakeAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  s_wakeAddr.sin_port        = 0; // Any free port
+
+  s_wakeRx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if ((s_wakeRx < 0) || bind(s_wakeRx, (struct sockaddr *) &s_wakeAddr, sizeof(s_wakeAddr)) ||
+      getsockname(s_wakeRx, (struct sockaddr *) &s_wakeAddr, &len)) {
+    ESP_LOGE(TAG, "Unable to create wake socket: errno %d", errno);
+    return VSCP_ERROR_ERROR;
+  }
+
+  s_wakeTx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (s_wakeTx < 0) {
+    ESP_LOGE(TAG, "Unable to create wake socket: errno %d", errno);
+    return VSCP_ERROR_ERROR;
+  }
+
+  return VSCP_ERROR_SUCCESS;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // tcpsrv_sendEventExToAllClients
 //
+// The event is stored once and queued by reference to every client
+// whose filter it passes. It is not stored at all if no client wants it.
+// A full client queue doesn't stop delivery to the other clients. This
+// is the only producer for the client rings.
+//
 
 int
 tcpsrv_sendEventExToAllClients(const vscpEvent *pev)
 {
+  int rv           = VSCP_ERROR_SUCCESS;
+  bool bWake       = false;
+  eventref_t *pref = NULL;
+  eventref_t *pdropped;
+
   for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
-    if (g_ctx[i].sock && (NULL != g_ctx[i].queueClient)) {
-      vscpEvent *pnew = vscp_fwhlp_mkEventCopy(pev);
-      if (NULL == pnew) {
-        vscp_fwhlp_deleteEvent(&pnew);
-        ESP_LOGE(TAG, "Unable to allocate memory for event for client %d", i);
-        return VSCP_ERROR_MEMORY;
-      }
-      else {
-        if (pdTRUE == xSemaphoreTake(g_ctx[i].mutexQueue, 10 / portTICK_PERIOD_MS)) {
-          if (pdTRUE != xQueueSend(g_ctx[i].queueClient, &(pev), 0)) {
-            xSemaphoreGive(g_ctx[i].mutexQueue);
-            vscp_fwhlp_deleteEvent(&pnew);
-            g_ctx[i].statistics.cntOverruns++;
-            ESP_LOGI(TAG, "Queue is full for client %d", i);
-            return VSCP_ERROR_TRM_FULL; // yes, receive queue, but transmit for sender
-          }
-          xSemaphoreGive(g_ctx[i].mutexQueue);
-        }
-        else {
-          ESP_LOGI(TAG, "Mutex timeout for client %d", i);
-          return VSCP_ERROR_TIMEOUT;
-        }
-      }
+
+    vscpctx_t *pctx = &g_ctx[i];
+    if (!pctx->sock || (NULL == pctx->ring.slots)) {
+      continue;
+    }
+
+    if (!tcpsrv_filter_match(&pctx->rxfilter[atomic_load(&pctx->rxfilterIdx)], pev)) {
+      continue;
+    }
+
+    // Stored on first use so nothing is allocated if no client wants it
+    if ((NULL == pref) && (NULL == (pref = eventref_new(pev)))) {
+      ESP_LOGE(TAG, "Unable to allocate memory for event");
+      return VSCP_ERROR_MEMORY;
+    }
+
+    eventref_get(pref);
+    if (eventring_push(&pctx->ring, pref, (void **) &pdropped)) {
+      bWake |= pctx->bRcvLoop;
+    }
+    else {
+      rv = VSCP_ERROR_TRM_FULL; // yes, receive queue, but transmit for sender
+    }
+
+    // Full ring, the new or the oldest event is dropped
+    if (NULL != pdropped) {
+      eventref_put(pdropped);
+      pctx->statistics.cntOverruns++;
+      ESP_LOGD(TAG, "Queue is full for client %d", i);
     }
   }
 
-  return VSCP_ERROR_SUCCESS;
+  // Queued references keep the event
+  eventref_put(pref);
+
+  // Clients in receive loop mode are fed by the server task
+  if (bWake) {
+    tcpsrv_wake();
+  }
+
+  return rv;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -190,147 +400,464 @@ tcpsrv_sendEventExToAllClients(const vscpEvent *pev)
 // }
 
 ///////////////////////////////////////////////////////////////////////////////
-// client_task
+// client_open
+//
+// Take a free context for an accepted socket and greet the client.
+//
+
+static int
+client_open(int sock)
+{
+  for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
+    if (!g_ctx[i].sock) {
+      vscpctx_t *pctx = &g_ctx[i];
+
+      // Events that raced the close of the last client
+      tcpsrv_clearEvents(pctx);
+
+      pctx->sock = sock;
+
+      // Mark transport channel as open
+      g_tr_tcpsrv[pctx->id].open = true;
+
+      ESP_LOGI(TAG, "Client socket=%d id=%d", pctx->sock, pctx->id);
+
+      // Greet client
+      vscp_link_callback_welcome(pctx);
+
+      // Another client
+      cntClients++;
+      return VSCP_ERROR_SUCCESS;
+    }
+  }
+
+  return VSCP_ERROR_TRM_FULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// client_close
+//
+// Free the context of a client. The socket may already have been closed
+// by the "quit" command.
 //
 
 static void
-client_task(void *pvParameters)
+client_close(vscpctx_t *pctx)
 {
-  int rv;
-  size_t len;
-  vscpctx_t *pctx = (vscpctx_t *) pvParameters;
+  // Mark transport channel as closed
+  g_tr_tcpsrv[pctx->id].open = false;
+
+  tcpsrv_clearEvents(pctx);
+
+  // Empty the queue
+  xQueueReset(g_tr_tcpsrv[pctx->id].msg_queue);
+
+  ESP_LOGI(TAG, "Closing down tcp/ip client");
 
-  // Mark transport channel as open
-  g_tr_tcpsrv[pctx->id].open = true;
+  // If not closed do it here
+  if (pctx->sock) {
+    shutdown(pctx->sock, 0);
+    close(pctx->sock);
+  }
+
+  tcpsrv_setContextDefaults(pctx);
+
+  cntClients--;
+  ESP_LOGI(TAG, "Number of clients %d.", cntClients);
+}
 
-  ESP_LOGI(TAG, "Client worker socket=%d id=%d", pctx->sock, pctx->id);
+///////////////////////////////////////////////////////////////////////////////
+// client_drop
+//
+// Close the socket of a client that failed. The context is freed by the
+// server task when it sees pctx->sock is zero.
+//
 
-  // Greet client
-  // send(pctx->sock, TCPSRV_WELCOME_MSG, sizeof(TCPSRV_WELCOME_MSG), 0);
-  vscp_link_callback_welcome(pctx);
+static void
+client_drop(vscpctx_t *pctx)
+{
+  shutdown(pctx->sock, 0);
+  close(pctx->sock);
+  pctx->sock   = 0;
+  pctx->outLen = 0;
+}
 
-  // Another client
-  cntClients++;
+///////////////////////////////////////////////////////////////////////////////
+// client_write
+//
+// Write what the socket takes without blocking. Returns the number of
+// bytes written or -1 if the connection failed.
+//
 
-  do {
-    len = (rv = recv(pctx->sock, pctx->buf + pctx->size, (sizeof(pctx->buf) - pctx->size) - 1, MSG_DONTWAIT));
-    if ((rv < 0)) {
-      // If nothing to read do idle work
-      if (errno == EAGAIN) {
-        // Handle rcvloop etc
-        vscp_link_idle_worker(pctx);
-        continue;
+static int
+client_write(vscpctx_t *pctx, const uint8_t *p, size_t len)
+{
+  size_t written = 0;
+
+  while (written < len) {
+    int rv = send(pctx->sock, p + written, len - written, MSG_DONTWAIT);
+    if (rv < 0) {
+      if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) {
+        break;
       }
-      ESP_LOGE(TAG, "Error occurred during receiving: rv=%d, errno=%d", rv, errno);
-      memset(pctx->buf, 0, sizeof(pctx->buf));
-      pctx->size = 0;
-      close(pctx->sock);
-      pctx->sock = 0;
-      break;
+      ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+      return -1;
+    }
+    written += rv;
+  }
+
+  return (int) written;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_send
+//
+
+bool
+tcpsrv_send(vscpctx_t *pctx, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *) buf;
+
+  if (!pctx->sock) {
+    return false;
+  }
+
+  // Kept output goes first
+  if (!pctx->outLen) {
+    int rv = client_write(pctx, p, len);
+    if (rv < 0) {
+      client_drop(pctx);
+      return false;
+    }
+    p += rv;
+    len -= rv;
+  }
+
+  if (len > (sizeof(pctx->out) - pctx->outLen)) {
+    ESP_LOGW(TAG, "Client %d doesn't read, disconnecting", pctx->id);
+    client_drop(pctx);
+    return false;
+  }
+
+  memcpy(pctx->out + pctx->outLen, p, len);
+  pctx->outLen += len;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// client_flush
+//
+// Write kept output when the socket can take more. Returns false if the
+// connection failed.
+//
+
+static bool
+client_flush(vscpctx_t *pctx)
+{
+  int rv = client_write(pctx, pctx->out, pctx->outLen);
+  if (rv < 0) {
+    client_drop(pctx);
+    return false;
+  }
+
+  memmove(pctx->out, pctx->out + rv, pctx->outLen - rv);
+  pctx->outLen -= rv;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// client_bsend
+//
+// Take the binary frames of a bsend batch from the start of the command
+// buffer and send the events. The client gets '+OK' when all frames of
+// the batch are handled. Returns false if the connection failed.
+//
+
+static bool
+client_bsend(vscpctx_t *pctx)
+{
+  uint8_t *buf = (uint8_t *) pctx->buf;
+  size_t pos   = 0;
+  size_t used;
+  vscpEvent ev;
+
+  while (pctx->bsendLeft && (pos < pctx->size)) {
+
+    // Batch starts with the number of frames
+    if (pctx->bsendLeft < 0) {
+      if ((pctx->size - pos) < LINKBIN_BATCH_LEN) {
+        break;
+      }
+      pctx->bsendLeft = linkbin_read_count(buf + pos);
+      pos += LINKBIN_BATCH_LEN;
+      continue;
     }
-    else if (rv == 0) {
-      close(pctx->sock);
-      pctx->sock = 0;
-      ESP_LOGW(TAG, "Connection closed");
+
+    int rv = linkbin_read_frame(&ev, buf + pos, pctx->size - pos, &used);
+    if (VSCP_ERROR_BUFFER_TO_SMALL == rv) {
       break;
     }
+    else if (VSCP_ERROR_SUCCESS != rv) {
+      // The next frame can't be found, drop what is buffered
+      ESP_LOGW(TAG, "Invalid binary frame from client %d", pctx->id);
+      memset(pctx->buf, 0, sizeof(pctx->buf));
+      pctx->size        = 0;
+      pctx->bsendLeft   = 0;
+      pctx->bsendFailed = 0;
+      return tcpsrv_send(pctx, MSG_BINARY_FRAME_ERROR, strlen(MSG_BINARY_FRAME_ERROR));
+    }
+
+    // Event data points into the buffer, it's copied on send
+    if (VSCP_ERROR_SUCCESS != vscp_link_callback_send(pctx, &ev)) {
+      pctx->bsendFailed++;
+    }
+
+    pos += used;
+    pctx->bsendLeft--;
+  }
+
+  memmove(pctx->buf, pctx->buf + pos, (pctx->size - pos) + 1);
+  pctx->size -= pos;
+
+  if (pctx->bsendLeft) {
+    return true;
+  }
+
+  const char *msg   = pctx->bsendFailed ? MSG_BINARY_SEND_ERROR : VSCP_LINK_MSG_OK;
+  pctx->bsendFailed = 0;
+  return tcpsrv_send(pctx, msg, strlen(msg));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// client_read
+//
+// Read what the client has sent and run the commands in it. Returns
+// false when the connection is gone.
+//
+
+static bool
+client_read(vscpctx_t *pctx)
+{
+  int rv = recv(pctx->sock, pctx->buf + pctx->size, (sizeof(pctx->buf) - pctx->size) - 1, MSG_DONTWAIT);
+  if (rv < 0) {
+    if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) {
+      return true;
+    }
+    ESP_LOGE(TAG, "Error occurred during receiving: rv=%d, errno=%d", rv, errno);
+    return false;
+  }
+  else if (0 == rv) {
+    ESP_LOGW(TAG, "Connection closed");
+    return false;
+  }
+
+  pctx->size += rv;
+  pctx->buf[pctx->size] = 0;
+
+  // Frames of a bsend batch come before any further command
+  if (pctx->bsendLeft && !client_bsend(pctx)) {
+    return false;
+  }
+  if (pctx->bsendLeft || !pctx->size) {
+    return true;
+  }
+
+  // Parse VSCP command
+  char *pnext = NULL;
+  if (VSCP_ERROR_SUCCESS == vscp_link_parser(pctx, pctx->buf, &pnext)) {
+
+    // Binary frames can follow the command so strlen can't be used
+    size_t used = (NULL != pnext) ? (size_t) (pnext - pctx->buf) : pctx->size;
+    if (used < pctx->size) {
+      memmove(pctx->buf, pnext, (pctx->size - used) + 1);
+      pctx->size -= used;
+    }
     else {
+      memset(pctx->buf, 0, sizeof(pctx->buf));
+      pctx->size = 0;
+    }
+  }
+  else if (1 <= (sizeof(pctx->buf) - pctx->size)) {
+    *pctx->buf = 0;
+    pctx->size = 0;
+  }
 
-      pctx->size += len;
-      pctx->buf[pctx->size + 1] = 0;
+  // The frames of a bsend can come in the same read as the command
+  if (pctx->sock && pctx->bsendLeft && pctx->size && !client_bsend(pctx)) {
+    return false;
+  }
 
-      // Parse VSCP command
-      char *pnext = NULL;
-      if (VSCP_ERROR_SUCCESS == vscp_link_parser(pctx, pctx->buf, &pnext)) {
+  // If socket gets closed ("quit" command)
+  // pctx->sock is zero
+  return (0 != pctx->sock);
+}
 
-        if ((NULL != pnext) && *pnext) {
-          // printf("Copy [%s]\n", pnext);
-          strncpy(pctx->buf, pnext, sizeof(pctx->buf));
-          pctx->size = strlen(pctx->buf);
-        }
-        else {
-          memset(pctx->buf, 0, sizeof(pctx->buf));
-          pctx->size = 0;
-        }
-      }
-      else if (1 <= (sizeof(pctx->buf) - pctx->size)) {
-        // printf("Full buffer without crlf\n");
-        *pctx->buf = 0;
-        pctx->size = 0;
-      }
+///////////////////////////////////////////////////////////////////////////////
+// client_batch
+//
+// Write up to PRJDEF_VSCP_LINK_RCVLOOP_BATCH queued events to a client
+// with one send, as text lines or as a batch of binary frames. Events are
+// formatted straight from the shared reference so nothing is copied.
+// Returns the number of events written or -1 if the connection failed.
+// An event too large for the text buffer is left first in the queue.
+//
 
-      // printf("post len %d\n", pctx->size);
+static int
+client_batch(vscpctx_t *pctx, bool bBinary)
+{
+  int cnt    = 0;
+  size_t len = bBinary ? LINKBIN_BATCH_LEN : 0; // Frame count goes first
+  eventref_t *pref;
 
-      // If socket gets closed ("quit" command)
-      // pctx->sock is zero
-      if (!pctx->sock) {
+  while ((cnt < PRJDEF_VSCP_LINK_RCVLOOP_BATCH) && (NULL != (pref = tcpsrv_takeEvent(pctx)))) {
+
+    // An event that doesn't fit is held and goes first next time
+    if (bBinary) {
+      size_t n = linkbin_write_frame((uint8_t *) s_batchBuf + len, sizeof(s_batchBuf) - len, &pref->ev);
+      if (!n) {
+        pctx->prefHeld = pref;
+        break;
+      }
+      len += n;
+    }
+    else {
+      // Room for at least one character and the line end
+      if (((sizeof(s_batchBuf) - len) < 4) ||
+          (VSCP_ERROR_SUCCESS != vscp_fwhlp_eventToString(s_batchBuf + len, sizeof(s_batchBuf) - len - 2, &pref->ev))) {
+        pctx->prefHeld = pref;
         break;
       }
+      len += strlen(s_batchBuf + len);
+      s_batchBuf[len++] = '\r';
+      s_batchBuf[len++] = '\n';
+    }
 
-      // Get event from out fifo to feed to
-      // protocol handler etc
-      // vscpEvent *pev = NULL;
-      // if (pdTRUE == xSemaphoreTake(pctx->mutexQueue, (TickType_t) 10/ portTICK_PERIOD_MS)) {
-      //   if (pdTRUE != xQueueReceive(pctx->queueClient, &pev, 0)) {
-      //     pev = NULL;
-      //   }
-      //   xSemaphoreGive(pctx->mutexQueue);
-      // }
-      // else {
-      //   ESP_LOGW(TAG, "Unable to get mutex for client queue for client %d", pctx->id);
-      // }
-
-      // pev is NULL if no event is available here
-      // The worker is still called.
-      // if pev != NULL the worker is responsible for
-      // freeing the event
-
-      // Do protocol work here
-      // if (NULL != pev) {
-      //  vscp2_do_work(pev);
-      //}
-
-      // Handle rcvloop etc
-      vscp_link_idle_worker(pctx);
-    }
-  } while (pctx->sock);
+    // Update receive statistics
+    pctx->statistics.cntReceiveFrames++;
+    pctx->statistics.cntReceiveData += pref->ev.sizeData;
 
-  // Mark transport channel as closed
-  g_tr_tcpsrv[pctx->id].open = false;
+    eventref_put(pref);
+    cnt++;
+  }
 
-  vscpEvent *pev;
-  if (pdTRUE == xSemaphoreTake(pctx->mutexQueue, 5000 / portTICK_PERIOD_MS)) {
+  if (!cnt) {
+    return 0;
+  }
 
-    while (pdTRUE == xQueueReceive(pctx->queueClient, &(pev), 0)) {
-      vscp_fwhlp_deleteEvent(&pev);
-    }
-    xSemaphoreGive(pctx->mutexQueue);
+  if (bBinary) {
+    linkbin_write_count((uint8_t *) s_batchBuf, cnt);
   }
-  else {
-    ESP_LOGE(TAG, "Could not empty input queue on close (mutex)");
+
+  if (!tcpsrv_send(pctx, s_batchBuf, len)) {
+    return -1;
   }
 
-  // Empty the queue
-  xQueueReset(g_tr_tcpsrv[pctx->id].msg_queue);
+  return cnt;
+}
 
-  ESP_LOGI(TAG, "Closing down tcp/ip client");
+///////////////////////////////////////////////////////////////////////////////
+// tcpsrv_binaryRetrieve
+//
 
-  // If not closed do it here
-  if (pctx->sock) {
-    shutdown(pctx->sock, 0);
-    close(pctx->sock);
+int
+tcpsrv_binaryRetrieve(vscpctx_t *pctx)
+{
+  uint8_t end[LINKBIN_BATCH_LEN] = { 0 };
+  int total                      = 0;
+  int rv                         = 0;
+
+  // Events queued while writing, or that the client is too slow to
+  // take now, are left for the next bretr
+  while ((total < CLIENT_QUEUE_SIZE) && !pctx->outLen && ((rv = client_batch(pctx, true)) > 0)) {
+    total += rv;
   }
 
-  tcpsrv_setContextDefaults(pctx);
+  if ((rv < 0) || !tcpsrv_send(pctx, end, sizeof(end))) {
+    return VSCP_ERROR_ERROR;
+  }
 
-  cntClients--;
-  ESP_LOGI(TAG, "Number of clients %d.", cntClients);
-  vTaskDelete(NULL);
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// client_work
+//
+// Feed queued events to a client in receive loop mode. Events are held
+// for up to PRJDEF_VSCP_LINK_RCVLOOP_COALESCE_MS so they can be written
+// together. The link code sends the '+OK' keep alive and events that
+// don't fit in a batch. Binary (brcvloop) clients get a batch with no
+// frames as keep alive instead. Returns microseconds until events held
+// for the client are due, -1 if none are held.
+//
+
+static int64_t
+client_work(vscpctx_t *pctx)
+{
+  // Events wait in the queue until the client has taken what was written
+  if (pctx->outLen) {
+    return -1;
+  }
+
+  if (pctx->bRcvLoop) {
+
+    uint16_t nQueued = tcpsrv_countEvents(pctx);
+
+#if PRJDEF_VSCP_LINK_RCVLOOP_COALESCE_MS
+    if (!nQueued) {
+      pctx->coalesce_start = 0;
+    }
+    else if (nQueued < PRJDEF_VSCP_LINK_RCVLOOP_BATCH) {
+      int64_t now = esp_timer_get_time();
+      if (!pctx->coalesce_start) {
+        pctx->coalesce_start = now;
+      }
+      int64_t left = (pctx->coalesce_start + PRJDEF_VSCP_LINK_RCVLOOP_COALESCE_MS * 1000) - now;
+      if (left > 0) {
+        return left;
+      }
+    }
+#endif
+
+    while (nQueued && !pctx->outLen) {
+      int rv = client_batch(pctx, pctx->bBinary);
+      if (rv < 0) {
+        return -1;
+      }
+      if (0 == rv) {
+        break;
+      }
+      nQueued = tcpsrv_countEvents(pctx);
+    }
+
+    pctx->coalesce_start = 0;
+
+    if (pctx->bBinary) {
+      if ((esp_timer_get_time() - pctx->last_rcvloop_time) > 1000000l) {
+        uint8_t keepalive[LINKBIN_BATCH_LEN] = { 0 };
+        pctx->last_rcvloop_time              = esp_timer_get_time();
+        tcpsrv_send(pctx, keepalive, sizeof(keepalive));
+      }
+      return -1;
+    }
+  }
+
+  int cnt = CLIENT_QUEUE_SIZE;
+  do {
+    vscp_link_idle_worker(pctx);
+  } while (pctx->sock && !pctx->outLen && pctx->bRcvLoop && tcpsrv_countEvents(pctx) && --cnt);
+
+  return -1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // tcpsrv_task
 //
+// One task serves all clients. It sleeps in select until a client has
+// sent something, a client can take kept output, a new client connects
+// or an event is queued for a client in receive loop mode. Client
+// sockets never block so a client that doesn't read can't stall the
+// others.
+//
 
 void
 tcpsrv_task(void *pvParameters)
@@ -343,22 +870,16 @@ tcpsrv_task(void *pvParameters)
   int keepInterval = KEEPALIVE_INTERVAL;
   int keepCount    = KEEPALIVE_COUNT;
   struct sockaddr_storage dest_addr;
-  vscpEvent *pev;
-
-  // g_mutexQueueDroplet = xSemaphoreCreateMutex();
-
-  // Initialize the input fifo
-  // g_queueDroplet = xQueueCreate(DROPLET_QUEUE_SIZE, sizeof(pev));
 
   for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
-    g_ctx[i].id         = i;
-    g_ctx[i].sock       = 0;
-    g_ctx[i].mutexQueue = xSemaphoreCreateMutex();
-    if (NULL == g_ctx[i].mutexQueue) {
-      ESP_LOGE(TAG, "Failed to create mutex for client queue for client %d", i);
-    }
-    g_ctx[i].queueClient = xQueueCreate(CLIENT_QUEUE_SIZE, sizeof(pev));
-    if (NULL == g_ctx[i].queueClient) {
+    g_ctx[i].id       = i;
+    g_ctx[i].sock     = 0;
+    g_ctx[i].prefHeld = NULL;
+    atomic_init(&g_ctx[i].rxfilterIdx, 0);
+    if (VSCP_ERROR_SUCCESS != eventring_init(&g_ctx[i].ring,
+                                             CLIENT_QUEUE_SIZE,
+                                             PRJDEF_VSCP_LINK_QUEUE_DROP_OLDEST ? EVENTRING_DROP_OLDEST
+                                                                                : EVENTRING_DROP_NEWEST)) {
       ESP_LOGE(TAG, "Failed to create client queue for client %d", i);
     }
     tcpsrv_setContextDefaults(&g_ctx[i]);
@@ -409,14 +930,88 @@ tcpsrv_task(void *pvParameters)
     goto CLEAN_UP;
   }
 
-  int sock;
+  if (VSCP_ERROR_SUCCESS != tcpsrv_wake_init()) {
+    goto CLEAN_UP;
+  }
+
+  ESP_LOGI(TAG, "Socket listening");
+
+  int64_t wait = -1; // Held events are due (us), -1 if none
+
   while (1) {
 
-    ESP_LOGI(TAG, "Socket listening");
+    fd_set readset;
+    fd_set writeset;
+    int maxfd     = MAX(listen_sock, s_wakeRx);
+    bool bRcvLoop = false;
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+    FD_SET(listen_sock, &readset);
+    FD_SET(s_wakeRx, &readset);
+    for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
+      if (g_ctx[i].sock) {
+        FD_SET(g_ctx[i].sock, &readset);
+        if (g_ctx[i].outLen) {
+          FD_SET(g_ctx[i].sock, &writeset);
+        }
+        maxfd = MAX(maxfd, g_ctx[i].sock);
+        bRcvLoop |= g_ctx[i].bRcvLoop;
+      }
+    }
+
+    // Clients in receive loop mode get '+OK' every second
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    if (bRcvLoop && (wait >= 0) && (wait < 1000000)) {
+      tv.tv_sec  = 0;
+      tv.tv_usec = wait;
+    }
+    int n = select(maxfd + 1, &readset, &writeset, NULL, bRcvLoop ? &tv : NULL);
+    if (n < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      ESP_LOGE(TAG, "select failed: errno %d", errno);
+      break;
+    }
+
+    // Queued events are handled below for all clients
+    if (FD_ISSET(s_wakeRx, &readset)) {
+      char dummy[16];
+      while (recv(s_wakeRx, dummy, sizeof(dummy), MSG_DONTWAIT) > 0)
+        ;
+    }
+
+    wait = -1;
+    for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
+      vscpctx_t *pctx = &g_ctx[i];
+      if (!pctx->sock) {
+        continue;
+      }
+      if (FD_ISSET(pctx->sock, &writeset) && !client_flush(pctx)) {
+        client_close(pctx);
+        continue;
+      }
+      if (FD_ISSET(pctx->sock, &readset) && !client_read(pctx)) {
+        client_close(pctx);
+        continue;
+      }
+      int64_t due = client_work(pctx);
+      if ((due >= 0) && ((wait < 0) || (due < wait))) {
+        wait = due;
+      }
+      if (!pctx->sock) {
+        client_close(pctx);
+      }
+    }
+
+    if (!FD_ISSET(listen_sock, &readset)) {
+      continue;
+    }
 
     struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
     socklen_t addr_len = sizeof(source_addr);
-    sock               = accept(listen_sock, (struct sockaddr *) &source_addr, &addr_len);
+    int sock           = accept(listen_sock, (struct sockaddr *) &source_addr, &addr_len);
     if (sock < 0) {
       ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
       break;
@@ -428,6 +1023,15 @@ tcpsrv_task(void *pvParameters)
     setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
     setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
 
+#if PRJDEF_VSCP_LINK_TCP_NODELAY
+    // Events are batched by the server, don't let Nagle hold them back
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(int));
+#endif
+
+    // A client that doesn't read must not stall the others
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
     // Convert ip address to string
     if (source_addr.ss_family == PF_INET) {
       inet_ntoa_r(((struct sockaddr_in *) &source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
@@ -438,25 +1042,14 @@ tcpsrv_task(void *pvParameters)
 
     ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
 
-    if (cntClients >= MAX_TCP_CONNECTIONS) {
+    if (VSCP_ERROR_SUCCESS != client_open(sock)) {
       ESP_LOGW(TAG, "Max number of clients %d. Closing connection", cntClients);
       send(sock, MSG_MAX_CLIENTS, sizeof(MSG_MAX_CLIENTS), 0);
       close(sock);
-      continue;
-    }
-
-    // Start tgask
-    for (int i = 0; i < MAX_TCP_CONNECTIONS; i++) {
-      if (!g_ctx[i].sock) {
-        g_ctx[i].sock = sock;
-        // Create VSCP Link tcp/ip client task
-        xTaskCreate(client_task, "link-client", 8 * 1024, (void *) &g_ctx[i], 5, NULL);
-        break;
-      }
     }
   }
 
 CLEAN_UP:
   close(listen_sock);
   vTaskDelete(NULL);
-}
\ No newline at end of file
+}
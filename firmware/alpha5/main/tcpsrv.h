@@ -39,9 +39,19 @@
 #include <vscp-link-protocol.h>
 #include <vscp-firmware-level2.h>
 
+#include "eventref.h"
+#include "eventring.h"
+
 // Buffer
 #define TCPIP_BUF_MAX_SIZE (1024 * 3)
 
+/**
+ * Output a client has not taken yet. Client sockets don't block, what
+ * the socket doesn't accept is kept here and written when it can take
+ * more. A client that lets it fill up is disconnected.
+ */
+#define TCPSRV_OUT_BUF_SIZE (1024 * 2)
+
 /**
  * VSCP TCP link protocol character buffer size
  */
@@ -57,9 +67,29 @@
 
 /**
  * Max number of events in each of the transmit queues
- * (Events to Droplet from VSCP link client)
+ * (Events to Droplet from VSCP link client).
+ * Must be a power of two.
  */
-#define CLIENT_QUEUE_SIZE 4
+#define CLIENT_QUEUE_SIZE 16
+
+/*
+  Receive filter of a client compiled from its vscpEventFilter. It is
+  checked before an event is stored and queued for the client so events
+  the client doesn't want cost nothing. Same match as
+  vscp_fwhlp_doLevel2Filter.
+*/
+typedef struct _tcpsrv_filter {
+  int bAll;                  // Nothing is masked, every event passes
+  int bGuid;                 // Some GUID bits are masked
+  uint16_t mask_class;       // Class bits that must match
+  uint16_t value_class;      // Class bits, filter & mask
+  uint16_t mask_type;        // Type bits that must match
+  uint16_t value_type;       // Type bits, filter & mask
+  uint8_t mask_priority;     // Priority bits that must match
+  uint8_t value_priority;    // Priority bits, filter & mask
+  uint8_t mask_GUID[16];     // GUID bits that must match
+  uint8_t value_GUID[16];    // GUID bits, filter & mask
+} tcpsrv_filter_t;
 
 /*
   Socket context
@@ -70,20 +100,31 @@ typedef struct _vscpctx {
   int sock;                                  // Socket
   size_t size;                               // Number of characters in buffer
   char buf[TCPIP_BUF_MAX_SIZE];              // Command Buffer
+  uint8_t out[TCPSRV_OUT_BUF_SIZE];          // Output the socket has not taken yet
+  size_t outLen;                             // Number of bytes in out
   char user[VSCP_LINK_MAX_USER_NAME_LENGTH]; // Username storage
-  SemaphoreHandle_t mutexQueue;              // Protect the queue
-  QueueHandle_t queueClient;                 // VSCP events to VSCP link client
+  eventring_t ring;                          // VSCP events (eventref_t *) to VSCP link client
+  eventref_t *prefHeld;                      // Taken from ring but not written yet, goes first
   int bValidated;                            // User is validated
   uint8_t privLevel;                         // User privilege level 0-15
   int bRcvLoop;                              // Receive loop is enabled if non zero
+  int bBinary;                               // Receive loop writes binary frames (brcvloop)
+  int bsendLeft;                             // Frames left of a bsend batch, -1 count not read yet
+  int bsendFailed;                           // Events of the bsend batch that could not be sent
   vscpEventFilter filter;                    // Filter for events
+  tcpsrv_filter_t rxfilter[2];               // Compiled filter, checked on fan out
+  atomic_int rxfilterIdx;                    // rxfilter in use, the other one is written
   VSCPStatistics statistics;                 // VSCP Statistics
   VSCPStatus status;                         // VSCP status
-  uint32_t last_rcvloop_time;                // Time of last received event
+  int64_t last_rcvloop_time;                 // Time of last received event
+  int64_t coalesce_start;                    // Time (us) events started to be held, zero if none
 } vscpctx_t;
 
 #define MSG_MAX_CLIENTS "Max number of clients reached. Disconnecting.\r\n"
 
+#define MSG_BINARY_FRAME_ERROR "-OK - Invalid binary frame\r\n"
+#define MSG_BINARY_SEND_ERROR  "-OK - Failed to send binary event(s)\r\n"
+
 /**
  * @brief Set defaults for the Context Defaults object
  *
@@ -92,15 +133,93 @@ typedef struct _vscpctx {
 void
 tcpsrv_setContextDefaults(vscpctx_t *pctx);
 
+/**
+ * @fn tcpsrv_send
+ * @brief Write to a client without blocking
+ *
+ * What the socket doesn't take is kept and written by the server task
+ * when the client reads. If that doesn't fit or the connection failed
+ * the socket is closed and pctx->sock set to zero.
+ *
+ * @param pctx Pointer to context
+ * @param buf Data to write
+ * @param len Number of bytes to write
+ * @return true if all was written or kept, false if the client is gone.
+ */
+bool
+tcpsrv_send(vscpctx_t *pctx, const void *buf, size_t len);
+
+/**
+ * @fn tcpsrv_compileFilter
+ * @brief Compile the filter and mask of a client for use on fan out
+ *
+ * Must be called after pctx->filter is changed.
+ *
+ * @param pctx Pointer to context
+ */
+void
+tcpsrv_compileFilter(vscpctx_t *pctx);
+
+/**
+ * @fn tcpsrv_takeEvent
+ * @brief Take the next event queued for a client
+ *
+ * Must be called from the server task. The caller owns the reference.
+ *
+ * @param pctx Pointer to context
+ * @return Event reference or NULL if none is queued.
+ */
+eventref_t *
+tcpsrv_takeEvent(vscpctx_t *pctx);
+
+/**
+ * @fn tcpsrv_countEvents
+ * @brief Number of events queued for a client
+ *
+ * @param pctx Pointer to context
+ * @return Number of events
+ */
+uint16_t
+tcpsrv_countEvents(vscpctx_t *pctx);
+
+/**
+ * @fn tcpsrv_clearEvents
+ * @brief Drop all events queued for a client
+ *
+ * Must be called from the server task.
+ *
+ * @param pctx Pointer to context
+ */
+void
+tcpsrv_clearEvents(vscpctx_t *pctx);
+
 /**
  * @fn tcpsrv_sendEventExToAllClients
  * @brief Send event ex to all active clients
+ *
+ * The event is copied once and shared by the clients whose filter it
+ * passes. pev can be a view on memory that is not kept after the call.
+ *
  * @param pev Pointer to event to send
- * @return VSCP_EVENT_SUCCESS if all web OK. Error code otherwise.
+ * @return VSCP_EVENT_SUCCESS if all web OK. Error code otherwise. Clients
+ *         with room in their queue get the event even if another fails.
  */
 int
 tcpsrv_sendEventExToAllClients(const vscpEvent *pev);
 
+/**
+ * @fn tcpsrv_binaryRetrieve
+ * @brief Write all queued events to a client as binary frames (bretr)
+ *
+ * Events are written in batches followed by a batch with no frames.
+ * Must be called from the server task.
+ *
+ * @param pctx Pointer to context
+ * @return VSCP_ERROR_SUCCESS if all was written. Error code otherwise.
+ */
+int
+tcpsrv_binaryRetrieve(vscpctx_t *pctx);
+
 /*!
   VSCP tcp/ip link protocol task
   @param pvParameters Task parameters
@@ -175,6 +175,61 @@
  */
 #define PRJDEF_VSCP_LINK_ENABLE_RCVLOOP_CMD (1)
 
+/**
+ * Max number of queued events written to a client in
+ * rcvloop mode with one send. Clients can have at most
+ * CLIENT_QUEUE_SIZE events queued.
+ */
+#define PRJDEF_VSCP_LINK_RCVLOOP_BATCH (8)
+
+/**
+ * Buffer for the events of one rcvloop write. An event
+ * that doesn't fit on its own is written by the link code.
+ */
+#define PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE (1024)
+
+/**
+ * Milliseconds to hold events in rcvloop mode so more
+ * of them go in one write. Events are written at once
+ * when a full batch is queued. Zero writes at once.
+ */
+#define PRJDEF_VSCP_LINK_RCVLOOP_COALESCE_MS (0)
+
+/**
+ * Set TCP_NODELAY on client sockets so writes are not
+ * held back by Nagle's algorithm. Batching replaces it.
+ */
+#define PRJDEF_VSCP_LINK_TCP_NODELAY (1)
+
+/**
+ * What to drop when the event queue of a client is
+ * full. Non zero drops the oldest queued event to make
+ * room, zero drops the new event.
+ */
+#define PRJDEF_VSCP_LINK_QUEUE_DROP_OLDEST (0)
+
+/**
+ * Measurement streams (GUID, class, type, sensor index)
+ * tracked by the MQTT publish deadband filter. About
+ * 64 bytes each.
+ */
+#define PRJDEF_MQTT_PUBFILTER_SIZE (64)
+
+/**
+ * Label of the flash partition MQTT messages are kept
+ * in while the broker can not be reached. Without it
+ * such messages are lost.
+ */
+#define PRJDEF_MQTT_OUTBOX_PARTITION "outbox"
+
+/**
+ * Messages stored while the broker was away are
+ * published in batches of this many after a
+ * reconnect, with a pause between batches.
+ */
+#define PRJDEF_MQTT_OUTBOX_DRAIN_BATCH    (16)
+#define PRJDEF_MQTT_OUTBOX_DRAIN_INTERVAL (100) // ms
+
 
 /*!
   Name of device for level II capabilities announcement event.
@@ -309,8 +364,10 @@
 /**
  * @brief Maximum number of simultanonus TCP/IP connections
  * This is the maximum simultaneous number
- * of connections to the server
+ * of connections to the server. A connection only costs
+ * its context as all clients are served from tcpsrv_task.
+ * Each uses one lwIP socket (CONFIG_LWIP_MAX_SOCKETS).
  */
-#define MAX_TCP_CONNECTIONS 2
+#define MAX_TCP_CONNECTIONS 4
 
 #endif // _VSCP_PROJDEFS_H_
\ No newline at end of file
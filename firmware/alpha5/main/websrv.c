@@ -28,6 +28,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
@@ -60,6 +61,8 @@
 
 #include "websrv.h"
 #include "main.h"
+#include "mqtt.h"
+#include "mqttfmt.h"
 
 #ifdef CONFIG_EXAMPLE_PROV_TRANSPORT_BLE
 #include <wifi_provisioning/scheme_ble.h>
@@ -73,7 +76,6 @@
 // #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
 // External from main
-extern nvs_handle_t g_nvsHandle;
 extern node_persistent_config_t g_persistent;
 extern esp_netif_t *g_netif;
 extern vprintf_like_t g_stdLogFunc;
@@ -1601,12 +1603,6 @@ do_config_module_get_handler(httpd_req_t *req)
         VSCP_FREE(pdecoded);
 
         setAccessPointParameters();
-
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "node_name", g_persistent.nodeName);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update node name");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting node_name => rv=%d", rv);
@@ -1618,11 +1614,8 @@ do_config_module_get_handler(httpd_req_t *req)
         memset(g_persistent.pmk, 0, 32);
         vscp_fwhlp_hex2bin(g_persistent.pmk, 32, param);
 
-        // Write changed value to persistent storage
-        rv = nvs_set_blob(g_nvsHandle, "pmk", g_persistent.pmk, sizeof(g_persistent.pmk));
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to write node pmk to nvs. rv=%d", rv);
-        }
+        // Droplet keeps the key expanded
+        droplet_set_pmk(g_persistent.pmk);
       }
       else {
         ESP_LOGE(TAG, "Error getting node_name => rv=%d", rv);
@@ -1632,11 +1625,6 @@ do_config_module_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "strtdly", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => strtdly=%s", param);
         g_persistent.startDelay = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u8(g_nvsHandle, "start_delay", g_persistent.startDelay);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update start delay");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting strtdly => rv=%d", rv);
@@ -1651,21 +1639,16 @@ do_config_module_get_handler(httpd_req_t *req)
         if (VSCP_ERROR_SUCCESS != vscp_fwhlp_parseGuid(g_persistent.nodeGuid, p, NULL)) {
           ESP_LOGE(TAG, "Failed to read GUID");
         }
-
-        // Write changed value to persistent storage
-        rv = nvs_set_blob(g_nvsHandle, "guid", g_persistent.nodeGuid, 16);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to write node GUID to nvs. rv=%d", rv);
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting guid => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
-      }
+      // Save the whole configuration in one go
+      writePersistentConfigs();
+
+      // The compiled publish topic has node name and GUID folded in
+      mqtt_compile_topic();
 
       VSCP_FREE(param);
     }
@@ -1891,11 +1874,6 @@ do_config_wifi_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => name=%s", pdecoded);
         strncpy(g_persistent.nodeName, pdecoded, 31);
         VSCP_FREE(pdecoded);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "node_name", g_persistent.nodeName);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update node name");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting node_name => rv=%d", rv);
@@ -1905,11 +1883,6 @@ do_config_wifi_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "strtdly", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => strtdly=%s", param);
         g_persistent.startDelay = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u8(g_nvsHandle, "start_delay", g_persistent.startDelay);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update start delay");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting strtdly => rv=%d", rv);
@@ -1924,21 +1897,16 @@ do_config_wifi_get_handler(httpd_req_t *req)
         if (VSCP_ERROR_SUCCESS != vscp_fwhlp_parseGuid(g_persistent.nodeGuid, p, NULL)) {
           ESP_LOGE(TAG, "Failed to read GUID");
         }
-
-        // Write changed value to persistent storage
-        rv = nvs_set_blob(g_nvsHandle, "guid", g_persistent.nodeGuid, 16);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to write node GUID to nvs. rv=%d", rv);
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting guid => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
-      }
+      // Save the whole configuration in one go
+      writePersistentConfigs();
+
+      // The compiled publish topic has node name and GUID folded in
+      mqtt_compile_topic();
 
       VSCP_FREE(param);
     }
@@ -2128,12 +2096,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
         g_persistent.dropletLongRange = false;
       }
 
-      // Write changed value to persistent storage
-      rv = nvs_set_u8(g_nvsHandle, "drop_lr", g_persistent.dropletLongRange);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update droplet long range");
-      }
-
       // Forward
       if (ESP_OK == (rv = httpd_query_key_value(buf, "fw", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => fw=%s", param);
@@ -2148,12 +2110,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
         g_persistent.dropletForwardEnable = false;
       }
 
-      // Write changed value to persistent storage
-      rv = nvs_set_u8(g_nvsHandle, "drop_fw", g_persistent.dropletForwardEnable);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update droplet forward");
-      }
-
       // Filter Adj. Channel
       if (ESP_OK == (rv = httpd_query_key_value(buf, "adjf", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => adjf=%s", param);
@@ -2168,12 +2124,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
         g_persistent.dropletFilterAdjacentChannel = false;
       }
 
-      // Write changed value to persistent storage
-      rv = nvs_set_u8(g_nvsHandle, "drop_filt", g_persistent.dropletFilterAdjacentChannel);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update droplet adj. freq. filter");
-      }
-
       // Allow switching channel on forward
       if (ESP_OK == (rv = httpd_query_key_value(buf, "swchf", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => swchf=%s", param);
@@ -2188,21 +2138,10 @@ do_config_droplet_get_handler(httpd_req_t *req)
         g_persistent.dropletForwardSwitchChannel = false;
       }
 
-      // Write changed value to persistent storage
-      rv = nvs_set_u8(g_nvsHandle, "drop_swchf", g_persistent.dropletForwardSwitchChannel);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update droplet adj. freq. filter");
-      }
-
       // channel
       if (ESP_OK == (rv = httpd_query_key_value(buf, "channel", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => channel=%s", param);
         g_persistent.dropletChannel = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u8(g_nvsHandle, "drop_ch", g_persistent.dropletChannel);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update droplet channel");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting droplet channel => rv=%d", rv);
@@ -2212,11 +2151,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "ttl", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => ttl=%s", param);
         g_persistent.dropletTtl = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u8(g_nvsHandle, "drop_ttl", g_persistent.dropletTtl);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update droplet ttl");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting droplet ttl => rv=%d", rv);
@@ -2226,11 +2160,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "qsize", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => qsize=%s", param);
         g_persistent.dropletSizeQueue = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u8(g_nvsHandle, "drop_qsize", g_persistent.dropletSizeQueue);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update droplet qsize");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting droplet queue size => rv=%d", rv);
@@ -2244,11 +2173,6 @@ do_config_droplet_get_handler(httpd_req_t *req)
         if (g_persistent.dropletFilterWeakSignal > 0) {
           g_persistent.dropletFilterWeakSignal *= -1;
         }
-        // Write changed value to persistent storage
-        rv = nvs_set_i8(g_nvsHandle, "drop_rssi", g_persistent.dropletFilterWeakSignal);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update droplet rssi");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting droplet rssi => rv=%d", rv);
@@ -2258,19 +2182,13 @@ do_config_droplet_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "enc", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => enc=%s", param);
         g_persistent.dropletEncryption = atoi(param);
-        rv                             = nvs_set_u8(g_nvsHandle, "drop_enc", g_persistent.dropletEncryption);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update droplet encryption");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting droplet enc => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
-      }
+      // Save the whole configuration in one go
+      writePersistentConfigs();
 
       VSCP_FREE(param);
     }
@@ -2406,11 +2324,6 @@ do_config_vscplink_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "url", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => url=%s", param);
         strncpy(g_persistent.vscplinkUrl, param, sizeof(g_persistent.vscplinkUrl) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "vscp_url", g_persistent.vscplinkUrl);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update VSCP link url");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting VSCP link URL => rv=%d", rv);
@@ -2420,11 +2333,6 @@ do_config_vscplink_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "port", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => port=%s", param);
         g_persistent.vscplinkPort = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u16(g_nvsHandle, "vscp_port", g_persistent.vscplinkPort);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update VSCP link port");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting VSCP link port => rv=%d", rv);
@@ -2440,11 +2348,6 @@ do_config_vscplink_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => user=%s", pdecoded);
         strncpy(g_persistent.vscplinkUsername, pdecoded, sizeof(g_persistent.vscplinkUsername) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "vscp_user", g_persistent.vscplinkUsername);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update VSCP link user");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting VSCP link username => rv=%d", rv);
@@ -2460,11 +2363,6 @@ do_config_vscplink_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => password=%s", pdecoded);
         strncpy(g_persistent.vscplinkPassword, pdecoded, sizeof(g_persistent.vscplinkPassword) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "vscp_password", g_persistent.vscplinkPassword);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update VSCP link password err=%02X", rv);
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting VSCP link password => rv=%d", rv);
@@ -2475,21 +2373,13 @@ do_config_vscplink_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => key=%s", param);
         memset(g_persistent.vscpLinkKey, 0, 32);
         vscp_fwhlp_hex2bin(g_persistent.vscpLinkKey, 32, param);
-
-        // Write changed value to persistent storage
-        rv = nvs_set_blob(g_nvsHandle, "vscp_key", g_persistent.vscpLinkKey, sizeof(g_persistent.vscpLinkKey));
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to write VSCP link key to nvs. rv=%d", rv);
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting VSCP link key => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
-      }
+      // Save the whole configuration in one go
+      writePersistentConfigs();
 
       VSCP_FREE(param);
     }
@@ -2573,6 +2463,37 @@ config_mqtt_get_handler(httpd_req_t *req)
   sprintf(buf, "Publish:<input type=\"text\" name=\"pub\" value=\"%s\" >", g_persistent.mqttPub);
   httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
 
+  sprintf(buf, "Payload format:<select  name=\"fmt\" >");
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  sprintf(buf,
+          "<option value=\"0\" %s>JSON</option>",
+          (MQTTFMT_FORMAT_JSON == g_persistent.mqttFormat) ? "selected" : "");
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  sprintf(buf,
+          "<option value=\"1\" %s>Binary frame</option>",
+          (MQTTFMT_FORMAT_BINARY == g_persistent.mqttFormat) ? "selected" : "");
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  sprintf(buf,
+          "<option value=\"2\" %s>CBOR</option>",
+          (MQTTFMT_FORMAT_CBOR == g_persistent.mqttFormat) ? "selected" : "");
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+  sprintf(buf, "</select>");
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+
+  sprintf(buf,
+          "Deadband:<input type=\"text\" name=\"db\" value=\"%lu.%03lu\" >",
+          (unsigned long) (g_persistent.mqttDeadband / 1000),
+          (unsigned long) (g_persistent.mqttDeadband % 1000));
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+
+  sprintf(buf,
+          "Min interval (s):<input type=\"text\" name=\"minint\" value=\"%d\" >",
+          g_persistent.mqttMinInterval);
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+
+  sprintf(buf, "Max age (s):<input type=\"text\" name=\"maxage\" value=\"%d\" >", g_persistent.mqttMaxAge);
+  httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
+
   sprintf(buf, "<button class=\"bgrn bgrn:hover\">Save</button></fieldset></form></div>");
   httpd_resp_send_chunk(req, buf, HTTPD_RESP_USE_STRLEN);
 
@@ -2633,11 +2554,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => url=%s", pdecoded);
         strncpy(g_persistent.mqttUrl, pdecoded, sizeof(g_persistent.mqttUrl) - 1);
         VSCP_FREE(pdecoded);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_url", g_persistent.mqttUrl);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT url");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT URL => rv=%d", rv);
@@ -2647,11 +2563,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "port", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => port=%s", param);
         g_persistent.mqttPort = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u16(g_nvsHandle, "mqtt_port", g_persistent.mqttPort);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT port");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT port => rv=%d", rv);
@@ -2667,11 +2578,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => clientid=%s", pdecoded);
         strncpy(g_persistent.mqttClientid, pdecoded, sizeof(g_persistent.mqttClientid) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_cid", g_persistent.mqttClientid);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT clientid");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT clientid => rv=%d", rv);
@@ -2687,11 +2593,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => user=%s", pdecoded);
         strncpy(g_persistent.mqttUsername, pdecoded, sizeof(g_persistent.mqttUsername) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_user", g_persistent.mqttUsername);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT user");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT user => rv=%d", rv);
@@ -2707,11 +2608,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => password=%s", pdecoded);
         strncpy(g_persistent.mqttPassword, pdecoded, sizeof(g_persistent.mqttPassword) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_password", g_persistent.mqttPassword);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT password");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT password => rv=%d", rv);
@@ -2728,11 +2624,6 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => sub=%s", pdecoded);
         strncpy(g_persistent.mqttSub, pdecoded, sizeof(g_persistent.mqttSub) - 1);
         VSCP_FREE(pdecoded);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_sub", g_persistent.mqttSub);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT sub");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT sub => rv=%d", rv);
@@ -2749,21 +2640,58 @@ do_config_mqtt_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => pub=%s", pdecoded);
         strncpy(g_persistent.mqttPub, pdecoded, sizeof(g_persistent.mqttPub) - 1);
         VSCP_FREE(pdecoded);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "mqtt_pub", g_persistent.mqttPub);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update MQTT pub");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting MQTT pub => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
+      // Payload format
+      if (ESP_OK == (rv = httpd_query_key_value(buf, "fmt", param, WEBPAGE_PARAM_SIZE))) {
+        ESP_LOGI(TAG, "Found query parameter => fmt=%s", param);
+        if ((atoi(param) >= 0) && (atoi(param) < MQTTFMT_FORMAT_COUNT)) {
+          g_persistent.mqttFormat = atoi(param);
+        }
+      }
+      else {
+        ESP_LOGE(TAG, "Error getting MQTT fmt => rv=%d", rv);
+      }
+
+      // Publish filter deadband, stored in 1/1000 of unit
+      if (ESP_OK == (rv = httpd_query_key_value(buf, "db", param, WEBPAGE_PARAM_SIZE))) {
+        ESP_LOGI(TAG, "Found query parameter => db=%s", param);
+        double deadband = strtod(param, NULL);
+        if ((deadband >= 0) && (deadband <= (UINT32_MAX / 1000))) {
+          g_persistent.mqttDeadband = (uint32_t) (deadband * 1000 + 0.5);
+        }
+      }
+      else {
+        ESP_LOGE(TAG, "Error getting MQTT db => rv=%d", rv);
+      }
+
+      // Publish filter min interval
+      if (ESP_OK == (rv = httpd_query_key_value(buf, "minint", param, WEBPAGE_PARAM_SIZE))) {
+        ESP_LOGI(TAG, "Found query parameter => minint=%s", param);
+        g_persistent.mqttMinInterval = atoi(param);
+      }
+      else {
+        ESP_LOGE(TAG, "Error getting MQTT minint => rv=%d", rv);
+      }
+
+      // Publish filter max age
+      if (ESP_OK == (rv = httpd_query_key_value(buf, "maxage", param, WEBPAGE_PARAM_SIZE))) {
+        ESP_LOGI(TAG, "Found query parameter => maxage=%s", param);
+        g_persistent.mqttMaxAge = atoi(param);
+      }
+      else {
+        ESP_LOGE(TAG, "Error getting MQTT maxage => rv=%d", rv);
       }
 
+      // Save the whole configuration in one go
+      writePersistentConfigs();
+
+      // Publish topic may have changed
+      mqtt_compile_topic();
+
       VSCP_FREE(param);
     }
 
@@ -2895,11 +2823,6 @@ do_config_web_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "port", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => port=%s", param);
         g_persistent.webPort = atoi(param);
-        // Write changed value to persistent storage
-        rv = nvs_set_u16(g_nvsHandle, "web_port", g_persistent.webPort);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update Web server port");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting Web server port => rv=%d", rv);
@@ -2915,11 +2838,6 @@ do_config_web_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => user=%s", pdecoded);
         strncpy(g_persistent.webUsername, pdecoded, sizeof(g_persistent.webUsername) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "web_user", g_persistent.webUsername);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update Web server user");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting Web server user => rv=%d", rv);
@@ -2935,20 +2853,13 @@ do_config_web_get_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found query parameter => password=%s", pdecoded);
         strncpy(g_persistent.webPassword, pdecoded, sizeof(g_persistent.webPassword) - 1);
-        // Write changed value to persistent storage
-        rv = nvs_set_str(g_nvsHandle, "web_password", g_persistent.webPassword);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update Web server password");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting Web server password => rv=%d", rv);
       }
 
-      rv = nvs_commit(g_nvsHandle);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to commit updates to nvs\n");
-      }
+      // Save the whole configuration in one go
+      writePersistentConfigs();
 
       VSCP_FREE(param);
     }
@@ -3110,20 +3021,10 @@ do_config_log_get_handler(httpd_req_t *req)
         g_persistent.logwrite2Stdout = 0;
       }
 
-      rv = nvs_set_u8(g_nvsHandle, "log_stdout", g_persistent.logwrite2Stdout);
-      if (rv != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to update log-stdout");
-      }
-
       // type
       if (ESP_OK == (rv = httpd_query_key_value(buf, "type", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => type=%s", param);
         g_persistent.logType = atoi(param);
-
-        rv = nvs_set_u8(g_nvsHandle, "log_type", g_persistent.logType);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update log type");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log type => rv=%d", rv);
@@ -3133,11 +3034,6 @@ do_config_log_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "level", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => level=%s", param);
         g_persistent.logLevel = atoi(param);
-
-        rv = nvs_set_u8(g_nvsHandle, "log_level", g_persistent.logLevel);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update log level");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log level => rv=%d", rv);
@@ -3147,11 +3043,6 @@ do_config_log_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "retries", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => retries=%s", param);
         g_persistent.logRetries = atoi(param);
-
-        rv = nvs_set_u8(g_nvsHandle, "log_retries", g_persistent.logRetries);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update log retries");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log retries => rv=%d", rv);
@@ -3161,11 +3052,6 @@ do_config_log_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "port", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => port=%s", param);
         g_persistent.logPort = atoi(param);
-
-        rv = nvs_set_u8(g_nvsHandle, "log_port", g_persistent.logPort);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to update log port");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log port => rv=%d", rv);
@@ -3175,11 +3061,6 @@ do_config_log_get_handler(httpd_req_t *req)
       if (ESP_OK == (rv = httpd_query_key_value(buf, "url", param, WEBPAGE_PARAM_SIZE))) {
         ESP_LOGI(TAG, "Found query parameter => url=%s", param);
         strncpy(g_persistent.logUrl, param, sizeof(g_persistent.logUrl));
-
-        rv = nvs_set_str(g_nvsHandle, "log_url", g_persistent.logUrl);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to save log URL");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log port => rv=%d", rv);
@@ -3196,16 +3077,14 @@ do_config_log_get_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Found query parameter => topic=%s", pdecoded);
         strncpy(g_persistent.logMqttTopic, pdecoded, sizeof(g_persistent.logMqttTopic));
         VSCP_FREE(pdecoded);
-
-        rv = nvs_set_str(g_nvsHandle, "log_mqtt_topic", g_persistent.logMqttTopic);
-        if (rv != ESP_OK) {
-          ESP_LOGE(TAG, "Failed to save log topic");
-        }
       }
       else {
         ESP_LOGE(TAG, "Error getting log topic => rv=%d", rv);
       }
 
+      // Save the whole configuration in one go
+      writePersistentConfigs();
+
       VSCP_FREE(param);
     }
 
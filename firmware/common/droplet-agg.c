@@ -0,0 +1,163 @@
+/**
+ * @brief           VSCP droplet frame aggregation
+ * @file            droplet-agg.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include <vscp.h>
+
+#include "droplet-agg.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_init
+//
+
+size_t
+droplet_agg_init(uint8_t *frame, uint8_t nodeType, uint8_t version)
+{
+  memset(frame, 0, DROPLET_POS_AGG_RECORDS);
+
+  frame[DROPLET_POS_ID]       = DROPLET_ID_MSB;
+  frame[DROPLET_POS_ID + 1]   = DROPLET_ID_LSB + version;
+  frame[DROPLET_POS_PKT_TYPE] = (nodeType << 4) | DROPLET_PKT_TYPE_AGGREGATE;
+
+  return DROPLET_POS_AGG_RECORDS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_add
+//
+
+int
+droplet_agg_add(uint8_t *frame, size_t *plen, size_t maxlen, const uint8_t *evframe, size_t evlen)
+{
+  vscpEvent ev;
+  size_t sizeRecord;
+
+  if ((NULL == frame) || (NULL == plen) || (NULL == evframe) || (evlen <= DROPLET_POS_HEAD) ||
+      DROPLET_IS_AGGREGATE(evframe)) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  // Event frame may use either header layout
+  uint8_t version = DROPLET_FRAME_VERSION(evframe);
+  if (0 == droplet_parseVscp(&ev, evframe + DROPLET_POS_HEAD, evlen - DROPLET_POS_HEAD, version)) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  if (maxlen > DROPLET_AGG_MAX_FRAME) {
+    maxlen = DROPLET_AGG_MAX_FRAME;
+  }
+
+  if ((*plen >= maxlen) || (0xff == frame[DROPLET_POS_AGG_COUNT])) {
+    return VSCP_ERROR_BUFFER_TO_SMALL;
+  }
+
+  // The record is the VSCP content of the event in the layout of the aggregate
+  sizeRecord = droplet_buildVscp(frame + *plen, maxlen - *plen, &ev, DROPLET_FRAME_VERSION(frame));
+  if (0 == sizeRecord) {
+    return VSCP_ERROR_BUFFER_TO_SMALL;
+  }
+
+  *plen += sizeRecord;
+  frame[DROPLET_POS_AGG_COUNT]++;
+  frame[DROPLET_POS_AGG_LEN] = (uint8_t) (*plen - DROPLET_POS_AGG_RECORDS);
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_finish
+//
+
+int
+droplet_agg_finish(uint8_t *frame, size_t *plen)
+{
+  int count = frame[DROPLET_POS_AGG_COUNT];
+
+  if (1 == count) {
+    memmove(frame + DROPLET_POS_HEAD, frame + DROPLET_POS_AGG_RECORDS, *plen - DROPLET_POS_AGG_RECORDS);
+    *plen -= DROPLET_POS_AGG_RECORDS - DROPLET_POS_HEAD;
+    frame[DROPLET_POS_PKT_TYPE] &= ~DROPLET_PKT_TYPE_AGGREGATE;
+  }
+
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_next
+//
+
+int
+droplet_agg_next(vscpEvent *pev, uint8_t *frame, size_t len, size_t *poffset, uint32_t timestamp)
+{
+  if ((NULL == pev) || (NULL == frame) || (NULL == poffset) || (len < DROPLET_POS_AGG_RECORDS)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  // Records end where the length byte says, frame may be padded after decryption
+  size_t end = DROPLET_POS_AGG_RECORDS + frame[DROPLET_POS_AGG_LEN];
+  if (end > len) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  size_t pos = DROPLET_POS_AGG_RECORDS + *poffset;
+  if (pos >= end) {
+    return VSCP_ERROR_RCV_EMPTY;
+  }
+
+  memset(pev, 0, sizeof(vscpEvent));
+
+  size_t sizeRecord = droplet_parseVscp(pev, frame + pos, end - pos, DROPLET_FRAME_VERSION(frame));
+  if (0 == sizeRecord) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  pev->timestamp = timestamp ? timestamp : (uint32_t) esp_timer_get_time();
+
+  *poffset += sizeRecord;
+
+  return VSCP_ERROR_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/**
+ * @brief           VSCP droplet frame aggregation
+ * @file            droplet-agg.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Packs several small events into one aggregate frame that shares the
+ * droplet header (and IV when encrypted) and unpacks them again on the
+ * receiving side. No task or global state so the same code is used by
+ * the stack and the host benchmark.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_AGG_H
+#define DROPLET_AGG_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// True if the frame is an aggregate frame
+#define DROPLET_IS_AGGREGATE(frame) ((frame)[DROPLET_POS_PKT_TYPE] & DROPLET_PKT_TYPE_AGGREGATE)
+
+/**
+ * @fn droplet_agg_init
+ * @brief Start a new, empty, aggregate frame
+ *
+ * Id and packet type are set. ttl and magic are left for the send path.
+ *
+ * @param frame Buffer for the aggregate frame. At least DROPLET_POS_AGG_RECORDS long.
+ * @param nodeType Node type put in the packet type byte
+ * @param version Header layout of the event records (DROPLET_VERSION or DROPLET_VERSION_COMPACT)
+ * @return size_t Length of the empty frame
+ */
+size_t
+droplet_agg_init(uint8_t *frame, uint8_t nodeType, uint8_t version);
+
+/**
+ * @fn droplet_agg_add
+ * @brief Append the event in a single event frame to an aggregate frame
+ *
+ * @param frame Aggregate frame
+ * @param plen Pointer to length of the aggregate frame. Updated.
+ * @param maxlen Longest the aggregate frame may be (at most DROPLET_AGG_MAX_FRAME)
+ * @param evframe Single event frame as built by droplet_evToFrame. Either header layout.
+ * @param evlen Length of the single event frame
+ * @return int VSCP_ERROR_SUCCESS if added, VSCP_ERROR_BUFFER_TO_SMALL if the
+ *         event doesn't fit (send the aggregate frame and start a new one),
+ *         VSCP_ERROR_PARAMETER if evframe is not a valid single event frame.
+ */
+int
+droplet_agg_add(uint8_t *frame, size_t *plen, size_t maxlen, const uint8_t *evframe, size_t evlen);
+
+/**
+ * @fn droplet_agg_finish
+ * @brief Make an aggregate frame ready for sending
+ *
+ * An aggregate frame with only one event is turned into a normal
+ * single event frame as that is two bytes shorter.
+ *
+ * @param frame Aggregate frame
+ * @param plen Pointer to length of the frame. Updated.
+ * @return int Number of events in the frame.
+ */
+int
+droplet_agg_finish(uint8_t *frame, size_t *plen);
+
+/**
+ * @fn droplet_agg_next
+ * @brief Get the next event from a received aggregate frame
+ *
+ * The event is a view on the frame, pdata points into the frame.
+ * Start with *poffset set to zero.
+ *
+ * @param pev Event to fill in
+ * @param frame Received (decrypted) aggregate frame
+ * @param len Length of frame. May include block padding.
+ * @param poffset Pointer to offset of next record. Updated.
+ * @param timestamp Timestamp for the event. Zero is now.
+ * @return int VSCP_ERROR_SUCCESS if an event was returned, VSCP_ERROR_RCV_EMPTY
+ *         when there are no more events and VSCP_ERROR_INVALID_FRAME if a record
+ *         is outside of the frame.
+ */
+int
+droplet_agg_next(vscpEvent *pev, uint8_t *frame, size_t len, size_t *poffset, uint32_t timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
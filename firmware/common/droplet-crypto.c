@@ -0,0 +1,297 @@
+/**
+ * @brief           VSCP droplet frame encryption
+ * @file            droplet-crypto.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Uses mbedtls AES which is hardware accelerated on the ESP32 and,
+ * unlike the firmware helper, can decrypt CBC in place.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+
+#include <mbedtls/aes.h>
+
+#include <vscp.h>
+
+#include "droplet-crypto.h"
+
+static const char *TAG = "droplet-crypto";
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_keybits
+//
+
+static unsigned int
+droplet_crypto_keybits(uint8_t nAlgorithm)
+{
+  switch (nAlgorithm) {
+    case VSCP_ENCRYPTION_AES128:
+      return 128;
+    case VSCP_ENCRYPTION_AES192:
+      return 192;
+    case VSCP_ENCRYPTION_AES256:
+      return 256;
+    default:
+      return 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_key_init
+//
+
+int
+droplet_crypto_key_init(droplet_crypto_key_t *pkey, const uint8_t *key)
+{
+  if ((NULL == pkey) || (NULL == key)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  // Re-keying
+  if (pkey->bValid) {
+    droplet_crypto_key_free(pkey);
+  }
+
+  memcpy(pkey->key, key, DROPLET_KEY_LEN);
+
+  for (int i = 0; i < DROPLET_CRYPTO_NUM_KEYSIZES; i++) {
+    unsigned int keybits = droplet_crypto_keybits(VSCP_ENCRYPTION_AES128 + i);
+    mbedtls_aes_init(&pkey->enc[i]);
+    mbedtls_aes_init(&pkey->dec[i]);
+    if ((0 != mbedtls_aes_setkey_enc(&pkey->enc[i], key, keybits)) ||
+        (0 != mbedtls_aes_setkey_dec(&pkey->dec[i], key, keybits))) {
+      ESP_LOGE(TAG, "Failed to expand %d bit key", keybits);
+      droplet_crypto_key_free(pkey);
+      return VSCP_ERROR_ERROR;
+    }
+  }
+
+  pkey->bValid = true;
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_key_free
+//
+
+void
+droplet_crypto_key_free(droplet_crypto_key_t *pkey)
+{
+  if (NULL == pkey) {
+    return;
+  }
+
+  for (int i = 0; i < DROPLET_CRYPTO_NUM_KEYSIZES; i++) {
+    mbedtls_aes_free(&pkey->enc[i]);
+    mbedtls_aes_free(&pkey->dec[i]);
+  }
+
+  memset(pkey->key, 0, DROPLET_KEY_LEN);
+  pkey->bValid = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_key_match
+//
+
+bool
+droplet_crypto_key_match(const droplet_crypto_key_t *pkey, const uint8_t *key)
+{
+  return (NULL != pkey) && (NULL != key) && pkey->bValid && !memcmp(pkey->key, key, DROPLET_KEY_LEN);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_encrypt_ctx
+//
+
+static size_t
+droplet_crypto_encrypt_ctx(uint8_t *out, const uint8_t *frame, size_t len, mbedtls_aes_context *pctx, const uint8_t *iv)
+{
+  uint8_t ivwork[DROPLET_IV_LEN];
+
+  // Encrypted part padded to a whole number of blocks
+  size_t enclen = ((len - DROPLET_POS_HEAD) + 15) & ~(size_t) 15;
+
+  // Header is sent in clear, rest is encrypted in the out buffer
+  if (out != frame) {
+    memcpy(out, frame, len);
+  }
+  memset(out + len, 0, DROPLET_POS_HEAD + enclen - len);
+
+  // IV goes after the encrypted data. mbedtls updates the IV it is given
+  // so work on a copy.
+  if (NULL != iv) {
+    memcpy(ivwork, iv, DROPLET_IV_LEN);
+  }
+  else {
+    esp_fill_random(ivwork, DROPLET_IV_LEN);
+  }
+  memcpy(out + DROPLET_POS_HEAD + enclen, ivwork, DROPLET_IV_LEN);
+
+  int rv = mbedtls_aes_crypt_cbc(pctx, MBEDTLS_AES_ENCRYPT, enclen, ivwork, out + DROPLET_POS_HEAD, out + DROPLET_POS_HEAD);
+  if (0 != rv) {
+    ESP_LOGE(TAG, "Failed to encrypt frame rv=%d", rv);
+    return 0;
+  }
+
+  return DROPLET_POS_HEAD + enclen + DROPLET_IV_LEN;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_decrypt_ctx
+//
+
+static size_t
+droplet_crypto_decrypt_ctx(uint8_t *frame, size_t len, mbedtls_aes_context *pctx)
+{
+  uint8_t iv[DROPLET_IV_LEN];
+
+  // Must hold at least one block and the IV and be block aligned
+  if ((len < (DROPLET_POS_HEAD + 16 + DROPLET_IV_LEN)) || ((len - DROPLET_POS_HEAD - DROPLET_IV_LEN) % 16)) {
+    ESP_LOGE(TAG, "Invalid encrypted frame length %d", (int) len);
+    return 0;
+  }
+
+  size_t enclen = len - DROPLET_POS_HEAD - DROPLET_IV_LEN;
+  memcpy(iv, frame + DROPLET_POS_HEAD + enclen, DROPLET_IV_LEN);
+
+  int rv = mbedtls_aes_crypt_cbc(pctx, MBEDTLS_AES_DECRYPT, enclen, iv, frame + DROPLET_POS_HEAD, frame + DROPLET_POS_HEAD);
+  if (0 != rv) {
+    ESP_LOGE(TAG, "Failed to decrypt frame rv=%d", rv);
+    return 0;
+  }
+
+  return DROPLET_POS_HEAD + enclen;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_encrypt
+//
+
+size_t
+droplet_crypto_encrypt(uint8_t *out,
+                       const uint8_t *frame,
+                       size_t len,
+                       const uint8_t *key,
+                       const uint8_t *iv,
+                       uint8_t nAlgorithm)
+{
+  unsigned int keybits = droplet_crypto_keybits(nAlgorithm);
+  size_t rv            = 0;
+
+  if ((NULL == out) || (NULL == frame) || (NULL == key) || !keybits || (len <= DROPLET_POS_HEAD)) {
+    ESP_LOGE(TAG, "Invalid encryption parameters");
+    return 0;
+  }
+
+  mbedtls_aes_context ctx;
+  mbedtls_aes_init(&ctx);
+  if (0 == mbedtls_aes_setkey_enc(&ctx, key, keybits)) {
+    rv = droplet_crypto_encrypt_ctx(out, frame, len, &ctx, iv);
+  }
+  mbedtls_aes_free(&ctx);
+
+  return rv;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_decrypt
+//
+
+size_t
+droplet_crypto_decrypt(uint8_t *frame, size_t len, const uint8_t *key, uint8_t nAlgorithm)
+{
+  unsigned int keybits = droplet_crypto_keybits(nAlgorithm);
+  size_t rv            = 0;
+
+  if ((NULL == frame) || (NULL == key) || !keybits) {
+    ESP_LOGE(TAG, "Invalid decryption parameters");
+    return 0;
+  }
+
+  mbedtls_aes_context ctx;
+  mbedtls_aes_init(&ctx);
+  if (0 == mbedtls_aes_setkey_dec(&ctx, key, keybits)) {
+    rv = droplet_crypto_decrypt_ctx(frame, len, &ctx);
+  }
+  mbedtls_aes_free(&ctx);
+
+  return rv;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_encrypt_key
+//
+
+size_t
+droplet_crypto_encrypt_key(uint8_t *out,
+                           const uint8_t *frame,
+                           size_t len,
+                           droplet_crypto_key_t *pkey,
+                           const uint8_t *iv,
+                           uint8_t nAlgorithm)
+{
+  if ((NULL == out) || (NULL == frame) || (NULL == pkey) || !pkey->bValid || !droplet_crypto_keybits(nAlgorithm) ||
+      (len <= DROPLET_POS_HEAD)) {
+    ESP_LOGE(TAG, "Invalid encryption parameters");
+    return 0;
+  }
+
+  return droplet_crypto_encrypt_ctx(out, frame, len, &pkey->enc[nAlgorithm - VSCP_ENCRYPTION_AES128], iv);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_crypto_decrypt_key
+//
+
+size_t
+droplet_crypto_decrypt_key(uint8_t *frame, size_t len, droplet_crypto_key_t *pkey, uint8_t nAlgorithm)
+{
+  if ((NULL == frame) || (NULL == pkey) || !pkey->bValid || !droplet_crypto_keybits(nAlgorithm)) {
+    ESP_LOGE(TAG, "Invalid decryption parameters");
+    return 0;
+  }
+
+  return droplet_crypto_decrypt_ctx(frame, len, &pkey->dec[nAlgorithm - VSCP_ENCRYPTION_AES128]);
+}
@@ -0,0 +1,189 @@
+/**
+ * @brief           VSCP droplet frame encryption
+ * @file            droplet-crypto.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * AES-CBC encryption of droplet frames that can work in place. The
+ * frame header up to DROPLET_POS_HEAD (id, packet type, ttl, magic) is
+ * sent in clear so that nodes can check ttl and the duplicate filter
+ * without a key. The rest of the frame is padded to the AES block size,
+ * encrypted and followed by the IV
+ *
+ *   | id | pkt-type | ttl | magic | encrypted head..data + padding | IV |
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_CRYPTO_H
+#define DROPLET_CRYPTO_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mbedtls/aes.h>
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Room needed after a frame for it to be encrypted in place (padding + IV)
+#define DROPLET_CRYPTO_HEADROOM (16 + DROPLET_IV_LEN)
+
+// Largest decrypted frame. Aggregate frames are the largest and are a whole number of blocks.
+#define DROPLET_CRYPTO_MAX_PLAIN DROPLET_AGG_MAX_FRAME
+
+// AES-128, AES-192 and AES-256
+#define DROPLET_CRYPTO_NUM_KEYSIZES 3
+
+/**
+ * @brief Expanded key
+ *
+ * Holds the encrypt and decrypt key schedules for all key sizes so they
+ * are expanded once and not for every frame. The 128 and 192 bit keys are
+ * the first 16 and 24 bytes of the key.
+ */
+typedef struct {
+  bool bValid;                                         // Schedules are set up
+  uint8_t key[DROPLET_KEY_LEN];                        // Key schedules are expanded from
+  mbedtls_aes_context enc[DROPLET_CRYPTO_NUM_KEYSIZES]; // Encrypt schedules
+  mbedtls_aes_context dec[DROPLET_CRYPTO_NUM_KEYSIZES]; // Decrypt schedules
+} droplet_crypto_key_t;
+
+/**
+ * @fn droplet_crypto_key_init
+ * @brief Expand a key for all key sizes
+ *
+ * Can be called again to change the key. Not thread safe against
+ * encryption/decryption with the same key object.
+ *
+ * @param pkey Pointer to key object
+ * @param key Key, DROPLET_KEY_LEN bytes
+ * @return int VSCP_ERROR_SUCCESS if all is OK
+ */
+int
+droplet_crypto_key_init(droplet_crypto_key_t *pkey, const uint8_t *key);
+
+/**
+ * @fn droplet_crypto_key_free
+ * @brief Free and clear a key object
+ *
+ * @param pkey Pointer to key object
+ */
+void
+droplet_crypto_key_free(droplet_crypto_key_t *pkey);
+
+/**
+ * @fn droplet_crypto_key_match
+ * @brief Check if a key object is expanded from a key
+ *
+ * @param pkey Pointer to key object
+ * @param key Key, DROPLET_KEY_LEN bytes
+ * @return true if key object is valid and expanded from key
+ */
+bool
+droplet_crypto_key_match(const droplet_crypto_key_t *pkey, const uint8_t *key);
+
+/**
+ * @fn droplet_crypto_encrypt
+ * @brief Encrypt a droplet frame
+ *
+ * @param out Buffer that get the encrypted frame. Can be the same as frame
+ *            to encrypt in place. Must have room for len + DROPLET_CRYPTO_HEADROOM
+ *            bytes.
+ * @param frame Frame to encrypt.
+ * @param len Length of frame. Anything longer than DROPLET_POS_HEAD, short
+ *            compact and fragment frames included. The encrypted part is
+ *            padded to whole blocks.
+ * @param key Key. 16, 24 or 32 bytes depending on algorithm.
+ * @param iv Initialization vector (DROPLET_IV_LEN bytes). Random if NULL.
+ * @param nAlgorithm VSCP_ENCRYPTION_AES128/AES192/AES256
+ * @return size_t Length of encrypted frame or zero on error.
+ */
+size_t
+droplet_crypto_encrypt(uint8_t *out,
+                       const uint8_t *frame,
+                       size_t len,
+                       const uint8_t *key,
+                       const uint8_t *iv,
+                       uint8_t nAlgorithm);
+
+/**
+ * @fn droplet_crypto_decrypt
+ * @brief Decrypt a droplet frame in place
+ *
+ * The decrypted frame may contain padding after the data. Use the size
+ * byte of the frame for the real data length.
+ *
+ * @param frame Encrypted frame. Get the decrypted frame.
+ * @param len Length of encrypted frame (including IV).
+ * @param key Key. 16, 24 or 32 bytes depending on algorithm.
+ * @param nAlgorithm VSCP_ENCRYPTION_AES128/AES192/AES256
+ * @return size_t Length of decrypted frame or zero on error.
+ */
+size_t
+droplet_crypto_decrypt(uint8_t *frame, size_t len, const uint8_t *key, uint8_t nAlgorithm);
+
+/**
+ * @fn droplet_crypto_encrypt_key
+ * @brief Encrypt a droplet frame with an expanded key
+ *
+ * Same as droplet_crypto_encrypt but uses the key schedule in pkey.
+ */
+size_t
+droplet_crypto_encrypt_key(uint8_t *out,
+                           const uint8_t *frame,
+                           size_t len,
+                           droplet_crypto_key_t *pkey,
+                           const uint8_t *iv,
+                           uint8_t nAlgorithm);
+
+/**
+ * @fn droplet_crypto_decrypt_key
+ * @brief Decrypt a droplet frame in place with an expanded key
+ *
+ * Same as droplet_crypto_decrypt but uses the key schedule in pkey.
+ */
+size_t
+droplet_crypto_decrypt_key(uint8_t *frame, size_t len, droplet_crypto_key_t *pkey, uint8_t nAlgorithm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,321 @@
+/**
+ * @brief           VSCP droplet ESP-NOW transport
+ * @file            droplet-espnow.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_check.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <esp_wifi_types.h>
+
+#include <vscp.h>
+
+#include "vscp-droplet.h"
+
+static const char *TAG = "droplet-espnow";
+
+typedef struct {
+  uint16_t frame_head;
+  uint16_t duration;
+  uint8_t destination_address[6];
+  uint8_t source_address[6];
+  uint8_t broadcast_address[6];
+  uint16_t sequence_control;
+
+  uint8_t category_code;
+  uint8_t organization_identifier[3]; // 0x18fe34
+  uint8_t random_values[4];
+  struct {
+    uint8_t element_id;                 // 0xdd
+    uint8_t lenght;                     //
+    uint8_t organization_identifier[3]; // 0x18fe34
+    uint8_t type;                       // 4
+    uint8_t version;
+    uint8_t body[0];
+  } vendor_specific_content;
+} __attribute__((packed)) espnow_frame_format_t;
+
+// ------------------------------------------------
+
+typedef struct {
+  unsigned frame_ctrl : 16;
+  unsigned duration_id : 16;
+  uint8_t addr1[6]; /* receiver address */
+  uint8_t addr2[6]; /* sender address */
+  uint8_t addr3[6]; /* filtering address */
+  unsigned sequence_ctrl : 16;
+  uint8_t addr4[6]; /* optional */
+} wifi_ieee80211_mac_hdr_t;
+
+typedef struct {
+  wifi_ieee80211_mac_hdr_t hdr;
+  uint8_t payload[0]; /* network data ended with 4 bytes csum (CRC32) */
+} wifi_ieee80211_packet_t;
+
+static wifi_country_t g_self_country = { 0 };
+
+///////////////////////////////////////////////////////////////////////////////
+// wifi_sniffer_packet_type2str
+//
+
+const char *
+wifi_sniffer_packet_type2str(wifi_promiscuous_pkt_type_t type)
+{
+  switch (type) {
+    case WIFI_PKT_MGMT:
+      return "MGMT";
+    case WIFI_PKT_DATA:
+      return "DATA";
+    default:
+    case WIFI_PKT_MISC:
+      return "MISC";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// promiscuous_rx_cb
+//
+
+void
+promiscuous_rx_cb(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+
+  /*! All espnow traffic uses action frames which are a subtype of the
+    mgmnt frames so filter out everything else.
+  */
+  if (type != WIFI_PKT_MGMT) {
+    return;
+  }
+
+  static const uint8_t ACTION_SUBTYPE  = 0xd0;
+  static const uint8_t ESPRESSIF_OUI[] = { 0x18, 0xfe, 0x34 };
+
+  const wifi_promiscuous_pkt_t *ppkt  = (wifi_promiscuous_pkt_t *) buf;
+  const wifi_ieee80211_packet_t *ipkt = (wifi_ieee80211_packet_t *) ppkt->payload;
+  const wifi_ieee80211_mac_hdr_t *hdr = &ipkt->hdr;
+
+  // Only continue processing if this is an action frame containing the Espressif OUI.
+  if ((ACTION_SUBTYPE == (hdr->frame_ctrl & 0xFF)) && (memcmp(hdr->addr4, ESPRESSIF_OUI, 3) == 0)) {
+    int rssi = ppkt->rx_ctrl.rssi;
+    printf("-------------------------------> %d", rssi);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_recv_cb
+//
+// Called in the WiFi task. Frame is handed over to the droplet core
+// which queue it for the droplet receive task.
+//
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
+static void
+espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len)
+{
+  if (recv_info == NULL || data == NULL || len <= 0) {
+    ESP_LOGE(TAG, "Receive cb arg error");
+    return;
+  }
+
+  droplet_transport_recv(recv_info->src_addr, recv_info->des_addr, recv_info->rx_ctrl, data, len);
+}
+#else
+static void
+espnow_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len)
+{
+  if (mac_addr == NULL || data == NULL || len <= 0) {
+    ESP_LOGE(TAG, "Receive cb arg error");
+    return;
+  }
+
+  wifi_promiscuous_pkt_t *promiscuous_pkt =
+    (wifi_promiscuous_pkt_t *) (data - sizeof(wifi_pkt_rx_ctrl_t) - sizeof(espnow_frame_format_t));
+
+  // Destination address is not available pre 5.0.1
+  droplet_transport_recv(mac_addr, NULL, &promiscuous_pkt->rx_ctrl, data, len);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_send_cb
+//
+// Called in the WiFi task.
+//
+
+static void
+espnow_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
+{
+  droplet_transport_send_cb(mac_addr, (ESP_NOW_SEND_SUCCESS == status));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_add_peer
+//
+
+static esp_err_t
+espnow_add_peer(const uint8_t *peer_addr, uint8_t channel)
+{
+  esp_now_peer_info_t *peer = VSCP_MALLOC(sizeof(esp_now_peer_info_t));
+  if (NULL == peer) {
+    ESP_LOGE(TAG, "Malloc peer information fail");
+    return ESP_ERR_NO_MEM;
+  }
+
+  memset(peer, 0, sizeof(esp_now_peer_info_t));
+  peer->channel = channel;
+  peer->ifidx   = PRJDEF_DROPLET_WIFI_IF;
+  peer->encrypt = false;
+  memcpy(peer->peer_addr, peer_addr, ESP_NOW_ETH_ALEN);
+
+  esp_err_t rv = esp_now_add_peer(peer);
+  VSCP_FREE(peer);
+
+  return rv;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_del_peer
+//
+
+static esp_err_t
+espnow_del_peer(const uint8_t *peer_addr)
+{
+  return esp_now_del_peer(peer_addr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_init
+//
+
+static esp_err_t
+espnow_init(const droplet_config_t *config)
+{
+  esp_err_t rv;
+
+  esp_wifi_set_promiscuous(true);
+  esp_wifi_set_promiscuous_rx_cb(&promiscuous_rx_cb);
+
+  ESP_ERROR_CHECK(esp_now_init());
+  ESP_ERROR_CHECK(esp_now_register_send_cb(espnow_send_cb));
+  ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_recv_cb));
+  ESP_ERROR_CHECK(esp_now_set_wake_window(65535));
+  ESP_ERROR_CHECK(esp_now_set_pmk(config->pmk));
+
+  esp_wifi_get_country(&g_self_country);
+
+  // Add broadcast peer information to peer list.
+  if (ESP_OK != (rv = espnow_add_peer(DROPLET_ADDR_BROADCAST, PRJDEF_DROPLET_CHANNEL))) {
+    ESP_LOGE(TAG, "Failed to add broadcast peer rv=%X", rv);
+    esp_now_deinit();
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_deinit
+//
+
+static esp_err_t
+espnow_deinit(void)
+{
+  esp_wifi_set_promiscuous(false);
+  return esp_now_deinit();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_send
+//
+
+static esp_err_t
+espnow_send(const uint8_t *dest_addr, const uint8_t *data, size_t len)
+{
+  return esp_now_send(dest_addr, data, len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_get_mac
+//
+
+static esp_err_t
+espnow_get_mac(uint8_t *mac)
+{
+  return esp_wifi_get_mac(ESP_IF_WIFI_STA, mac);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_get_channel
+//
+
+static esp_err_t
+espnow_get_channel(uint8_t *channel)
+{
+  wifi_second_chan_t second;
+  return esp_wifi_get_channel(channel, &second);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// espnow_set_channel
+//
+
+static esp_err_t
+espnow_set_channel(uint8_t channel)
+{
+  return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
+
+const droplet_transport_t g_droplet_transport_espnow = {
+  .name        = "esp-now",
+  .init        = espnow_init,
+  .deinit      = espnow_deinit,
+  .send        = espnow_send,
+  .add_peer    = espnow_add_peer,
+  .del_peer    = espnow_del_peer,
+  .get_mac     = espnow_get_mac,
+  .get_channel = espnow_get_channel,
+  .set_channel = espnow_set_channel,
+};
@@ -0,0 +1,233 @@
+/**
+ * @brief           VSCP droplet send flow control
+ * @file            droplet-flow.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vscp.h>
+
+#include "droplet-flow.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_init
+//
+
+int
+droplet_flow_init(droplet_flow_t *pflow, const droplet_flow_config_t *pconfig)
+{
+  if ((NULL == pflow) || (NULL == pconfig)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  if (!pconfig->minWindow || (pconfig->minWindow > pconfig->maxWindow) ||
+      (pconfig->maxWindow > DROPLET_FLOW_RING_SIZE)) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  memset(pflow, 0, sizeof(droplet_flow_t));
+  pflow->config = *pconfig;
+  atomic_init(&pflow->head, 0);
+  atomic_init(&pflow->tail, 0);
+  atomic_init(&pflow->window, pconfig->minWindow);
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_in_flight
+//
+
+uint32_t
+droplet_flow_in_flight(droplet_flow_t *pflow)
+{
+  return atomic_load(&pflow->head) - atomic_load(&pflow->tail);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_can_send
+//
+
+bool
+droplet_flow_can_send(droplet_flow_t *pflow)
+{
+  return droplet_flow_in_flight(pflow) < atomic_load(&pflow->window);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_sent
+//
+
+void
+droplet_flow_sent(droplet_flow_t *pflow, uint32_t now)
+{
+  uint32_t head = atomic_load_explicit(&pflow->head, memory_order_relaxed);
+
+  // Window is never larger than the ring
+  pflow->sendTime[head & (DROPLET_FLOW_RING_SIZE - 1)] = now;
+  atomic_store_explicit(&pflow->head, head + 1, memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_consume
+//
+// Take the oldest frame in flight. Confirms and timeouts can race so the
+// tail is moved with compare and swap.
+//
+
+static bool
+droplet_flow_consume(droplet_flow_t *pflow, uint32_t *psendTime)
+{
+  uint32_t tail = atomic_load_explicit(&pflow->tail, memory_order_relaxed);
+
+  do {
+    if (tail == atomic_load_explicit(&pflow->head, memory_order_acquire)) {
+      return false;
+    }
+    *psendTime = pflow->sendTime[tail & (DROPLET_FLOW_RING_SIZE - 1)];
+  } while (!atomic_compare_exchange_weak_explicit(&pflow->tail,
+                                                  &tail,
+                                                  tail + 1,
+                                                  memory_order_acq_rel,
+                                                  memory_order_relaxed));
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_failed
+//
+// Multiplicative decrease
+//
+
+static void
+droplet_flow_failed(droplet_flow_t *pflow)
+{
+  uint16_t window = atomic_load(&pflow->window) / 2;
+
+  atomic_store(&pflow->window, (window < pflow->config.minWindow) ? pflow->config.minWindow : window);
+  pflow->credit    = 0;
+  pflow->failRatio = pflow->failRatio - (pflow->failRatio / 16) + (1000 / 16);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_confirm
+//
+
+bool
+droplet_flow_confirm(droplet_flow_t *pflow, bool bSuccess, uint32_t now)
+{
+  uint32_t sendTime;
+
+  if (!droplet_flow_consume(pflow, &sendTime)) {
+    return false;
+  }
+
+  uint32_t latency = now - sendTime;
+
+  // Histogram bins double in width
+  int bin        = 0;
+  uint32_t limit = DROPLET_FLOW_HIST_FIRST;
+  while ((bin < (DROPLET_TX_LATENCY_BINS - 1)) && (latency >= limit)) {
+    bin++;
+    limit <<= 1;
+  }
+  pflow->ackHist[bin]++;
+
+  // Smoothed latency (1/8 of new sample)
+  pflow->ackLatency = pflow->ackLatency ? (pflow->ackLatency - (pflow->ackLatency / 8) + (latency / 8)) : latency;
+
+  if (!bSuccess) {
+    pflow->nConfirmFail++;
+    droplet_flow_failed(pflow);
+    return true;
+  }
+
+  pflow->nConfirmOk++;
+  pflow->failRatio -= pflow->failRatio / 16;
+
+  uint16_t window = atomic_load(&pflow->window);
+  if (latency <= pflow->config.targetLatency) {
+    // Additive increase. One more frame for every window of fast confirms.
+    if ((++pflow->credit >= window) && (window < pflow->config.maxWindow)) {
+      atomic_store(&pflow->window, window + 1);
+      pflow->credit = 0;
+    }
+  }
+  else if ((latency > (2 * pflow->config.targetLatency)) && (window > pflow->config.minWindow)) {
+    // Frames queue up in the radio
+    atomic_store(&pflow->window, window - 1);
+    pflow->credit = 0;
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_timeout
+//
+
+void
+droplet_flow_timeout(droplet_flow_t *pflow)
+{
+  uint32_t sendTime;
+
+  if (droplet_flow_consume(pflow, &sendTime)) {
+    pflow->nTimeout++;
+    droplet_flow_failed(pflow);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_flow_abort
+//
+
+void
+droplet_flow_abort(droplet_flow_t *pflow)
+{
+  uint32_t sendTime;
+
+  if (droplet_flow_consume(pflow, &sendTime)) {
+    pflow->nAbort++;
+    droplet_flow_failed(pflow);
+  }
+}
@@ -0,0 +1,173 @@
+/**
+ * @brief           VSCP droplet send flow control
+ * @file            droplet-flow.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * In-flight window for frames handed to the radio. A frame is in flight
+ * from when it is given to the transport until its send confirm. The
+ * window grows by one for every window of fast successful confirms and
+ * is halved on failures so the send rate follows what the radio can take
+ * without overrunning its TX buffers.
+ *
+ * Sends are registered by the send task and confirms come from the
+ * transport (WiFi task for ESP-NOW). Send times are kept in a ring
+ * indexed by free running counters so the number of frames in flight is
+ * always exact. ESP-NOW confirms frames in the order they were sent.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_FLOW_H
+#define DROPLET_FLOW_H
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DROPLET_FLOW_RING_SIZE 32 // Max window. Must be a power of two.
+
+// First ack latency histogram bin is below this (us), every next bin doubles
+#define DROPLET_FLOW_HIST_FIRST 250
+
+/**
+ * @brief Flow control configuration
+ */
+typedef struct {
+  uint16_t minWindow;     // Window is never made smaller than this
+  uint16_t maxWindow;     // Window is never made larger than this (<= DROPLET_FLOW_RING_SIZE)
+  uint32_t targetLatency; // Confirms slower than this (us) don't grow the window
+} droplet_flow_config_t;
+
+/**
+ * @brief Flow control state
+ */
+typedef struct {
+  droplet_flow_config_t config;
+  atomic_uint_least32_t head;                // Frames sent (free running)
+  atomic_uint_least32_t tail;                // Frames confirmed or timed out (free running)
+  uint32_t sendTime[DROPLET_FLOW_RING_SIZE]; // Send time (us) for frames in flight
+  atomic_uint_least16_t window;              // Current window
+  uint16_t credit;                           // Fast confirms since last window increase
+  // Metrics
+  uint32_t nConfirmOk;                           // Successful send confirms
+  uint32_t nConfirmFail;                         // Failed send confirms
+  uint32_t nTimeout;                             // Frames that never got a confirm
+  uint32_t nAbort;                               // Frames the radio did not accept
+  uint32_t failRatio;                            // Smoothed failure ratio (per mille)
+  uint32_t ackLatency;                           // Smoothed ack latency (us)
+  uint32_t ackHist[DROPLET_TX_LATENCY_BINS];     // Ack latency histogram
+} droplet_flow_t;
+
+/**
+ * @fn droplet_flow_init
+ * @brief Initialize flow control
+ *
+ * @param pflow Pointer to flow state
+ * @param pconfig Configuration. Window starts at minWindow.
+ * @return int VSCP_ERROR_SUCCESS if OK, VSCP_ERROR_PARAMETER on invalid configuration.
+ */
+int
+droplet_flow_init(droplet_flow_t *pflow, const droplet_flow_config_t *pconfig);
+
+/**
+ * @fn droplet_flow_in_flight
+ * @brief Number of frames sent but not confirmed
+ */
+uint32_t
+droplet_flow_in_flight(droplet_flow_t *pflow);
+
+/**
+ * @fn droplet_flow_can_send
+ * @brief Check if there is room in the window for one more frame
+ */
+bool
+droplet_flow_can_send(droplet_flow_t *pflow);
+
+/**
+ * @fn droplet_flow_sent
+ * @brief Register a frame handed to the radio. Send task only.
+ *
+ * @param pflow Pointer to flow state
+ * @param now Time in us
+ */
+void
+droplet_flow_sent(droplet_flow_t *pflow, uint32_t now);
+
+/**
+ * @fn droplet_flow_confirm
+ * @brief Register send confirm for the oldest frame in flight
+ *
+ * @param pflow Pointer to flow state
+ * @param bSuccess True if frame was sent successfully
+ * @param now Time in us
+ * @return bool False if there was no frame in flight (late confirm after timeout)
+ */
+bool
+droplet_flow_confirm(droplet_flow_t *pflow, bool bSuccess, uint32_t now);
+
+/**
+ * @fn droplet_flow_timeout
+ * @brief Give up on the oldest frame in flight. Counted as a failure.
+ *
+ * @param pflow Pointer to flow state
+ */
+void
+droplet_flow_timeout(droplet_flow_t *pflow);
+
+/**
+ * @fn droplet_flow_abort
+ * @brief Frame registered with droplet_flow_sent could not be sent
+ *
+ * Takes one frame out of the window. Counted as a failure as a full
+ * radio TX queue is the usual reason.
+ *
+ * @param pflow Pointer to flow state
+ */
+void
+droplet_flow_abort(droplet_flow_t *pflow);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
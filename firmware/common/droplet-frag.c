@@ -0,0 +1,363 @@
+/**
+ * @brief           VSCP droplet fragmentation and reassembly
+ * @file            droplet-frag.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <esp_timer.h>
+
+#include <vscp.h>
+
+#include "droplet-frag.h"
+
+// One bit for every fragment in droplet_frag_entry_t.rcvd
+#if DROPLET_FRAG_MAX_COUNT > 8
+#error "Too many fragments for a message. Increase DROPLET_AGG_MAX_FRAME or lower DROPLET_MAX_FRAG_DATA"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_init
+//
+
+int
+droplet_frag_init(droplet_frag_t *pfrag, uint8_t nSlots, uint32_t timeout)
+{
+  if ((NULL == pfrag) || !nSlots || !timeout) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  memset(pfrag, 0, sizeof(droplet_frag_t));
+
+  pfrag->pslots = VSCP_CALLOC(nSlots * sizeof(droplet_frag_entry_t));
+  if (NULL == pfrag->pslots) {
+    return VSCP_ERROR_MEMORY;
+  }
+  pfrag->nSlots  = nSlots;
+  pfrag->timeout = timeout;
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_deinit
+//
+
+void
+droplet_frag_deinit(droplet_frag_t *pfrag)
+{
+  if (NULL == pfrag) {
+    return;
+  }
+
+  VSCP_FREE(pfrag->pslots);
+  pfrag->pslots  = NULL;
+  pfrag->nSlots  = 0;
+  pfrag->memUsed = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_message
+//
+
+size_t
+droplet_frag_message(uint8_t *msg, size_t len, const vscpEvent *pev, uint8_t version)
+{
+  size_t n;
+
+  if ((NULL == msg) || (NULL == pev) || (pev->sizeData > DROPLET_MAX_FRAG_DATA) ||
+      (pev->sizeData && (NULL == pev->pdata))) {
+    return 0;
+  }
+
+  // Header with a zero size byte. The data follows it.
+  vscpEvent hdr = *pev;
+  hdr.sizeData  = 0;
+  hdr.pdata     = NULL;
+  if (0 == (n = droplet_buildVscp(msg, len, &hdr, version))) {
+    return 0;
+  }
+
+  if ((n + pev->sizeData) > len) {
+    return 0;
+  }
+
+  if (pev->sizeData) {
+    memcpy(msg + n, pev->pdata, pev->sizeData);
+  }
+
+  return n + pev->sizeData;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_count
+//
+
+uint8_t
+droplet_frag_count(size_t msglen)
+{
+  return (msglen + DROPLET_FRAG_MAX_PAYLOAD - 1) / DROPLET_FRAG_MAX_PAYLOAD;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_build
+//
+
+size_t
+droplet_frag_build(uint8_t *frame,
+                   const uint8_t *msg,
+                   size_t msglen,
+                   uint16_t msgid,
+                   uint8_t index,
+                   uint8_t nodeType,
+                   uint8_t version)
+{
+  uint8_t count = droplet_frag_count(msglen);
+
+  if ((NULL == frame) || (NULL == msg) || (msglen > DROPLET_FRAG_MAX_MSG) || (index >= count)) {
+    return 0;
+  }
+
+  size_t offset = index * DROPLET_FRAG_MAX_PAYLOAD;
+  size_t n      = MIN(DROPLET_FRAG_MAX_PAYLOAD, msglen - offset);
+
+  memset(frame, 0, DROPLET_POS_FRAG_PAYLOAD);
+
+  frame[DROPLET_POS_ID]          = DROPLET_ID_MSB;
+  frame[DROPLET_POS_ID + 1]      = DROPLET_ID_LSB + version;
+  frame[DROPLET_POS_PKT_TYPE]    = (nodeType << 4) | DROPLET_PKT_TYPE_FRAGMENT;
+  frame[DROPLET_POS_FRAG_ID]     = (msgid >> 8) & 0xff;
+  frame[DROPLET_POS_FRAG_ID + 1] = msgid & 0xff;
+  frame[DROPLET_POS_FRAG_INDEX]  = index;
+  frame[DROPLET_POS_FRAG_COUNT]  = count;
+  frame[DROPLET_POS_FRAG_LEN]    = n;
+  memcpy(frame + DROPLET_POS_FRAG_PAYLOAD, msg + offset, n);
+
+  return DROPLET_POS_FRAG_PAYLOAD + n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// frag_find
+//
+// Slot for a message or a free slot if the message is new. NULL if
+// there is no free slot.
+//
+
+static droplet_frag_entry_t *
+frag_find(droplet_frag_t *pfrag, const uint8_t *src, uint16_t msgid, bool *pbNew)
+{
+  droplet_frag_entry_t *pfree = NULL;
+
+  for (int i = 0; i < pfrag->nSlots; i++) {
+    droplet_frag_entry_t *pentry = &pfrag->pslots[i];
+    if (!pentry->bUsed) {
+      if (NULL == pfree) {
+        pfree = pentry;
+      }
+    }
+    else if ((pentry->msgid == msgid) && !memcmp(pentry->src, src, DROPLET_ADDR_LEN)) {
+      *pbNew = false;
+      return pentry;
+    }
+  }
+
+  *pbNew = true;
+  return pfree;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_add
+//
+
+int
+droplet_frag_add(droplet_frag_t *pfrag,
+                 const uint8_t *src,
+                 const uint8_t *frame,
+                 size_t len,
+                 uint32_t now,
+                 droplet_frag_entry_t **ppentry)
+{
+  bool bNew;
+  droplet_frag_entry_t *pentry;
+
+  if ((NULL == pfrag) || (NULL == pfrag->pslots) || (NULL == src) || (NULL == frame) || (NULL == ppentry) ||
+      (len < DROPLET_POS_FRAG_PAYLOAD) || !DROPLET_IS_FRAGMENT(frame)) {
+    return DROPLET_FRAG_INVALID;
+  }
+
+  uint16_t msgid  = (frame[DROPLET_POS_FRAG_ID] << 8) + frame[DROPLET_POS_FRAG_ID + 1];
+  uint8_t index   = frame[DROPLET_POS_FRAG_INDEX];
+  uint8_t count   = frame[DROPLET_POS_FRAG_COUNT];
+  size_t n        = frame[DROPLET_POS_FRAG_LEN];
+  size_t offset   = index * DROPLET_FRAG_MAX_PAYLOAD;
+  uint8_t version = DROPLET_FRAME_VERSION(frame);
+
+  // All but the last fragment are full. Frame may be padded after decryption.
+  if (!count || (count > DROPLET_FRAG_MAX_COUNT) || (index >= count) || !n ||
+      ((DROPLET_POS_FRAG_PAYLOAD + n) > len) || ((index < (count - 1)) && (DROPLET_FRAG_MAX_PAYLOAD != n)) ||
+      ((offset + n) > DROPLET_FRAG_MAX_MSG)) {
+    return DROPLET_FRAG_INVALID;
+  }
+
+  pentry = frag_find(pfrag, src, msgid, &bNew);
+  if (NULL == pentry) {
+    // Make room from stale messages before giving up
+    if (droplet_frag_expire(pfrag, now)) {
+      pentry = frag_find(pfrag, src, msgid, &bNew);
+    }
+    if (NULL == pentry) {
+      pfrag->nDropped++;
+      return DROPLET_FRAG_NO_SLOT;
+    }
+  }
+
+  if (bNew) {
+    memcpy(pentry->src, src, DROPLET_ADDR_LEN);
+    pentry->msgid   = msgid;
+    pentry->version = version;
+    pentry->count   = count;
+    pentry->rcvd    = 0;
+    pentry->nBytes  = 0;
+    pentry->total   = 0;
+    pentry->started = now;
+    pentry->bUsed   = true;
+  }
+  else if ((pentry->count != count) || (pentry->version != version)) {
+    return DROPLET_FRAG_INVALID;
+  }
+  else if (pentry->rcvd & (1 << index)) {
+    pfrag->nDup++;
+    return DROPLET_FRAG_DUP;
+  }
+
+  memcpy(pentry->buf + offset, frame + DROPLET_POS_FRAG_PAYLOAD, n);
+  pentry->rcvd |= (1 << index);
+  pentry->nBytes += n;
+
+  pfrag->memUsed += n;
+  if (pfrag->memUsed > pfrag->maxMemUsed) {
+    pfrag->maxMemUsed = pfrag->memUsed;
+  }
+
+  // Length of the message is given by the last fragment
+  if (index == (count - 1)) {
+    pentry->total = offset + n;
+  }
+
+  if (pentry->rcvd != ((1 << count) - 1)) {
+    return DROPLET_FRAG_MORE;
+  }
+
+  pfrag->nComplete++;
+  *ppentry = pentry;
+
+  return DROPLET_FRAG_DONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_event
+//
+
+int
+droplet_frag_event(vscpEvent *pev, const droplet_frag_entry_t *pentry, uint32_t timestamp)
+{
+  size_t n;
+
+  if ((NULL == pev) || (NULL == pentry)) {
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  memset(pev, 0, sizeof(vscpEvent));
+
+  // Size byte of a message is always zero. Data is the rest of the message.
+  n = droplet_parseVscp(pev, pentry->buf, pentry->total, pentry->version);
+  if (!n || pev->sizeData || ((pentry->total - n) > DROPLET_MAX_FRAG_DATA)) {
+    return VSCP_ERROR_INVALID_FRAME;
+  }
+
+  pev->sizeData  = pentry->total - n;
+  pev->pdata     = pev->sizeData ? (uint8_t *) (pentry->buf + n) : NULL;
+  pev->timestamp = timestamp ? timestamp : (uint32_t) esp_timer_get_time();
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_release
+//
+
+void
+droplet_frag_release(droplet_frag_t *pfrag, droplet_frag_entry_t *pentry)
+{
+  if ((NULL == pfrag) || (NULL == pentry) || !pentry->bUsed) {
+    return;
+  }
+
+  pfrag->memUsed -= pentry->nBytes;
+  pentry->bUsed = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_expire
+//
+
+int
+droplet_frag_expire(droplet_frag_t *pfrag, uint32_t now)
+{
+  int cnt = 0;
+
+  if ((NULL == pfrag) || (NULL == pfrag->pslots)) {
+    return 0;
+  }
+
+  for (int i = 0; i < pfrag->nSlots; i++) {
+    droplet_frag_entry_t *pentry = &pfrag->pslots[i];
+    if (pentry->bUsed && ((uint32_t) (now - pentry->started) >= pfrag->timeout)) {
+      droplet_frag_release(pfrag, pentry);
+      pfrag->nTimeouts++;
+      cnt++;
+    }
+  }
+
+  return cnt;
+}
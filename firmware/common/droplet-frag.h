@@ -0,0 +1,244 @@
+/**
+ * @brief           VSCP droplet fragmentation and reassembly
+ * @file            droplet-frag.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Splits events with more data than fits in one frame into fragment
+ * frames and puts them together again on the receiving side in a fixed
+ * set of reassembly slots. There is no task or global state in here and
+ * time is given by the caller so the same code runs in the stack and on
+ * the host.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_FRAG_H
+#define DROPLET_FRAG_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// True if the frame is a fragment frame
+#define DROPLET_IS_FRAGMENT(frame) ((frame)[DROPLET_POS_PKT_TYPE] & DROPLET_PKT_TYPE_FRAGMENT)
+
+// Results from droplet_frag_add
+#define DROPLET_FRAG_MORE    0 // Fragment stored. More fragments are needed.
+#define DROPLET_FRAG_DONE    1 // Last missing fragment. Message is complete.
+#define DROPLET_FRAG_DUP     2 // Fragment has been received before. Drop it.
+#define DROPLET_FRAG_NO_SLOT 3 // All reassembly slots are in use. Fragment dropped.
+#define DROPLET_FRAG_INVALID 4 // Not a valid fragment frame
+
+/**
+ * @brief Reassembly slot
+ *
+ * A message is identified by the address it is received from and the
+ * message id in the fragment header. Fragments are placed at their
+ * offset in the message so they can arrive in any order.
+ */
+typedef struct {
+  uint8_t src[DROPLET_ADDR_LEN];     // Address fragments are received from
+  uint16_t msgid;                    // Message id
+  uint8_t version;                   // Header layout of the message
+  uint8_t count;                     // Fragments in message
+  uint8_t rcvd;                      // Bit for every received fragment
+  bool bUsed;                        // Slot holds a message
+  uint16_t nBytes;                   // Message bytes received so far
+  uint16_t total;                    // Message length. Known when the last fragment is in.
+  uint32_t started;                  // Time (ms) when first fragment was received
+  uint8_t buf[DROPLET_FRAG_MAX_MSG]; // Message
+} droplet_frag_entry_t;
+
+/**
+ * @brief Reassembly state
+ */
+typedef struct {
+  droplet_frag_entry_t *pslots; // Reassembly slots
+  uint8_t nSlots;               // Number of slots
+  uint32_t timeout;             // Milliseconds a partly received message is kept
+  uint32_t memUsed;             // Message bytes held in slots
+  uint32_t maxMemUsed;          // High water mark for memUsed
+  uint32_t nComplete;           // Messages reassembled
+  uint32_t nTimeouts;           // Partly received messages dropped on timeout
+  uint32_t nDup;                // Fragments received twice
+  uint32_t nDropped;            // Fragments dropped because all slots were in use
+} droplet_frag_t;
+
+/**
+ * @fn droplet_frag_init
+ * @brief Allocate reassembly slots
+ *
+ * @param pfrag Pointer to reassembly state
+ * @param nSlots Number of messages that can be reassembled at once
+ * @param timeout Milliseconds a partly received message is kept
+ * @return int VSCP_ERROR_SUCCESS on success, VSCP_ERROR_MEMORY if the slots
+ *         can't be allocated.
+ */
+int
+droplet_frag_init(droplet_frag_t *pfrag, uint8_t nSlots, uint32_t timeout);
+
+/**
+ * @fn droplet_frag_deinit
+ * @brief Free reassembly slots
+ *
+ * @param pfrag Pointer to reassembly state
+ */
+void
+droplet_frag_deinit(droplet_frag_t *pfrag);
+
+/**
+ * @fn droplet_frag_message
+ * @brief Build the message for an event that is sent as fragments
+ *
+ * The message is the VSCP content of the event with a zero size byte
+ * followed by all data.
+ *
+ * @param msg Buffer for message. DROPLET_FRAG_MAX_MSG is always enough.
+ * @param len Size of buffer
+ * @param pev Event with up to DROPLET_MAX_FRAG_DATA bytes of data
+ * @param version Header layout (DROPLET_VERSION or DROPLET_VERSION_COMPACT)
+ * @return size_t Length of the message or zero if the event is invalid or
+ *         doesn't fit.
+ */
+size_t
+droplet_frag_message(uint8_t *msg, size_t len, const vscpEvent *pev, uint8_t version);
+
+/**
+ * @fn droplet_frag_build
+ * @brief Build one fragment frame of a message
+ *
+ * Id and packet type are set. ttl and magic are left for the send path.
+ *
+ * @param frame Buffer for the fragment frame. At least DROPLET_AGG_MAX_FRAME long.
+ * @param msg Message as built by droplet_frag_message
+ * @param msglen Length of message
+ * @param msgid Message id. Same for all fragments of the message.
+ * @param index Fragment to build. Zero to droplet_frag_count - 1.
+ * @param nodeType Node type put in the packet type byte
+ * @param version Header layout of the message
+ * @return size_t Length of the fragment frame or zero if index is out of range.
+ */
+size_t
+droplet_frag_build(uint8_t *frame,
+                   const uint8_t *msg,
+                   size_t msglen,
+                   uint16_t msgid,
+                   uint8_t index,
+                   uint8_t nodeType,
+                   uint8_t version);
+
+/**
+ * @fn droplet_frag_count
+ * @brief Number of fragments a message is sent in
+ *
+ * @param msglen Length of message
+ * @return uint8_t Number of fragments
+ */
+uint8_t
+droplet_frag_count(size_t msglen);
+
+/**
+ * @fn droplet_frag_add
+ * @brief Add a received fragment frame
+ *
+ * When DROPLET_FRAG_DONE is returned *ppentry points to the slot with the
+ * complete message. Get the event with droplet_frag_event and give the
+ * slot back with droplet_frag_release.
+ *
+ * @param pfrag Pointer to reassembly state
+ * @param src Six byte address the frame is received from
+ * @param frame Received (decrypted) fragment frame
+ * @param len Length of frame. May include block padding.
+ * @param now Current time in milliseconds
+ * @param ppentry Pointer that get the slot of a complete message
+ * @return int DROPLET_FRAG_xxx result
+ */
+int
+droplet_frag_add(droplet_frag_t *pfrag,
+                 const uint8_t *src,
+                 const uint8_t *frame,
+                 size_t len,
+                 uint32_t now,
+                 droplet_frag_entry_t **ppentry);
+
+/**
+ * @fn droplet_frag_event
+ * @brief Get the event from a complete message
+ *
+ * The event is a view on the slot, pdata points into the message. It is
+ * valid until the slot is released.
+ *
+ * @param pev Event to fill in
+ * @param pentry Slot with complete message
+ * @param timestamp Timestamp for the event. Zero is now.
+ * @return int VSCP_ERROR_SUCCESS on success, VSCP_ERROR_INVALID_FRAME if the
+ *         message is not a valid event.
+ */
+int
+droplet_frag_event(vscpEvent *pev, const droplet_frag_entry_t *pentry, uint32_t timestamp);
+
+/**
+ * @fn droplet_frag_release
+ * @brief Give a reassembly slot back
+ *
+ * @param pfrag Pointer to reassembly state
+ * @param pentry Slot to free
+ */
+void
+droplet_frag_release(droplet_frag_t *pfrag, droplet_frag_entry_t *pentry);
+
+/**
+ * @fn droplet_frag_expire
+ * @brief Drop messages that have not been completed in time
+ *
+ * @param pfrag Pointer to reassembly state
+ * @param now Current time in milliseconds
+ * @return int Number of messages dropped
+ */
+int
+droplet_frag_expire(droplet_frag_t *pfrag, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
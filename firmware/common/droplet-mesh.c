@@ -0,0 +1,391 @@
+/**
+ * @brief           VSCP droplet mesh (flooding) core
+ * @file            droplet-mesh.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vscp.h>
+
+#include "droplet-mesh.h"
+
+#define FRAME_MAGIC(frame) (((frame)[DROPLET_POS_MAGIC] << 8) + (frame)[DROPLET_POS_MAGIC + 1])
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_mesh_init
+//
+
+int
+droplet_mesh_init(droplet_mesh_t *pmesh, const uint8_t *addr, const droplet_mesh_config_t *pconfig)
+{
+  if ((NULL == pmesh) || (NULL == addr) || (NULL == pconfig) || !pconfig->sizeCache || !pconfig->maxAge) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  // Deferred forwards need a cancel count and a signal range to weight the delay with
+  bool bDefer = (DROPLET_FWD_COUNTER == pconfig->fwdStrategy) || (DROPLET_FWD_RSSI == pconfig->fwdStrategy) ||
+                pconfig->jitterMax;
+  if (bDefer && (!pconfig->counterMax || (pconfig->rssiFar >= pconfig->rssiNear))) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  memset(pmesh, 0, sizeof(droplet_mesh_t));
+  memcpy(pmesh->addr, addr, DROPLET_ADDR_LEN);
+  pmesh->config = *pconfig;
+
+  // Seed from the address so nodes don't draw the same backoff
+  pmesh->rng = 2166136261UL;
+  for (int i = 0; i < DROPLET_ADDR_LEN; i++) {
+    pmesh->rng ^= addr[i];
+    pmesh->rng *= 16777619UL;
+  }
+  if (!pmesh->rng) {
+    pmesh->rng = 1;
+  }
+
+  // Power of two number of buckets so the index is a mask
+  uint32_t nBuckets = 1;
+  while ((nBuckets * DROPLET_MESH_WAYS) < pconfig->sizeCache) {
+    nBuckets <<= 1;
+  }
+
+  pmesh->pcache = VSCP_CALLOC(nBuckets * DROPLET_MESH_WAYS * sizeof(droplet_mesh_entry_t));
+  if (NULL == pmesh->pcache) {
+    return VSCP_ERROR_MEMORY;
+  }
+  pmesh->nBuckets = (uint16_t) nBuckets;
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_mesh_deinit
+//
+
+void
+droplet_mesh_deinit(droplet_mesh_t *pmesh)
+{
+  if (NULL == pmesh) {
+    return;
+  }
+
+  VSCP_FREE(pmesh->pcache);
+  pmesh->pcache   = NULL;
+  pmesh->nBuckets = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mesh_hash
+//
+// FNV-1a over the VSCP part of the frame. Id, packet type, ttl and magic
+// are left out. Block padding is left out, for both header layouts and
+// aggregate frames.
+//
+
+static uint32_t
+mesh_hash(const uint8_t *frame, size_t len)
+{
+  uint32_t hash = 2166136261UL;
+  size_t end    = droplet_getFrameLen(frame, len);
+
+  if (0 == end) {
+    end = len;
+  }
+
+  for (size_t i = DROPLET_POS_HEAD; i < end; i++) {
+    hash ^= frame[i];
+    hash *= 16777619UL;
+  }
+
+  return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mesh_random
+//
+// xorshift32. Good enough for gossip and backoff.
+//
+
+static uint32_t
+mesh_random(droplet_mesh_t *pmesh)
+{
+  uint32_t x = pmesh->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  pmesh->rng = x;
+  return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mesh_lookup
+//
+// Look the frame up in its bucket. The bucket is picked from the magic
+// alone so frames that share magic meet in the same bucket and are
+// told apart by the content hash.
+//
+// Returns the entry for the frame. *pbSeen is set if the frame was
+// already there. Otherwise the frame is entered in the bucket, in a free
+// or expired entry if there is one and in place of the oldest entry if
+// not, with no copies counted.
+//
+
+static droplet_mesh_entry_t *
+mesh_lookup(droplet_mesh_t *pmesh, uint16_t magic, uint32_t hash, uint32_t now, bool *pbSeen)
+{
+  uint32_t index              = ((uint32_t) magic * 40503UL) >> 4; // Spread random magic over buckets
+  droplet_mesh_entry_t *pfree = NULL;
+  droplet_mesh_entry_t *pold  = NULL;
+  droplet_mesh_entry_t *pe    = &pmesh->pcache[(index & (pmesh->nBuckets - 1)) * DROPLET_MESH_WAYS];
+
+  for (int i = 0; i < DROPLET_MESH_WAYS; i++, pe++) {
+
+    if (!pe->bUsed || ((uint32_t) (now - pe->time) >= pmesh->config.maxAge)) {
+      pe->bUsed = false;
+      if (NULL == pfree) {
+        pfree = pe;
+      }
+      continue;
+    }
+
+    if (pe->magic == magic) {
+      if (pe->hash == hash) {
+        *pbSeen = true;
+        return pe;
+      }
+      pmesh->nCollisions++;
+    }
+
+    if ((NULL == pold) || ((uint32_t) (now - pe->time) > (uint32_t) (now - pold->time))) {
+      pold = pe;
+    }
+  }
+
+  if (NULL == pfree) {
+    pmesh->nEvictions++;
+    pfree = pold;
+  }
+
+  pfree->bUsed   = true;
+  pfree->magic   = magic;
+  pfree->hash    = hash;
+  pfree->time    = now;
+  pfree->nCopies = 0;
+  pfree->tag     = 0;
+
+  *pbSeen = false;
+  return pfree;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_mesh_remember
+//
+
+void
+droplet_mesh_remember(droplet_mesh_t *pmesh, const uint8_t *frame, size_t len, uint32_t now)
+{
+  bool bSeen;
+  mesh_lookup(pmesh, FRAME_MAGIC(frame), mesh_hash(frame, len), now, &bSeen);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// mesh_delay
+//
+// How long to hold a frame before it is forwarded.
+//
+// Counter: random backoff over the whole window.
+//
+// RSSI: the backoff is scaled with signal strength so distant nodes, that
+// add the most coverage, get to forward first and close nodes hear their
+// copies and stay quiet. A random part within one eighth of the window
+// keeps nodes at the same distance apart.
+//
+// Flood/gossip: jitter so neighbours that got the frame at the same time
+// don't rebroadcast at the same time. Half of it is weighted with signal
+// strength as for RSSI and half is random.
+//
+
+static uint32_t
+mesh_delay(droplet_mesh_t *pmesh, int8_t rssi)
+{
+  uint32_t window;
+  uint32_t slot;
+
+  switch (pmesh->config.fwdStrategy) {
+    case DROPLET_FWD_COUNTER:
+      return mesh_random(pmesh) % (pmesh->config.backoffMax + 1);
+
+    case DROPLET_FWD_RSSI:
+      window = pmesh->config.backoffMax;
+      slot   = window / 8;
+      break;
+
+    default:
+      window = pmesh->config.jitterMax;
+      slot   = window / 2;
+      break;
+  }
+
+  int span = pmesh->config.rssiNear - pmesh->config.rssiFar;
+  int pos  = rssi - pmesh->config.rssiFar;
+  if (pos < 0) {
+    pos = 0;
+  }
+  if (pos > span) {
+    pos = span;
+  }
+
+  return ((window - slot) * (uint32_t) pos) / (uint32_t) span + (mesh_random(pmesh) % (slot + 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_mesh_process
+//
+
+int
+droplet_mesh_process(droplet_mesh_t *pmesh,
+                     uint8_t *frame,
+                     size_t len,
+                     const uint8_t *dst_addr,
+                     int8_t rssi,
+                     uint32_t now,
+                     droplet_mesh_sched_t *psched)
+{
+  int rv = DROPLET_MESH_DELIVER;
+  bool bSeen;
+
+  // Check if we have already received this frame. Copies are counted
+  // and cancel a scheduled forward when there are enough of them.
+  droplet_mesh_entry_t *pe = mesh_lookup(pmesh, FRAME_MAGIC(frame), mesh_hash(frame, len), now, &bSeen);
+  if (bSeen) {
+    pmesh->nHits++;
+    if (pe->nCopies < 0xff) {
+      pe->nCopies++;
+    }
+    if (pe->tag && (pe->nCopies >= pmesh->config.counterMax)) {
+      pmesh->nFwdCancelled++;
+      psched->cancel = pe->tag;
+      pe->tag        = 0;
+      return DROPLET_MESH_DUPLICATE | DROPLET_MESH_CANCEL;
+    }
+    return DROPLET_MESH_DUPLICATE;
+  }
+  pe->nCopies = 1;
+
+  // Decrease ttl as we have seen this frame
+  if (frame[DROPLET_POS_TTL]) {
+    frame[DROPLET_POS_TTL]--;
+  }
+
+  // Frames addressed to us end here. Broadcast frames are
+  // forwarded as long as there is ttl left.
+  if (!pmesh->config.bForwardEnable || !frame[DROPLET_POS_TTL] ||
+      ((NULL != dst_addr) && !memcmp(dst_addr, pmesh->addr, DROPLET_ADDR_LEN))) {
+    return rv;
+  }
+
+  bool bDefer = false;
+
+  switch (pmesh->config.fwdStrategy) {
+
+    case DROPLET_FWD_GOSSIP:
+      if ((mesh_random(pmesh) % 100) >= pmesh->config.gossipProb) {
+        pmesh->nFwdSuppressed++;
+        return rv;
+      }
+      bDefer = pmesh->config.jitterMax;
+      break;
+
+    case DROPLET_FWD_RSSI:
+      if (rssi >= pmesh->config.rssiNear) {
+        pmesh->nFwdSuppressed++; // Sender is close, we add next to no coverage
+        return rv;
+      }
+      bDefer = true;
+      break;
+
+    case DROPLET_FWD_COUNTER:
+      bDefer = true;
+      break;
+
+    case DROPLET_FWD_FLOOD:
+    default:
+      bDefer = pmesh->config.jitterMax;
+      break;
+  }
+
+  // Can't defer if the caller can't hold the frame
+  if (!bDefer || (NULL == psched) || !psched->tag) {
+    return rv | DROPLET_MESH_FORWARD;
+  }
+
+  pe->tag       = psched->tag;
+  psched->delay = mesh_delay(pmesh, rssi);
+  pmesh->nFwdDeferred++;
+
+  return rv | DROPLET_MESH_DEFER;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_mesh_forward_check
+//
+
+bool
+droplet_mesh_forward_check(droplet_mesh_t *pmesh, const uint8_t *frame, size_t len, uint32_t now)
+{
+  bool bSeen;
+  droplet_mesh_entry_t *pe = mesh_lookup(pmesh, FRAME_MAGIC(frame), mesh_hash(frame, len), now, &bSeen);
+
+  if (!bSeen) {
+    pe->nCopies = 1; // Dropped out of the filter. Enter it again and forward.
+    return true;
+  }
+
+  pe->tag = 0;
+
+  if (pe->nCopies >= pmesh->config.counterMax) {
+    pmesh->nFwdSuppressed++;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,227 @@
+/**
+ * @brief           VSCP droplet mesh (flooding) core
+ * @file            droplet-mesh.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Duplicate filtering, ttl handling and the forward decision for
+ * received droplet frames. There is no radio, task or global state in
+ * here so the same code runs in the firmware (one instance) and in the
+ * host mesh simulator (one instance per simulated node).
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_MESH_H
+#define DROPLET_MESH_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Result flags from droplet_mesh_process
+#define DROPLET_MESH_DELIVER   0x01 // Hand frame to the application
+#define DROPLET_MESH_FORWARD   0x02 // Retransmit the (ttl updated) frame
+#define DROPLET_MESH_DUPLICATE 0x04 // Frame has been seen before. Drop it.
+#define DROPLET_MESH_DEFER     0x08 // Forward decision is deferred. Ask droplet_mesh_forward_check later.
+#define DROPLET_MESH_CANCEL    0x10 // Enough copies heard. Drop the scheduled forward with the returned tag.
+
+#define DROPLET_MESH_WAYS 4 // Entries per duplicate filter bucket
+
+/**
+ * @brief Duplicate filter entry
+ *
+ * A frame is identified by its magic and a hash over the VSCP part of the
+ * frame (head, nickname, class, type, size, data). ttl is not part of the
+ * key as it changes when a frame is forwarded.
+ */
+typedef struct {
+  uint32_t hash;   // Hash of VSCP content
+  uint32_t time;   // Time (ms) when first seen
+  uint16_t magic;  // Frame magic
+  bool bUsed;      // Entry holds a frame
+  uint8_t nCopies; // Copies heard (saturates at 255)
+  uint16_t tag;    // Tag of scheduled forward (zero is none)
+} droplet_mesh_entry_t;
+
+/**
+ * @brief Mesh configuration
+ */
+typedef struct {
+  uint16_t sizeCache;                 // Duplicate filter entries, rounded up to power of two (DROPLET_MSG_CACHE_SIZE on target)
+  uint32_t maxAge;                    // Milliseconds a frame is remembered (DROPLET_MSG_CACHE_MAX_AGE on target)
+  bool bForwardEnable;                // Forward frames with ttl left
+  droplet_fwd_strategy_t fwdStrategy; // How to decide if a new frame is forwarded
+  uint8_t gossipProb;                 // Gossip: percent probability that a frame is forwarded
+  uint8_t counterMax;                 // Copies heard while a forward is scheduled that cancel it
+  uint16_t backoffMax;                // Counter/RSSI: longest time (ms) a forward decision is deferred
+  uint16_t jitterMax;                 // Flood/gossip: longest time (ms) a forward is held (zero sends at once)
+  int8_t rssiNear;                    // RSSI: frames at or above this level (dBm) are never forwarded
+  int8_t rssiFar;                     // Frames at or below this level (dBm) get the shortest backoff/jitter
+} droplet_mesh_config_t;
+
+/**
+ * @brief Forward scheduling for droplet_mesh_process
+ *
+ * The caller picks a tag for the frame before calling droplet_mesh_process.
+ * If the forward is deferred the tag is kept in the duplicate filter entry so
+ * a later copy that cancels the forward can be matched to it in O(1).
+ */
+typedef struct {
+  uint16_t tag;    // In: tag for a deferred forward. Zero if the frame can't be held.
+  uint16_t cancel; // Out: tag of the forward to drop when DROPLET_MESH_CANCEL is returned
+  uint32_t delay;  // Out: milliseconds to hold the frame when DROPLET_MESH_DEFER is returned
+} droplet_mesh_sched_t;
+
+/**
+ * @brief Mesh state for one node
+ */
+typedef struct {
+  uint8_t addr[DROPLET_ADDR_LEN]; // Address of this node
+  droplet_mesh_config_t config;   // Configuration
+  droplet_mesh_entry_t *pcache;   // Duplicate filter (nBuckets * DROPLET_MESH_WAYS entries)
+  uint16_t nBuckets;              // Number of buckets. Always a power of two.
+  uint32_t nHits;                 // Duplicates found
+  uint32_t nEvictions;            // Live entries thrown out because a bucket was full
+  uint32_t nCollisions;           // Same magic but different content
+  uint32_t nFwdSuppressed;        // Forwards dropped by the forwarding strategy
+  uint32_t nFwdDeferred;          // Forward decisions deferred for backoff or jitter
+  uint32_t nFwdCancelled;         // Deferred forwards cancelled by copies from neighbours
+  uint32_t rng;                   // Random state for gossip and backoff
+} droplet_mesh_t;
+
+/**
+ * @fn droplet_mesh_init
+ * @brief Initialize mesh state for a node
+ *
+ * @param pmesh Pointer to mesh state
+ * @param addr Six byte address of the node
+ * @param pconfig Pointer to mesh configuration
+ * @return int VSCP_ERROR_SUCCESS on success, VSCP_ERROR_MEMORY if the cache
+ *         can't be allocated.
+ */
+int
+droplet_mesh_init(droplet_mesh_t *pmesh, const uint8_t *addr, const droplet_mesh_config_t *pconfig);
+
+/**
+ * @fn droplet_mesh_deinit
+ * @brief Free resources held by mesh state
+ *
+ * @param pmesh Pointer to mesh state
+ */
+void
+droplet_mesh_deinit(droplet_mesh_t *pmesh);
+
+/**
+ * @fn droplet_mesh_remember
+ * @brief Enter a frame originated by this node in the cache
+ *
+ * Must be called for frames we send ourself so they are not handled
+ * as new frames when they are forwarded back to us by a neighbour.
+ *
+ * @param pmesh Pointer to mesh state
+ * @param frame Pointer to unencrypted frame (header must be set)
+ * @param len Length of frame
+ * @param now Current time in milliseconds
+ */
+void
+droplet_mesh_remember(droplet_mesh_t *pmesh, const uint8_t *frame, size_t len, uint32_t now);
+
+/**
+ * @fn droplet_mesh_process
+ * @brief Decide what to do with a received frame
+ *
+ * The ttl in the frame is decreased if the frame is new so a forwarded
+ * frame can be sent as is.
+ *
+ * With the counter and RSSI strategies, and with jitter for the others,
+ * the forward of a new frame is deferred. DROPLET_MESH_DEFER is returned
+ * instead of DROPLET_MESH_FORWARD and psched->delay is set to the number
+ * of milliseconds to wait. Keep the frame under psched->tag and call
+ * droplet_mesh_forward_check when the time is up. Frames are forwarded
+ * at once if psched is NULL or has no tag.
+ *
+ * When a copy of a deferred frame brings the count of copies heard up
+ * to counterMax, DROPLET_MESH_CANCEL is returned with the duplicate flag
+ * and psched->cancel set to the tag of the frame to drop.
+ *
+ * @param pmesh Pointer to mesh state
+ * @param frame Pointer to received unencrypted frame. Must be at least
+ *              DROPLET_MIN_FRAME long.
+ * @param len Length of frame
+ * @param dst_addr Destination address the frame was received on.
+ * @param rssi Signal strength (dBm) the frame was received with
+ * @param now Current time in milliseconds
+ * @param psched Pointer to forward scheduling info. Can be NULL.
+ * @return int Combination of DROPLET_MESH_xxx flags.
+ */
+int
+droplet_mesh_process(droplet_mesh_t *pmesh,
+                     uint8_t *frame,
+                     size_t len,
+                     const uint8_t *dst_addr,
+                     int8_t rssi,
+                     uint32_t now,
+                     droplet_mesh_sched_t *psched);
+
+/**
+ * @fn droplet_mesh_forward_check
+ * @brief Final forward decision for a deferred frame
+ *
+ * The frame is forwarded unless counterMax or more copies of it have been
+ * heard since it was first received. A frame that has dropped out of the
+ * duplicate filter is forwarded as the count is lost. The tag of the
+ * frame is released.
+ *
+ * @param pmesh Pointer to mesh state
+ * @param frame Pointer to the frame as returned from droplet_mesh_process
+ * @param len Length of frame
+ * @param now Current time in milliseconds
+ * @return true if the frame should be forwarded.
+ */
+bool
+droplet_mesh_forward_check(droplet_mesh_t *pmesh, const uint8_t *frame, size_t len, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
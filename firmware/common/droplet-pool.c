@@ -0,0 +1,156 @@
+/**
+ * @brief           VSCP droplet fixed block pool
+ * @file            droplet-pool.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vscp.h>
+
+#include "droplet-pool.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_pool_init
+//
+
+int
+droplet_pool_init(droplet_pool_t *ppool, uint16_t nBlocks, size_t sizeBlock)
+{
+  if ((NULL == ppool) || !nBlocks || !sizeBlock) {
+    return VSCP_ERROR_PARAMETER;
+  }
+
+  memset(ppool, 0, sizeof(droplet_pool_t));
+
+  // Keep every block aligned for the structures put in them
+  ppool->sizeBlock = (sizeBlock + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  ppool->nBlocks   = nBlocks;
+  ppool->nWords    = (nBlocks + 31) / 32;
+
+  ppool->pmem  = VSCP_MALLOC(ppool->sizeBlock * nBlocks);
+  ppool->pfree = VSCP_MALLOC(ppool->nWords * sizeof(atomic_uint_least32_t));
+  if ((NULL == ppool->pmem) || (NULL == ppool->pfree)) {
+    droplet_pool_deinit(ppool);
+    return VSCP_ERROR_MEMORY;
+  }
+
+  for (uint16_t i = 0; i < ppool->nWords; i++) {
+    uint16_t n = nBlocks - (i * 32);
+    atomic_init(&ppool->pfree[i], (n >= 32) ? 0xffffffffUL : ((1UL << n) - 1));
+  }
+  atomic_init(&ppool->nInUse, 0);
+  atomic_init(&ppool->maxInUse, 0);
+
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_pool_deinit
+//
+
+void
+droplet_pool_deinit(droplet_pool_t *ppool)
+{
+  if (NULL == ppool) {
+    return;
+  }
+
+  VSCP_FREE(ppool->pmem);
+  VSCP_FREE(ppool->pfree);
+  ppool->pmem    = NULL;
+  ppool->pfree   = NULL;
+  ppool->nBlocks = 0;
+  ppool->nWords  = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_pool_alloc
+//
+
+void *
+droplet_pool_alloc(droplet_pool_t *ppool)
+{
+  for (uint16_t i = 0; i < ppool->nWords; i++) {
+    uint_least32_t bits = atomic_load_explicit(&ppool->pfree[i], memory_order_relaxed);
+    while (bits) {
+      int bit = __builtin_ctz(bits);
+      if (atomic_compare_exchange_weak_explicit(&ppool->pfree[i],
+                                                &bits,
+                                                bits & ~(1UL << bit),
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+        uint_least16_t inuse = atomic_fetch_add_explicit(&ppool->nInUse, 1, memory_order_relaxed) + 1;
+        uint_least16_t max   = atomic_load_explicit(&ppool->maxInUse, memory_order_relaxed);
+        while ((inuse > max) && !atomic_compare_exchange_weak_explicit(&ppool->maxInUse,
+                                                                       &max,
+                                                                       inuse,
+                                                                       memory_order_relaxed,
+                                                                       memory_order_relaxed))
+          ;
+        return ppool->pmem + ((size_t) (i * 32 + bit) * ppool->sizeBlock);
+      }
+      // bits now holds the current value, try again
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_pool_free
+//
+
+void
+droplet_pool_free(droplet_pool_t *ppool, void *pblock)
+{
+  if (NULL == pblock) {
+    return;
+  }
+
+  size_t index = ((uint8_t *) pblock - ppool->pmem) / ppool->sizeBlock;
+  if (index >= ppool->nBlocks) {
+    return;
+  }
+
+  atomic_fetch_sub_explicit(&ppool->nInUse, 1, memory_order_relaxed);
+  atomic_fetch_or_explicit(&ppool->pfree[index / 32], 1UL << (index % 32), memory_order_release);
+}
@@ -0,0 +1,117 @@
+/**
+ * @brief           VSCP droplet fixed block pool
+ * @file            droplet-pool.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Preallocated pool of equal sized blocks. Blocks are claimed and
+ * returned with atomic operations on a free bitmap so the pool can be
+ * used from the WiFi task and droplet tasks without locks and without
+ * touching the heap after init.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_POOL_H
+#define DROPLET_POOL_H
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Block pool
+ */
+typedef struct {
+  uint8_t *pmem;                 // Block memory
+  size_t sizeBlock;              // Size of one block (aligned)
+  uint16_t nBlocks;              // Number of blocks
+  uint16_t nWords;               // Number of words in free bitmap
+  atomic_uint_least32_t *pfree;  // Free bitmap. Set bit is a free block.
+  atomic_uint_least16_t nInUse;  // Blocks currently claimed
+  atomic_uint_least16_t maxInUse; // High water mark for claimed blocks
+} droplet_pool_t;
+
+/**
+ * @fn droplet_pool_init
+ * @brief Allocate and initialize a block pool
+ *
+ * @param ppool Pointer to pool
+ * @param nBlocks Number of blocks
+ * @param sizeBlock Size of each block
+ * @return int VSCP_ERROR_SUCCESS on success, VSCP_ERROR_MEMORY if memory
+ *         can't be allocated.
+ */
+int
+droplet_pool_init(droplet_pool_t *ppool, uint16_t nBlocks, size_t sizeBlock);
+
+/**
+ * @fn droplet_pool_deinit
+ * @brief Free pool memory. No blocks may be in use.
+ *
+ * @param ppool Pointer to pool
+ */
+void
+droplet_pool_deinit(droplet_pool_t *ppool);
+
+/**
+ * @fn droplet_pool_alloc
+ * @brief Claim a block
+ *
+ * @param ppool Pointer to pool
+ * @return void* Pointer to block or NULL if all blocks are in use.
+ */
+void *
+droplet_pool_alloc(droplet_pool_t *ppool);
+
+/**
+ * @fn droplet_pool_free
+ * @brief Return a block to the pool
+ *
+ * @param ppool Pointer to pool
+ * @param pblock Block from droplet_pool_alloc. NULL is ignored.
+ */
+void
+droplet_pool_free(droplet_pool_t *ppool, void *pblock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -53,65 +53,35 @@
 #include <freertos/task.h>
 
 #include <esp_check.h>
-#include <esp_crc.h>
 #include <esp_log.h>
 #include <esp_mac.h>
-#include <esp_now.h>
 #include <esp_random.h>
 #include <esp_timer.h>
-#include <esp_wifi.h>
 #include <esp_wifi_types.h>
 
-#include <cJSON.h>
-
 #include <vscp-firmware-helper.h>
 #include <vscp.h>
 
+#include "droplet-agg.h"
+#include "droplet-crypto.h"
+#include "droplet-flow.h"
+#include "droplet-frag.h"
+#include "droplet-mesh.h"
+#include "droplet-pool.h"
 #include "vscp-droplet.h"
 
 static const char *TAG = "droplet";
 
-typedef struct {
-  uint16_t frame_head;
-  uint16_t duration;
-  uint8_t destination_address[6];
-  uint8_t source_address[6];
-  uint8_t broadcast_address[6];
-  uint16_t sequence_control;
-
-  uint8_t category_code;
-  uint8_t organization_identifier[3]; // 0x18fe34
-  uint8_t random_values[4];
-  struct {
-    uint8_t element_id;                 // 0xdd
-    uint8_t lenght;                     //
-    uint8_t organization_identifier[3]; // 0x18fe34
-    uint8_t type;                       // 4
-    uint8_t version;
-    uint8_t body[0];
-  } vendor_specific_content;
-} __attribute__((packed)) espnow_frame_format_t;
-
-// ------------------------------------------------
-
-typedef struct {
-  unsigned frame_ctrl : 16;
-  unsigned duration_id : 16;
-  uint8_t addr1[6]; /* receiver address */
-  uint8_t addr2[6]; /* sender address */
-  uint8_t addr3[6]; /* filtering address */
-  unsigned sequence_ctrl : 16;
-  uint8_t addr4[6]; /* optional */
-} wifi_ieee80211_mac_hdr_t;
-
-typedef struct {
-  wifi_ieee80211_mac_hdr_t hdr;
-  uint8_t payload[0]; /* network data ended with 4 bytes csum (CRC32) */
-} wifi_ieee80211_packet_t;
-
 static droplet_config_t s_droplet_config = { 0 };
-static wifi_country_t g_self_country     = { 0 };
 
+// Radio transport in use
+#ifdef ESP_PLATFORM
+static const droplet_transport_t *s_droplet_transport = &g_droplet_transport_espnow;
+#else
+static const droplet_transport_t *s_droplet_transport = NULL;
+#endif
+
+// Default max in-flight window
 #define DROPLET_MAX_BUFFERED_NUM                                                                                       \
   (CONFIG_ESP32_WIFI_DYNAMIC_TX_BUFFER_NUM / 2) /* Not more than CONFIG_ESP32_WIFI_DYNAMIC_TX_BUFFER_NUM */
 
@@ -120,32 +90,100 @@ uint8_t g_droplet_sendSequence = 0;
 
 static EventGroupHandle_t s_droplet_event_group = NULL;
 
-// Number of send events in transit
-uint32_t g_droplet_buffered_num = 0;
+// Frames handed to the radio but not yet confirmed
+static droplet_flow_t s_droplet_flow;
 
 QueueHandle_t g_droplet_rcvqueue = NULL;
 
+// Receive slots. Claimed in the transport callback, returned by the receive task.
+static droplet_pool_t s_droplet_rxpool = { 0 };
+
 #define DROPLET_SEND_CB_OK_BIT            BIT0
 #define DROPLET_SEND_CB_FAIL_BIT          BIT1
+#define DROPLET_TX_SLOT_FREE_BIT          BIT2 // Send task returned a send slot
 #define DROPLET_PROV_CLIENT_GOT_INIT1_BIT BIT4 // Client new node on-line received
 #define DROPLET_PROV_CLIENT_GOT_INIT2_BIT BIT5 // Client probe ack received
 #define DROPLET_PROV_SRV_GOT_PMK_BIT      BIT6 // Provisioning key received
 
-static struct {
-  uint16_t magic;
-} __attribute__((packed)) g_droplet_magic_cache[DROPLET_MSG_CACHE_SIZE] = { 0 };
+// Duplicate filter, ttl and forward handling
+static droplet_mesh_t s_droplet_mesh = { 0 };
+
+// Protects the mesh state. Own frames are entered from the sending task.
+static SemaphoreHandle_t s_droplet_mesh_lock;
+
+// Reassembly of large events. Only used by the receive task.
+static droplet_frag_t s_droplet_frag = { 0 };
+
+// Offset in the VSCP content of a fixed layout frame position
+#define REL(pos) ((pos) - DROPLET_POS_HEAD)
+
+// States of a held forward
+#define DROPLET_FWD_FREE 0 // Entry is free
+#define DROPLET_FWD_WAIT 1 // Waiting for backoff/jitter. Owned by the receive task.
+#define DROPLET_FWD_SEND 2 // Queued for sending. Owned by the send task.
+
+/**
+ * @brief Received frame held before it is forwarded
+ *
+ * The index + 1 is the tag the mesh core keeps in the duplicate filter
+ * entry for the frame so copies that cancel it find it directly.
+ */
+typedef struct __droplet_fwdpkt {
+  atomic_uint_least8_t state; // DROPLET_FWD_xxx
+  uint8_t nRetries;           // Resends after the radio failed to send it
+  TickType_t due;             // Tick count when the forward decision is due
+  uint8_t dst_addr[6];
+  uint8_t len;
+  uint8_t frame[DROPLET_CRYPTO_MAX_PLAIN];
+} droplet_fwdpkt_t;
+
+// Held forwards
+static droplet_fwdpkt_t s_droplet_fwd_pending[DROPLET_FWD_PENDING_SIZE];
 
-static uint8_t g_droplet_magic_cache_next = 0;
+/**
+ * @brief Frame waiting in the send queue
+ */
+typedef struct __droplet_txpkt {
+  uint8_t dest_addr[6];
+  uint8_t prio;
+  size_t len;
+  droplet_tx_done_cb_t cb;
+  void *userdata;
+  uint8_t frame[DROPLET_MAX_ENCRYPTED_FRAME];
+} droplet_txpkt_t;
+
+// Send slots. Claimed by the producers, returned by the send task.
+static droplet_pool_t s_droplet_txpool = { 0 };
+
+// One queue of prepared frames per priority class
+static QueueHandle_t s_droplet_txqueue[DROPLET_TX_PRIO_COUNT];
+
+// Given once for every queued frame. The send task is the only sender.
+static SemaphoreHandle_t s_droplet_txsignal = NULL;
+
+// Broadcast events waiting to be sent together in one aggregate frame
+static uint8_t s_droplet_agg_frame[DROPLET_AGG_MAX_FRAME];
+static size_t s_droplet_agg_len     = 0;
+static TickType_t s_droplet_agg_due = 0;
+
+// Protects the aggregate frame. Filled by the senders, flushed by the send task.
+static SemaphoreHandle_t s_droplet_agg_lock = NULL;
+
+// Event records in aggregate frames use the compact header if enabled
+#define DROPLET_AGG_VERSION (s_droplet_config.bCompactHeader ? DROPLET_VERSION_COMPACT : DROPLET_VERSION)
 
-// This mutex protects the espnow_send as it is NOT thread safe
-static SemaphoreHandle_t droplet_send_lock;
+// Expanded primary key used for all frames sent/received with the pmk
+static droplet_crypto_key_t s_droplet_pmk_key;
+
+// Protects the expanded key as it can be changed during provisioning
+static SemaphoreHandle_t s_droplet_key_lock;
 
 /*!
   The discovery cache holds all nodes this node has discovered by there
   heartbeats.
 */
 // static struct {
-//   uint8_t mac[ESP_NOW_ETH_ALEN];
+//   uint8_t mac[DROPLET_ADDR_LEN];
 // } __attribute__((packed)) g_droplet_discovery_cache[DROPLET_DISCOVERY_CACHE_SIZE] = { 0 };
 
 /**
@@ -160,22 +198,7 @@ typedef struct __droplet_rxpkt {
   uint8_t payload[0];
 } droplet_rxpkt_t;
 
-/**
- * @brief Send and receive statistics
- *
- */
-typedef struct {
-  uint32_t nSend;            // # sent frames
-  uint32_t nSendFailures;    // Number of send failures
-  uint32_t nSendLock;        // Number of send lock give ups
-  uint32_t nSendAck;         // # of failed send confirms
-  uint32_t nRecv;            // # received frames
-  uint32_t nRecvOverruns;    // Number of receive overruns
-  uint32_t nRecvFrameFault;  // Frame to big or to small
-  uint32_t nRecvAdjChFilter; // Adjacent channel filter
-  uint32_t nRecvŔssiFilter;  // RSSI filter stats
-  uint32_t nForw;            // # Number of forwarded frames
-} droplet_stats_t;
+#define DROPLET_RX_SLOT_SIZE (sizeof(droplet_rxpkt_t) + DROPLET_MAX_ENCRYPTED_FRAME)
 
 static droplet_stats_t g_dropletStats = { 0 };
 
@@ -188,9 +211,6 @@ const uint8_t DROPLET_ADDR_BROADCAST[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0XFF }
 // const uint8_t DROPLET_ADDR_GROUP_SEC[6]  = { 'S', 'E', 'C', 0x0, 0x0, 0x0 };
 // const uint8_t DROPLET_ADDR_GROUP_OTA[6]  = { 'O', 'T', 'A', 0x0, 0x0, 0x0 };
 
-static uint8_t s_vscp_zero_guid[16] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-
 // User handler for received droplet frames/events
 static vscp_event_handler_cb_t s_vscp_event_handler_cb = NULL;
 
@@ -211,18 +231,9 @@ static droplet_provisioning_t s_provisionNodeInfo = { 0 };
 static void
 droplet_rcv_task(void *arg);
 static void
-droplet_client_init_task(void *pvParameter);
-static void
 droplet_heartbeat_task(void *pvParameter);
 static void
-droplet_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status);
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
-static void
-droplet_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len);
-#else
-static void
-droplet_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len);
-#endif
+droplet_tx_task(void *arg);
 
 //-----------------------------------------------------------------------------
 //                                Droplet
@@ -237,82 +248,6 @@ droplet_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len);
 //   size_t length  = nvs_get_blob(g_nvsHandle, "discovery-cache", g_droplet_discovery_cache, &length);
 // }
 
-///////////////////////////////////////////////////////////////////////////////
-// wifi_sniffer_packet_type2str
-//
-
-const char *
-wifi_sniffer_packet_type2str(wifi_promiscuous_pkt_type_t type)
-{
-  switch (type) {
-    case WIFI_PKT_MGMT:
-      return "MGMT";
-    case WIFI_PKT_DATA:
-      return "DATA";
-    default:
-    case WIFI_PKT_MISC:
-      return "MISC";
-  }
-}
-
-///////////////////////////////////////////////////////////////////////////////
-// promiscuous_rx_cb
-//
-
-void
-promiscuous_rx_cb(void *buf, wifi_promiscuous_pkt_type_t type)
-{
-
-  /*! All espnow traffic uses action frames which are a subtype of the
-    mgmnt frames so filter out everything else.
-  */
-  if (type != WIFI_PKT_MGMT) {
-    return;
-  }
-
-  static const uint8_t ACTION_SUBTYPE  = 0xd0;
-  static const uint8_t ESPRESSIF_OUI[] = { 0x18, 0xfe, 0x34 };
-
-  const wifi_promiscuous_pkt_t *ppkt  = (wifi_promiscuous_pkt_t *) buf;
-  const wifi_ieee80211_packet_t *ipkt = (wifi_ieee80211_packet_t *) ppkt->payload;
-  const wifi_ieee80211_mac_hdr_t *hdr = &ipkt->hdr;
-
-  // printf("PACKET TYPE=%s, CHAN=%02d, RSSI=%02d,"
-  //        " ADDR1=%02x:%02x:%02x:%02x:%02x:%02x,"
-  //        " ADDR2=%02x:%02x:%02x:%02x:%02x:%02x,"
-  //        " ADDR3=%02x:%02x:%02x:%02x:%02x:%02x\n",
-  //        wifi_sniffer_packet_type2str(type),
-  //        ppkt->rx_ctrl.channel,
-  //        ppkt->rx_ctrl.rssi,
-  //        /* ADDR1 */
-  //        hdr->addr1[0],
-  //        hdr->addr1[1],
-  //        hdr->addr1[2],
-  //        hdr->addr1[3],
-  //        hdr->addr1[4],
-  //        hdr->addr1[5],
-  //        /* ADDR2 */
-  //        hdr->addr2[0],
-  //        hdr->addr2[1],
-  //        hdr->addr2[2],
-  //        hdr->addr2[3],
-  //        hdr->addr2[4],
-  //        hdr->addr2[5],
-  //        /* ADDR3 */
-  //        hdr->addr3[0],
-  //        hdr->addr3[1],
-  //        hdr->addr3[2],
-  //        hdr->addr3[3],
-  //        hdr->addr3[4],
-  //        hdr->addr3[5]);
-
-  // Only continue processing if this is an action frame containing the Espressif OUI.
-  if ((ACTION_SUBTYPE == (hdr->frame_ctrl & 0xFF)) && (memcmp(hdr->addr4, ESPRESSIF_OUI, 3) == 0)) {
-    int rssi = ppkt->rx_ctrl.rssi;
-    printf("-------------------------------> %d", rssi);
-  }
-}
-
 // ----------------------------------------------------------------------------
 //                                  VSCP
 // ----------------------------------------------------------------------------
@@ -339,7 +274,7 @@ droplet_build_guid_from_mac(uint8_t *pguid, const uint8_t *pmac, uint16_t nickna
   }
 
   memcpy(pguid, prebytes, 8);
-  memcpy(pguid + 8, pmac, ESP_NOW_ETH_ALEN);
+  memcpy(pguid + 8, pmac, DROPLET_ADDR_LEN);
   pguid[14] = (nickname << 8) & 0xff;
   pguid[15] = nickname & 0xff;
 
@@ -407,6 +342,8 @@ droplet_build_l1_heartbeat(uint8_t *buf, uint8_t len, const uint8_t *pguid)
 int
 droplet_build_l2_heartbeat(uint8_t *buf, uint8_t len, const uint8_t *pguid, const char *name)
 {
+  (void) name;
+
   // Need a buffer
   if (NULL == buf) {
     ESP_LOGE(TAG, "Pointer to buffer is NULL");
@@ -485,24 +422,260 @@ droplet_getMinBufSizeEx(vscpEventEx *pex)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// droplet_evToFrame
+// droplet_put_varint
+//
+// Seven bits per byte, least significant first. High bit set if more
+// bytes follow. Returns bytes written or zero if there is no room.
 //
 
-int
-droplet_evToFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev)
+static size_t
+droplet_put_varint(uint8_t *buf, size_t len, uint16_t val)
 {
-  // Need a buffer
-  if (NULL == buf) {
-    ESP_LOGE(TAG, "Pointer to buffer is NULL");
-    return VSCP_ERROR_INVALID_POINTER;
+  size_t pos = 0;
+
+  do {
+    if (pos >= len) {
+      return 0;
+    }
+    buf[pos++] = (val & 0x7f) | ((val > 0x7f) ? 0x80 : 0);
+    val >>= 7;
+  } while (val);
+
+  return pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_get_varint
+//
+// Returns bytes used or zero if the varint is truncated or too large.
+//
+
+static size_t
+droplet_get_varint(const uint8_t *buf, size_t len, uint16_t *pval)
+{
+  uint32_t val = 0;
+
+  for (size_t pos = 0; (pos < len) && (pos < 3); pos++) {
+    val |= (uint32_t) (buf[pos] & 0x7f) << (7 * pos);
+    if (!(buf[pos] & 0x80)) {
+      if (val > 0xffff) {
+        return 0;
+      }
+      *pval = (uint16_t) val;
+      return pos + 1;
+    }
   }
 
-  // Need event
-  if (NULL == pev) {
-    ESP_LOGE(TAG, "Pointer to event is NULL");
-    return VSCP_ERROR_INVALID_POINTER;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_buildVscp
+//
+
+size_t
+droplet_buildVscp(uint8_t *buf, size_t len, const vscpEvent *pev, uint8_t version)
+{
+  size_t pos = 0;
+  size_t n;
+
+  if ((NULL == buf) || (NULL == pev) || (pev->sizeData > DROPLET_MAX_DATA) || (pev->sizeData && (NULL == pev->pdata))) {
+    return 0;
+  }
+
+  if (DROPLET_VERSION == version) {
+    if (len < (DROPLET_POS_DATA - DROPLET_POS_HEAD)) {
+      return 0;
+    }
+    buf[REL(DROPLET_POS_HEAD)]         = (pev->head >> 8) & 0xff;
+    buf[REL(DROPLET_POS_HEAD) + 1]     = pev->head & 0xff;
+    buf[REL(DROPLET_POS_NICKNAME)]     = pev->GUID[14];
+    buf[REL(DROPLET_POS_NICKNAME) + 1] = pev->GUID[15];
+    buf[REL(DROPLET_POS_CLASS)]        = (pev->vscp_class >> 8) & 0xff;
+    buf[REL(DROPLET_POS_CLASS) + 1]    = pev->vscp_class & 0xff;
+    buf[REL(DROPLET_POS_TYPE)]         = (pev->vscp_type >> 8) & 0xff;
+    buf[REL(DROPLET_POS_TYPE) + 1]     = pev->vscp_type & 0xff;
+    pos                                = REL(DROPLET_POS_SIZE);
+  }
+  else if (DROPLET_VERSION_COMPACT == version) {
+    if (len < 2) {
+      return 0;
+    }
+    buf[0] = 0;
+    buf[1] = pev->head & 0xff;
+    pos    = 2;
+
+    if (pev->head & 0xff00) {
+      if (pos >= len) {
+        return 0;
+      }
+      buf[0] |= DROPLET_COMPACT_FLAG_HEAD_MSB;
+      buf[pos++] = (pev->head >> 8) & 0xff;
+    }
+
+    if (pev->GUID[14] || pev->GUID[15]) {
+      if ((pos + 2) > len) {
+        return 0;
+      }
+      buf[0] |= DROPLET_COMPACT_FLAG_NICKNAME;
+      buf[pos++] = pev->GUID[14];
+      buf[pos++] = pev->GUID[15];
+    }
+
+    if (0 == (n = droplet_put_varint(buf + pos, len - pos, pev->vscp_class))) {
+      return 0;
+    }
+    pos += n;
+
+    if (0 == (n = droplet_put_varint(buf + pos, len - pos, pev->vscp_type))) {
+      return 0;
+    }
+    pos += n;
+  }
+  else {
+    return 0;
+  }
+
+  if ((pos + 1 + pev->sizeData) > len) {
+    return 0;
+  }
+
+  buf[pos++] = pev->sizeData;
+  if (pev->sizeData) {
+    memcpy(buf + pos, pev->pdata, pev->sizeData);
+  }
+
+  return pos + pev->sizeData;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_parseVscp
+//
+
+size_t
+droplet_parseVscp(vscpEvent *pev, const uint8_t *buf, size_t len, uint8_t version)
+{
+  size_t pos = 0;
+  size_t n;
+
+  if ((NULL == pev) || (NULL == buf)) {
+    return 0;
+  }
+
+  if (DROPLET_VERSION == version) {
+    if (len < (DROPLET_POS_DATA - DROPLET_POS_HEAD)) {
+      return 0;
+    }
+    pev->head       = (buf[REL(DROPLET_POS_HEAD)] << 8) + buf[REL(DROPLET_POS_HEAD) + 1];
+    pev->GUID[14]   = buf[REL(DROPLET_POS_NICKNAME)];
+    pev->GUID[15]   = buf[REL(DROPLET_POS_NICKNAME) + 1];
+    pev->vscp_class = (buf[REL(DROPLET_POS_CLASS)] << 8) + buf[REL(DROPLET_POS_CLASS) + 1];
+    pev->vscp_type  = (buf[REL(DROPLET_POS_TYPE)] << 8) + buf[REL(DROPLET_POS_TYPE) + 1];
+    pos             = REL(DROPLET_POS_SIZE);
+  }
+  else if (DROPLET_VERSION_COMPACT == version) {
+    // Unknown flags are from a later version we can't read
+    if ((len < 2) || (buf[0] & ~(DROPLET_COMPACT_FLAG_HEAD_MSB | DROPLET_COMPACT_FLAG_NICKNAME))) {
+      return 0;
+    }
+    uint8_t flags = buf[0];
+    pev->head     = buf[1];
+    pev->GUID[14] = 0;
+    pev->GUID[15] = 0;
+    pos           = 2;
+
+    if (flags & DROPLET_COMPACT_FLAG_HEAD_MSB) {
+      if (pos >= len) {
+        return 0;
+      }
+      pev->head |= buf[pos++] << 8;
+    }
+
+    if (flags & DROPLET_COMPACT_FLAG_NICKNAME) {
+      if ((pos + 2) > len) {
+        return 0;
+      }
+      pev->GUID[14] = buf[pos++];
+      pev->GUID[15] = buf[pos++];
+    }
+
+    if (0 == (n = droplet_get_varint(buf + pos, len - pos, &pev->vscp_class))) {
+      return 0;
+    }
+    pos += n;
+
+    if (0 == (n = droplet_get_varint(buf + pos, len - pos, &pev->vscp_type))) {
+      return 0;
+    }
+    pos += n;
+  }
+  else {
+    return 0;
+  }
+
+  // Size byte tells real size, frame may be padded after decryption.
+  // A frame that is shorter than its size byte says is invalid.
+  if ((pos >= len) || (buf[pos] > (len - pos - 1))) {
+    return 0;
+  }
+
+  pev->sizeData = buf[pos];
+  pos++;
+  pev->pdata    = pev->sizeData ? (uint8_t *) (buf + pos) : NULL;
+
+  return pos + pev->sizeData;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_getFrameLen
+//
+
+size_t
+droplet_getFrameLen(const uint8_t *buf, size_t len)
+{
+  vscpEvent ev;
+  size_t n;
+
+  if ((NULL == buf) || (len <= DROPLET_POS_HEAD)) {
+    return 0;
+  }
+
+  if (buf[DROPLET_POS_PKT_TYPE] & DROPLET_PKT_TYPE_AGGREGATE) {
+    if (len < DROPLET_POS_AGG_RECORDS) {
+      return 0;
+    }
+    n = DROPLET_POS_AGG_RECORDS + buf[DROPLET_POS_AGG_LEN];
+    return (n <= len) ? n : 0;
+  }
+
+  if (buf[DROPLET_POS_PKT_TYPE] & DROPLET_PKT_TYPE_FRAGMENT) {
+    if (len < DROPLET_POS_FRAG_PAYLOAD) {
+      return 0;
+    }
+    n = DROPLET_POS_FRAG_PAYLOAD + buf[DROPLET_POS_FRAG_LEN];
+    return (n <= len) ? n : 0;
   }
 
+  if (0 == (n = droplet_parseVscp(&ev, buf + DROPLET_POS_HEAD, len - DROPLET_POS_HEAD, DROPLET_FRAME_VERSION(buf)))) {
+    return 0;
+  }
+
+  return DROPLET_POS_HEAD + n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_buildFrame
+//
+// Frame for an event. The compact header is used if enabled and shorter.
+//
+
+static int
+droplet_buildFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev)
+{
+  size_t n;
+  size_t sizeFixed = DROPLET_POS_DATA - DROPLET_POS_HEAD + pev->sizeData;
+  uint8_t version  = DROPLET_VERSION;
+
   // Must have room for frame
   if (len < (DROPLET_MIN_FRAME + pev->sizeData)) {
     ESP_LOGE(TAG, "Size of buffer is to small to fit event, len:%d", len);
@@ -511,30 +684,48 @@ droplet_evToFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev)
 
   memset(buf, 0, len);
 
-  buf[DROPLET_POS_PKT_TYPE] = (PRJDEF_NODE_TYPE << 4) + VSCP_ENCRYPTION_AES128;
+  if (s_droplet_config.bCompactHeader) {
+    n = droplet_buildVscp(buf + DROPLET_POS_HEAD, len - DROPLET_POS_HEAD, pev, DROPLET_VERSION_COMPACT);
+    if (n && (n < sizeFixed)) {
+      version = DROPLET_VERSION_COMPACT;
+    }
+  }
 
-  // head
-  buf[DROPLET_POS_HEAD] = (pev->head >> 8) & 0xff;
-  buf[DROPLET_POS_HEAD] = pev->head & 0xff;
+  if (DROPLET_VERSION == version) {
+    memset(buf + DROPLET_POS_HEAD, 0, len - DROPLET_POS_HEAD);
+    if (0 == droplet_buildVscp(buf + DROPLET_POS_HEAD, len - DROPLET_POS_HEAD, pev, DROPLET_VERSION)) {
+      ESP_LOGE(TAG, "Invalid event");
+      return VSCP_ERROR_PARAMETER;
+    }
+  }
 
-  // nickname
-  buf[DROPLET_POS_NICKNAME]     = pev->GUID[14];
-  buf[DROPLET_POS_NICKNAME + 1] = pev->GUID[15];
+  buf[DROPLET_POS_ID]       = DROPLET_ID_MSB;
+  buf[DROPLET_POS_ID + 1]   = DROPLET_ID_LSB + version;
+  buf[DROPLET_POS_PKT_TYPE] = (PRJDEF_NODE_TYPE << 4) + VSCP_ENCRYPTION_AES128;
 
-  // vscp-class
-  buf[DROPLET_POS_CLASS]     = (pev->vscp_class >> 8) & 0xff;
-  buf[DROPLET_POS_CLASS + 1] = pev->vscp_class & 0xff;
+  return VSCP_ERROR_SUCCESS;
+}
 
-  // vscp-type
-  buf[DROPLET_POS_TYPE]     = (pev->vscp_type >> 8) & 0xff;
-  buf[DROPLET_POS_TYPE + 1] = pev->vscp_type & 0xff;
+///////////////////////////////////////////////////////////////////////////////
+// droplet_evToFrame
+//
 
-  // data
-  if (pev->sizeData) {
-    memcpy((buf + DROPLET_POS_DATA), pev->pdata, pev->sizeData);
+int
+droplet_evToFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev)
+{
+  // Need a buffer
+  if (NULL == buf) {
+    ESP_LOGE(TAG, "Pointer to buffer is NULL");
+    return VSCP_ERROR_INVALID_POINTER;
   }
 
-  return VSCP_ERROR_SUCCESS;
+  // Need event
+  if (NULL == pev) {
+    ESP_LOGE(TAG, "Pointer to event is NULL");
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  return droplet_buildFrame(buf, len, pev);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -544,6 +735,8 @@ droplet_evToFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev)
 int
 droplet_exToFrame(uint8_t *buf, uint8_t len, const vscpEventEx *pex)
 {
+  vscpEvent ev;
+
   // Need a buffer
   if (NULL == buf) {
     ESP_LOGE(TAG, "Pointer to buffer is NULL");
@@ -556,33 +749,41 @@ droplet_exToFrame(uint8_t *buf, uint8_t len, const vscpEventEx *pex)
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // Must have room for frame
-  if (len < (DROPLET_MIN_FRAME + pex->sizeData)) {
-    ESP_LOGE(TAG, "Size of buffer is to small to fit event, len:%d", len);
-    return VSCP_ERROR_PARAMETER;
-  }
-
-  memset(buf, 0, len);
-
-  // head
-  buf[DROPLET_POS_HEAD]     = (pex->head >> 8) & 0xff;
-  buf[DROPLET_POS_HEAD + 1] = pex->head & 0xff;
+  // Event view on the ex data
+  memset(&ev, 0, sizeof(ev));
+  ev.head       = pex->head;
+  ev.vscp_class = pex->vscp_class;
+  ev.vscp_type  = pex->vscp_type;
+  ev.sizeData   = pex->sizeData;
+  ev.pdata      = (uint8_t *) pex->data;
+  memcpy(ev.GUID, pex->GUID, 16);
 
-  // nickname
-  buf[DROPLET_POS_NICKNAME]     = pex->GUID[14];
-  buf[DROPLET_POS_NICKNAME + 1] = pex->GUID[15];
+  return droplet_buildFrame(buf, len, &ev);
+}
 
-  // vscp-class
-  buf[DROPLET_POS_CLASS]     = (pex->vscp_class >> 8) & 0xff;
-  buf[DROPLET_POS_CLASS + 1] = pex->vscp_class & 0xff;
+///////////////////////////////////////////////////////////////////////////////
+// droplet_checkFrame
+//
+// Validate id and packet type of a single event frame and decode its
+// VSCP content.
+//
 
-  // vscp-type
-  buf[DROPLET_POS_TYPE]     = (pex->vscp_type >> 8) & 0xff;
-  buf[DROPLET_POS_TYPE + 1] = pex->vscp_type & 0xff;
+static int
+droplet_checkFrame(vscpEvent *pev, const uint8_t *buf, uint8_t len)
+{
+  // Must be at least have min size
+  if ((NULL == buf) || (len < DROPLET_COMPACT_MIN_FRAME)) {
+    ESP_LOGE(TAG, "esp-now data is too short, len:%d", len);
+    return VSCP_ERROR_MTU;
+  }
 
-  // data
-  if (pex->sizeData) {
-    memcpy((buf + DROPLET_POS_DATA), pex->data, pex->sizeData);
+  // Must have valid paket type byte
+  if ((buf[DROPLET_POS_ID] != DROPLET_ID_MSB) || ((buf[DROPLET_POS_ID + 1] & 0xf0) != 0xA0) ||
+      ((buf[DROPLET_POS_PKT_TYPE] & 0x0f) > VSCP_ENCRYPTION_AES256) || DROPLET_IS_AGGREGATE(buf) ||
+      DROPLET_IS_FRAGMENT(buf) ||
+      (0 == droplet_parseVscp(pev, buf + DROPLET_POS_HEAD, len - DROPLET_POS_HEAD, DROPLET_FRAME_VERSION(buf)))) {
+    ESP_LOGE(TAG, "esp-now data is an invalid frame");
+    return VSCP_ERROR_INVALID_FRAME;
   }
 
   return VSCP_ERROR_SUCCESS;
@@ -595,44 +796,33 @@ droplet_exToFrame(uint8_t *buf, uint8_t len, const vscpEventEx *pex)
 int
 droplet_frameToEv(vscpEvent *pev, const uint8_t *buf, uint8_t len, uint32_t timestamp)
 {
+  int rv;
+  vscpEvent view;
+
   // Need event
   if (NULL == pev) {
     ESP_LOGE(TAG, "Pointer to event is NULL");
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // Must be at least have min size
-  if (len < DROPLET_MIN_FRAME) {
-    ESP_LOGE(TAG, "esp-now data is too short, len:%d", len);
-    return VSCP_ERROR_MTU;
-  }
-
-  // Must have valid paket type byte
-  if ((buf[DROPLET_POS_ID] != 0x55) || ((buf[DROPLET_POS_ID + 1] & 0xf0) != 0xA0) ||
-      ((buf[DROPLET_POS_PKT_TYPE] & 0x0f) > VSCP_ENCRYPTION_AES256)) {
-    ESP_LOGE(TAG, "esp-now data is an invalid frame");
-    return VSCP_ERROR_INVALID_FRAME;
+  memset(&view, 0, sizeof(vscpEvent));
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_checkFrame(&view, buf, len))) {
+    return rv;
   }
 
   memset(pev, 0, sizeof(vscpEvent));
 
-  // Free any allocated event data
-  if (NULL != pev->pdata) {
-    VSCP_FREE(pev->pdata);
-    pev->pdata = NULL;
-  }
-
   // Set VSCP size
-  pev->sizeData = len - DROPLET_MIN_FRAME;
+  pev->sizeData = view.sizeData;
   if (pev->sizeData) {
     pev->pdata = VSCP_MALLOC(pev->sizeData);
     if (NULL == pev->pdata) {
       return VSCP_ERROR_MEMORY;
     }
-  }
 
-  // Copy in VSCP data
-  memcpy(pev->pdata, buf + DROPLET_MIN_FRAME, pev->sizeData);
+    // Copy in VSCP data
+    memcpy(pev->pdata, view.pdata, pev->sizeData);
+  }
 
   // Set timestamp if not set
   if (!timestamp) {
@@ -642,18 +832,44 @@ droplet_frameToEv(vscpEvent *pev, const uint8_t *buf, uint8_t len, uint32_t time
     pev->timestamp = timestamp;
   }
 
-  // Head
-  pev->head = (buf[DROPLET_POS_HEAD] << 8) + buf[DROPLET_POS_HEAD + 1];
+  pev->head       = view.head;
+  pev->GUID[14]   = view.GUID[14];
+  pev->GUID[15]   = view.GUID[15];
+  pev->vscp_class = view.vscp_class;
+  pev->vscp_type  = view.vscp_type;
 
-  // Nickname
-  pev->GUID[14] = buf[DROPLET_POS_NICKNAME];
-  pev->GUID[15] = buf[DROPLET_POS_NICKNAME + 1];
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frameToEvView
+//
+
+int
+droplet_frameToEvView(vscpEvent *pev, uint8_t *buf, uint8_t len, uint32_t timestamp)
+{
+  int rv;
+
+  // Need event
+  if (NULL == pev) {
+    ESP_LOGE(TAG, "Pointer to event is NULL");
+    return VSCP_ERROR_INVALID_POINTER;
+  }
+
+  memset(pev, 0, sizeof(vscpEvent));
 
-  // VSCP class
-  pev->vscp_class = (buf[DROPLET_POS_CLASS] << 8) + buf[DROPLET_POS_CLASS + 1];
+  // Data pointer is set to the data in the frame
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_checkFrame(pev, buf, len))) {
+    return rv;
+  }
 
-  // VSCP type
-  pev->vscp_type = (buf[DROPLET_POS_TYPE] << 8) + buf[DROPLET_POS_TYPE + 1];
+  // Set timestamp if not set
+  if (!timestamp) {
+    pev->timestamp = esp_timer_get_time();
+  }
+  else {
+    pev->timestamp = timestamp;
+  }
 
   return VSCP_ERROR_SUCCESS;
 }
@@ -665,31 +881,27 @@ droplet_frameToEv(vscpEvent *pev, const uint8_t *buf, uint8_t len, uint32_t time
 int
 droplet_frameToEx(vscpEventEx *pex, const uint8_t *buf, uint8_t len, uint32_t timestamp)
 {
+  int rv;
+  vscpEvent view;
+
   // Need event
   if (NULL == pex) {
     ESP_LOGE(TAG, "Pointer to event is NULL");
     return VSCP_ERROR_INVALID_POINTER;
   }
 
-  // Must at least have min size
-  if (len < DROPLET_MIN_FRAME) {
-    ESP_LOGE(TAG, "esp-now data is too short, len:%d", len);
-    return VSCP_ERROR_MTU;
-  }
-
-  // Must have valid first byte
-  if ((buf[0] & 0xff) > VSCP_ENCRYPTION_AES256) {
-    ESP_LOGE(TAG, "esp-now data is an invalid frame");
-    return VSCP_ERROR_MTU;
+  memset(&view, 0, sizeof(vscpEvent));
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_checkFrame(&view, buf, len))) {
+    return rv;
   }
 
   memset(pex, 0, sizeof(vscpEventEx));
 
-  // Set VSCP size
-  pex->sizeData = len - DROPLET_MIN_FRAME;
-
   // Copy in VSCP data
-  memcpy(pex->data, buf + DROPLET_MIN_FRAME, pex->sizeData);
+  pex->sizeData = view.sizeData;
+  if (pex->sizeData) {
+    memcpy(pex->data, view.pdata, pex->sizeData);
+  }
 
   // Set timestamp if not set
   if (!timestamp) {
@@ -699,20 +911,214 @@ droplet_frameToEx(vscpEventEx *pex, const uint8_t *buf, uint8_t len, uint32_t ti
     pex->timestamp = timestamp;
   }
 
-  // Head
-  pex->head = (buf[DROPLET_POS_HEAD] << 8) + buf[DROPLET_POS_HEAD + 1];
+  pex->head       = view.head;
+  pex->GUID[14]   = view.GUID[14];
+  pex->GUID[15]   = view.GUID[15];
+  pex->vscp_class = view.vscp_class;
+  pex->vscp_type  = view.vscp_type;
 
-  // Nickname
-  pex->GUID[14] = buf[DROPLET_POS_NICKNAME];
-  pex->GUID[15] = buf[DROPLET_POS_NICKNAME + 1];
+  return VSCP_ERROR_SUCCESS;
+}
 
-  // VSCP class
-  pex->vscp_class = (buf[DROPLET_POS_CLASS] << 8) + buf[DROPLET_POS_CLASS + 1];
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_enabled
+//
+// Only broadcasts using the primary key can share a frame
+//
 
-  // VSCP type
-  pex->vscp_type = (buf[DROPLET_POS_TYPE] << 8) + buf[DROPLET_POS_TYPE + 1];
+static bool
+droplet_agg_enabled(const uint8_t *destAddr, const uint8_t *pkey)
+{
+  return s_droplet_config.aggLinger && (NULL != s_droplet_agg_lock) &&
+         !memcmp(destAddr, DROPLET_ADDR_BROADCAST, DROPLET_ADDR_LEN) &&
+         ((NULL == pkey) || (pkey == s_droplet_config.pmk));
+}
 
-  return VSCP_ERROR_SUCCESS;
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_flush
+//
+// Send the pending aggregate frame. Must be called with the aggregate
+// lock held. The aggregate is kept for another try if the send queue is
+// full (ESP_ERR_NO_MEM) and dropped on any other error.
+//
+
+static esp_err_t
+droplet_agg_flush(uint32_t wait_ms)
+{
+  esp_err_t ret;
+  uint8_t frame[DROPLET_AGG_MAX_FRAME];
+  size_t len = s_droplet_agg_len;
+
+  if (0 == s_droplet_agg_frame[DROPLET_POS_AGG_COUNT]) {
+    return ESP_OK;
+  }
+
+  // Finished in a copy as a single event is unwrapped to a normal frame
+  memcpy(frame, s_droplet_agg_frame, len);
+  int cnt = droplet_agg_finish(frame, &len);
+
+  if (ESP_OK != (ret = droplet_send(DROPLET_ADDR_BROADCAST,
+                                    false,
+                                    s_droplet_config.nEncryption,
+                                    s_droplet_config.pmk,
+                                    s_droplet_config.ttl,
+                                    frame,
+                                    len,
+                                    wait_ms))) {
+    if (ESP_ERR_NO_MEM == ret) {
+      return ret;
+    }
+    ESP_LOGE(TAG, "Failed to send aggregate frame, %d events dropped. rv=%X", cnt, (int) ret);
+    // A frame that failed to encrypt is counted by droplet_tx_enqueue
+    if (ESP_FAIL != ret) {
+      g_dropletStats.nSendFailures++; // Update send failures
+    }
+  }
+  else if (cnt > 1) {
+    g_dropletStats.nAggSent++;
+    g_dropletStats.nAggEvents += cnt;
+  }
+
+  s_droplet_agg_len = droplet_agg_init(s_droplet_agg_frame, PRJDEF_NODE_TYPE, DROPLET_AGG_VERSION);
+  return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_queue
+//
+// Add an event frame to the pending aggregate. The aggregate is sent by
+// the send task when the linger time is over or here when it is full.
+//
+
+static esp_err_t
+droplet_agg_queue(const uint8_t *evframe, size_t evlen, uint32_t wait_ms)
+{
+  int rv;
+  esp_err_t ret;
+  bool bFirst;
+
+  xSemaphoreTake(s_droplet_agg_lock, portMAX_DELAY);
+
+  rv = droplet_agg_add(s_droplet_agg_frame, &s_droplet_agg_len, DROPLET_AGG_MAX_FRAME, evframe, evlen);
+  if (VSCP_ERROR_BUFFER_TO_SMALL == rv) {
+    // Full. Send what we have and start a new one.
+    if (ESP_ERR_NO_MEM == (ret = droplet_agg_flush(wait_ms))) {
+      xSemaphoreGive(s_droplet_agg_lock);
+      return ret;
+    }
+    rv = droplet_agg_add(s_droplet_agg_frame, &s_droplet_agg_len, DROPLET_AGG_MAX_FRAME, evframe, evlen);
+  }
+
+  if (VSCP_ERROR_SUCCESS != rv) {
+    xSemaphoreGive(s_droplet_agg_lock);
+    ESP_LOGE(TAG, "Failed to add event to aggregate frame. rv=%d", rv);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  bFirst = (1 == s_droplet_agg_frame[DROPLET_POS_AGG_COUNT]);
+  if (bFirst) {
+    s_droplet_agg_due = xTaskGetTickCount() + pdMS_TO_TICKS(s_droplet_config.aggLinger + portTICK_PERIOD_MS - 1);
+  }
+
+  xSemaphoreGive(s_droplet_agg_lock);
+
+  // Let the send task pick up the new deadline
+  if (bFirst) {
+    xSemaphoreGive(s_droplet_txsignal);
+  }
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_agg_run
+//
+// Called by the send task. Sends the aggregate when its linger time is
+// over and returns the number of ticks until it is due.
+//
+
+static TickType_t
+droplet_agg_run(void)
+{
+  TickType_t wait = portMAX_DELAY;
+
+  if (NULL == s_droplet_agg_lock) {
+    return wait;
+  }
+
+  // A sender holding the lock may be waiting for us to free a send slot
+  if (pdTRUE != xSemaphoreTake(s_droplet_agg_lock, 0)) {
+    return 1;
+  }
+
+  if (s_droplet_agg_frame[DROPLET_POS_AGG_COUNT]) {
+    TickType_t left = s_droplet_agg_due - xTaskGetTickCount();
+    if ((int32_t) left > 0) {
+      wait = left;
+    }
+    else if (ESP_ERR_NO_MEM == droplet_agg_flush(0)) {
+      wait = 1; // Send queue is full. Try again on next tick.
+    }
+  }
+
+  xSemaphoreGive(s_droplet_agg_lock);
+  return wait;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_send_fragmented
+//
+// Send an event with more data than fits in one frame as a number of
+// fragment frames. They are never aggregated.
+//
+
+static esp_err_t
+droplet_send_fragmented(const uint8_t *destAddr, const vscpEvent *pev, const uint8_t *pkey, uint32_t wait_ms)
+{
+  esp_err_t rv = ESP_OK;
+  size_t msglen;
+  uint16_t msgid;
+  uint8_t *pmsg;
+  uint8_t frame[DROPLET_AGG_MAX_FRAME];
+  uint8_t version = s_droplet_config.bCompactHeader ? DROPLET_VERSION_COMPACT : DROPLET_VERSION;
+
+  if (pev->sizeData > DROPLET_MAX_FRAG_DATA) {
+    ESP_LOGE(TAG, "Event data is too large, size:%d", pev->sizeData);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  pmsg = VSCP_MALLOC(DROPLET_FRAG_MAX_MSG);
+  if (NULL == pmsg) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (0 == (msglen = droplet_frag_message(pmsg, DROPLET_FRAG_MAX_MSG, pev, version))) {
+    VSCP_FREE(pmsg);
+    ESP_LOGE(TAG, "Invalid event");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  esp_fill_random(&msgid, sizeof(msgid));
+
+  uint8_t count = droplet_frag_count(msglen);
+  for (uint8_t i = 0; i < count; i++) {
+    size_t len = droplet_frag_build(frame, pmsg, msglen, msgid, i, PRJDEF_NODE_TYPE, version);
+    if (ESP_OK != (rv = droplet_send(destAddr,
+                                     false,
+                                     s_droplet_config.nEncryption,
+                                     (pkey != NULL) ? pkey : s_droplet_config.pmk,
+                                     s_droplet_config.ttl,
+                                     frame,
+                                     len,
+                                     wait_ms))) {
+      ESP_LOGE(TAG, "Failed to send fragment %d of %d. rv=%X", i, count, rv);
+      break;
+    }
+    g_dropletStats.nFragSent++;
+  }
+
+  VSCP_FREE(pmsg);
+  return rv;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -723,7 +1129,7 @@ esp_err_t
 droplet_sendEvent(const uint8_t *destAddr, const vscpEvent *pev, const uint8_t *pkey, uint32_t wait_ms)
 {
   esp_err_t rv;
-  uint8_t *pbuf = NULL;
+  uint8_t frame[DROPLET_MAX_FRAME]; // Queued by copy, so no heap needed
 
   // Need event
   if (NULL == pev) {
@@ -731,35 +1137,40 @@ droplet_sendEvent(const uint8_t *destAddr, const vscpEvent *pev, const uint8_t *
     return ESP_ERR_INVALID_ARG;
   }
 
-  pbuf = VSCP_MALLOC(DROPLET_MIN_FRAME + pev->sizeData);
-  if (NULL == pbuf) {
-    return ESP_ERR_NO_MEM;
+  // Too large for one frame
+  if (pev->sizeData > DROPLET_MAX_DATA) {
+    return droplet_send_fragmented(destAddr, pev, pkey, wait_ms);
   }
 
-  if (VSCP_ERROR_SUCCESS != (rv = droplet_evToFrame(pbuf, DROPLET_MIN_FRAME + pev->sizeData, pev))) {
-    VSCP_FREE(pbuf);
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_evToFrame(frame, DROPLET_MIN_FRAME + pev->sizeData, pev))) {
     ESP_LOGE(TAG, "Failed to convert event to frame. rv=%d", rv);
     return rv;
   }
 
+  // Compact header makes the frame shorter than the buffer
+  size_t len = droplet_getFrameLen(frame, DROPLET_MIN_FRAME + pev->sizeData);
+
   ESP_LOGI(TAG, "Send mac: " MACSTR ", version: %d", MAC2STR(destAddr), DROPLET_VERSION);
 
+  // Broadcasts with the primary key are sent in an aggregate frame
+  if (droplet_agg_enabled(destAddr, pkey)) {
+    return droplet_agg_queue(frame, len, wait_ms);
+  }
+
   if (ESP_OK != (rv = droplet_send(destAddr, //DROPLET_ADDR_BROADCAST,
                                    false,
                                    s_droplet_config.nEncryption,
                                    (pkey != NULL) ? pkey : s_droplet_config.pmk,
                                    s_droplet_config.ttl,
-                                   pbuf,
-                                   DROPLET_MIN_FRAME + pev->sizeData,
+                                   frame,
+                                   len,
                                    wait_ms))) {
     ESP_LOGE(TAG, "Failed to send event. rv=%X", rv);
-    VSCP_FREE(pbuf);
     return rv;
   }
 
   ESP_LOGI(TAG, "Event sent OK");
 
-  VSCP_FREE(pbuf);
   return ESP_OK;
 }
 
@@ -771,7 +1182,7 @@ esp_err_t
 droplet_sendEventEx(const uint8_t *destAddr, const vscpEventEx *pex, const uint8_t *pkey, uint32_t wait_ms)
 {
   esp_err_t rv;
-  uint8_t *pbuf;
+  uint8_t frame[DROPLET_MAX_FRAME]; // Queued by copy, so no heap needed
 
   ESP_LOGI(TAG, "Send Event");
 
@@ -781,107 +1192,515 @@ droplet_sendEventEx(const uint8_t *destAddr, const vscpEventEx *pex, const uint8
     return ESP_ERR_INVALID_ARG;
   }
 
-  pbuf = VSCP_MALLOC(DROPLET_MIN_FRAME + pex->sizeData);
-  if (NULL == pbuf) {
-    return ESP_ERR_NO_MEM;
+  // Too large for one frame
+  if (pex->sizeData > DROPLET_MAX_DATA) {
+    vscpEvent ev;
+    memset(&ev, 0, sizeof(vscpEvent));
+    ev.head       = pex->head;
+    ev.vscp_class = pex->vscp_class;
+    ev.vscp_type  = pex->vscp_type;
+    ev.sizeData   = pex->sizeData;
+    ev.pdata      = (uint8_t *) pex->data;
+    memcpy(ev.GUID, pex->GUID, 16);
+    return droplet_send_fragmented(destAddr, &ev, pkey, wait_ms);
   }
 
-  if (VSCP_ERROR_SUCCESS != (rv = droplet_exToFrame(pbuf, DROPLET_MIN_FRAME + pex->sizeData, pex))) {
-    VSCP_FREE(pbuf);
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_exToFrame(frame, DROPLET_MIN_FRAME + pex->sizeData, pex))) {
     ESP_LOGE(TAG, "Failed to convert event to frame. rv=%d", rv);
     return ESP_ERR_INVALID_ARG;
   }
 
+  // Compact header makes the frame shorter than the buffer
+  size_t len = droplet_getFrameLen(frame, DROPLET_MIN_FRAME + pex->sizeData);
+
+  // Broadcasts with the primary key are sent in an aggregate frame
+  if (droplet_agg_enabled(destAddr, pkey)) {
+    return droplet_agg_queue(frame, len, wait_ms);
+  }
+
   if (ESP_OK != (rv = droplet_send(destAddr, //  DROPLET_ADDR_BROADCAST,
                                    false,
                                    s_droplet_config.nEncryption,
                                    (pkey != NULL) ? pkey : s_droplet_config.pmk,
                                    s_droplet_config.ttl,
-                                   pbuf,
-                                   DROPLET_MIN_FRAME + pex->sizeData,
+                                   frame,
+                                   len,
                                    wait_ms))) {
     ESP_LOGE(TAG, "Failed to send event. rv=%X", rv);
-    VSCP_FREE(pbuf);
     return rv;
   }
 
-  ESP_LOGI(TAG, "Event sent OK");
+  ESP_LOGI(TAG, "Event sent OK");
+
+  return ESP_OK;
+}
+
+//=============================================================================
+//                         Droplet Core stuff
+//=============================================================================
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_init
+//
+
+esp_err_t
+droplet_init(const droplet_config_t *config)
+{
+  esp_err_t ret = ESP_FAIL;
+
+  s_stateDroplet = DROPLET_STATE_IDLE;
+
+  // ESP_ERROR_CHECK(config);
+  memcpy(&s_droplet_config, config, sizeof(droplet_config_t));
+
+  // One receive slot for every queue position so a claimed slot can always be queued
+  droplet_pool_deinit(&s_droplet_rxpool);
+  if (VSCP_ERROR_SUCCESS != droplet_pool_init(&s_droplet_rxpool, s_droplet_config.sizeQueue, DROPLET_RX_SLOT_SIZE)) {
+    ESP_LOGE(TAG, "Failed to allocate receive slots");
+    return ESP_ERR_NO_MEM;
+  }
+
+  g_droplet_rcvqueue = xQueueCreate(s_droplet_config.sizeQueue, sizeof(void *));
+  if (NULL == g_droplet_rcvqueue) {
+    ESP_LOGD(TAG, "Create droplet event queue fail");
+    return ESP_FAIL;
+  }
+
+  // Event group for droplet sent cb
+  s_droplet_event_group = xEventGroupCreate();
+  ESP_RETURN_ON_ERROR(!s_droplet_event_group, TAG, "Create event group fail");
+
+  // Send queue
+  uint8_t sizeTxQueue = s_droplet_config.sizeTxQueue ? s_droplet_config.sizeTxQueue : DROPLET_TX_QUEUE_SIZE;
+  droplet_pool_deinit(&s_droplet_txpool);
+  if (VSCP_ERROR_SUCCESS != droplet_pool_init(&s_droplet_txpool, sizeTxQueue, sizeof(droplet_txpkt_t))) {
+    ESP_LOGE(TAG, "Failed to allocate send slots");
+    return ESP_ERR_NO_MEM;
+  }
+
+  for (int prio = 0; prio < DROPLET_TX_PRIO_COUNT; prio++) {
+    s_droplet_txqueue[prio] = xQueueCreate(sizeTxQueue, sizeof(void *));
+    ESP_RETURN_ON_ERROR(!s_droplet_txqueue[prio], TAG, "Create send queue fail");
+  }
+
+  s_droplet_txsignal = xSemaphoreCreateCounting(sizeTxQueue, 0);
+  ESP_RETURN_ON_ERROR(!s_droplet_txsignal, TAG, "Create send semaphore fail");
+
+  // In-flight window. Starts small and grows as long as the radio keeps up.
+  droplet_flow_config_t flowConfig = {
+    .minWindow     = 1,
+    .maxWindow     = s_droplet_config.maxTxInFlight ? s_droplet_config.maxTxInFlight : DROPLET_MAX_BUFFERED_NUM,
+    .targetLatency = DROPLET_TX_TARGET_LATENCY,
+  };
+  if (flowConfig.maxWindow > DROPLET_FLOW_RING_SIZE) {
+    flowConfig.maxWindow = DROPLET_FLOW_RING_SIZE;
+  }
+  if (VSCP_ERROR_SUCCESS != droplet_flow_init(&s_droplet_flow, &flowConfig)) {
+    ESP_LOGE(TAG, "Invalid send window configuration");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  s_droplet_key_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_ERROR(!s_droplet_key_lock, TAG, "Create key semaphore mutex fail");
+
+  s_droplet_agg_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_ERROR(!s_droplet_agg_lock, TAG, "Create aggregate semaphore mutex fail");
+  s_droplet_agg_len = droplet_agg_init(s_droplet_agg_frame, PRJDEF_NODE_TYPE, DROPLET_AGG_VERSION);
+
+  // Expand the primary key once instead of for every frame
+  if ((NULL != s_droplet_config.pmk) &&
+      (VSCP_ERROR_SUCCESS != droplet_crypto_key_init(&s_droplet_pmk_key, s_droplet_config.pmk))) {
+    ESP_LOGE(TAG, "Failed to expand primary key");
+    return ESP_FAIL;
+  }
+
+  // Bring up the radio transport
+  if ((NULL == s_droplet_transport) || (NULL == s_droplet_transport->send)) {
+    ESP_LOGE(TAG, "No droplet transport set");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if ((NULL != s_droplet_transport->init) && (ESP_OK != (ret = s_droplet_transport->init(config)))) {
+    ESP_LOGE(TAG, "Failed to initialize %s transport rv=%X", s_droplet_transport->name, ret);
+    return ESP_FAIL;
+  }
+
+  if (NULL != s_droplet_transport->get_mac) {
+    s_droplet_transport->get_mac(DROPLET_ADDR_SELF);
+  }
+
+  droplet_mesh_config_t meshConfig = {
+    .sizeCache      = s_droplet_config.sizeMsgCache ? s_droplet_config.sizeMsgCache : DROPLET_MSG_CACHE_SIZE,
+    .maxAge         = s_droplet_config.maxAgeMsgCache ? s_droplet_config.maxAgeMsgCache : DROPLET_MSG_CACHE_MAX_AGE,
+    .bForwardEnable = s_droplet_config.bForwardEnable,
+    .fwdStrategy    = s_droplet_config.fwdStrategy,
+    .gossipProb     = s_droplet_config.fwdGossipProb ? s_droplet_config.fwdGossipProb : DROPLET_FWD_GOSSIP_PROB,
+    .counterMax     = s_droplet_config.fwdCounterMax ? s_droplet_config.fwdCounterMax : DROPLET_FWD_COUNTER_MAX,
+    .backoffMax     = s_droplet_config.fwdBackoff ? s_droplet_config.fwdBackoff : DROPLET_FWD_BACKOFF,
+    .jitterMax      = s_droplet_config.fwdJitter ? s_droplet_config.fwdJitter : DROPLET_FWD_JITTER,
+    .rssiNear       = s_droplet_config.fwdRssiNear ? s_droplet_config.fwdRssiNear : DROPLET_FWD_RSSI_NEAR,
+    .rssiFar        = s_droplet_config.fwdRssiFar ? s_droplet_config.fwdRssiFar : DROPLET_FWD_RSSI_FAR,
+  };
+
+  droplet_mesh_deinit(&s_droplet_mesh);
+  int rv;
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_mesh_init(&s_droplet_mesh, DROPLET_ADDR_SELF, &meshConfig))) {
+    ESP_LOGE(TAG, "Failed to initialize mesh rv=%d", rv);
+    return (VSCP_ERROR_MEMORY == rv) ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_ARG;
+  }
+  memset(s_droplet_fwd_pending, 0, sizeof(s_droplet_fwd_pending));
+
+  droplet_frag_deinit(&s_droplet_frag);
+  if (VSCP_ERROR_SUCCESS !=
+      droplet_frag_init(&s_droplet_frag,
+                        s_droplet_config.sizeFragSlots ? s_droplet_config.sizeFragSlots : DROPLET_FRAG_SLOTS,
+                        s_droplet_config.fragTimeout ? s_droplet_config.fragTimeout : DROPLET_FRAG_TIMEOUT)) {
+    ESP_LOGE(TAG, "Failed to allocate reassembly slots");
+    return ESP_ERR_NO_MEM;
+  }
+
+  s_droplet_mesh_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_ERROR(!s_droplet_mesh_lock, TAG, "Create mesh semaphore mutex fail");
+  ESP_LOGD(TAG,
+           "mac: " MACSTR ", version: %d, transport: %s",
+           MAC2STR(DROPLET_ADDR_SELF),
+           DROPLET_VERSION,
+           s_droplet_transport->name);
+
+  // Start receive task
+  xTaskCreate(droplet_rcv_task, "droplet rcv_task", 1024 * 8, (void *) &s_droplet_config, 5, NULL);
+
+  // Start send task
+  xTaskCreate(droplet_tx_task, "droplet tx_task", 4096, NULL, 5, NULL);
+
+  // Start heartbeat task vscp_heartbeat_task
+  xTaskCreate(&droplet_heartbeat_task, "droplet_heartbeat_task", 4096, (void *) &s_droplet_config, 5, NULL);
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward
+//
+// Queue a received frame for the send task. The frame is sent as is
+// with the ttl already decreased.
+//
+
+static esp_err_t
+droplet_forward(const uint8_t *dst_addr, uint8_t *frame, size_t len, droplet_tx_done_cb_t cb, void *userdata)
+{
+  esp_err_t ret;
+
+  ESP_LOGI(TAG, "Forward frame %X", ((frame[DROPLET_POS_MAGIC] << 8) + frame[DROPLET_POS_MAGIC + 1]));
+
+  // Queued for the send task so event delivery is not held up
+  if (ESP_OK == (ret = droplet_send_async(dst_addr,
+                                          true,
+                                          VSCP_ENCRYPTION_NONE,
+                                          s_droplet_config.pmk,
+                                          0,
+                                          frame,
+                                          len,
+                                          DROPLET_TX_PRIO_FORWARD,
+                                          cb,
+                                          userdata))) {
+    ESP_LOGD(TAG, "Frame queued for forwarding");
+    g_dropletStats.nForw++; // Update forward frame statistics
+  }
+  else {
+    ESP_LOGE(TAG, "Failed to forward frame ret=%X", ret);
+  }
+
+  return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward_done
+//
+// Called from the send task when a held forward has been handed to the
+// radio. A frame the radio failed to send (busy channel) is queued again
+// a few times before it is given up.
+//
+
+static void
+droplet_forward_done(esp_err_t status, void *userdata)
+{
+  droplet_fwdpkt_t *pfwd = (droplet_fwdpkt_t *) userdata;
+
+  if (ESP_OK != status) {
+    g_dropletStats.nForwCollisions++;
+    if (pfwd->nRetries < DROPLET_FWD_RETRIES) {
+      pfwd->nRetries++;
+      g_dropletStats.nForwRetries++;
+      // Same frame again, counted as a retry and not as a new forward
+      if (ESP_OK == droplet_send_async(pfwd->dst_addr,
+                                       true,
+                                       VSCP_ENCRYPTION_NONE,
+                                       s_droplet_config.pmk,
+                                       0,
+                                       pfwd->frame,
+                                       pfwd->len,
+                                       DROPLET_TX_PRIO_FORWARD,
+                                       droplet_forward_done,
+                                       pfwd)) {
+        return;
+      }
+    }
+  }
+
+  atomic_store(&pfwd->state, DROPLET_FWD_FREE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward_tag
+//
+// Tag of a free held forward entry or zero if all are in use
+//
+
+static uint16_t
+droplet_forward_tag(void)
+{
+  for (int i = 0; i < DROPLET_FWD_PENDING_SIZE; i++) {
+    if (DROPLET_FWD_FREE == atomic_load(&s_droplet_fwd_pending[i].state)) {
+      return (uint16_t) (i + 1);
+    }
+  }
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward_hold
+//
+// Keep a copy of the frame in the entry for tag until the forward
+// decision is due. Delay is rounded up to whole ticks. Returns false
+// if the frame does not fit the entry.
+//
+
+static bool
+droplet_forward_hold(uint16_t tag, const uint8_t *dst_addr, const uint8_t *frame, size_t len, uint32_t delay)
+{
+  droplet_fwdpkt_t *pfwd = &s_droplet_fwd_pending[tag - 1];
+
+  if (len > sizeof(pfwd->frame)) {
+    return false;
+  }
+
+  pfwd->due      = xTaskGetTickCount() + (delay + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+  pfwd->nRetries = 0;
+  memcpy(pfwd->dst_addr, dst_addr, DROPLET_ADDR_LEN);
+  pfwd->len = (uint8_t) len;
+  memcpy(pfwd->frame, frame, len);
+  atomic_store(&pfwd->state, DROPLET_FWD_WAIT);
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward_cancel
+//
+// Enough copies of a held frame have been heard from neighbours
+//
+
+static void
+droplet_forward_cancel(uint16_t tag)
+{
+  droplet_fwdpkt_t *pfwd = &s_droplet_fwd_pending[tag - 1];
+
+  if (DROPLET_FWD_WAIT == atomic_load(&pfwd->state)) {
+    ESP_LOGD(TAG,
+             "Forward of frame %X cancelled",
+             ((pfwd->frame[DROPLET_POS_MAGIC] << 8) + pfwd->frame[DROPLET_POS_MAGIC + 1]));
+    atomic_store(&pfwd->state, DROPLET_FWD_FREE);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_forward_run
+//
+// Make the forward decision for held frames that are due. Returns
+// the number of ticks until the next one is due.
+//
+
+static TickType_t
+droplet_forward_run(void)
+{
+  TickType_t wait = portMAX_DELAY;
+  TickType_t now  = xTaskGetTickCount();
+
+  for (int i = 0; i < DROPLET_FWD_PENDING_SIZE; i++) {
+    droplet_fwdpkt_t *pfwd = &s_droplet_fwd_pending[i];
+    if (DROPLET_FWD_WAIT != atomic_load(&pfwd->state)) {
+      continue;
+    }
+
+    TickType_t left = pfwd->due - now;
+    if ((int32_t) left > 0) {
+      if (left < wait) {
+        wait = left;
+      }
+      continue;
+    }
+
+    xSemaphoreTake(s_droplet_mesh_lock, portMAX_DELAY);
+    bool bForward = droplet_mesh_forward_check(&s_droplet_mesh, pfwd->frame, pfwd->len, now * portTICK_PERIOD_MS);
+    xSemaphoreGive(s_droplet_mesh_lock);
+
+    if (!bForward) {
+      ESP_LOGD(TAG,
+               "Forward of frame %X suppressed",
+               ((pfwd->frame[DROPLET_POS_MAGIC] << 8) + pfwd->frame[DROPLET_POS_MAGIC + 1]));
+      atomic_store(&pfwd->state, DROPLET_FWD_FREE);
+      continue;
+    }
 
-  VSCP_FREE(pbuf);
-  return ESP_OK;
-}
+    // The send task owns the entry until the frame has been sent
+    atomic_store(&pfwd->state, DROPLET_FWD_SEND);
+    if (ESP_OK != droplet_forward(pfwd->dst_addr, pfwd->frame, pfwd->len, droplet_forward_done, pfwd)) {
+      atomic_store(&pfwd->state, DROPLET_FWD_FREE);
+    }
+  }
 
-//=============================================================================
-//                         Droplet Core stuff
-//=============================================================================
+  return wait;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// droplet_init
+// droplet_handle_event
+//
+// Provisioning state machine and user callback for one received event.
+// The event is a view on the receive slot.
 //
 
-esp_err_t
-droplet_init(const droplet_config_t *config)
+static void
+droplet_handle_event(droplet_rxpkt_t *prxdata, vscpEvent *pev)
 {
-  //void *p;
-  // esp_err_t ret = ESP_FAIL;
+  // clang-format off
 
-  s_stateDroplet = DROPLET_STATE_IDLE;
+  // * * * Provisioning events * * *
+  
+  ESP_LOGD(TAG,"++++++++++++++++++++++++++++++++++++++++++++++++++  state=%d", s_stateDroplet);
+  ESP_LOG_BUFFER_HEXDUMP(TAG, prxdata->src_addr, DROPLET_ADDR_LEN, ESP_LOG_DEBUG);
+  ESP_LOG_BUFFER_HEXDUMP(TAG, prxdata->dst_addr, DROPLET_ADDR_LEN, ESP_LOG_DEBUG);
+  ESP_LOG_BUFFER_HEXDUMP(TAG, s_provisionNodeInfo.mac, DROPLET_ADDR_LEN, ESP_LOG_DEBUG);
+
+  if (DROPLET_STATE_CLIENT_INIT == s_stateDroplet) {
+    
+    // Is this event addressed to us?
+    ESP_LOGD(TAG, "Size for init event %d", pev->sizeData);
+    ESP_LOG_BUFFER_HEXDUMP(TAG, pev->pdata, pev->sizeData, ESP_LOG_DEBUG);
+
+    if (!memcmp(prxdata->dst_addr, s_droplet_config.nodeGuid + 8, DROPLET_ADDR_LEN) &&
+      ((2+16+32) == pev->sizeData) && 
+      (/*VSCP_CLASS2_SECURITY*/ 1034 == pev->vscp_class) &&
+      (/*VSCP2_TYPE_SECURITY_SETKEY*/ 1 == pev->vscp_type)) {          
+
+      ESP_LOGI(TAG,"----> Setting PMK from serving node and setting idle state");
+
+      // We now have got the system 32 byte key. Save it
+      droplet_set_pmk(pev->pdata + 2 + 16);
+
+      // We use the channel.
+      if (NULL != s_droplet_attach_network_handler_cb) {
+        s_droplet_attach_network_handler_cb(&(prxdata->rx_ctrl), NULL);
+      }
 
-  // ESP_ERROR_CHECK(config);
-  memcpy(&s_droplet_config, config, sizeof(droplet_config_t));
+      esp_err_t ret = 0;
+      uint8_t buf[DROPLET_MIN_FRAME + 3]; // Three byte data
+      size_t size = sizeof(buf);
 
-  g_droplet_rcvqueue = xQueueCreate(s_droplet_config.sizeQueue, sizeof(void *));
-  if (NULL == g_droplet_rcvqueue) {
-    ESP_LOGD(TAG, "Create droplet event queue fail");
-    return ESP_FAIL;
-  }
+      // Create Heartbeat event
+      if (VSCP_ERROR_SUCCESS != (ret = droplet_build_l1_heartbeat(buf, size, s_droplet_config.nodeGuid))) {
+        ESP_LOGE(TAG, "Could not create heartbeat event, will exit task. VSCP rv %d", ret);
+        return;
+      }
+  
+      ret = droplet_send_async(DROPLET_ADDR_BROADCAST,
+                               false,
+                               VSCP_ENCRYPTION_NONE,
+                               s_droplet_config.pmk,
+                               4,
+                               buf,
+                               DROPLET_MIN_FRAME + 3,
+                               DROPLET_TX_PRIO_PROVISIONING,
+                               NULL,
+                               NULL);
 
-  // Event group for droplet sent cb
-  s_droplet_event_group = xEventGroupCreate();
-  ESP_RETURN_ON_ERROR(!s_droplet_event_group, TAG, "Create event group fail");
+      if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send heartbeat. ret = %X", ret);
+      }
 
-  droplet_send_lock = xSemaphoreCreateMutex();
-  ESP_RETURN_ON_ERROR(!droplet_send_lock, TAG, "Create send semaphore mutex fail");
+      s_stateDroplet = DROPLET_STATE_IDLE;
 
-  esp_wifi_set_promiscuous(true);
-  esp_wifi_set_promiscuous_rx_cb(&promiscuous_rx_cb);
+    } // init match
 
-  // Initialize DROPLET function
-  ESP_ERROR_CHECK(esp_now_init());
-  ESP_ERROR_CHECK(esp_now_register_send_cb(droplet_send_cb));
-  ESP_ERROR_CHECK(esp_now_register_recv_cb(droplet_recv_cb));
-  ESP_ERROR_CHECK(esp_now_set_wake_window(65535));
-  ESP_ERROR_CHECK(esp_now_set_pmk(config->pmk));
+  } // DROPLET_STATE_CLIENT_INIT
 
-  // ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL));
+  // Heartbeat from node under initialization
+  else if ((DROPLET_STATE_SRV_INIT1 == s_stateDroplet) && 
+           (VSCP_CLASS1_PROTOCOL == pev->vscp_class) &&
+           (VSCP_TYPE_PROTOCOL_NEW_NODE_ONLINE == pev->vscp_type) &&
+           !memcmp(prxdata->src_addr, s_provisionNodeInfo.mac, DROPLET_ADDR_LEN)) {
+    ESP_LOGI(TAG,"Status set for INIT1 <----------------------------------");
+    xEventGroupSetBits(s_droplet_event_group, DROPLET_PROV_CLIENT_GOT_INIT1_BIT);
+  }
+  // New node online from node under initialization
+  else if ((DROPLET_STATE_SRV_INIT2 == s_stateDroplet) && 
+           (VSCP_CLASS1_PROTOCOL == pev->vscp_class) &&
+           (VSCP_TYPE_PROTOCOL_PROBE_ACK == pev->vscp_type) &&
+           !memcmp(prxdata->src_addr, s_provisionNodeInfo.mac, DROPLET_ADDR_LEN)) {
+    ESP_LOGI(TAG,"Status set for INIT2 <----------------------------------");
+    xEventGroupSetBits(s_droplet_event_group, DROPLET_PROV_CLIENT_GOT_INIT2_BIT);
+  }
+  else {
+    // Call event callback and let it do it's work
+    s_vscp_event_handler_cb(pev, NULL);
+  }
 
-  esp_wifi_get_country(&g_self_country);
-  esp_wifi_get_mac(ESP_IF_WIFI_STA, DROPLET_ADDR_SELF);
-  ESP_LOGD(TAG, "mac: " MACSTR ", version: %d", MAC2STR(DROPLET_ADDR_SELF), DROPLET_VERSION);
+// clang-format on
+}
 
-  // Add broadcast peer information to peer list.
-  esp_now_peer_info_t *peer = VSCP_MALLOC(sizeof(esp_now_peer_info_t));
-  if (NULL == peer) {
-    ESP_LOGE(TAG, "Malloc peer information fail");
-    // vSemaphoreDelete(s_vscp_droplet_event_queue);
-    esp_now_deinit();
-    return ESP_FAIL;
-  }
-  memset(peer, 0, sizeof(esp_now_peer_info_t));
-  peer->channel = PRJDEF_DROPLET_CHANNEL;
-  peer->ifidx   = PRJDEF_DROPLET_WIFI_IF;
-  peer->encrypt = false;
-  memcpy(peer->peer_addr, DROPLET_ADDR_BROADCAST, ESP_NOW_ETH_ALEN);
-  ESP_ERROR_CHECK(esp_now_add_peer(peer));
-  VSCP_FREE(peer);
+///////////////////////////////////////////////////////////////////////////////
+// droplet_frag_recv
+//
+// Add a received fragment to its message and handle the event when the
+// message is complete. The event is a view on the reassembly slot.
+//
 
-  // Start receive task
-  xTaskCreate(droplet_rcv_task, "droplet rcv_task", 1024 * 8, (void *) &s_droplet_config, 5, NULL);
+static void
+droplet_frag_recv(droplet_rxpkt_t *prxdata, size_t size)
+{
+  int rv;
+  vscpEvent ev;
+  droplet_frag_entry_t *pentry = NULL;
+
+  g_dropletStats.nFragRecv++;
+
+  rv = droplet_frag_add(&s_droplet_frag,
+                        prxdata->src_addr,
+                        prxdata->payload,
+                        size,
+                        xTaskGetTickCount() * portTICK_PERIOD_MS,
+                        &pentry);
+  if (DROPLET_FRAG_INVALID == rv) {
+    ESP_LOGE(TAG, "Invalid fragment frame. len=%d", (int) size);
+    return;
+  }
+  if (DROPLET_FRAG_NO_SLOT == rv) {
+    ESP_LOGW(TAG, "No reassembly slot for fragment");
+    return;
+  }
+  if (DROPLET_FRAG_DONE != rv) {
+    return;
+  }
 
-  // Start heartbeat task vscp_heartbeat_task
-  xTaskCreate(&droplet_heartbeat_task, "droplet_heartbeat_task", 4096, (void *) &s_droplet_config, 5, NULL);
+  if (VSCP_ERROR_SUCCESS != (rv = droplet_frag_event(&ev, pentry, prxdata->rx_ctrl.timestamp))) {
+    ESP_LOGE(TAG, "Invalid reassembled event. rv=%d len=%d", rv, (int) pentry->total);
+  }
+  else {
+    droplet_handle_event(prxdata, &ev);
+  }
 
-  return ESP_OK;
+  droplet_frag_release(&s_droplet_frag, pentry);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -897,15 +1716,21 @@ droplet_rcv_task(void *arg)
   bool bRun                = true;
   size_t size              = 0;
 
+  (void) arg;
+
   ESP_LOGI(TAG, "droplet task entry");
 
   while (bRun) {
 
   NEXT_FRAME:
 
-    // Get receive frame (if any)
-    if ((ret = xQueueReceive(g_droplet_rcvqueue, &prxdata, portMAX_DELAY)) != pdTRUE) {
-      ESP_LOGE(TAG, "Failed to get receive data from queue. ret=%d", ret);
+    // Get receive frame (if any). Wake up when a deferred forward is due.
+    ret = xQueueReceive(g_droplet_rcvqueue, &prxdata, droplet_forward_run());
+
+    // Drop large events that will never be completed
+    droplet_frag_expire(&s_droplet_frag, xTaskGetTickCount() * portTICK_PERIOD_MS);
+
+    if (pdTRUE != ret) {
       continue;
     }
 
@@ -928,192 +1753,102 @@ droplet_rcv_task(void *arg)
 
       uint8_t nEncryption = prxdata->payload[DROPLET_POS_PKT_TYPE] & 0x0f;
 
-      // Allocate space for data
-      uint8_t *pdata = VSCP_MALLOC(prxdata->size);
-      if (NULL == pdata) {
-        VSCP_FREE(prxdata);
-        ESP_LOGE(TAG, "Unable to allocate data. Terminating");
-        return;
-      }
-
-      if (VSCP_ERROR_SUCCESS != vscp_fwhlp_decryptFrame(pdata,
-                                                        prxdata->payload,
-                                                        prxdata->size,
-                                                        s_droplet_config.pmk, // key
-                                                        NULL,                 // IV  - use embedded
-                                                        nEncryption)) {
+      // Decrypted in the receive slot. IV is dropped from the size.
+      xSemaphoreTake(s_droplet_key_lock, portMAX_DELAY);
+      size = droplet_crypto_decrypt_key(prxdata->payload, prxdata->size, &s_droplet_pmk_key, nEncryption);
+      xSemaphoreGive(s_droplet_key_lock);
+      if (0 == size) {
         ESP_LOGE(TAG, "Failed to decrypt frame");
-        VSCP_FREE(pdata);
-        VSCP_FREE(prxdata);
+        droplet_pool_free(&s_droplet_rxpool, prxdata);
         continue;
       }
-
-      size -= 16; // no need to send the old IV
-
-      // Copy back decrypted payload data
-      memcpy(prxdata->payload, pdata, size);
-
-      VSCP_FREE(pdata);
+      prxdata->payload[DROPLET_POS_ID + 1] &= ~DROPLET_VERSION_CRYPT;
     }
 
-    // Check if we have already received this frame
-    for (size_t i = 0, index = g_droplet_magic_cache_next; i < DROPLET_MSG_CACHE_SIZE;
-         i++, index          = (g_droplet_magic_cache_next + i) % DROPLET_MSG_CACHE_SIZE) {
-      if (g_droplet_magic_cache[index].magic ==
-          ((prxdata->payload[DROPLET_POS_MAGIC] << 8) + prxdata->payload[DROPLET_POS_MAGIC + 1])) {
-        ESP_LOGI(TAG,
-                 "Frame %X is skipped - already in cache, ",
-                 ((prxdata->payload[DROPLET_POS_MAGIC] << 8) + prxdata->payload[DROPLET_POS_MAGIC + 1]));
-        VSCP_FREE(prxdata);
-        goto NEXT_FRAME;
-      }
+    // A decrypted frame always fits, a clear frame up to the air frame
+    // size does not and could never be forwarded or held
+    if (size > DROPLET_CRYPTO_MAX_PLAIN) {
+      ESP_LOGE(TAG, "Frame is too large len=%d", (int) size);
+      g_dropletStats.nRecvFrameFault++;
+      droplet_pool_free(&s_droplet_rxpool, prxdata);
+      continue;
     }
 
-    // Store magic in cache
-    g_droplet_magic_cache[g_droplet_magic_cache_next].magic =
-      (prxdata->payload[DROPLET_POS_MAGIC] << 8) + prxdata->payload[DROPLET_POS_MAGIC + 1];
-    g_droplet_magic_cache_next = (g_droplet_magic_cache_next + 1) % DROPLET_MSG_CACHE_SIZE;
-
-    // Decrease ttl as we have seen this frame
-    uint8_t ttl                       = --prxdata->payload[DROPLET_POS_TTL];
-    prxdata->payload[DROPLET_POS_TTL] = ttl;
+    // Check if we have already received this frame, decrease ttl
+    // and decide if it should be forwarded
+    droplet_mesh_sched_t sched = { .tag = droplet_forward_tag() };
+    xSemaphoreTake(s_droplet_mesh_lock, portMAX_DELAY);
+    int meshflags = droplet_mesh_process(&s_droplet_mesh,
+                                         prxdata->payload,
+                                         size,
+                                         prxdata->dst_addr,
+                                         prxdata->rx_ctrl.rssi,
+                                         xTaskGetTickCount() * portTICK_PERIOD_MS,
+                                         &sched);
+    xSemaphoreGive(s_droplet_mesh_lock);
+    if (meshflags & DROPLET_MESH_CANCEL) {
+      droplet_forward_cancel(sched.cancel);
+    }
+    if (meshflags & DROPLET_MESH_DUPLICATE) {
+      ESP_LOGI(TAG,
+               "Frame %X is skipped - already in cache, ",
+               ((prxdata->payload[DROPLET_POS_MAGIC] << 8) + prxdata->payload[DROPLET_POS_MAGIC + 1]));
+      droplet_pool_free(&s_droplet_rxpool, prxdata);
+      goto NEXT_FRAME;
+    }
 
     // Destination address can't be a pointer as it will be encrypted if
     // encryption is enabled in frame
     // uint8_t dest_addr[6];
     // memcpy(dest_addr, prxdata->payload + DROPLET_POS_DEST_ADDR, 6);
 
-    // if ttl is zero or frame is addressed to us don't forward
-    if (s_droplet_config.bForwardEnable && ttl && DROPLET_ADDR_IS_SELF(prxdata->dst_addr)) {
-      ESP_LOGI(TAG,
-               "Forward frame %X",
-               ((prxdata->payload[DROPLET_POS_MAGIC] << 8) + prxdata->payload[DROPLET_POS_MAGIC + 1]));
-      if (ESP_OK == (ret = droplet_send(prxdata->dst_addr,
-                                        true,
-                                        VSCP_ENCRYPTION_NONE,
-                                        s_droplet_config.pmk,
-                                        0,
-                                        prxdata->payload,
-                                        size,
-                                        20))) {
-        ESP_LOGD(TAG, "Frame forwarded successfully");
-        g_dropletStats.nForw++; // Update forward frame statistics
-      }
-      else {
-        ESP_LOGE(TAG, "Failed to forward frame ret=%X", ret);
-        g_dropletStats.nSendFailures++; // Update send failures
-      }
+    // ttl is zero or frame is addressed to us if not forwarded
+    if (meshflags & DROPLET_MESH_FORWARD) {
+      droplet_forward(prxdata->dst_addr, prxdata->payload, size, NULL, NULL);
+    }
+    // Hold it for a while so neighbours don't rebroadcast at the same
+    // time and the forward can be cancelled if they do it for us
+    else if ((meshflags & DROPLET_MESH_DEFER) &&
+             !droplet_forward_hold(sched.tag, prxdata->dst_addr, prxdata->payload, size, sched.delay)) {
+      droplet_forward(prxdata->dst_addr, prxdata->payload, size, NULL, NULL);
     }
 
     // Handle event callback
     if (NULL != s_vscp_event_handler_cb) {
-      vscpEvent *pev = vscp_fwhlp_newEvent();
-      if (NULL == pev) {
-        ESP_LOGE(TAG, "Failed to allocate new event-");
-        goto CONTINUE;
-      }
-      ESP_LOGI(TAG, "Frame size %d", prxdata->size);
-      if (VSCP_ERROR_SUCCESS !=
-          (rv = droplet_frameToEv(pev, prxdata->payload, prxdata->size, prxdata->rx_ctrl.timestamp))) {
-        ESP_LOGE(TAG, "Failed to convert frame to event. rv=%d len=%d", rv, prxdata->size);
-        if (VSCP_ERROR_SUCCESS != (rv = vscp_fwhlp_deleteEvent(&pev))) {
-          ESP_LOGE(TAG, "Failed to delete event. rv=%d", rv);
+      // Event is a view on the frame. Valid until the slot is returned.
+      vscpEvent ev;
+      ESP_LOGI(TAG, "Frame size %d", (int) size);
+      if (DROPLET_IS_AGGREGATE(prxdata->payload)) {
+        // One callback for every event carried in the frame
+        size_t offset = 0;
+        g_dropletStats.nAggRecv++;
+        while (VSCP_ERROR_SUCCESS ==
+               (rv = droplet_agg_next(&ev, prxdata->payload, size, &offset, prxdata->rx_ctrl.timestamp))) {
+          droplet_handle_event(prxdata, &ev);
+        }
+        if (VSCP_ERROR_RCV_EMPTY != rv) {
+          ESP_LOGE(TAG, "Invalid aggregate frame. rv=%d len=%d", rv, (int) size);
         }
-        goto CONTINUE;
       }
-
-      // clang-format off
-
-      // * * * Provisioning events * * *
-      
-      ESP_LOGD(TAG,"++++++++++++++++++++++++++++++++++++++++++++++++++  state=%d", s_stateDroplet);
-      ESP_LOG_BUFFER_HEXDUMP(TAG, prxdata->src_addr, ESP_NOW_ETH_ALEN, ESP_LOG_DEBUG);
-      ESP_LOG_BUFFER_HEXDUMP(TAG, prxdata->dst_addr, ESP_NOW_ETH_ALEN, ESP_LOG_DEBUG);
-      ESP_LOG_BUFFER_HEXDUMP(TAG, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN, ESP_LOG_DEBUG);
-
-      if (DROPLET_STATE_CLIENT_INIT == s_stateDroplet) {
-        
-        // Is this event addressed to us?
-        ESP_LOGD(TAG, "Size for init event %d", pev->sizeData);
-        ESP_LOG_BUFFER_HEXDUMP(TAG, pev->pdata, pev->sizeData, ESP_LOG_DEBUG);
-
-        if (!memcmp(prxdata->dst_addr, s_droplet_config.nodeGuid + 8, ESP_NOW_ETH_ALEN) &&
-          ((2+16+32) == pev->sizeData) && 
-          (/*VSCP_CLASS2_SECURITY*/ 1034 == pev->vscp_class) &&
-          (/*VSCP2_TYPE_SECURITY_SETKEY*/ 1 == pev->vscp_type)) {          
-
-          ESP_LOGI(TAG,"----> Setting PMK from serving node and setting idle state");
-
-          // We now have got the system 32 byte key. Save it
-          memcpy(s_droplet_config.pmk, pev->pdata + 2 + 16, 32);
-
-          // We use the channel.
-          if (NULL != s_droplet_attach_network_handler_cb) {
-            s_droplet_attach_network_handler_cb(&(prxdata->rx_ctrl), NULL);
-          }
-
-          esp_err_t ret = 0;
-          uint8_t buf[DROPLET_MIN_FRAME + 3]; // Three byte data
-          size_t size = sizeof(buf);
-
-          // Create Heartbeat event
-          if (VSCP_ERROR_SUCCESS != (ret = droplet_build_l1_heartbeat(buf, size, s_droplet_config.nodeGuid))) {
-            ESP_LOGE(TAG, "Could not create heartbeat event, will exit task. VSCP rv %d", ret);
-            goto CONTINUE;
-          }
-  
-          ret = droplet_send(DROPLET_ADDR_BROADCAST,
-                                  false,
-                                  VSCP_ENCRYPTION_NONE,
-                                  s_droplet_config.pmk,
-                                  4,
-                                  buf,
-                                  DROPLET_MIN_FRAME + 3,
-                                  10 / portTICK_PERIOD_MS);
-
-          if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to send heartbeat. ret = %X", ret);
-          }
-
-          s_stateDroplet = DROPLET_STATE_IDLE;
-
-        } // init match
-
-      } // DROPLET_STATE_CLIENT_INIT
-
-      // Heartbeat from node under initialization
-      else if ((DROPLET_STATE_SRV_INIT1 == s_stateDroplet) && 
-               (VSCP_CLASS1_PROTOCOL == pev->vscp_class) &&
-               (VSCP_TYPE_PROTOCOL_NEW_NODE_ONLINE == pev->vscp_type) &&
-               !memcmp(prxdata->src_addr, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN)) {
-        ESP_LOGI(TAG,"Status set for INIT1 <----------------------------------");
-        xEventGroupSetBits(s_droplet_event_group, DROPLET_PROV_CLIENT_GOT_INIT1_BIT);
+      else if (DROPLET_IS_FRAGMENT(prxdata->payload)) {
+        droplet_frag_recv(prxdata, size);
       }
-      // New node online from node under initialization
-      else if ((DROPLET_STATE_SRV_INIT2 == s_stateDroplet) && 
-               (VSCP_CLASS1_PROTOCOL == pev->vscp_class) &&
-               (VSCP_TYPE_PROTOCOL_PROBE_ACK == pev->vscp_type) &&
-               !memcmp(prxdata->src_addr, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN)) {
-        ESP_LOGI(TAG,"Status set for INIT2 <----------------------------------");
-        xEventGroupSetBits(s_droplet_event_group, DROPLET_PROV_CLIENT_GOT_INIT2_BIT);
+      else if (VSCP_ERROR_SUCCESS !=
+               (rv = droplet_frameToEvView(&ev, prxdata->payload, size, prxdata->rx_ctrl.timestamp))) {
+        ESP_LOGE(TAG, "Failed to convert frame to event. rv=%d len=%d", rv, (int) size);
       }
       else {
-        // Call event callback and let it do it's work
-        s_vscp_event_handler_cb(pev, NULL);
+        droplet_handle_event(prxdata, &ev);
       }
-
-// clang-format on
     }
 
-  CONTINUE:
-
-    VSCP_FREE(prxdata); // Deallocate structure data
+    droplet_pool_free(&s_droplet_rxpool, prxdata); // Return receive slot
 
   } // while
 
   // Empty queue
   while (xQueueReceive(g_droplet_rcvqueue, &prxdata, 0)) {
-    VSCP_FREE((prxdata)); // Deallocate receive frame data
+    droplet_pool_free(&s_droplet_rxpool, prxdata); // Return receive slot
   }
 
   vQueueDelete(g_droplet_rcvqueue);
@@ -1124,43 +1859,35 @@ droplet_rcv_task(void *arg)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// droplet_recv_cb
+// droplet_transport_recv
+//
+// Called by the transport for every received frame. For ESP-NOW this is
+// in the WiFi task so only validate, filter and queue the frame here.
 //
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
-static void
-droplet_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len)
-{
-  if (recv_info == NULL || data == NULL || len <= 0) {
-    ESP_LOGE(TAG, "Receive cb arg error");
-    return;
-  }
-
-  // wifi_pkt_rx_ctrl_t *prx_ctrl = &recv_info->rx_ctrl;
-#else
-static void
-droplet_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len)
+void
+droplet_transport_recv(const uint8_t *src_addr,
+                       const uint8_t *dst_addr,
+                       const wifi_pkt_rx_ctrl_t *rx_ctrl,
+                       const uint8_t *data,
+                       int len)
 {
-  if (mac_addr == NULL || data == NULL || len <= 0) {
+  if (src_addr == NULL || rx_ctrl == NULL || data == NULL || len <= 0) {
     ESP_LOGE(TAG, "Receive cb arg error");
     return;
   }
 
-  wifi_promiscuous_pkt_t *promiscuous_pkt =
-    (wifi_promiscuous_pkt_t *) (data - sizeof(wifi_pkt_rx_ctrl_t) - sizeof(espnow_frame_format_t));
-  wifi_pkt_rx_ctrl_t *prx_ctrl = &promiscuous_pkt->rx_ctrl;
-#endif
-
   // Check that frame length is within limits
-  if ((len < DROPLET_MIN_FRAME) || (len > DROPLET_MAX_FRAME) ||
+  if ((len < DROPLET_COMPACT_MIN_FRAME) || (len > DROPLET_MAX_ENCRYPTED_FRAME) ||
       ((data[DROPLET_POS_PKT_TYPE] & 0x0f) > VSCP_ENCRYPTION_AES256)) {
     ESP_LOGE(TAG, "Frame length/type is invalid len=%d", len);
     g_dropletStats.nRecvFrameFault++; // Increase receive frame faults
     return;
   }
 
-  // Check frame id and droplet protocol version
-  if ((data[DROPLET_POS_ID] != 0x55) || (data[DROPLET_POS_ID + 1] != 0xa0)) {
+  // Check frame id and droplet protocol version. Both header layouts are understood.
+  if ((data[DROPLET_POS_ID] != DROPLET_ID_MSB) || ((data[DROPLET_POS_ID + 1] & 0xf0) != 0xa0) ||
+      (DROPLET_FRAME_VERSION(data) > DROPLET_VERSION_COMPACT)) {
     ESP_LOGW(TAG,
              "Frame is invalid. id=%X,  protocol version=%d",
              (data[DROPLET_POS_ID] << 8) + data[DROPLET_POS_ID + 1],
@@ -1168,69 +1895,50 @@ droplet_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len)
     return;
   }
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
+  // Encrypted frames must have the crypt flag, others must not
+  if (!(data[DROPLET_POS_ID + 1] & DROPLET_VERSION_CRYPT) != !(data[DROPLET_POS_PKT_TYPE] & 0x0f)) {
+    ESP_LOGW(TAG,
+             "Frame is encrypted with an unsupported layout. id=%X",
+             (data[DROPLET_POS_ID] << 8) + data[DROPLET_POS_ID + 1]);
+    g_dropletStats.nRecvFrameFault++; // Increase receive frame faults
+    return;
+  }
+
   ESP_LOGI(TAG,
            "Receive event from " MACSTR " to " MACSTR " frame %04X, RSSI %d Channel %d",
-           MAC2STR((recv_info->src_addr)),
-           MAC2STR((recv_info->des_addr)),
-           ((data[DROPLET_POS_MAGIC] << 8) + data[DROPLET_POS_MAGIC + 1]),
-           recv_info->rx_ctrl->rssi,
-           recv_info->rx_ctrl->channel);
-#else
-  ESP_LOGI(TAG,
-           "Receive event from " MACSTR " frame %04X, RSSI %d Channel %d",
-           MAC2STR(mac_addr),
+           MAC2STR(src_addr),
+           MAC2STR((NULL != dst_addr) ? dst_addr : DROPLET_ADDR_NONE),
            ((data[DROPLET_POS_MAGIC] << 8) + data[DROPLET_POS_MAGIC + 1]),
-           prx_ctrl->rssi,
-           prx_ctrl->channel);
-#endif
+           rx_ctrl->rssi,
+           rx_ctrl->channel);
 
   ESP_LOG_BUFFER_HEXDUMP(TAG, data, len, ESP_LOG_DEBUG);
 
-// Channel filtering
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
-  if (s_droplet_config.bFilterAdjacentChannel && (s_droplet_config.channel != recv_info->rx_ctrl->channel)) {
-    ESP_LOGI(TAG, "Filter adjacent channels, %d != %d", s_droplet_config.channel, recv_info->rx_ctrl->channel);
-    g_dropletStats.nRecvAdjChFilter++; // Increase adjacent channel filter statistics
-    return;
-  }
-#else
-  if (s_droplet_config.bFilterAdjacentChannel && (s_droplet_config.channel != prx_ctrl->channel)) {
-    ESP_LOGI(TAG, "Filter adjacent channels, %d != %d", s_droplet_config.channel, prx_ctrl->channel);
+  // Channel filtering
+  if (s_droplet_config.bFilterAdjacentChannel && (s_droplet_config.channel != rx_ctrl->channel)) {
+    ESP_LOGI(TAG, "Filter adjacent channels, %d != %d", s_droplet_config.channel, rx_ctrl->channel);
     g_dropletStats.nRecvAdjChFilter++; // Increase adjacent channel filter statistics
     return;
   }
-#endif
 
-// RSSI filtering
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
-  if (s_droplet_config.filterWeakSignal && (s_droplet_config.filterWeakSignal > recv_info->rx_ctrl->rssi)) {
-    ESP_LOGI(TAG, "Filter weak signal strength, %d > %d", s_droplet_config.filterWeakSignal, recv_info->rx_ctrl->rssi);
-    g_dropletStats.nRecvŔssiFilter++; // Increase RSSI filter statistics
+  // RSSI filtering
+  if (s_droplet_config.filterWeakSignal && (s_droplet_config.filterWeakSignal > rx_ctrl->rssi)) {
+    ESP_LOGI(TAG, "Filter weak signal strength, %d > %d", s_droplet_config.filterWeakSignal, rx_ctrl->rssi);
+    g_dropletStats.nRecvRssiFilter++; // Increase RSSI filter statistics
     return;
   }
-#else
-  if (s_droplet_config.filterWeakSignal && (s_droplet_config.filterWeakSignal > prx_ctrl->rssi)) {
-    ESP_LOGI(TAG, "Filter weak signal strength, %d > %d", s_droplet_config.filterWeakSignal, prx_ctrl->rssi);
-    g_dropletStats.nRecvŔssiFilter++; // Increase RSSI filter statistics
-    return;
-  }
-#endif
 
-  droplet_rxpkt_t *prxdata = VSCP_MALLOC(sizeof(droplet_rxpkt_t) + len);
+  // Claim a receive slot. No heap use here as we may be in the WiFi task.
+  droplet_rxpkt_t *prxdata = droplet_pool_alloc(&s_droplet_rxpool);
   if (NULL == prxdata) {
-    ESP_LOGD(TAG, "Failed to allocate data.");
+    ESP_LOGD(TAG, "No free receive slot.");
+    g_dropletStats.nRecvPoolEmpty++; // Receive pool exhausted
     return;
   }
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 1)
-  memcpy(prxdata->src_addr, recv_info->src_addr, ESP_NOW_ETH_ALEN);
-  memcpy(prxdata->dst_addr, recv_info->des_addr, ESP_NOW_ETH_ALEN);
-  memcpy(&prxdata->rx_ctrl, recv_info->rx_ctrl, sizeof(wifi_pkt_rx_ctrl_t));
-#else
-  memcpy(prxdata->src_addr, mac_addr, ESP_NOW_ETH_ALEN);
-  memcpy(&prxdata->rx_ctrl, prx_ctrl, sizeof(wifi_pkt_rx_ctrl_t));
-#endif
+  memcpy(prxdata->src_addr, src_addr, DROPLET_ADDR_LEN);
+  memcpy(prxdata->dst_addr, (NULL != dst_addr) ? dst_addr : DROPLET_ADDR_NONE, DROPLET_ADDR_LEN);
+  memcpy(&prxdata->rx_ctrl, rx_ctrl, sizeof(wifi_pkt_rx_ctrl_t));
 
   memcpy(&prxdata->payload, data, len);
   prxdata->size = len;
@@ -1241,29 +1949,29 @@ droplet_recv_cb(const uint8_t *mac_addr, const uint8_t *data, int len)
   }
 
   ESP_LOGI(TAG,
-           "Event pushed to queue. Class=%d Type=%d len=%d",
-           (prxdata->payload[DROPLET_POS_CLASS] << 8) + prxdata->payload[DROPLET_POS_CLASS + 1],
-           (prxdata->payload[DROPLET_POS_TYPE] << 8) + prxdata->payload[DROPLET_POS_TYPE + 1],
-           prxdata->payload[DROPLET_POS_SIZE]);
+           "Frame pushed to queue. Version=%d Type=%02X len=%d",
+           DROPLET_FRAME_VERSION(prxdata->payload),
+           prxdata->payload[DROPLET_POS_PKT_TYPE],
+           len);
 
   if (xQueueSend(g_droplet_rcvqueue, &(prxdata), 0) != pdPASS) {
     ESP_LOGW(TAG, "[%s, %d] Send event queue failed. errQUEUE_FULL", __func__, __LINE__);
-    VSCP_FREE(prxdata);
+    droplet_pool_free(&s_droplet_rxpool, prxdata);
     g_dropletStats.nRecvOverruns++; // Receive overrun
     return;
   }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// droplet_send_cb
+// droplet_transport_send_cb
 //
 // DROPLET sending or receiving callback function is called in WiFi task.
 // Users should not do lengthy operations from this task. Instead, post
 // necessary data to a queue and handle it from a lower priority task.
 //
 
-static void
-droplet_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
+void
+droplet_transport_send_cb(const uint8_t *mac_addr, bool bSuccess)
 {
   // Must be an address
   if (mac_addr == NULL) {
@@ -1271,12 +1979,10 @@ droplet_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
     return;
   }
 
-  // There is room for more data
-  if (g_droplet_buffered_num) {
-    g_droplet_buffered_num--;
-  }
+  // Frame has left the radio, make room for the next one
+  droplet_flow_confirm(&s_droplet_flow, bSuccess, (uint32_t) esp_timer_get_time());
 
-  if (status == ESP_NOW_SEND_SUCCESS) {
+  if (bSuccess) {
     xEventGroupSetBits(s_droplet_event_group, DROPLET_SEND_CB_OK_BIT);
   }
   else {
@@ -1285,18 +1991,98 @@ droplet_send_cb(const uint8_t *mac_addr, esp_now_send_status_t status)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// droplet_send
+// droplet_set_transport
 //
 
 esp_err_t
-droplet_send(const uint8_t *dest_addr,
-             bool bPreserveHeader,
-             uint8_t nEncrypt,
-             const uint8_t *pkey,
-             uint8_t ttl,
-             uint8_t *payload,
-             size_t size,
-             uint16_t wait_ms)
+droplet_set_transport(const droplet_transport_t *ptransport)
+{
+  if ((NULL == ptransport) || (NULL == ptransport->send)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  s_droplet_transport = ptransport;
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_set_pmk
+//
+
+esp_err_t
+droplet_set_pmk(const uint8_t *pmk)
+{
+  if ((NULL == pmk) || (NULL == s_droplet_config.pmk) || (NULL == s_droplet_key_lock)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  xSemaphoreTake(s_droplet_key_lock, portMAX_DELAY);
+  if (pmk != s_droplet_config.pmk) {
+    memcpy(s_droplet_config.pmk, pmk, DROPLET_KEY_LEN);
+  }
+  int rv = droplet_crypto_key_init(&s_droplet_pmk_key, s_droplet_config.pmk);
+  xSemaphoreGive(s_droplet_key_lock);
+
+  if (VSCP_ERROR_SUCCESS != rv) {
+    ESP_LOGE(TAG, "Failed to expand primary key rv=%d", rv);
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_get_stats
+//
+
+void
+droplet_get_stats(droplet_stats_t *pstats)
+{
+  if (NULL != pstats) {
+    memcpy(pstats, &g_dropletStats, sizeof(droplet_stats_t));
+    pstats->nForwSuppressed  = s_droplet_mesh.nFwdSuppressed;
+    pstats->nForwDeferred    = s_droplet_mesh.nFwdDeferred;
+    pstats->nForwCancelled   = s_droplet_mesh.nFwdCancelled;
+    pstats->nDupHits         = s_droplet_mesh.nHits;
+    pstats->nDupEvictions    = s_droplet_mesh.nEvictions;
+    pstats->nDupCollisions   = s_droplet_mesh.nCollisions;
+    pstats->nFragReassembled = s_droplet_frag.nComplete;
+    pstats->nFragTimeouts    = s_droplet_frag.nTimeouts;
+    pstats->nFragDup         = s_droplet_frag.nDup;
+    pstats->nFragDropped     = s_droplet_frag.nDropped;
+    pstats->maxFragMem       = s_droplet_frag.maxMemUsed;
+    pstats->maxRecvPoolUsed  = atomic_load(&s_droplet_rxpool.maxInUse);
+    pstats->maxTxQueueUsed   = atomic_load(&s_droplet_txpool.maxInUse);
+    pstats->txInFlight       = droplet_flow_in_flight(&s_droplet_flow);
+    pstats->txWindow         = atomic_load(&s_droplet_flow.window);
+    pstats->txFailRatio      = s_droplet_flow.failRatio;
+    pstats->txAckLatency     = s_droplet_flow.ackLatency;
+    pstats->nSendConfirmOk   = s_droplet_flow.nConfirmOk;
+    pstats->nSendConfirmFail = s_droplet_flow.nConfirmFail;
+    memcpy(pstats->txAckHist, s_droplet_flow.ackHist, sizeof(pstats->txAckHist));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_tx_enqueue
+//
+// Prepare frame in a send slot and queue it for the send task. Runs in
+// the callers task. Only waits if there is no free send slot and
+// wait_ms is non zero.
+//
+
+static esp_err_t
+droplet_tx_enqueue(const uint8_t *dest_addr,
+                   bool bPreserveHeader,
+                   uint8_t nEncrypt,
+                   const uint8_t *pkey,
+                   uint8_t ttl,
+                   uint8_t *payload,
+                   size_t size,
+                   droplet_tx_prio_t prio,
+                   droplet_tx_done_cb_t cb,
+                   void *userdata,
+                   uint32_t wait_ms)
 {
   if (NULL == dest_addr) {
     ESP_LOGE(TAG, "destination address pointer invalid");
@@ -1308,21 +2094,38 @@ droplet_send(const uint8_t *dest_addr,
     return ESP_ERR_INVALID_ARG;
   }
 
-  if (size > DROPLET_MAX_FRAME) {
+  // Forwarded frames may have block padding left from decryption
+  if ((size < DROPLET_COMPACT_MIN_FRAME) || (size > DROPLET_CRYPTO_MAX_PLAIN)) {
     ESP_LOGE(TAG, "frame size is invalid");
     return ESP_ERR_INVALID_ARG;
   }
 
+  if ((prio >= DROPLET_TX_PRIO_COUNT) || (NULL == s_droplet_txsignal)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
   static uint8_t seq = 0;
-  esp_err_t ret      = ESP_FAIL;
-  // TickType_t write_ticks = 0;
-  uint32_t start_ticks = xTaskGetTickCount();
-  uint8_t *outbuf      = NULL;
-  //bool bBroadcast      = (0 == memcmp(dest_addr, DROPLET_ADDR_BROADCAST, ESP_NOW_ETH_ALEN));
-  size_t frame_len     = size;
+  droplet_txpkt_t *ptx = NULL;
+
+  // Get a send slot. Wait for one to be freed only if asked to.
+  TickType_t start = xTaskGetTickCount();
+  while (NULL == (ptx = droplet_pool_alloc(&s_droplet_txpool))) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (waited >= pdMS_TO_TICKS(wait_ms)) {
+      ESP_LOGW(TAG, "Send queue full, frame dropped prio=%d", prio);
+      g_dropletStats.nSendLock++; // Increase send queue full counter
+      return ESP_ERR_NO_MEM;
+    }
+    xEventGroupWaitBits(s_droplet_event_group,
+                        DROPLET_TX_SLOT_FREE_BIT,
+                        pdTRUE,
+                        pdFALSE,
+                        pdMS_TO_TICKS(wait_ms) - waited);
+  }
 
+  // Header layout version is kept
   payload[DROPLET_POS_ID]     = DROPLET_ID_MSB;
-  payload[DROPLET_POS_ID + 1] = DROPLET_ID_LSB;
+  payload[DROPLET_POS_ID + 1] = DROPLET_ID_LSB + DROPLET_FRAME_VERSION(payload);
 
   if (bPreserveHeader) {
     // Let pktid byte decide if we should encrypt or not
@@ -1336,112 +2139,186 @@ droplet_send(const uint8_t *dest_addr,
     // Magic word
     esp_fill_random((payload + DROPLET_POS_MAGIC), 2);
 
-    // Set destination address
-    // memcpy(payload + DROPLET_POS_DEST_ADDR, dest_addr, ESP_NOW_ETH_ALEN);
+    // Add frame sequency to VSCP head LSB (same place in both layouts).
+    // Aggregate and fragment frames have no VSCP header.
+    if (!DROPLET_IS_AGGREGATE(payload) && !DROPLET_IS_FRAGMENT(payload)) {
+      payload[DROPLET_POS_HEAD + 1] = (payload[DROPLET_POS_HEAD + 1] & 0xf8) + (seq++ & 0x07);
+    }
 
-    // Add frame sequency to VSCP header
-    payload[DROPLET_POS_HEAD + 1] = (payload[DROPLET_POS_HEAD + 1] & 0xf8) + seq++;
+    // Don't handle our own frame as new if a neighbour forwards it back to us
+    if (NULL != s_droplet_mesh_lock) {
+      xSemaphoreTake(s_droplet_mesh_lock, portMAX_DELAY);
+      droplet_mesh_remember(&s_droplet_mesh, payload, size, xTaskGetTickCount() * portTICK_PERIOD_MS);
+      xSemaphoreGive(s_droplet_mesh_lock);
+    }
   }
 
   // Encrypt data if needed. IV will be placed at end of data
-  // | id | encrypted-data | IV |
+  // | id | pkt-type | ttl | magic | encrypted-data | IV |
   if (nEncrypt) {
 
-    // Fill in iv at end of send frame
-    uint8_t *iv = VSCP_MALLOC(16);
-    esp_fill_random(iv, DROPLET_IV_LEN);
-
-    // Encrypt send frame
-    outbuf = VSCP_MALLOC(size + (16 - (size % 16) + 16) + 1); // size + padding + iv + coding byte
+    payload[DROPLET_POS_PKT_TYPE] = (payload[DROPLET_POS_PKT_TYPE] & 0xf0) | nEncrypt;
 
-    payload[DROPLET_POS_PKT_TYPE] = nEncrypt;
-
-    // uint64_t start = esp_timer_get_time();
-    if (0 == (frame_len = vscp_fwhlp_encryptFrame(outbuf,
-                                                  payload,
-                                                  size,
-                                                  pkey, // key
-                                                  iv,   // IV
-                                                  nEncrypt))) {
+    // Encrypted straight into the send slot, caller frame is left in clear
+    if (droplet_crypto_key_match(&s_droplet_pmk_key, pkey)) {
+      xSemaphoreTake(s_droplet_key_lock, portMAX_DELAY);
+      ptx->len = droplet_crypto_encrypt_key(ptx->frame, payload, size, &s_droplet_pmk_key, NULL, nEncrypt);
+      xSemaphoreGive(s_droplet_key_lock);
+    }
+    else {
+      ptx->len = droplet_crypto_encrypt(ptx->frame, payload, size, pkey, NULL, nEncrypt);
+    }
+    if (0 == ptx->len) {
       ESP_LOGE(TAG, "Failed to encrypt frame");
-      VSCP_FREE(iv);
-      VSCP_FREE(outbuf);
+      g_dropletStats.nSendFailures++; // Update send failures
+      droplet_pool_free(&s_droplet_txpool, ptx);
       return ESP_FAIL;
     }
-    // printf("Encrypt %d %lld\n", size, esp_timer_get_time() - start);
-
-    // Decryption test printout
-    if (0) {
-      uint8_t yyy[frame_len + 16];
-      if (VSCP_ERROR_SUCCESS != vscp_fwhlp_decryptFrame(yyy,
-                                                        outbuf,
-                                                        frame_len,
-                                                        pkey, // key
-                                                        NULL, // IV  - use embedded
-                                                        VSCP_ENCRYPTION_FROM_TYPE_BYTE)) {
-        ESP_LOGE(TAG, "Failed to decrypt frame");
-        VSCP_FREE(outbuf);
-        VSCP_FREE(iv);
-        return ESP_FAIL;
-      }
-
-      ESP_LOG_BUFFER_HEX("DEC", yyy, frame_len);
-    }
+    ptx->frame[DROPLET_POS_ID + 1] |= DROPLET_VERSION_CRYPT;
   }
   // If not encrypted
   else {
-    outbuf = VSCP_MALLOC(size);
-    if (NULL == outbuf) {
-      return ESP_ERR_NO_MEM;
+    payload[DROPLET_POS_PKT_TYPE] = (payload[DROPLET_POS_PKT_TYPE] & 0xf0) | VSCP_ENCRYPTION_NONE;
+    memcpy(ptx->frame, payload, size);
+    ptx->len = size;
+  }
+
+  memcpy(ptx->dest_addr, dest_addr, DROPLET_ADDR_LEN);
+  ptx->prio     = prio;
+  ptx->cb       = cb;
+  ptx->userdata = userdata;
+
+  // Queues are as long as there are slots so this can't fail
+  xQueueSend(s_droplet_txqueue[prio], &ptx, 0);
+  xSemaphoreGive(s_droplet_txsignal);
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_send
+//
+
+esp_err_t
+droplet_send(const uint8_t *dest_addr,
+             bool bPreserveHeader,
+             uint8_t nEncrypt,
+             const uint8_t *pkey,
+             uint8_t ttl,
+             uint8_t *payload,
+             size_t size,
+             uint16_t wait_ms)
+{
+  return droplet_tx_enqueue(dest_addr,
+                            bPreserveHeader,
+                            nEncrypt,
+                            pkey,
+                            ttl,
+                            payload,
+                            size,
+                            bPreserveHeader ? DROPLET_TX_PRIO_FORWARD : DROPLET_TX_PRIO_LOCAL,
+                            NULL,
+                            NULL,
+                            wait_ms);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_send_async
+//
+
+esp_err_t
+droplet_send_async(const uint8_t *dest_addr,
+                   bool bPreserveHeader,
+                   uint8_t nEncrypt,
+                   const uint8_t *pkey,
+                   uint8_t ttl,
+                   uint8_t *payload,
+                   size_t size,
+                   droplet_tx_prio_t prio,
+                   droplet_tx_done_cb_t cb,
+                   void *userdata)
+{
+  return droplet_tx_enqueue(dest_addr, bPreserveHeader, nEncrypt, pkey, ttl, payload, size, prio, cb, userdata, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_tx_task
+//
+// The only task that sends on the transport. Takes frames from the
+// queues in priority order and holds back when the radio has too many
+// frames in flight.
+//
+
+static void
+droplet_tx_task(void *arg)
+{
+  esp_err_t ret;
+  droplet_txpkt_t *ptx = NULL;
+
+  (void) arg;
+
+  ESP_LOGI(TAG, "droplet tx task entry");
+
+  while (true) {
+
+    // One signal for every queued frame. Wake up when an aggregate is due.
+    if (pdTRUE != xSemaphoreTake(s_droplet_txsignal, droplet_agg_run())) {
+      continue;
     }
-    memcpy(outbuf, payload, size);
-    outbuf[DROPLET_POS_PKT_TYPE] = VSCP_ENCRYPTION_NONE;
-  }
-
-  // Wait for other tasks to be sent before send ESP-NOW data
-  if (xSemaphoreTake(droplet_send_lock, pdMS_TO_TICKS(wait_ms)) != pdPASS) {
-    ESP_LOGE(TAG, "Timeout trying to get send lock.");
-    VSCP_FREE(outbuf);
-    g_dropletStats.nSendLock++; // Increase send lock failure counter
-    return ESP_ERR_TIMEOUT;
-  }
-
-  xEventGroupClearBits(s_droplet_event_group, DROPLET_SEND_CB_OK_BIT | DROPLET_SEND_CB_FAIL_BIT);
-
-  ESP_LOGI(TAG,"esp_now_send " MACSTR " len=%d", MAC2STR(dest_addr), frame_len);
-  ret = esp_now_send(dest_addr, outbuf, frame_len);
-  if (ret == ESP_OK) {
-
-    // write_ticks = (wait_ticks == portMAX_DELAY)                    ? portMAX_DELAY
-    //               : xTaskGetTickCount() - start_ticks < wait_ticks ? wait_ticks - (xTaskGetTickCount() - start_ticks)
-    //                                                                : 0;
-    g_droplet_buffered_num++;
-
-    // Wait send cb if no room for frames
-    if (g_droplet_buffered_num >= DROPLET_MAX_BUFFERED_NUM) {
-      EventBits_t uxBits = xEventGroupWaitBits(s_droplet_event_group,
-                                               DROPLET_SEND_CB_OK_BIT | DROPLET_SEND_CB_FAIL_BIT,
-                                               pdTRUE,
-                                               pdFALSE,
-                                               wait_ms);
-      if (uxBits & DROPLET_SEND_CB_OK_BIT) {
-        ret = ESP_OK;
+
+    ptx = NULL;
+    for (int prio = 0; prio < DROPLET_TX_PRIO_COUNT; prio++) {
+      if (pdTRUE == xQueueReceive(s_droplet_txqueue[prio], &ptx, 0)) {
+        break;
       }
-      else {
-        ESP_LOGE(TAG, "Timeout waiting for send status.");
-        g_dropletStats.nSendAck++; // Increase sendack failures
-        ret = ESP_FAIL;
+    }
+
+    if (NULL == ptx) {
+      continue;
+    }
+
+    // Wait for send confirms while the in-flight window is full
+    if (!droplet_flow_can_send(&s_droplet_flow)) {
+      g_dropletStats.nTxWindowWait++;
+      while (!droplet_flow_can_send(&s_droplet_flow)) {
+        EventBits_t uxBits = xEventGroupWaitBits(s_droplet_event_group,
+                                                 DROPLET_SEND_CB_OK_BIT | DROPLET_SEND_CB_FAIL_BIT,
+                                                 pdTRUE,
+                                                 pdFALSE,
+                                                 pdMS_TO_TICKS(DROPLET_TX_ACK_TIMEOUT));
+        if (!(uxBits & (DROPLET_SEND_CB_OK_BIT | DROPLET_SEND_CB_FAIL_BIT))) {
+          ESP_LOGE(TAG, "Timeout waiting for send status.");
+          g_dropletStats.nSendAck++; // Increase sendack failures
+          droplet_flow_timeout(&s_droplet_flow);
+        }
       }
     }
-  }
-  else {
-    ESP_LOGE(TAG, "Failed to send frame err=%X", (int) ret);
-  }
 
-  xSemaphoreGive(droplet_send_lock);
-  VSCP_FREE(outbuf);
+    ESP_LOGI(TAG,
+             "%s send " MACSTR " len=%d prio=%d",
+             s_droplet_transport->name,
+             MAC2STR(ptx->dest_addr),
+             (int) ptx->len,
+             ptx->prio);
+    // Registered before sending as the confirm can come before send returns
+    droplet_flow_sent(&s_droplet_flow, (uint32_t) esp_timer_get_time());
+    ret = s_droplet_transport->send(ptx->dest_addr, ptx->frame, ptx->len);
+    if (ESP_OK == ret) {
+      g_dropletStats.nSend++; // Update send frame statistics
+    }
+    else {
+      ESP_LOGE(TAG, "Failed to send frame err=%X", (int) ret);
+      g_dropletStats.nSendFailures++; // Update send failures
+      droplet_flow_abort(&s_droplet_flow);
+    }
 
-  return ret;
+    if (NULL != ptx->cb) {
+      ptx->cb(ret, ptx->userdata);
+    }
+
+    droplet_pool_free(&s_droplet_txpool, ptx);
+    xEventGroupSetBits(s_droplet_event_group, DROPLET_TX_SLOT_FREE_BIT);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1449,7 +2326,7 @@ droplet_send(const uint8_t *dest_addr,
 //
 
 void
-droplet_set_vscp_user_handler_cb(vscp_event_handler_cb_t *cb)
+droplet_set_vscp_user_handler_cb(vscp_event_handler_cb_t cb)
 {
   s_vscp_event_handler_cb = cb;
 }
@@ -1469,7 +2346,7 @@ droplet_clear_vscp_handler_cb(void)
 //
 
 void
-droplet_set_attach_network_handler_cb(droplet_attach_network_handler_cb_t *cb)
+droplet_set_attach_network_handler_cb(droplet_attach_network_handler_cb_t cb)
 {
   s_droplet_attach_network_handler_cb = cb;
 }
@@ -1488,20 +2365,9 @@ int
 droplet_probe(void)
 {
   // Add broadcast peer information to peer list.
-  esp_now_peer_info_t *peer = VSCP_MALLOC(sizeof(esp_now_peer_info_t));
-  if (NULL == peer) {
-    ESP_LOGE(TAG, "Malloc peer information fail");
-    // vSemaphoreDelete(s_vscp_droplet_event_queue);
-    esp_now_deinit();
-    return ESP_FAIL;
+  if (NULL != s_droplet_transport->add_peer) {
+    ESP_ERROR_CHECK(s_droplet_transport->add_peer(DROPLET_ADDR_BROADCAST, PRJDEF_DROPLET_CHANNEL));
   }
-  memset(peer, 0, sizeof(esp_now_peer_info_t));
-  peer->channel = PRJDEF_DROPLET_CHANNEL;
-  peer->ifidx   = PRJDEF_DROPLET_WIFI_IF;
-  peer->encrypt = false;
-  memcpy(peer->peer_addr, DROPLET_ADDR_BROADCAST, ESP_NOW_ETH_ALEN);
-  ESP_ERROR_CHECK(esp_now_add_peer(peer));
-  VSCP_FREE(peer);
 
   return 0;
 }
@@ -1537,21 +2403,22 @@ droplet_heartbeat_task(void *pvParameter)
 
     if (DROPLET_STATE_IDLE == s_stateDroplet) {
 
-      uint8_t ch     = 0;
-      uint8_t second = 0;
+      uint8_t ch = 0;
 
-      if (ESP_OK != (ret = esp_wifi_get_channel(&ch, &second))) {
+      if ((NULL != s_droplet_transport->get_channel) && (ESP_OK != (ret = s_droplet_transport->get_channel(&ch)))) {
         ESP_LOGE(TAG, "Failed to get wifi channel, rv = %X", ret);
       }
-      ESP_LOGI(TAG, "Sending heartbeat ch=%d (%d).", ch, second);
-      ret = droplet_send(DROPLET_ADDR_BROADCAST,
-                         false,
-                         VSCP_ENCRYPTION_NONE,
-                         s_droplet_config.pmk,
-                         4,
-                         buf,
-                         DROPLET_MIN_FRAME + 3,
-                         1000 / portTICK_PERIOD_MS);
+      ESP_LOGI(TAG, "Sending heartbeat ch=%d.", ch);
+      ret = droplet_send_async(DROPLET_ADDR_BROADCAST,
+                               false,
+                               VSCP_ENCRYPTION_NONE,
+                               s_droplet_config.pmk,
+                               4,
+                               buf,
+                               DROPLET_MIN_FRAME + 3,
+                               DROPLET_TX_PRIO_HEARTBEAT,
+                               NULL,
+                               NULL);
       if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send heartbeat. ret = %X", ret);
       }
@@ -1581,7 +2448,7 @@ droplet_client_provisioning_task(void *pvParameter)
   uint8_t *pbuf  = NULL;
   vscpEvent *pev = NULL;
   uint8_t nLoops = 0;
-  uint8_t origChannel;
+  uint8_t origChannel = PRJDEF_DROPLET_CHANNEL;
   uint8_t channel   = 1; // Start on this channel
   uint8_t intMsgCnt = 0;
 
@@ -1632,23 +2499,29 @@ droplet_client_provisioning_task(void *pvParameter)
   vscp_fwhlp_deleteEvent(&pev);
 
   // Save channel we use
-  esp_wifi_get_channel(&origChannel, NULL);
+  if (NULL != s_droplet_transport->get_channel) {
+    s_droplet_transport->get_channel(&origChannel);
+  }
 
   ESP_LOGI(TAG, "Start initialization sequency");
 
   while ((DROPLET_STATE_CLIENT_INIT == s_stateDroplet) && (nLoops < DROPLET_INIT_LOOPS)) {
 
-    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    if (NULL != s_droplet_transport->set_channel) {
+      s_droplet_transport->set_channel(channel);
+    }
     ESP_LOGI(TAG, "Channel = %d\n", channel);
 
-    ret = droplet_send(DROPLET_ADDR_BROADCAST,
-                       false,
-                       VSCP_ENCRYPTION_NONE,
-                       s_droplet_config.lkey,
-                       4,
-                       pbuf,
-                       DROPLET_MIN_FRAME + 2,
-                       0 / portTICK_PERIOD_MS);
+    ret = droplet_send_async(DROPLET_ADDR_BROADCAST,
+                             false,
+                             VSCP_ENCRYPTION_NONE,
+                             s_droplet_config.lkey,
+                             4,
+                             pbuf,
+                             DROPLET_MIN_FRAME + 2,
+                             DROPLET_TX_PRIO_PROVISIONING,
+                             NULL,
+                             NULL);
     if (ret != ESP_OK) {
       ESP_LOGE(TAG, "Failed to send heartbeat. ret = %X", ret);
     }
@@ -1671,7 +2544,9 @@ ERROR:
   VSCP_FREE(pbuf);
 
   // Set original channel
-  esp_wifi_set_channel(origChannel, WIFI_SECOND_CHAN_NONE);
+  if (NULL != s_droplet_transport->set_channel) {
+    s_droplet_transport->set_channel(origChannel);
+  }
 
   // Set idle state
   s_stateDroplet = DROPLET_STATE_IDLE;
@@ -1753,19 +2628,13 @@ droplet_server_provisioning_task(void *pvParameter)
     goto ERROR;
   }
 
-  // Add broadcast peer information to peer list.
-  esp_now_peer_info_t *peer = VSCP_MALLOC(sizeof(esp_now_peer_info_t));
-  if (NULL == peer) {
-    ESP_LOGE(TAG, "Malloc peer information fail");
-    goto ERROR;
+  // Add peer information for node under provisioning to peer list.
+  if (NULL != s_droplet_transport->add_peer) {
+    if (ESP_OK != (ret = s_droplet_transport->add_peer(s_provisionNodeInfo.mac, 0))) {
+      ESP_LOGE(TAG, "Failed to add peer rv=%X", ret);
+      goto ERROR;
+    }
   }
-  memset(peer, 0, sizeof(esp_now_peer_info_t));
-  peer->channel = 0;
-  peer->ifidx   = PRJDEF_DROPLET_WIFI_IF;
-  peer->encrypt = false;
-  memcpy(peer->peer_addr, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN);
-  ESP_ERROR_CHECK(esp_now_add_peer(peer));
-  VSCP_FREE(peer);
 
   // Wait for first event
   s_stateDroplet = DROPLET_STATE_SRV_INIT1;
@@ -1809,7 +2678,7 @@ droplet_server_provisioning_task(void *pvParameter)
     // Build GUID for desitnation node
     memset(pev->pdata + 2, 0xff, 7);
     pev->pdata[2+7] = 0xfe;
-    memcpy(pev->pdata + 2 + 8, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN);  // Destination GUID
+    memcpy(pev->pdata + 2 + 8, s_provisionNodeInfo.mac, DROPLET_ADDR_LEN);  // Destination GUID
     memset(pev->pdata + 2 + 14, 0, 2);
     memcpy(pev->pdata + 2 + 16, pconfig->pmk, 32);
 
@@ -1836,7 +2705,9 @@ droplet_server_provisioning_task(void *pvParameter)
   }
 
 ERROR:
-  esp_now_del_peer(s_provisionNodeInfo.mac);
+  if (NULL != s_droplet_transport->del_peer) {
+    s_droplet_transport->del_peer(s_provisionNodeInfo.mac);
+  }
   s_stateDroplet = DROPLET_STATE_IDLE;
   ESP_LOGI(TAG, "End initialization sequency");
   vTaskDelete(NULL);
@@ -1854,10 +2725,10 @@ droplet_startServerProvisioning(const uint8_t *pmac, const uint8_t *pkey)
   }
 
   // Save provision parameters
-  memcpy(s_provisionNodeInfo.mac, pmac, ESP_NOW_ETH_ALEN);
+  memcpy(s_provisionNodeInfo.mac, pmac, DROPLET_ADDR_LEN);
   memcpy(s_provisionNodeInfo.keyLocal, pkey, 32);
 
-  ESP_LOG_BUFFER_HEXDUMP(TAG, s_provisionNodeInfo.mac, ESP_NOW_ETH_ALEN, ESP_LOG_INFO);
+  ESP_LOG_BUFFER_HEXDUMP(TAG, s_provisionNodeInfo.mac, DROPLET_ADDR_LEN, ESP_LOG_INFO);
   ESP_LOG_BUFFER_HEXDUMP(TAG, s_provisionNodeInfo.keyLocal, 32, ESP_LOG_INFO);
 
   if (DROPLET_STATE_IDLE == s_stateDroplet) {
@@ -54,13 +54,25 @@
 extern "C" {
 #endif
 
-#define DROPLET_VERSION 0x00
+#define DROPLET_VERSION         0x00 // Fixed frame layout
+#define DROPLET_VERSION_COMPACT 0x01 // Compact VSCP header
+
+// Flag in the version nibble of encrypted frames. The header up to
+// DROPLET_POS_HEAD is in clear and the IV follows the padded data
+// (droplet-crypto.c). Older firmware encrypted everything after the
+// first byte with version 0. The two can't read each other, older
+// nodes refuse frames with the flag and frames without it are refused
+// here.
+#define DROPLET_VERSION_CRYPT 0x02
 
 // Frame id
 
 #define DROPLET_ID_MSB 0x55
 #define DROPLET_ID_LSB (0xA0 + DROPLET_VERSION)
 
+// Frame layout version from the low nibble of the id
+#define DROPLET_FRAME_VERSION(frame) ((frame)[DROPLET_POS_ID + 1] & 0x0f & ~DROPLET_VERSION_CRYPT)
+
 // Security
 
 #define DROPLET_KEY_LEN 32 // Secret key length (AES-128 use the first 16)
@@ -88,9 +100,68 @@ extern "C" {
 #define DROPLET_POS_DATA     15 // VSCP data (max 128 bytes)
 
 #define DROPLET_MIN_FRAME DROPLET_POS_DATA // Number of bytes in minimum frame
+
+/*
+  Compact VSCP content (DROPLET_VERSION_COMPACT). Head MSB and nickname
+  are only there if set in flags. Class and type are varints, seven bits
+  per byte with the high bit set if more bytes follow, so Level I classes
+  and types take one or two bytes. The head LSB is at the same position
+  as in the fixed layout.
+
+  | flags | head LSB | [head MSB] | [nickname (2)] | class (1-3) | type (1-3) | size | data |
+*/
+#define DROPLET_POS_COMPACT_FLAGS     6    // Compact header flags (1)
+#define DROPLET_COMPACT_FLAG_HEAD_MSB 0x01 // Head MSB is in the frame
+#define DROPLET_COMPACT_FLAG_NICKNAME 0x02 // Nickname is in the frame
+
+#define DROPLET_COMPACT_MIN_FRAME (DROPLET_POS_COMPACT_FLAGS + 5) // Shortest compact frame
 #define DROPLET_MAX_DATA  128              // Max VSCP data (of possible 512 bytes) that a frame can hold
 #define DROPLET_MAX_FRAME DROPLET_MIN_FRAME + DROPLET_MAX_DATA
 
+// ESP-NOW payload limit
+#define DROPLET_MAX_AIR_FRAME 250
+
+/*
+  Aggregate frame. Several events share one droplet header (and IV when
+  encrypted). Marked with DROPLET_PKT_TYPE_AGGREGATE in the packet type.
+  Every event record is the VSCP content of a single event frame, head,
+  nickname, class, type, size and data, in the layout given by the
+  version in the id.
+*/
+#define DROPLET_PKT_TYPE_AGGREGATE 0x80 // Packet type flag for aggregate frame
+#define DROPLET_POS_AGG_COUNT      6    // Number of event records (1)
+#define DROPLET_POS_AGG_LEN        7    // Bytes of event records (1)
+#define DROPLET_POS_AGG_RECORDS    8    // First event record
+
+// Largest aggregate frame. Still fits DROPLET_MAX_AIR_FRAME when padded and given an IV.
+#define DROPLET_AGG_MAX_FRAME (DROPLET_POS_HEAD + ((DROPLET_MAX_AIR_FRAME - DROPLET_IV_LEN - DROPLET_POS_HEAD) & ~15))
+
+/*
+  Fragment frame. An event with more data than DROPLET_MAX_DATA is sent
+  as a message, the VSCP content of the event with a zero size byte
+  followed by all data, split over several fragment frames. Marked with
+  DROPLET_PKT_TYPE_FRAGMENT in the packet type. The layout of the VSCP
+  header in the message is given by the version in the id.
+
+  | id | pkt-type | ttl | magic | msg id (2) | index | count | len | message bytes |
+*/
+#define DROPLET_PKT_TYPE_FRAGMENT 0x40 // Packet type flag for fragment frame
+#define DROPLET_POS_FRAG_ID       6    // Message id (2). Same in all fragments of a message.
+#define DROPLET_POS_FRAG_INDEX    8    // Fragment index (1)
+#define DROPLET_POS_FRAG_COUNT    9    // Fragments in message (1)
+#define DROPLET_POS_FRAG_LEN      10   // Message bytes in this fragment (1)
+#define DROPLET_POS_FRAG_PAYLOAD  11   // First message byte
+
+#define DROPLET_MAX_FRAG_DATA    512                          // Max VSCP data of a fragmented event
+#define DROPLET_FRAG_MAX_MSG     (DROPLET_MAX_FRAG_DATA + 16) // Largest message, VSCP header and data
+
+// Message bytes in a full fragment and the most fragments a message needs
+#define DROPLET_FRAG_MAX_PAYLOAD (DROPLET_AGG_MAX_FRAME - DROPLET_POS_FRAG_PAYLOAD)
+#define DROPLET_FRAG_MAX_COUNT   ((DROPLET_FRAG_MAX_MSG + DROPLET_FRAG_MAX_PAYLOAD - 1) / DROPLET_FRAG_MAX_PAYLOAD)
+
+// Largest frame on air. Encrypted frames are padded to the AES block size and carry the IV.
+#define DROPLET_MAX_ENCRYPTED_FRAME DROPLET_MAX_AIR_FRAME
+
 typedef enum {
   DROPLET_ALPHA_NODE = 0,
   DROPLET_BETA_NODE,
@@ -114,6 +185,20 @@ typedef enum {
   DROPLET_STATE_SRV_OTA      // OTA state for Alpha/Beta/Gamma nodes that serve firmware.
 } droplet_state_t;
 
+/**
+ * @brief Forwarding strategies
+ *
+ * Flooding forwards every new frame which in dense networks gives a
+ * broadcast storm. The other strategies let nodes that add little
+ * coverage stay quiet.
+ */
+typedef enum {
+  DROPLET_FWD_FLOOD = 0, // Forward every new frame
+  DROPLET_FWD_GOSSIP,    // Forward with a fixed probability
+  DROPLET_FWD_COUNTER,   // Wait a random backoff. Forward unless enough copies were heard meanwhile.
+  DROPLET_FWD_RSSI,      // As counter but backoff grows with signal strength. Close senders are not forwarded.
+} droplet_fwd_strategy_t;
+
 /**
  * @brief Initialize the configuration of droplet
  */
@@ -123,7 +208,22 @@ typedef struct {
   uint8_t ttl;                  // Default ttl
   bool bForwardEnable;          // Forward when packets are received
   bool bForwardSwitchChannel;   // Forward data packet with exchange channel
-  uint8_t sizeQueue;            // Size of receive queue
+  uint8_t fwdStrategy;          // Forwarding strategy (droplet_fwd_strategy_t)
+  uint8_t fwdGossipProb;        // Gossip forward probability in percent (zero is DROPLET_FWD_GOSSIP_PROB)
+  uint8_t fwdCounterMax;        // Copies heard that cancel a held forward (zero is DROPLET_FWD_COUNTER_MAX)
+  uint16_t fwdBackoff;          // Max forward backoff in ms (zero is DROPLET_FWD_BACKOFF)
+  uint16_t fwdJitter;           // Max flood/gossip forward jitter in ms (zero is DROPLET_FWD_JITTER)
+  int8_t fwdRssiNear;           // Senders at or above this RSSI are not forwarded (zero is DROPLET_FWD_RSSI_NEAR)
+  int8_t fwdRssiFar;            // Senders at or below this RSSI get the shortest backoff (zero is DROPLET_FWD_RSSI_FAR)
+  uint8_t sizeQueue;            // Size of receive queue and number of receive slots
+  uint8_t sizeTxQueue;          // Frames that can wait for sending (zero is DROPLET_TX_QUEUE_SIZE)
+  uint8_t maxTxInFlight;        // Max frames in the radio (zero is half the WiFi TX buffers)
+  uint16_t sizeMsgCache;        // Duplicate filter entries (zero is DROPLET_MSG_CACHE_SIZE)
+  uint32_t maxAgeMsgCache;      // Milliseconds a frame is remembered (zero is DROPLET_MSG_CACHE_MAX_AGE)
+  uint16_t aggLinger;           // Milliseconds events are held to be sent in one frame (zero is no aggregation)
+  bool bCompactHeader;          // Send events with the compact header when it is shorter
+  uint16_t fragTimeout;         // Milliseconds a partly received large event is kept (zero is DROPLET_FRAG_TIMEOUT)
+  uint8_t sizeFragSlots;        // Large events that can be reassembled at once (zero is DROPLET_FRAG_SLOTS)
   uint8_t nEncryption;          // 0=no encryption, 1=AES-128, 2=AES-192, 3=AES-256
   bool bFilterAdjacentChannel;  // Don't receive if from other channel
   int filterWeakSignal;         // Filter onm RSSI (zero is no rssi filtering)
@@ -155,7 +255,22 @@ typedef struct {
  */
 typedef esp_err_t (*type_handle_t)(uint8_t *src_addr, void *data, size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl);
 
-#define DROPLET_MSG_CACHE_SIZE           32    // Size for magic cache
+#define DROPLET_MSG_CACHE_SIZE           32    // Default number of entries in duplicate filter
+#define DROPLET_MSG_CACHE_MAX_AGE        5000  // Default milliseconds a frame is held in duplicate filter
+#define DROPLET_TX_QUEUE_SIZE            16    // Default number of frames that can wait for sending
+#define DROPLET_FWD_GOSSIP_PROB          65    // Default gossip forward probability (percent)
+#define DROPLET_FWD_COUNTER_MAX          3     // Default number of copies that cancel a held forward
+#define DROPLET_FWD_BACKOFF              20    // Default max forward backoff in milliseconds
+#define DROPLET_FWD_JITTER               10    // Default max flood/gossip forward jitter in milliseconds
+#define DROPLET_FWD_RETRIES              2     // Resends of a held forward the radio failed to send
+#define DROPLET_FWD_RSSI_NEAR            -45   // Default RSSI (dBm) for a sender that is too close to forward
+#define DROPLET_FWD_RSSI_FAR             -85   // Default RSSI (dBm) for a sender at the edge of range
+#define DROPLET_FWD_PENDING_SIZE         8     // Forwards that can be held for backoff/jitter
+#define DROPLET_FRAG_SLOTS               4     // Default number of large events that can be reassembled at once
+#define DROPLET_FRAG_TIMEOUT             2000  // Default milliseconds a partly received large event is kept
+#define DROPLET_TX_ACK_TIMEOUT           100   // Milliseconds send task waits for a send confirm
+#define DROPLET_TX_TARGET_LATENCY        4000  // Send confirms slower than this (us) don't grow the window
+#define DROPLET_TX_LATENCY_BINS          8     // Bins in send confirm latency histogram
 #define DROPLET_HEART_BEAT_INTERVAL      30000 // Milliseconds between heartbeat events
 #define DROPLET_INIT_LOOPS               2     // Number of all channel loops
 #define DROPLET_INIT_HEART_BEAT_INTERVAL 200   // Milliseconds between heartbeat probe events
@@ -181,9 +296,110 @@ typedef enum { DROPLET_CTRL_INIT, DROPLET_CTRL_BOUND, DEOPLET_CTRL_MAX } droplet
 #define DROPLET_ADDR_IS_SELF(addr)          !memcmp(addr, DROPLET_ADDR_SELF, 6)
 #define DROPLET_ADDR_IS_EQUAL(addr1, addr2) !memcmp(addr1, addr2, 6)
 
+DROPLET_DECLARE_COMMON_ADDR(DROPLET_ADDR_NONE)
+DROPLET_DECLARE_COMMON_ADDR(DROPLET_ADDR_BROADCAST)
+
+/**
+ * @brief Send and receive statistics
+ *
+ */
+typedef struct {
+  uint32_t nSend;            // # sent frames
+  uint32_t nSendFailures;    // Number of send failures
+  uint32_t nSendLock;        // Frames dropped because the send queue was full
+  uint32_t nSendAck;         // # of failed send confirms
+  uint32_t nRecv;            // # received frames
+  uint32_t nRecvOverruns;    // Number of receive overruns
+  uint32_t nRecvFrameFault;  // Frame to big or to small
+  uint32_t nRecvAdjChFilter; // Adjacent channel filter
+  uint32_t nRecvRssiFilter;  // RSSI filter stats
+  uint32_t nRecvPoolEmpty;   // Frames dropped because all receive slots were in use
+  uint32_t maxRecvPoolUsed;  // High water mark for receive slots in use
+  uint32_t nForw;            // # Number of forwarded frames
+  uint32_t nForwSuppressed;  // Forwards dropped by the forwarding strategy
+  uint32_t nForwDeferred;    // Forwards held for backoff or jitter
+  uint32_t nForwCancelled;   // Held forwards cancelled by copies from neighbours
+  uint32_t nForwCollisions;  // Held forwards the radio failed to send
+  uint32_t nForwRetries;     // Resends of held forwards
+  uint32_t nAggSent;         // Aggregate frames sent
+  uint32_t nAggEvents;       // Events sent in aggregate frames
+  uint32_t nAggRecv;         // Aggregate frames received
+  uint32_t nFragSent;        // Fragment frames sent
+  uint32_t nFragRecv;        // Fragment frames received
+  uint32_t nFragReassembled; // Large events reassembled from fragments
+  uint32_t nFragTimeouts;    // Partly received large events dropped on timeout
+  uint32_t nFragDup;         // Fragments received twice for the same event
+  uint32_t nFragDropped;     // Fragments dropped because all reassembly slots were in use
+  uint32_t maxFragMem;       // High water mark for bytes held for reassembly
+  uint32_t nTxWindowWait;    // Times the send task waited for frames in flight to be confirmed
+  uint32_t maxTxQueueUsed;   // High water mark for frames waiting to be sent
+  uint32_t txInFlight;       // Frames sent but not confirmed
+  uint32_t txWindow;         // Current in-flight window
+  uint32_t txFailRatio;      // Smoothed send confirm failure ratio (per mille)
+  uint32_t txAckLatency;     // Smoothed send confirm latency (us)
+  uint32_t nSendConfirmOk;   // Successful send confirms
+  uint32_t nSendConfirmFail; // Failed send confirms
+  uint32_t txAckHist[DROPLET_TX_LATENCY_BINS]; // Confirm latency, <250us, <500us, ... >=16ms
+  uint32_t nDupHits;         // Duplicate frames dropped
+  uint32_t nDupEvictions;    // Live duplicate filter entries evicted (filter too small)
+  uint32_t nDupCollisions;   // Frames with same magic but other content
+} droplet_stats_t;
+
+/**
+ * @brief Send priority classes
+ *
+ * The send task always sends the oldest frame of the highest class
+ * (lowest number) first.
+ */
+typedef enum {
+  DROPLET_TX_PRIO_PROVISIONING = 0, // Provisioning handshake
+  DROPLET_TX_PRIO_FORWARD,          // Frames forwarded for other nodes
+  DROPLET_TX_PRIO_LOCAL,            // Frames originated on this node
+  DROPLET_TX_PRIO_HEARTBEAT,        // Heartbeats
+  DROPLET_TX_PRIO_COUNT
+} droplet_tx_prio_t;
+
+/*
+  Called from the send task when a queued frame has been handed to the
+  transport. status is the transport send result.
+*/
+typedef void (*droplet_tx_done_cb_t)(esp_err_t status, void *userdata);
+
+/**
+ * @brief Radio transport used by the droplet stack
+ *
+ * The droplet core never talks to the radio itself. Frames are sent through
+ * the active transport and the transport hands received frames back with
+ * droplet_transport_recv() and send confirmations with droplet_transport_send_cb().
+ * On target the ESP-NOW transport is used if nothing else is set. Host builds
+ * register one of the POSIX transports before calling droplet_init.
+ *
+ * Only send is mandatory. Unset members are treated as not supported.
+ */
+typedef struct {
+  const char *name;                                                      // Name used in log output
+  esp_err_t (*init)(const droplet_config_t *config);                     // Bring up radio
+  esp_err_t (*deinit)(void);                                             // Take down radio
+  esp_err_t (*send)(const uint8_t *dest_addr, const uint8_t *data, size_t len); // Send one frame
+  esp_err_t (*add_peer)(const uint8_t *peer_addr, uint8_t channel);      // Add unicast peer
+  esp_err_t (*del_peer)(const uint8_t *peer_addr);                       // Remove unicast peer
+  esp_err_t (*get_mac)(uint8_t *mac);                                    // Get our own address
+  esp_err_t (*get_channel)(uint8_t *channel);                            // Get current channel
+  esp_err_t (*set_channel)(uint8_t channel);                             // Set channel
+} droplet_transport_t;
+
+#ifdef ESP_PLATFORM
+// ESP-NOW transport (droplet-espnow.c)
+extern const droplet_transport_t g_droplet_transport_espnow;
+#endif
+
 // Callback functions
 
-// Callback for droplet received events
+/*
+  Callback for droplet received events. The event is a view on the
+  receive slot and is only valid while the callback runs. Copy it
+  (vscp_fwhlp_mkEventCopy) if it must be kept.
+*/
 typedef void (*vscp_event_handler_cb_t)(const vscpEvent *pev, void *userdata);
 
 // Callback for client node attach to network
@@ -200,14 +416,86 @@ typedef void (*droplet_attach_network_handler_cb_t)(wifi_pkt_rx_ctrl_t *prxdata,
 esp_err_t
 droplet_init(const droplet_config_t *config);
 
+/**
+ * @fn droplet_set_transport
+ * @brief Set the radio transport the droplet stack should use
+ *
+ * Must be called before droplet_init. On target the ESP-NOW transport
+ * is used if no transport is set.
+ *
+ * @param ptransport Pointer to transport. Must stay valid while droplet is used.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG if the transport
+ *         has no send method.
+ */
+esp_err_t
+droplet_set_transport(const droplet_transport_t *ptransport);
+
+/**
+ * @fn droplet_transport_recv
+ * @brief Hand a received frame to the droplet stack
+ *
+ * Called by the transport for every received frame. Can be called from
+ * the radio task so it only validates, filters and queues the frame.
+ *
+ * @param src_addr Pointer to six byte source address.
+ * @param dst_addr Pointer to six byte destination address. Can be NULL if not known.
+ * @param rx_ctrl Pointer to radio metadata for the frame.
+ * @param data Pointer to frame data.
+ * @param len Length of frame data.
+ */
+void
+droplet_transport_recv(const uint8_t *src_addr,
+                       const uint8_t *dst_addr,
+                       const wifi_pkt_rx_ctrl_t *rx_ctrl,
+                       const uint8_t *data,
+                       int len);
+
+/**
+ * @fn droplet_transport_send_cb
+ * @brief Report send status of a frame to the droplet stack
+ *
+ * @param mac_addr Destination address for frame.
+ * @param bSuccess True if frame was sent successfully.
+ */
+void
+droplet_transport_send_cb(const uint8_t *mac_addr, bool bSuccess);
+
+/**
+ * @fn droplet_set_pmk
+ * @brief Set a new primary key
+ *
+ * The key is written to the pmk buffer given in the configuration and the
+ * cached key schedules are updated. Must be called if the pmk buffer is
+ * changed after droplet_init.
+ *
+ * @param pmk Pointer to 32 byte key. Can be the configured pmk buffer.
+ * @return esp_err_t ESP_OK if all is OK
+ */
+esp_err_t
+droplet_set_pmk(const uint8_t *pmk);
+
+/**
+ * @fn droplet_get_stats
+ * @brief Get a copy of the droplet send/receive statistics
+ *
+ * @param pstats Pointer to statistics structure that will get data.
+ */
+void
+droplet_get_stats(droplet_stats_t *pstats);
+
 /**
  * @brief Send droplet frame
  *
+ * The frame is prepared (header, encryption) and queued for the send task
+ * with local priority (forward priority if bPreserveHeader is set). The
+ * call returns when the frame is queued, not when it is sent.
+ *
  * @param dest_addr Pointer to destination mac address. Normally broadcast 0xff,0xff,0xff,0xff,0xff,0xff
  * @param bPreserveHeader Set to true if header is already set in payload and need to be preserved. If false
  *                        ttl , magic etc will be set by the routine.
- * @param nEncrypt  Encryption type. Frame size will increase by 16 as the iv is appended to
- *                  the end of it. Valid values is
+ * @param nEncrypt  Encryption type. The frame from the VSCP head and on is padded to the AES
+ *                  block size and encrypted and the iv (16 bytes) is appended to the end of it.
+ *                  Id, packet type, ttl and magic are sent in clear. Valid values is
  *                  VSCP_ENCRYPTION_NONE           0
  *                  VSCP_ENCRYPTION_AES128         1
  *                  VSCP_ENCRYPTION_AES192         2
@@ -216,8 +504,9 @@ droplet_init(const droplet_config_t *config);
  * @param ttl   Time to live for frame. Will be decrease by one for every hop.
  * @param payload The frame data.
  * @param size  The size of the payload.
- * @param wait_ms Milliseconds to wait for the frame to get sent.
- * @return esp_err_t ESP_OK is returned if all is OK
+ * @param wait_ms Milliseconds to wait for room in the send queue if it is full.
+ * @return esp_err_t ESP_OK is returned if the frame is queued, ESP_ERR_NO_MEM if the
+ *                   send queue is full.
  */
 esp_err_t
 droplet_send(const uint8_t *dest_addr,
@@ -229,6 +518,30 @@ droplet_send(const uint8_t *dest_addr,
              size_t size,
              uint16_t wait_ms);
 
+/**
+ * @fn droplet_send_async
+ * @brief Queue droplet frame for sending without blocking
+ *
+ * Same as droplet_send but never waits. The frame is dropped and
+ * ESP_ERR_NO_MEM returned if the send queue is full.
+ *
+ * @param prio Priority class for the frame.
+ * @param cb Called from the send task when the frame has been sent. Can be NULL.
+ * @param userdata Passed to cb.
+ * @return esp_err_t ESP_OK is returned if the frame is queued
+ */
+esp_err_t
+droplet_send_async(const uint8_t *dest_addr,
+                   bool bPreserveHeader,
+                   uint8_t nEncrypt,
+                   const uint8_t *pkey,
+                   uint8_t ttl,
+                   uint8_t *data,
+                   size_t size,
+                   droplet_tx_prio_t prio,
+                   droplet_tx_done_cb_t cb,
+                   void *userdata);
+
 /**
  * @brief Build full GUID from mac address
  *
@@ -273,6 +586,9 @@ droplet_build_l2_heartbeat(uint8_t *buf, uint8_t len, const uint8_t *pguid, cons
  * @fn droplet_sendEvent
  * @brief  Send event on droplet network
  *
+ * Events with more than DROPLET_MAX_DATA (up to DROPLET_MAX_FRAG_DATA)
+ * bytes of data are sent as fragments and reassembled by the receiver.
+ *
  * @param destAddr Destination address.
  * @param pev Event to send
  * @param wait_ms Time in milliseconds to wait for send
@@ -316,9 +632,56 @@ droplet_getMinBufSizeEv(vscpEvent *pev);
 size_t
 droplet_getMinBufSizeEx(vscpEventEx *pex);
 
+/**
+ * @fn droplet_getFrameLen
+ * @brief Get the length of a frame from its content
+ *
+ * Decrypted frames keep their block padding. This gives the length
+ * without it, for all frame layouts and for aggregate frames.
+ *
+ * @param buf Frame in clear
+ * @param len Number of bytes in buf
+ * @return size_t Frame length or zero if the frame is invalid or longer than len.
+ */
+size_t
+droplet_getFrameLen(const uint8_t *buf, size_t len);
+
+/**
+ * @fn droplet_buildVscp
+ * @brief Write the VSCP content (head, nickname, class, type, size and data) of an event
+ *
+ * @param buf Where the content goes (DROPLET_POS_HEAD in a single event frame)
+ * @param len Room in buf
+ * @param pev Event
+ * @param version DROPLET_VERSION for the fixed layout or DROPLET_VERSION_COMPACT
+ * @return size_t Bytes written or zero if it does not fit or the event is invalid.
+ */
+size_t
+droplet_buildVscp(uint8_t *buf, size_t len, const vscpEvent *pev, uint8_t version);
+
+/**
+ * @fn droplet_parseVscp
+ * @brief Read the VSCP content of a frame
+ *
+ * head, nickname (GUID[14] and GUID[15]), class, type and data size are
+ * set and pdata points into buf. Nothing else in the event is changed.
+ *
+ * @param pev Event to fill in
+ * @param buf Start of the content (DROPLET_POS_HEAD in a single event frame)
+ * @param len Bytes available. May include block padding.
+ * @param version Frame layout version (DROPLET_FRAME_VERSION)
+ * @return size_t Bytes of content used or zero if the content is invalid or
+ *         shorter than its size byte says.
+ */
+size_t
+droplet_parseVscp(vscpEvent *pev, const uint8_t *buf, size_t len, uint8_t version);
+
 /**
  * @brief Construct VSCP ESP-NOW frame form event structure
  *
+ * The compact header is used if bCompactHeader is set in the configuration
+ * and it is shorter. Use droplet_getFrameLen for the length of the frame.
+ *
  * @param buf Pointer to buffer that will get the frame data
  * @param len Size of buffer. The buffer should have room for the frame plus VSCP data so it
  * should have a length that exceeds DROPLET_PACKET_MIN_SIZE + VSCP event data length.
@@ -332,6 +695,8 @@ droplet_evToFrame(uint8_t *buf, uint8_t len, const vscpEvent *pev);
 /**
  * @brief Construct VSCP ESP-NOW frame form event ex structure
  *
+ * Header layout is picked as for droplet_evToFrame.
+ *
  * @param buf Pointer to buffer that will get the frame data
  * @param len Size of buffer. The buffer should have room for the frame plus VSCP data so it
  * should have a length that exceeds DROPLET_PACKET_MIN_SIZE + VSCP event data length.
@@ -355,6 +720,24 @@ droplet_exToFrame(uint8_t *buf, uint8_t len, const vscpEventEx *pex);
 int
 droplet_frameToEv(vscpEvent *pev, const uint8_t *buf, uint8_t len, uint32_t timestamp);
 
+/**
+ * @fn droplet_frameToEvView
+ * @brief Fill in VSCP event from esp-now frame without copying data
+ *
+ * The event data pointer is set to point into the frame buffer so nothing
+ * is allocated. The event must not be used after the buffer is released
+ * and must not be freed with vscp_fwhlp_deleteEvent.
+ *
+ * @param pev Pointer to VSCP event
+ * @param buf  Buffer holding esp-now frame data
+ * @param len  Len of buffer
+ * @param timestamp The event timestamp normally comes from wifi_pkt_rx_ctrl_t in the wifi frame. If
+ * set to zero  it will be set from tickcount
+ * @return int VSCP_ERROR_SUCCES is returned if all goes well. Otherwise VSCP error code is returned.
+ */
+int
+droplet_frameToEvView(vscpEvent *pev, uint8_t *buf, uint8_t len, uint32_t timestamp);
+
 /**
  * @brief Fill in Data of VSCP ex event from esp-now frame
  *
@@ -378,7 +761,7 @@ droplet_frameToEx(vscpEventEx *pex, const uint8_t *buf, uint8_t len, uint32_t ti
  *
  */
 void
-droplet_set_vscp_user_handler_cb(vscp_event_handler_cb_t *cb);
+droplet_set_vscp_user_handler_cb(vscp_event_handler_cb_t cb);
 
 /**
  * @fn droplet_clear_vscp_handler_cb
@@ -396,7 +779,7 @@ droplet_clear_vscp_handler_cb(void);
  */
 
 void
-droplet_set_attach_network_handler_cb(droplet_attach_network_handler_cb_t *cb);
+droplet_set_attach_network_handler_cb(droplet_attach_network_handler_cb_t cb);
 
 /**
  * @fn droplet_clear_attach_network_handler_cb
@@ -0,0 +1,344 @@
+/**
+ * @brief           Droplet aggregate frame benchmark
+ * @file            droplet-bench-agg.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Packs a number of events into one aggregate frame (droplet-agg.c),
+ * optionally encrypts and decrypts it and unpacks it again. Reports
+ * events/s for the whole round trip and the bytes and airtime used
+ * for each event for a few batch sizes. Airtime is for a broadcast
+ * ESP-NOW frame at the given bit rate with a long preamble. Broadcasts
+ * are not acked so there is no ack time.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+
+#include <vscp.h>
+
+#include "droplet-agg.h"
+#include "droplet-crypto.h"
+#include "vscp-droplet.h"
+
+// Long preamble and PLCP header (us)
+#define BENCH_PREAMBLE_US 192
+
+// 802.11 header, action category, OUI, random value, vendor element and FCS
+#define BENCH_ESPNOW_OVERHEAD 43
+
+// Batch sizes measured. Zero is as many as fit in a frame.
+static const int s_batches[] = { 1, 2, 4, 8, 16, 0 };
+
+// Data sizes measured if none given
+static const int s_defaultSizes[] = { 3, 8 };
+
+// Header layout of the event records
+static uint8_t s_version = DROPLET_VERSION;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n events  Events per measurement (default 1000000)\n"
+          "  -d size    VSCP data size to measure, can be repeated (default 3,8)\n"
+          "  -e n       Encryption 0=none, 1=AES-128, 2=AES-192, 3=AES-256 (default 1)\n"
+          "  -r mbps    Bit rate used for airtime (default 1)\n"
+          "  -c         Compact event header (default fixed)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// pack
+//
+// Build the frame for a batch of events as the send path does. Returns
+// the number of events packed, which is less than nBatch if they don't
+// fit. Zero nBatch packs as many as fit.
+//
+
+static int
+pack(uint8_t *frame, size_t *plen, const uint8_t *evframe, size_t evlen, int nBatch)
+{
+  int cnt = 0;
+
+  *plen = droplet_agg_init(frame, PRJDEF_NODE_TYPE, s_version);
+  while (!nBatch || (cnt < nBatch)) {
+    if (VSCP_ERROR_SUCCESS != droplet_agg_add(frame, plen, DROPLET_AGG_MAX_FRAME, evframe, evlen)) {
+      break;
+    }
+    cnt++;
+  }
+
+  droplet_agg_finish(frame, plen);
+  return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// unpack
+//
+// Hand every event in a received frame to a dummy consumer as the
+// receive task does. Returns the number of events.
+//
+
+static int
+unpack(uint8_t *frame, size_t len, uint32_t *psum)
+{
+  vscpEvent ev;
+  size_t offset = 0;
+  int cnt       = 0;
+
+  if (!DROPLET_IS_AGGREGATE(frame)) {
+    if (VSCP_ERROR_SUCCESS != droplet_frameToEvView(&ev, frame, len, 1)) {
+      return 0;
+    }
+    *psum += ev.vscp_type + ev.pdata[ev.sizeData - 1];
+    return 1;
+  }
+
+  while (VSCP_ERROR_SUCCESS == droplet_agg_next(&ev, frame, len, &offset, 1)) {
+    *psum += ev.vscp_type + ev.pdata[ev.sizeData - 1];
+    cnt++;
+  }
+
+  return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bench
+//
+// Returns 0 if all events survive a round trip.
+//
+
+static int
+bench(uint8_t nAlgorithm, droplet_crypto_key_t *pkey, int sizeData, int nBatch, double rate, long nEvents)
+{
+  uint8_t data[DROPLET_MAX_DATA];
+  uint8_t evframe[DROPLET_MAX_FRAME];
+  uint8_t frame[DROPLET_AGG_MAX_FRAME];
+  uint8_t buf[DROPLET_MAX_AIR_FRAME + DROPLET_CRYPTO_HEADROOM];
+  size_t evlen = DROPLET_MIN_FRAME + sizeData;
+  size_t len, airlen;
+  uint32_t sum = 0;
+  long nFrames;
+  int cnt;
+  double start, t, airtime;
+  vscpEvent ev;
+
+  memset(&ev, 0, sizeof(ev));
+  esp_fill_random(data, sizeof(data));
+  ev.vscp_class = 20; // CLASS1.INFORMATION
+  ev.vscp_type  = 9;  // VSCP_TYPE_INFORMATION_ON
+  ev.sizeData   = sizeData;
+  ev.pdata      = data;
+  if (VSCP_ERROR_SUCCESS != droplet_evToFrame(evframe, evlen, &ev)) {
+    fprintf(stderr, "Failed to build event frame\n");
+    return -1;
+  }
+
+  // Round trip check, also gives frame size and events per frame
+  cnt = pack(frame, &len, evframe, evlen, nBatch);
+  if (nBatch && (cnt < nBatch)) {
+    return 0; // Doesn't fit, same as the full frame row
+  }
+  memcpy(buf, frame, len);
+  airlen = len;
+  if (nAlgorithm) {
+    if (0 == (airlen = droplet_crypto_encrypt_key(buf, buf, len, pkey, NULL, nAlgorithm))) {
+      fprintf(stderr, "Encryption failed\n");
+      return -1;
+    }
+    if (droplet_crypto_decrypt_key(buf, airlen, pkey, nAlgorithm) < len) {
+      fprintf(stderr, "Decryption failed\n");
+      return -1;
+    }
+  }
+  if ((airlen > DROPLET_MAX_AIR_FRAME) || (cnt != unpack(buf, len, &sum))) {
+    fprintf(stderr, "Round trip failed for data size %d batch %d\n", sizeData, cnt);
+    return -1;
+  }
+
+  // Whole frames only so every measurement handles the same events
+  nFrames = (nEvents + cnt - 1) / cnt;
+
+  start = now_sec();
+  for (long i = 0; i < nFrames; i++) {
+    pack(frame, &len, evframe, evlen, cnt);
+    if (nAlgorithm) {
+      airlen = droplet_crypto_encrypt_key(buf, frame, len, pkey, NULL, nAlgorithm);
+      len    = droplet_crypto_decrypt_key(buf, airlen, pkey, nAlgorithm);
+    }
+    else {
+      memcpy(buf, frame, len);
+    }
+    unpack(buf, len, &sum);
+  }
+  t = now_sec() - start;
+
+  airtime = BENCH_PREAMBLE_US + ((airlen + BENCH_ESPNOW_OVERHEAD) * 8) / rate;
+
+  printf("%-7s %4d %5d %5d %7.1f %7.0f %9.1f %9.0f %11.0f\n",
+         nAlgorithm ? (VSCP_ENCRYPTION_AES128 == nAlgorithm   ? "AES-128"
+                       : VSCP_ENCRYPTION_AES192 == nAlgorithm ? "AES-192"
+                                                              : "AES-256")
+                    : "none",
+         sizeData,
+         cnt,
+         (int) airlen,
+         (double) airlen / cnt,
+         airtime,
+         airtime / cnt,
+         1e6 * cnt / airtime,
+         (nFrames * cnt) / t);
+
+  // Keep the consumer from being optimized away
+  return (0xffffffff == sum) ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  long nEvents = 1000000;
+  int sizes[16];
+  int nSizes          = 0;
+  uint8_t nEncryption = VSCP_ENCRYPTION_AES128;
+  double rate         = 1;
+  uint8_t key[DROPLET_KEY_LEN];
+  droplet_crypto_key_t cryptoKey = { 0 };
+
+  while (-1 != (opt = getopt(argc, argv, "n:d:e:r:ch"))) {
+    switch (opt) {
+      case 'n':
+        nEvents = atol(optarg);
+        break;
+      case 'd':
+        if ((nSizes < 16) && (atoi(optarg) > 0) && (atoi(optarg) <= DROPLET_MAX_DATA)) {
+          sizes[nSizes++] = atoi(optarg);
+        }
+        break;
+      case 'e':
+        nEncryption = (uint8_t) atoi(optarg);
+        if (nEncryption > VSCP_ENCRYPTION_AES256) {
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 'c':
+        s_version = DROPLET_VERSION_COMPACT;
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (!nSizes) {
+    nSizes = sizeof(s_defaultSizes) / sizeof(s_defaultSizes[0]);
+    memcpy(sizes, s_defaultSizes, sizeof(s_defaultSizes));
+  }
+
+  if ((nEvents <= 0) || (rate <= 0)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  esp_fill_random(key, sizeof(key));
+  if (VSCP_ERROR_SUCCESS != droplet_crypto_key_init(&cryptoKey, key)) {
+    fprintf(stderr, "Failed to expand key\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%ld events per measurement, airtime at %.1f Mbit/s, %s header. A batch of one is a normal frame.\n",
+         nEvents,
+         rate,
+         (DROPLET_VERSION_COMPACT == s_version) ? "compact" : "fixed");
+  printf("%-7s %4s %5s %5s %7s %7s %9s %9s %11s\n",
+         "enc",
+         "data",
+         "batch",
+         "air",
+         "air/ev",
+         "air us",
+         "us/ev",
+         "air ev/s",
+         "cpu ev/s");
+
+  for (int i = 0; i < nSizes; i++) {
+    for (size_t j = 0; j < sizeof(s_batches) / sizeof(s_batches[0]); j++) {
+      if (bench(nEncryption, &cryptoKey, sizes[i], s_batches[j], rate, nEvents)) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  droplet_crypto_key_free(&cryptoKey);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/**
+ * @brief           Droplet frame encryption benchmark
+ * @file            droplet-bench-crypto.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Measures in place encryption and decryption of droplet frames
+ * (droplet-crypto.c) for all key sizes and a few frame sizes and
+ * reports frames/s and bytes/s. Bytes are frame bytes before
+ * encryption. Each direction is measured both with the key expanded
+ * for every frame and with a cached key schedule. A fixed IV is used
+ * so IV generation is not part of the figures.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+
+#include <vscp.h>
+
+#include "droplet-crypto.h"
+#include "vscp-droplet.h"
+
+// Data sizes measured if none given
+static const int s_defaultSizes[] = { 0, 8, 32, 64, DROPLET_MAX_DATA };
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n frames  Frames per measurement (default 200000)\n"
+          "  -d size    VSCP data size to measure, can be repeated (default 0,8,32,64,128)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bench
+//
+// Returns 0 if the frame survives a round trip.
+//
+
+static int
+bench(uint8_t nAlgorithm, droplet_crypto_key_t *pkey, int sizeData, long nFrames)
+{
+  const uint8_t *key = pkey->key;
+  uint8_t iv[DROPLET_IV_LEN];
+  uint8_t frame[DROPLET_MAX_FRAME];
+  uint8_t buf[DROPLET_MAX_FRAME + DROPLET_CRYPTO_HEADROOM];
+  size_t len = DROPLET_MIN_FRAME + sizeData;
+  size_t enclen;
+  double start, tenc, tencKey, tdec, tdecKey;
+
+  esp_fill_random(frame, len);
+  esp_fill_random(iv, sizeof(iv));
+  frame[DROPLET_POS_ID]       = DROPLET_ID_MSB;
+  frame[DROPLET_POS_ID + 1]   = DROPLET_ID_LSB;
+  frame[DROPLET_POS_PKT_TYPE] = nAlgorithm;
+  frame[DROPLET_POS_SIZE]     = sizeData;
+
+  // Round trip check
+  memcpy(buf, frame, len);
+  if (0 == (enclen = droplet_crypto_encrypt(buf, buf, len, key, NULL, nAlgorithm))) {
+    fprintf(stderr, "Encryption failed\n");
+    return -1;
+  }
+  if ((droplet_crypto_decrypt(buf, enclen, key, nAlgorithm) < len) || memcmp(buf, frame, len)) {
+    fprintf(stderr, "Round trip failed for data size %d\n", sizeData);
+    return -1;
+  }
+
+  // Encrypt the same buffer over and over
+  start = now_sec();
+  for (long i = 0; i < nFrames; i++) {
+    enclen = droplet_crypto_encrypt(buf, buf, len, key, iv, nAlgorithm);
+  }
+  tenc = now_sec() - start;
+
+  start = now_sec();
+  for (long i = 0; i < nFrames; i++) {
+    enclen = droplet_crypto_encrypt_key(buf, buf, len, pkey, iv, nAlgorithm);
+  }
+  tencKey = now_sec() - start;
+
+  // Decrypting in place gives garbage after the first round but the
+  // work done is the same
+  start = now_sec();
+  for (long i = 0; i < nFrames; i++) {
+    droplet_crypto_decrypt(buf, enclen, key, nAlgorithm);
+  }
+  tdec = now_sec() - start;
+
+  start = now_sec();
+  for (long i = 0; i < nFrames; i++) {
+    droplet_crypto_decrypt_key(buf, enclen, pkey, nAlgorithm);
+  }
+  tdecKey = now_sec() - start;
+
+  printf("AES-%-3d %5d %5d %11.0f %11.0f %8.2f %11.0f %11.0f %8.2f\n",
+         128 + 64 * (nAlgorithm - VSCP_ENCRYPTION_AES128),
+         (int) len,
+         (int) enclen,
+         nFrames / tenc,
+         nFrames / tencKey,
+         (nFrames * len) / tencKey / 1e6,
+         nFrames / tdec,
+         nFrames / tdecKey,
+         (nFrames * len) / tdecKey / 1e6);
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  long nFrames = 200000;
+  int sizes[16];
+  int nSizes = 0;
+  uint8_t key[DROPLET_KEY_LEN];
+  droplet_crypto_key_t cryptoKey = { 0 };
+
+  while (-1 != (opt = getopt(argc, argv, "n:d:h"))) {
+    switch (opt) {
+      case 'n':
+        nFrames = atol(optarg);
+        break;
+      case 'd':
+        if ((nSizes < 16) && (atoi(optarg) >= 0) && (atoi(optarg) <= DROPLET_MAX_DATA)) {
+          sizes[nSizes++] = atoi(optarg);
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (!nSizes) {
+    nSizes = sizeof(s_defaultSizes) / sizeof(s_defaultSizes[0]);
+    memcpy(sizes, s_defaultSizes, sizeof(s_defaultSizes));
+  }
+
+  if (nFrames <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  esp_log_level_set("*", ESP_LOG_ERROR);
+  esp_fill_random(key, sizeof(key));
+  if (VSCP_ERROR_SUCCESS != droplet_crypto_key_init(&cryptoKey, key)) {
+    fprintf(stderr, "Failed to expand key\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%d frames per measurement. frames/s with key expanded per frame and cached, MB/s cached\n",
+         (int) nFrames);
+  printf("key     frame   air   enc fr/s  enc cached   enc MB/s   dec fr/s  dec cached   dec MB/s\n");
+
+  for (uint8_t alg = VSCP_ENCRYPTION_AES128; alg <= VSCP_ENCRYPTION_AES256; alg++) {
+    for (int i = 0; i < nSizes; i++) {
+      if (bench(alg, &cryptoKey, sizes[i], nFrames)) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  droplet_crypto_key_free(&cryptoKey);
+
+  return EXIT_SUCCESS;
+}
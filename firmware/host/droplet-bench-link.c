@@ -0,0 +1,577 @@
+/**
+ * @brief           VSCP link server loop benchmark
+ * @file            droplet-bench-link.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Compares models of the two ways the gateway VSCP link server has fed
+ * events to clients in receive loop mode. "poll" is one task per client
+ * spinning on a non blocking recv and doing idle work on every EAGAIN.
+ * "select" is one task sleeping in select on all client sockets and a
+ * wake socket that is written when an event is queued. Queued events can
+ * be written one per send or in batches as tcpsrv_task does. This is a
+ * model of the loops, tcpsrv.c is not built here. The link protocol code
+ * is not part of this tree so event formatting is a stand in. Reports CPU
+ * used by the server threads and the latency from queueing an event to
+ * the client reading it.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_QUEUE_SIZE  16 // Events queued for each client (CLIENT_QUEUE_SIZE on the gateway)
+#define BENCH_MAX_CLIENTS 64 // Most clients that can be measured
+
+/**
+ * @brief Server side of a client connection
+ */
+typedef struct {
+  int sock;                         // Server side socket
+  pthread_mutex_t lock;             // Protects the queue
+  uint64_t queue[BENCH_QUEUE_SIZE]; // Queued events (time queued in us)
+  int head;                         // Oldest queued event
+  int cnt;                          // Number of queued events
+  uint64_t lastOk;                  // Time (us) of last '+OK'
+  uint32_t nDropped;                // Events dropped because the queue was full
+} bench_client_t;
+
+static bench_client_t s_clients[BENCH_MAX_CLIENTS];
+static int s_nClients;
+static int s_batch = 1; // Events written with one send
+static bool s_bNoDelay; // TCP_NODELAY on server sockets
+static atomic_bool s_bRun;
+static int s_wakeRx = -1;
+static int s_wakeTx = -1;
+static struct sockaddr_in s_wakeAddr;
+
+// Server thread CPU time (ns)
+static atomic_uint_fast64_t s_serverCpu;
+
+// Latency samples (us) from the client readers
+static uint32_t *s_samples;
+static size_t s_maxSamples;
+static atomic_size_t s_nSamples;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -m mode    Server loop poll, select or both (default both)\n"
+          "  -c n       Number of clients in receive loop mode (default 2)\n"
+          "  -r n       Events per second to every client (default 100)\n"
+          "  -t sec     Seconds to measure each mode (default 5)\n"
+          "  -b n       Events written with one send (default 1)\n"
+          "  -N         Set TCP_NODELAY on server sockets\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_us
+//
+
+static uint64_t
+now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// thread_cpu_done
+//
+// Add the CPU time used by the calling server thread.
+//
+
+static void
+thread_cpu_done(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  atomic_fetch_add(&s_serverCpu, (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// idle_worker
+//
+// Stand in for vscp_link_idle_worker in receive loop mode. Sends up to
+// s_batch queued events with one send or '+OK' once a second. Returns
+// true if an event was sent.
+//
+
+static bool
+idle_worker(bench_client_t *pc)
+{
+  char buf[64 * BENCH_QUEUE_SIZE];
+  size_t len = 0;
+  int cnt    = 0;
+
+  pthread_mutex_lock(&pc->lock);
+  while (pc->cnt && (cnt < s_batch)) {
+    len += snprintf(buf + len, sizeof(buf) - len, "E,%llu\r\n", (unsigned long long) pc->queue[pc->head]);
+    pc->head = (pc->head + 1) % BENCH_QUEUE_SIZE;
+    pc->cnt--;
+    cnt++;
+  }
+  pthread_mutex_unlock(&pc->lock);
+
+  if (len) {
+    send(pc->sock, buf, len, MSG_NOSIGNAL);
+  }
+  else if ((now_us() - pc->lastOk) > 1000000) {
+    pc->lastOk = now_us();
+    send(pc->sock, "+OK\r\n", 5, MSG_NOSIGNAL);
+  }
+
+  return (0 != cnt);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// poll_thread
+//
+// One thread per client as client_task did before.
+//
+
+static void *
+poll_thread(void *arg)
+{
+  bench_client_t *pc = (bench_client_t *) arg;
+  char buf[128];
+
+  while (atomic_load(&s_bRun)) {
+    int rv = recv(pc->sock, buf, sizeof(buf), MSG_DONTWAIT);
+    if ((rv < 0) && (EAGAIN == errno)) {
+      idle_worker(pc);
+      continue;
+    }
+    if (rv <= 0) {
+      break;
+    }
+  }
+
+  thread_cpu_done();
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// select_thread
+//
+// One thread for all clients as tcpsrv_task does now.
+//
+
+static void *
+select_thread(void *arg)
+{
+  char buf[128];
+
+  (void) arg;
+
+  while (atomic_load(&s_bRun)) {
+    fd_set readset;
+    int maxfd = s_wakeRx;
+
+    FD_ZERO(&readset);
+    FD_SET(s_wakeRx, &readset);
+    for (int i = 0; i < s_nClients; i++) {
+      FD_SET(s_clients[i].sock, &readset);
+      maxfd = MAX(maxfd, s_clients[i].sock);
+    }
+
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    if (select(maxfd + 1, &readset, NULL, NULL, &tv) < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      break;
+    }
+
+    if (FD_ISSET(s_wakeRx, &readset)) {
+      while (recv(s_wakeRx, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+    }
+
+    for (int i = 0; i < s_nClients; i++) {
+      if (FD_ISSET(s_clients[i].sock, &readset)) {
+        recv(s_clients[i].sock, buf, sizeof(buf), MSG_DONTWAIT);
+      }
+      int cnt = BENCH_QUEUE_SIZE;
+      while (idle_worker(&s_clients[i]) && --cnt)
+        ;
+    }
+  }
+
+  thread_cpu_done();
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// producer_thread
+//
+// Queue an event for every client at the given rate as the droplet
+// receive callback does.
+//
+
+static void *
+producer_thread(void *arg)
+{
+  int rate         = *(int *) arg;
+  bool bWake       = (s_wakeTx >= 0);
+  uint64_t next    = now_us();
+  uint64_t period  = 1000000 / rate;
+
+  while (atomic_load(&s_bRun)) {
+    next += period;
+    uint64_t now = now_us();
+    if (next > now) {
+      struct timespec ts = { .tv_sec = (next - now) / 1000000, .tv_nsec = ((next - now) % 1000000) * 1000 };
+      nanosleep(&ts, NULL);
+    }
+
+    uint64_t ts = now_us();
+    for (int i = 0; i < s_nClients; i++) {
+      bench_client_t *pc = &s_clients[i];
+      pthread_mutex_lock(&pc->lock);
+      if (pc->cnt < BENCH_QUEUE_SIZE) {
+        pc->queue[(pc->head + pc->cnt) % BENCH_QUEUE_SIZE] = ts;
+        pc->cnt++;
+      }
+      else {
+        pc->nDropped++;
+      }
+      pthread_mutex_unlock(&pc->lock);
+    }
+
+    if (bWake) {
+      sendto(s_wakeTx, "", 1, MSG_DONTWAIT, (struct sockaddr *) &s_wakeAddr, sizeof(s_wakeAddr));
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// reader_thread
+//
+// A link client. Reads event lines and records their latency.
+//
+
+static void *
+reader_thread(void *arg)
+{
+  int sock = *(int *) arg;
+  char buf[4096];
+  size_t len = 0;
+
+  for (;;) {
+    int rv = recv(sock, buf + len, sizeof(buf) - len - 1, 0);
+    if (rv <= 0) {
+      break;
+    }
+    len += rv;
+    buf[len] = 0;
+
+    char *p = buf, *eol;
+    while (NULL != (eol = strstr(p, "\r\n"))) {
+      if (('E' == p[0]) && (',' == p[1])) {
+        uint64_t lat = now_us() - strtoull(p + 2, NULL, 10);
+        size_t idx   = atomic_fetch_add(&s_nSamples, 1);
+        if (idx < s_maxSamples) {
+          s_samples[idx] = (uint32_t) MIN(lat, UINT32_MAX);
+        }
+      }
+      p = eol + 2;
+    }
+    len -= (p - buf);
+    memmove(buf, p, len);
+  }
+
+  close(sock);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// cmp_u32
+//
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// run
+//
+// Measure one server loop mode. Returns zero on success.
+//
+
+static int
+run(bool bSelect, int nClients, int rate, int seconds)
+{
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+  socklen_t addrlen       = sizeof(addr);
+  pthread_t readers[BENCH_MAX_CLIENTS];
+  pthread_t servers[BENCH_MAX_CLIENTS];
+  pthread_t producer;
+  int csocks[BENCH_MAX_CLIENTS];
+  int nServers = 0;
+
+  int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+  if ((listen_sock < 0) || bind(listen_sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen(listen_sock, nClients) || getsockname(listen_sock, (struct sockaddr *) &addr, &addrlen)) {
+    perror("listen");
+    return -1;
+  }
+
+  // Connect the clients
+  s_nClients = nClients;
+  for (int i = 0; i < nClients; i++) {
+    csocks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(csocks[i], (struct sockaddr *) &addr, sizeof(addr))) {
+      perror("connect");
+      return -1;
+    }
+    memset(&s_clients[i], 0, sizeof(bench_client_t));
+    pthread_mutex_init(&s_clients[i].lock, NULL);
+    s_clients[i].sock   = accept(listen_sock, NULL, NULL);
+    s_clients[i].lastOk = now_us();
+    if (s_bNoDelay) {
+      int opt = 1;
+      setsockopt(s_clients[i].sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+  }
+  close(listen_sock);
+
+  // Wake socket pair on the loopback interface
+  s_wakeRx = s_wakeTx = -1;
+  if (bSelect) {
+    socklen_t len = sizeof(s_wakeAddr);
+    memset(&s_wakeAddr, 0, sizeof(s_wakeAddr));
+    s_wakeAddr.sin_family      = AF_INET;
+    s_wakeAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    s_wakeRx                   = socket(AF_INET, SOCK_DGRAM, 0);
+    s_wakeTx                   = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bind(s_wakeRx, (struct sockaddr *) &s_wakeAddr, sizeof(s_wakeAddr)) ||
+        getsockname(s_wakeRx, (struct sockaddr *) &s_wakeAddr, &len)) {
+      perror("wake socket");
+      return -1;
+    }
+  }
+
+  atomic_store(&s_serverCpu, 0);
+  atomic_store(&s_nSamples, 0);
+  atomic_store(&s_bRun, true);
+
+  for (int i = 0; i < nClients; i++) {
+    pthread_create(&readers[i], NULL, reader_thread, &csocks[i]);
+  }
+
+  if (bSelect) {
+    pthread_create(&servers[nServers++], NULL, select_thread, NULL);
+  }
+  else {
+    for (int i = 0; i < nClients; i++) {
+      pthread_create(&servers[nServers++], NULL, poll_thread, &s_clients[i]);
+    }
+  }
+
+  uint64_t start = now_us();
+  pthread_create(&producer, NULL, producer_thread, &rate);
+
+  sleep(seconds);
+
+  atomic_store(&s_bRun, false);
+  pthread_join(producer, NULL);
+  if (bSelect) {
+    sendto(s_wakeTx, "", 1, 0, (struct sockaddr *) &s_wakeAddr, sizeof(s_wakeAddr));
+  }
+  for (int i = 0; i < nServers; i++) {
+    pthread_join(servers[i], NULL);
+  }
+  double wall = (now_us() - start) / 1e6;
+
+  uint32_t nDropped = 0;
+  for (int i = 0; i < nClients; i++) {
+    nDropped += s_clients[i].nDropped;
+    shutdown(s_clients[i].sock, SHUT_RDWR);
+    close(s_clients[i].sock);
+    pthread_mutex_destroy(&s_clients[i].lock);
+  }
+  for (int i = 0; i < nClients; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  if (bSelect) {
+    close(s_wakeRx);
+    close(s_wakeTx);
+  }
+
+  size_t n = MIN(atomic_load(&s_nSamples), s_maxSamples);
+  double sum = 0;
+  qsort(s_samples, n, sizeof(uint32_t), cmp_u32);
+  for (size_t i = 0; i < n; i++) {
+    sum += s_samples[i];
+  }
+
+  double cpu = 100.0 * (atomic_load(&s_serverCpu) / 1e9) / wall;
+  printf("%-7s %7d %7d %5d %9.1f %9.1f %9zu %9.1f %9u %9u %9u\n",
+         bSelect ? "select" : "poll",
+         nClients,
+         rate,
+         s_batch,
+         cpu,
+         MAX(0.0, 100.0 - cpu),
+         n,
+         n ? sum / n : 0.0,
+         n ? s_samples[n / 2] : 0,
+         n ? s_samples[(n * 99) / 100] : 0,
+         nDropped);
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  int nClients    = 2;
+  int rate        = 100;
+  int seconds     = 5;
+  bool bPoll      = true;
+  bool bSelect    = true;
+
+  while (-1 != (opt = getopt(argc, argv, "m:c:r:t:b:Nh"))) {
+    switch (opt) {
+      case 'm':
+        bPoll   = !strcmp(optarg, "poll") || !strcmp(optarg, "both");
+        bSelect = !strcmp(optarg, "select") || !strcmp(optarg, "both");
+        if (!bPoll && !bSelect) {
+          fprintf(stderr, "Unknown mode %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'c':
+        nClients = atoi(optarg);
+        if ((nClients < 1) || (nClients > BENCH_MAX_CLIENTS)) {
+          fprintf(stderr, "Clients must be 1 to %d\n", BENCH_MAX_CLIENTS);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        rate = atoi(optarg);
+        if ((rate < 1) || (rate > 100000)) {
+          fprintf(stderr, "Rate must be 1 to 100000\n");
+          return EXIT_FAILURE;
+        }
+        break;
+      case 't':
+        seconds = atoi(optarg);
+        if (seconds < 1) {
+          fprintf(stderr, "Time must be at least one second\n");
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'b':
+        s_batch = atoi(optarg);
+        if ((s_batch < 1) || (s_batch > BENCH_QUEUE_SIZE)) {
+          fprintf(stderr, "Batch must be 1 to %d\n", BENCH_QUEUE_SIZE);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'N':
+        s_bNoDelay = true;
+        break;
+      case 'h':
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  s_maxSamples = (size_t) nClients * rate * (seconds + 1);
+  s_samples    = malloc(s_maxSamples * sizeof(uint32_t));
+  if (NULL == s_samples) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  // CPU is for the server threads in percent of one core. Latency is in us.
+  printf("%-7s %7s %7s %5s %9s %9s %9s %9s %9s %9s %9s\n",
+         "mode",
+         "clients",
+         "ev/s",
+         "batch",
+         "cpu%",
+         "idle%",
+         "events",
+         "lat-avg",
+         "lat-p50",
+         "lat-p99",
+         "dropped");
+
+  if ((bPoll && run(false, nClients, rate, seconds)) || (bSelect && run(true, nClients, rate, seconds))) {
+    free(s_samples);
+    return EXIT_FAILURE;
+  }
+
+  free(s_samples);
+  return EXIT_SUCCESS;
+}
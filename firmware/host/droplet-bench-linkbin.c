@@ -0,0 +1,314 @@
+/**
+ * @brief           VSCP link binary frame benchmark
+ * @file            droplet-bench-linkbin.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Measures how fast the gateway can put events on a VSCP link
+ * connection as text lines (rcvloop/retr) and as binary frames
+ * (brcvloop/bretr, alpha5/main/linkbin.c), and how fast binary frames
+ * from bsend are read back. Events are written in batches into one
+ * buffer as tcpsrv_task does. Reports events/s and bytes per event.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_random.h>
+
+#include <vscp.h>
+#include <vscp-firmware-helper.h>
+
+#include "linkbin.h"
+
+// Max events written with one send (PRJDEF_VSCP_LINK_RCVLOOP_BATCH on the gateway)
+#define BENCH_BATCH 8
+
+// Buffer for one send (PRJDEF_VSCP_LINK_RCVLOOP_BUF_SIZE on the gateway)
+#define BENCH_BUF_SIZE 1024
+
+// Data sizes measured if none given
+static const int s_defaultSizes[] = { 0, 3, 8, 64, 256 };
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n events  Events per measurement (default 1000000)\n"
+          "  -d size    VSCP data size to measure, can be repeated (default 0,3,8,64,256)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// write_text
+//
+// Format up to BENCH_BATCH events as text lines as client_batch does.
+// Returns the number of bytes and sets the number of events.
+//
+
+static size_t
+write_text(char *buf, const vscpEvent *pev, int *pcnt)
+{
+  size_t len = 0;
+
+  for (*pcnt = 0; *pcnt < BENCH_BATCH; (*pcnt)++) {
+    if (((BENCH_BUF_SIZE - len) < 4) ||
+        (VSCP_ERROR_SUCCESS != vscp_fwhlp_eventToString(buf + len, BENCH_BUF_SIZE - len - 2, pev))) {
+      break;
+    }
+    len += strlen(buf + len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+  }
+
+  return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// write_binary
+//
+// Write up to BENCH_BATCH events as a batch of binary frames as
+// client_batch does. Returns the number of bytes and sets the number of
+// events.
+//
+
+static size_t
+write_binary(uint8_t *buf, const vscpEvent *pev, int *pcnt)
+{
+  size_t len = LINKBIN_BATCH_LEN;
+  size_t n;
+
+  for (*pcnt = 0; *pcnt < BENCH_BATCH; (*pcnt)++) {
+    if (0 == (n = linkbin_write_frame(buf + len, BENCH_BUF_SIZE - len, pev))) {
+      break;
+    }
+    len += n;
+  }
+
+  linkbin_write_count(buf, *pcnt);
+  return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// read_binary
+//
+// Read a batch of binary frames as client_bsend does. Returns the number
+// of events read.
+//
+
+static int
+read_binary(uint8_t *buf, size_t len, uint32_t *psum)
+{
+  size_t pos = LINKBIN_BATCH_LEN;
+  size_t used;
+  vscpEvent ev;
+  int cnt = linkbin_read_count(buf);
+
+  for (int i = 0; i < cnt; i++) {
+    if (VSCP_ERROR_SUCCESS != linkbin_read_frame(&ev, buf + pos, len - pos, &used)) {
+      return i;
+    }
+    *psum += ev.vscp_type + ev.sizeData;
+    pos += used;
+  }
+
+  return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bench
+//
+// Returns 0 if the binary frames survive a round trip.
+//
+
+static int
+bench(int sizeData, long nEvents)
+{
+  uint8_t data[LINKBIN_MAX_DATA];
+  char text[BENCH_BUF_SIZE];
+  uint8_t bin[BENCH_BUF_SIZE];
+  size_t textlen, binlen;
+  int nText, nBin;
+  uint32_t sum = 0;
+  double start, tText = 0, tBin, tRead;
+  vscpEvent ev;
+
+  memset(&ev, 0, sizeof(ev));
+  esp_fill_random(data, sizeof(data));
+  esp_fill_random(ev.GUID, sizeof(ev.GUID));
+  ev.head       = 0x60; // Priority 3
+  ev.timestamp  = 123456789;
+  ev.year       = 2023;
+  ev.month      = 6;
+  ev.day        = 12;
+  ev.hour       = 14;
+  ev.minute     = 22;
+  ev.second     = 5;
+  ev.vscp_class = 10; // CLASS1.MEASUREMENT
+  ev.vscp_type  = 6;  // VSCP_TYPE_MEASUREMENT_TEMPERATURE
+  ev.sizeData   = sizeData;
+  ev.pdata      = sizeData ? data : NULL;
+
+  textlen = write_text(text, &ev, &nText);
+  binlen  = write_binary(bin, &ev, &nBin);
+  if (!nBin || (nBin != read_binary(bin, binlen, &sum))) {
+    fprintf(stderr, "Round trip failed for data size %d\n", sizeData);
+    return -1;
+  }
+
+  // Text events that don't fit the buffer are left to the link code
+  if (nText) {
+    start = now_sec();
+    for (long i = 0; i < nEvents; i += nText) {
+      write_text(text, &ev, &nText);
+      sum += text[i % textlen];
+    }
+    tText = now_sec() - start;
+  }
+
+  start = now_sec();
+  for (long i = 0; i < nEvents; i += nBin) {
+    write_binary(bin, &ev, &nBin);
+    sum += bin[i % binlen];
+  }
+  tBin = now_sec() - start;
+
+  start = now_sec();
+  for (long i = 0; i < nEvents; i += nBin) {
+    read_binary(bin, binlen, &sum);
+  }
+  tRead = now_sec() - start;
+
+  printf("%5d %5d %9.1f %11.0f %5d %9.1f %11.0f %11.0f %7.1f\n",
+         sizeData,
+         nText,
+         nText ? (double) textlen / nText : 0.0,
+         nText ? nEvents / tText : 0.0,
+         nBin,
+         (double) binlen / nBin,
+         nEvents / tBin,
+         nEvents / tRead,
+         nText ? tText / tBin : 0.0);
+
+  // Keep the work from being optimized away
+  return (0xffffffff == sum) ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  long nEvents = 1000000;
+  int sizes[16];
+  int nSizes = 0;
+
+  while (-1 != (opt = getopt(argc, argv, "n:d:h"))) {
+    switch (opt) {
+      case 'n':
+        nEvents = atol(optarg);
+        break;
+      case 'd':
+        if ((nSizes < 16) && (atoi(optarg) >= 0) && (atoi(optarg) <= LINKBIN_MAX_DATA)) {
+          sizes[nSizes++] = atoi(optarg);
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (!nSizes) {
+    nSizes = sizeof(s_defaultSizes) / sizeof(s_defaultSizes[0]);
+    memcpy(sizes, s_defaultSizes, sizeof(s_defaultSizes));
+  }
+
+  if (nEvents <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%ld events per measurement. Up to %d events in a %d byte buffer per send. Binary bytes include the batch "
+         "count.\n",
+         nEvents,
+         BENCH_BATCH,
+         BENCH_BUF_SIZE);
+  printf("%5s %5s %9s %11s %5s %9s %11s %11s %7s\n",
+         "data",
+         "batch",
+         "text B/ev",
+         "text ev/s",
+         "batch",
+         "bin B/ev",
+         "bin ev/s",
+         "read ev/s",
+         "speedup");
+
+  for (int i = 0; i < nSizes; i++) {
+    if (bench(sizes[i], nEvents)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,357 @@
+/**
+ * @brief           MQTT publish formatting benchmark
+ * @file            droplet-bench-mqtt.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Measures how many events per second the gateway can turn into an
+ * MQTT topic and a JSON payload. Once as mqtt_send_vscp_event used to
+ * do it (heap buffer, vscp_fwhlp_create_json and one
+ * vscp_fwhlp_strsubst pass per placeholder) and once with a compiled
+ * topic and the JSON writer in alpha5/main/mqttfmt.c. The binary
+ * frame and CBOR payloads are sized and timed as well. Publishing
+ * itself is not measured.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_random.h>
+
+#include <vscp.h>
+#include <vscp-firmware-helper.h>
+
+#include "mqttfmt.h"
+
+// Topic used if none given (all placeholders)
+#define BENCH_TOPIC "vscp/{{node}}/{{guid}}/{{evguid}}/{{class}}/{{type}}/{{nickname}}/{{sindex}}"
+
+// JSON buffer mqtt_send_vscp_event used to allocate
+#define BENCH_LEGACY_JSON_SIZE 2048
+
+// Data sizes measured if none given
+static const int s_defaultSizes[] = { 0, 3, 8, 64, 256 };
+
+static const char *s_nodeName  = "droplet-alpha";
+static const uint8_t s_nodeGuid[16] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+                                        0x00, 0x08, 0xdc, 0x12, 0x34, 0x56, 0x00, 0x01 };
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n events  Events per measurement (default 1000000)\n"
+          "  -d size    VSCP data size to measure, can be repeated (default 0,3,8,64,256)\n"
+          "  -t topic   Publish topic template (default %s)\n"
+          "  -v         Print topic and payload of both ways for the first size\n"
+          "  -h         This help\n",
+          name,
+          BENCH_TOPIC);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// format_legacy
+//
+// Topic and payload as mqtt_send_vscp_event did it before topics were
+// compiled. Returns the payload length, zero on failure.
+//
+
+static size_t
+format_legacy(char *topic, const char *tmpl, const vscpEvent *pev)
+{
+  char saveTopic[128], workbuf[48];
+  size_t len;
+
+  char *pbuf = VSCP_MALLOC(BENCH_LEGACY_JSON_SIZE);
+  if (NULL == pbuf) {
+    return 0;
+  }
+
+  if (VSCP_ERROR_SUCCESS != vscp_fwhlp_create_json(pbuf, BENCH_LEGACY_JSON_SIZE, pev)) {
+    VSCP_FREE(pbuf);
+    return 0;
+  }
+
+  vscp_fwhlp_strsubst(topic, 128, tmpl, "{{node}}", s_nodeName);
+  strcpy(saveTopic, topic);
+
+  vscp_fwhlp_writeGuidToString(workbuf, s_nodeGuid);
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{guid}}", workbuf);
+  strcpy(saveTopic, topic);
+
+  vscp_fwhlp_writeGuidToString(workbuf, pev->GUID);
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{evguid}}", workbuf);
+  strcpy(saveTopic, topic);
+
+  sprintf(workbuf, "%d", pev->vscp_class);
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{class}}", workbuf);
+  strcpy(saveTopic, topic);
+
+  sprintf(workbuf, "%d", pev->vscp_type);
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{type}}", workbuf);
+  strcpy(saveTopic, topic);
+
+  sprintf(workbuf, "%d", ((pev->GUID[14] << 8) + (pev->GUID[15])));
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{nickname}}", workbuf);
+  strcpy(saveTopic, topic);
+
+  if (VSCP_ERROR_SUCCESS == vscp_fwhlp_isMeasurement(pev)) {
+    sprintf(workbuf, "%d", vscp_fwhlp_getMeasurementSensorIndex(pev));
+  }
+  else {
+    memset(workbuf, 0, sizeof(workbuf));
+  }
+  vscp_fwhlp_strsubst(topic, 128, saveTopic, "{{sindex}}", workbuf);
+
+  len = strlen(pbuf);
+  VSCP_FREE(pbuf);
+
+  return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// format_compiled
+//
+// Topic and payload as mqtt_send_vscp_event does it now. Returns the
+// payload length, zero on failure.
+//
+
+static size_t
+format_compiled(char *topic, char *json, const mqttfmt_topic_t *ptopic, const vscpEvent *pev)
+{
+  if (!mqttfmt_render_topic(topic, MQTTFMT_TOPIC_MAX, ptopic, pev)) {
+    return 0;
+  }
+
+  return mqttfmt_write_json(json, MQTTFMT_JSON_MAX, pev);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bench_payload
+//
+// Times the payload alone in one of the formats. Returns events/s, the
+// payload length is left in plen (zero on failure).
+//
+
+static double
+bench_payload(size_t *plen, long nEvents, const vscpEvent *pev, mqttfmt_format_t format, uint32_t *psum)
+{
+  static uint8_t buf[MQTTFMT_JSON_MAX];
+  double start;
+
+  *plen = 0;
+  start = now_sec();
+  for (long i = 0; i < nEvents; i++) {
+    if (!(*plen = mqttfmt_write_payload(buf, sizeof(buf), pev, format))) {
+      return 0;
+    }
+    *psum += buf[i % *plen];
+  }
+
+  return nEvents / (now_sec() - start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// bench
+//
+
+static int
+bench(int sizeData, long nEvents, const char *tmpl, const mqttfmt_topic_t *ptopic, int bVerbose)
+{
+  uint8_t data[MQTTFMT_MAX_DATA];
+  char topic[MQTTFMT_TOPIC_MAX];
+  static char json[MQTTFMT_JSON_MAX];
+  size_t legacyLen, compiledLen, binLen, cborLen;
+  uint32_t sum = 0;
+  double start, tLegacy, tCompiled, rateBin, rateCbor;
+  vscpEvent ev;
+
+  memset(&ev, 0, sizeof(ev));
+  esp_fill_random(data, sizeof(data));
+  esp_fill_random(ev.GUID, sizeof(ev.GUID));
+  ev.head       = 0x60; // Priority 3
+  ev.obid       = 42;
+  ev.timestamp  = 123456789;
+  ev.year       = 2023;
+  ev.month      = 6;
+  ev.day        = 12;
+  ev.hour       = 14;
+  ev.minute     = 22;
+  ev.second     = 5;
+  ev.vscp_class = 10; // CLASS1.MEASUREMENT
+  ev.vscp_type  = 6;  // VSCP_TYPE_MEASUREMENT_TEMPERATURE
+  ev.sizeData   = sizeData;
+  ev.pdata      = sizeData ? data : NULL;
+
+  if (bVerbose) {
+    legacyLen = format_legacy(topic, tmpl, &ev);
+    printf("legacy   %s (%zu byte payload)\n", topic, legacyLen);
+    compiledLen = format_compiled(topic, json, ptopic, &ev);
+    printf("compiled %s\n         %s\n", topic, json);
+  }
+
+  start = now_sec();
+  for (long i = 0; i < nEvents; i++) {
+    legacyLen = format_legacy(topic, tmpl, &ev);
+    sum += topic[i % 16] + legacyLen;
+  }
+  tLegacy = now_sec() - start;
+
+  start = now_sec();
+  for (long i = 0; i < nEvents; i++) {
+    compiledLen = format_compiled(topic, json, ptopic, &ev);
+    sum += topic[i % 16] + json[i % compiledLen];
+  }
+  tCompiled = now_sec() - start;
+
+  rateBin  = bench_payload(&binLen, nEvents, &ev, MQTTFMT_FORMAT_BINARY, &sum);
+  rateCbor = bench_payload(&cborLen, nEvents, &ev, MQTTFMT_FORMAT_CBOR, &sum);
+
+  if (!legacyLen || !compiledLen || !binLen || !cborLen) {
+    fprintf(stderr, "Formatting failed for data size %d\n", sizeData);
+    return -1;
+  }
+
+  printf("%5d %7zu %11.0f %11.0f %7.1f | %5zu %5zu %11.0f %11.0f\n",
+         sizeData,
+         compiledLen,
+         nEvents / tLegacy,
+         nEvents / tCompiled,
+         tLegacy / tCompiled,
+         binLen,
+         cborLen,
+         rateBin,
+         rateCbor);
+
+  // Keep the work from being optimized away
+  return (0xffffffff == sum) ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int rv;
+  int opt;
+  long nEvents   = 1000000;
+  const char *tmpl = BENCH_TOPIC;
+  int bVerbose   = 0;
+  int sizes[16];
+  int nSizes = 0;
+  mqttfmt_topic_t topic;
+
+  while (-1 != (opt = getopt(argc, argv, "n:d:t:vh"))) {
+    switch (opt) {
+      case 'n':
+        nEvents = atol(optarg);
+        break;
+      case 'd':
+        if ((nSizes < 16) && (atoi(optarg) >= 0) && (atoi(optarg) <= MQTTFMT_MAX_DATA)) {
+          sizes[nSizes++] = atoi(optarg);
+        }
+        break;
+      case 't':
+        tmpl = optarg;
+        break;
+      case 'v':
+        bVerbose = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (!nSizes) {
+    nSizes = sizeof(s_defaultSizes) / sizeof(s_defaultSizes[0]);
+    memcpy(sizes, s_defaultSizes, sizeof(s_defaultSizes));
+  }
+
+  if (nEvents <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (VSCP_ERROR_SUCCESS != (rv = mqttfmt_compile_topic(&topic, tmpl, s_nodeName, s_nodeGuid))) {
+    fprintf(stderr, "Failed to compile topic %s rv=%d\n", tmpl, rv);
+    return EXIT_FAILURE;
+  }
+
+  printf("%ld events per measurement. Topic %s (%d tokens).\n", nEvents, tmpl, topic.nTokens);
+  printf("%5s %7s %11s %11s %7s | %5s %5s %11s %11s\n",
+         "data",
+         "json B",
+         "legacy ev/s",
+         "compiled",
+         "speedup",
+         "bin B",
+         "cbor B",
+         "bin ev/s",
+         "cbor ev/s");
+
+  for (int i = 0; i < nSizes; i++) {
+    if (bench(sizes[i], nEvents, tmpl, &topic, bVerbose && !i)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/**
+ * @brief           MQTT publish filter simulation
+ * @file            droplet-bench-pubfilter.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Runs a day of simulated temperature sensors through the deadband
+ * filter of the gateway (alpha5/main/pubfilter.c) with a few filter
+ * settings and reports how many events would have been published, and
+ * the time the filter takes per event.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vscp.h>
+
+#include "pubfilter.h"
+
+#define BENCH_US 1000000LL
+
+// Table size of the gateway (PRJDEF_MQTT_PUBFILTER_SIZE)
+#define BENCH_TABLE_SIZE 64
+
+#define BENCH_MAX_TABLE 4096
+
+// Filter settings simulated
+static const struct {
+  const char *name;
+  double deadband;
+  int minInterval; // Seconds
+  int maxAge;      // Seconds
+} s_settings[] = {
+  { "off", 0, 0, 0 },
+  { "deadband 0.1", 0.1, 0, 0 },
+  { "deadband 0.1, min 10 s", 0.1, 10, 0 },
+  { "deadband 0.1, min 10 s, max age 15 min", 0.1, 10, 900 },
+  { "deadband 0.5, max age 1 h", 0.5, 0, 3600 },
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -s sensors  Number of sensors (default 32)\n"
+          "  -p seconds  Report period of each sensor (default 1)\n"
+          "  -H hours    Simulated time (default 24)\n"
+          "  -e entries  Filter table size (default %d)\n"
+          "  -h          This help\n",
+          name,
+          BENCH_TABLE_SIZE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// sensor_value
+//
+// Slow daily swing around 20 degrees, a phase per sensor, and noise
+// in the last digit
+//
+
+static double
+sensor_value(int sensor, long t)
+{
+  double noise = ((rand() % 5) - 2) * 0.01;
+  return 20 + 3 * sin(2 * M_PI * t / 86400.0 + sensor) + noise;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// make_event
+//
+// CLASS1.MEASUREMENT temperature, normalized integer with two decimals
+//
+
+static void
+make_event(vscpEvent *pev, uint8_t *data, int sensor, double value)
+{
+  int16_t v = (int16_t) lround(value * 100);
+
+  pev->GUID[14]   = (sensor >> 8) & 0xff;
+  pev->GUID[15]   = sensor & 0xff;
+  pev->vscp_class = 10; // CLASS1.MEASUREMENT
+  pev->vscp_type  = 6;  // VSCP_TYPE_MEASUREMENT_TEMPERATURE
+  data[0]         = 0x88; // Normalized integer, unit 1 (Celsius), sensor index 0
+  data[1]         = 0x82; // Decimal point two steps left
+  data[2]         = (v >> 8) & 0xff;
+  data[3]         = v & 0xff;
+  pev->sizeData   = 4;
+  pev->pdata      = data;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// simulate
+//
+
+static int
+simulate(int setting, int nSensors, int period, int hours, pubfilter_entry_t *ptable, int nEntries)
+{
+  pubfilter_t pf;
+  pubfilter_cfg_t cfg;
+  vscpEvent ev;
+  uint8_t data[4];
+  long nEvents    = 0;
+  long nPublished = 0;
+  double start, elapsed = 0;
+
+  memset(&ev, 0, sizeof(ev));
+  memset(ev.GUID, 0xfe, 14);
+  cfg.deadband    = s_settings[setting].deadband;
+  cfg.minInterval = s_settings[setting].minInterval * BENCH_US;
+  cfg.maxAge      = s_settings[setting].maxAge * BENCH_US;
+  pubfilter_init(&pf, ptable, nEntries);
+  srand(1);
+
+  for (long t = 0; t < hours * 3600L; t += period) {
+    for (int i = 0; i < nSensors; i++) {
+      make_event(&ev, data, i, sensor_value(i, t));
+      start = now_sec();
+      if (pubfilter_check(&pf, &cfg, &ev, t * BENCH_US)) {
+        nPublished++;
+      }
+      elapsed += now_sec() - start;
+      nEvents++;
+    }
+  }
+
+  if (nEvents != (pf.stats.nPassed + pf.stats.nSuppressed) && setting) {
+    fprintf(stderr, "Filter statistics do not add up\n");
+    return -1;
+  }
+
+  printf("%-40s %10ld %10ld %8.1f %6lu %7.0f\n",
+         s_settings[setting].name,
+         nEvents,
+         nPublished,
+         nPublished ? (double) nEvents / nPublished : 0,
+         (unsigned long) pf.stats.nEvicted,
+         nEvents ? elapsed * 1e9 / nEvents : 0);
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  int nSensors = 32;
+  int period   = 1;
+  int hours    = 24;
+  int nEntries = BENCH_TABLE_SIZE;
+  static pubfilter_entry_t table[BENCH_MAX_TABLE];
+
+  while (-1 != (opt = getopt(argc, argv, "s:p:H:e:h"))) {
+    switch (opt) {
+      case 's':
+        nSensors = atoi(optarg);
+        break;
+      case 'p':
+        period = atoi(optarg);
+        break;
+      case 'H':
+        hours = atoi(optarg);
+        break;
+      case 'e':
+        nEntries = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ((nSensors <= 0) || (nSensors > 65535) || (period <= 0) || (hours <= 0) || (nEntries <= 0) ||
+      (nEntries > BENCH_MAX_TABLE)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%d sensors reporting every %d s for %d h, table of %d entries.\n", nSensors, period, hours, nEntries);
+  printf("%-40s %10s %10s %8s %6s %7s\n", "filter", "events", "published", "ratio", "evict", "ns/ev");
+
+  for (int i = 0; i < (int) (sizeof(s_settings) / sizeof(s_settings[0])); i++) {
+    if (simulate(i, nSensors, period, hours, table, nEntries)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
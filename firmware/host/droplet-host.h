@@ -0,0 +1,127 @@
+/**
+ * @brief           Droplet host transports
+ * @file            droplet-host.h
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Transports used when the droplet stack runs on a POSIX host.
+ *
+ *  udp      - Frames are sent as UDP multicast datagrams so several
+ *             droplet processes on one or more machines form a network.
+ *  loopback - Frames are handed to a callback and received frames are
+ *             injected by the application. Used by simulators and tools.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#ifndef DROPLET_HOST_H
+#define DROPLET_HOST_H
+
+#pragma once
+
+#include "vscp-droplet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DROPLET_UDP_DEFAULT_GROUP "239.255.86.83" // 'V' 'S'
+#define DROPLET_UDP_DEFAULT_PORT  9598
+
+// UDP multicast transport (droplet-transport-udp.c)
+extern const droplet_transport_t g_droplet_transport_udp;
+
+// Loopback transport (droplet-transport-loopback.c)
+extern const droplet_transport_t g_droplet_transport_loopback;
+
+/**
+ * @fn droplet_transport_udp_config
+ * @brief Configure the UDP multicast transport
+ *
+ * Must be called before droplet_init.
+ *
+ * @param group Multicast group or NULL for DROPLET_UDP_DEFAULT_GROUP
+ * @param port UDP port or zero for DROPLET_UDP_DEFAULT_PORT
+ * @param mac Six byte address for this node or NULL for a random
+ *            locally administered address.
+ * @return esp_err_t ESP_OK on success.
+ */
+esp_err_t
+droplet_transport_udp_config(const char *group, uint16_t port, const uint8_t *mac);
+
+/**
+ * @brief Sink for frames sent on the loopback transport
+ *
+ * @param dest_addr Destination address of frame
+ * @param data Frame data
+ * @param len Length of frame
+ * @param userdata Pointer given to droplet_loopback_set_sink
+ */
+typedef void (*droplet_loopback_sink_t)(const uint8_t *dest_addr, const uint8_t *data, size_t len, void *userdata);
+
+/**
+ * @fn droplet_loopback_set_sink
+ * @brief Set callback that get all frames sent on the loopback transport
+ *
+ * @param sink Callback or NULL to drop sent frames.
+ * @param userdata Handed to the callback.
+ */
+void
+droplet_loopback_set_sink(droplet_loopback_sink_t sink, void *userdata);
+
+/**
+ * @fn droplet_loopback_set_mac
+ * @brief Set the address reported by the loopback transport
+ *
+ * @param mac Six byte address
+ */
+void
+droplet_loopback_set_mac(const uint8_t *mac);
+
+/**
+ * @fn droplet_loopback_inject
+ * @brief Feed a frame into the droplet receive path
+ *
+ * @param src_addr Six byte address of sender
+ * @param rssi Signal strength to report for the frame
+ * @param data Frame data
+ * @param len Length of frame
+ */
+void
+droplet_loopback_inject(const uint8_t *src_addr, int8_t rssi, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+/**
+ * @brief           Droplet node for host builds
+ * @file            droplet-node.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Runs the droplet stack as a process on a POSIX host using the UDP
+ * multicast transport. Several nodes started on one machine (or on a
+ * LAN) form a droplet network. Received events are printed and a test
+ * event can be sent periodically.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_mac.h>
+
+#include <vscp.h>
+
+#include "droplet-host.h"
+#include "vscp-droplet.h"
+
+static const char *TAG = "droplet-node";
+
+static volatile sig_atomic_t s_bRun = 1;
+
+// Default key (same as PRJDEF_DROPLET_PMK on target)
+static uint8_t s_pmk[DROPLET_KEY_LEN] = { 0xA4, 0xA8, 0x6F, 0x7D, 0x7E, 0x11, 0x9B, 0xA3, 0xF0, 0xCD, 0x06,
+                                          0x88, 0x1E, 0x37, 0x1B, 0x98, 0x9B, 0x33, 0xB6, 0xD6, 0x06, 0xA8,
+                                          0x63, 0xB6, 0x33, 0xEF, 0x52, 0x9D, 0x64, 0x54, 0x4F, 0x8E };
+
+static uint8_t s_guid[16] = { 0 };
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -g group   Multicast group (default " DROPLET_UDP_DEFAULT_GROUP ")\n"
+          "  -p port    UDP port (default %d)\n"
+          "  -m mac     Node address xx:xx:xx:xx:xx:xx (default random)\n"
+          "  -c channel Channel (default %d)\n"
+          "  -t ttl     Time to live for sent frames (default 7)\n"
+          "  -f         Enable forwarding\n"
+          "  -F name    Forwarding strategy flood, gossip, counter or rssi (default flood)\n"
+          "  -J ms      Max forward jitter for flood and gossip (default %d)\n"
+          "  -a ms      Hold broadcast events ms milliseconds and send them in one frame (default off)\n"
+          "  -C         Send with the compact event header\n"
+          "  -e n       Encryption 0=none, 1=AES-128, 2=AES-192, 3=AES-256 (default 0)\n"
+          "  -k key     Primary key as 64 hex digits\n"
+          "  -s ms      Send a test event every ms milliseconds\n"
+          "  -d bytes   Data size of test event, up to %d (default 3)\n"
+          "  -n sec     Run for sec seconds then print statistics and exit\n"
+          "  -v         Verbose (debug) logging\n"
+          "  -q         Quiet, only errors are logged\n",
+          name,
+          DROPLET_UDP_DEFAULT_PORT,
+          PRJDEF_DROPLET_CHANNEL,
+          DROPLET_FWD_JITTER,
+          DROPLET_MAX_FRAG_DATA);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// parse_hex
+//
+
+static int
+parse_hex(uint8_t *buf, size_t len, const char *str, const char *sep)
+{
+  for (size_t i = 0; i < len; i++) {
+    unsigned int val;
+    if (1 != sscanf(str, "%2x", &val)) {
+      return VSCP_ERROR_PARAMETER;
+    }
+    buf[i] = (uint8_t) val;
+    str += 2;
+    if ((NULL != sep) && (*str == *sep)) {
+      str++;
+    }
+  }
+  return VSCP_ERROR_SUCCESS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// node_receive_cb
+//
+
+static void
+node_receive_cb(const vscpEvent *pev, void *userdata)
+{
+  char data[3 * 128 + 1] = "";
+
+  (void) userdata;
+
+  for (int i = 0; (i < pev->sizeData) && (i < 128); i++) {
+    sprintf(data + 3 * i, "%02X ", pev->pdata[i]);
+  }
+
+  printf("class=%u type=%u guid=" MACSTR " size=%u data=%s\n",
+         pev->vscp_class,
+         pev->vscp_type,
+         MAC2STR(pev->GUID + 8),
+         pev->sizeData,
+         data);
+  fflush(stdout);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// print_stats
+//
+
+static void
+print_stats(void)
+{
+  droplet_stats_t stats;
+  droplet_get_stats(&stats);
+
+  printf("send=%u send-failures=%u send-queue-full=%u send-ack-fail=%u tx-window-wait=%u tx-queue-max=%u "
+         "recv=%u recv-overruns=%u recv-pool-empty=%u recv-pool-max=%u recv-faults=%u adj-ch-filter=%u "
+         "rssi-filter=%u forwarded=%u forward-suppressed=%u forward-held=%u "
+         "forward-cancelled=%u forward-collisions=%u forward-retries=%u "
+         "agg-sent=%u agg-events=%u agg-recv=%u "
+         "frag-sent=%u frag-recv=%u frag-events=%u frag-timeouts=%u frag-dup=%u frag-dropped=%u frag-mem-max=%u "
+         "dup-hits=%u dup-evictions=%u dup-collisions=%u\n",
+         stats.nSend,
+         stats.nSendFailures,
+         stats.nSendLock,
+         stats.nSendAck,
+         stats.nTxWindowWait,
+         stats.maxTxQueueUsed,
+         stats.nRecv,
+         stats.nRecvOverruns,
+         stats.nRecvPoolEmpty,
+         stats.maxRecvPoolUsed,
+         stats.nRecvFrameFault,
+         stats.nRecvAdjChFilter,
+         stats.nRecvRssiFilter,
+         stats.nForw,
+         stats.nForwSuppressed,
+         stats.nForwDeferred,
+         stats.nForwCancelled,
+         stats.nForwCollisions,
+         stats.nForwRetries,
+         stats.nAggSent,
+         stats.nAggEvents,
+         stats.nAggRecv,
+         stats.nFragSent,
+         stats.nFragRecv,
+         stats.nFragReassembled,
+         stats.nFragTimeouts,
+         stats.nFragDup,
+         stats.nFragDropped,
+         stats.maxFragMem,
+         stats.nDupHits,
+         stats.nDupEvictions,
+         stats.nDupCollisions);
+
+  printf("tx-in-flight=%u tx-window=%u confirm-ok=%u confirm-fail=%u fail-ratio=%u/1000 ack-latency=%uus ack-hist=",
+         stats.txInFlight,
+         stats.txWindow,
+         stats.nSendConfirmOk,
+         stats.nSendConfirmFail,
+         stats.txFailRatio,
+         stats.txAckLatency);
+  for (int i = 0; i < DROPLET_TX_LATENCY_BINS; i++) {
+    printf("%s%u", i ? "/" : "", stats.txAckHist[i]);
+  }
+  printf("\n");
+}
+
+static void
+sig_handler(int sig)
+{
+  (void) sig;
+  s_bRun = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  const char *group     = NULL;
+  uint16_t port         = 0;
+  uint8_t mac[6]        = { 0 };
+  bool bMac             = false;
+  uint32_t sendInterval = 0;
+  uint16_t sendSize     = 3;
+  uint32_t runTime      = 0;
+
+  droplet_config_t config = { .nodeType               = DROPLET_BETA_NODE,
+                              .channel                = PRJDEF_DROPLET_CHANNEL,
+                              .ttl                    = 7,
+                              .bForwardEnable         = false,
+                              .bForwardSwitchChannel  = false,
+                              .sizeQueue              = 32,
+                              .nEncryption            = VSCP_ENCRYPTION_NONE,
+                              .bFilterAdjacentChannel = true,
+                              .filterWeakSignal       = 0,
+                              .lkey                   = s_pmk,
+                              .pmk                    = s_pmk,
+                              .nodeGuid               = s_guid };
+
+  while (-1 != (opt = getopt(argc, argv, "g:p:m:c:t:fF:J:a:Ce:k:s:d:n:vqh"))) {
+    switch (opt) {
+      case 'g':
+        group = optarg;
+        break;
+      case 'p':
+        port = (uint16_t) atoi(optarg);
+        break;
+      case 'm':
+        if (VSCP_ERROR_SUCCESS != parse_hex(mac, sizeof(mac), optarg, ":")) {
+          fprintf(stderr, "Invalid mac address %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        bMac = true;
+        break;
+      case 'c':
+        config.channel = (uint8_t) atoi(optarg);
+        break;
+      case 't':
+        config.ttl = (uint8_t) atoi(optarg);
+        break;
+      case 'f':
+        config.bForwardEnable = true;
+        break;
+      case 'F':
+        if (!strcmp(optarg, "flood")) {
+          config.fwdStrategy = DROPLET_FWD_FLOOD;
+        }
+        else if (!strcmp(optarg, "gossip")) {
+          config.fwdStrategy = DROPLET_FWD_GOSSIP;
+        }
+        else if (!strcmp(optarg, "counter")) {
+          config.fwdStrategy = DROPLET_FWD_COUNTER;
+        }
+        else if (!strcmp(optarg, "rssi")) {
+          config.fwdStrategy = DROPLET_FWD_RSSI;
+        }
+        else {
+          fprintf(stderr, "Invalid forwarding strategy %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'J':
+        config.fwdJitter = (uint16_t) atoi(optarg);
+        break;
+      case 'a':
+        config.aggLinger = (uint16_t) atoi(optarg);
+        break;
+      case 'C':
+        config.bCompactHeader = true;
+        break;
+      case 'e':
+        config.nEncryption = (uint8_t) atoi(optarg);
+        if (config.nEncryption > VSCP_ENCRYPTION_AES256) {
+          fprintf(stderr, "Invalid encryption %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'k':
+        if ((2 * DROPLET_KEY_LEN != strlen(optarg)) ||
+            (VSCP_ERROR_SUCCESS != parse_hex(s_pmk, sizeof(s_pmk), optarg, NULL))) {
+          fprintf(stderr, "Key must be %d hex digits\n", 2 * DROPLET_KEY_LEN);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 's':
+        sendInterval = (uint32_t) atoi(optarg);
+        break;
+      case 'd':
+        sendSize = (uint16_t) atoi(optarg);
+        if ((sendSize < 3) || (sendSize > DROPLET_MAX_FRAG_DATA)) {
+          fprintf(stderr, "Data size must be 3 to %d\n", DROPLET_MAX_FRAG_DATA);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'n':
+        runTime = (uint32_t) atoi(optarg);
+        break;
+      case 'v':
+        esp_log_level_set("*", ESP_LOG_DEBUG);
+        break;
+      case 'q':
+        esp_log_level_set("*", ESP_LOG_ERROR);
+        break;
+      case 'h':
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  signal(SIGINT, sig_handler);
+  signal(SIGTERM, sig_handler);
+
+  if (ESP_OK != droplet_transport_udp_config(group, port, bMac ? mac : NULL)) {
+    fprintf(stderr, "Invalid transport configuration\n");
+    return EXIT_FAILURE;
+  }
+
+  droplet_set_transport(&g_droplet_transport_udp);
+  droplet_set_vscp_user_handler_cb(node_receive_cb);
+
+  if (ESP_OK != droplet_init(&config)) {
+    ESP_LOGE(TAG, "Failed to initialize droplet");
+    return EXIT_FAILURE;
+  }
+
+  // GUID is built from the node address as on target. The address
+  // is not known until the transport is up.
+  uint8_t self[6];
+  g_droplet_transport_udp.get_mac(self);
+  droplet_build_guid_from_mac(s_guid, self, PRJDEF_NODE_NICKNAME);
+
+  TickType_t start    = xTaskGetTickCount();
+  TickType_t lastSend = start;
+  uint8_t counter     = 0;
+
+  // Test data. Counter is in the third byte, the rest is a fill pattern.
+  uint8_t data[DROPLET_MAX_FRAG_DATA];
+  for (int i = 0; i < DROPLET_MAX_FRAG_DATA; i++) {
+    data[i] = (uint8_t) i;
+  }
+
+  while (s_bRun) {
+
+    vTaskDelay(pdMS_TO_TICKS(10));
+
+    if (sendInterval && ((xTaskGetTickCount() - lastSend) >= pdMS_TO_TICKS(sendInterval))) {
+      data[0] = 0x00;
+      data[1] = 0x00;
+      data[2] = counter++;
+      vscpEvent ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.vscp_class = 20; // CLASS1.INFORMATION
+      ev.vscp_type  = 9;  // VSCP_TYPE_INFORMATION_ON
+      ev.sizeData   = sendSize;
+      ev.pdata      = data;
+      memcpy(ev.GUID, s_guid, 16);
+
+      if (ESP_OK != droplet_sendEvent(DROPLET_ADDR_BROADCAST, &ev, NULL, 100)) {
+        ESP_LOGW(TAG, "Failed to send test event");
+      }
+      lastSend = xTaskGetTickCount();
+    }
+
+    if (runTime && ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(runTime * 1000))) {
+      break;
+    }
+  }
+
+  print_stats();
+
+  if (NULL != g_droplet_transport_udp.deinit) {
+    g_droplet_transport_udp.deinit();
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1112 @@
+/**
+ * @brief           Droplet mesh simulator
+ * @file            droplet-sim.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Discrete event simulation of a droplet network. Every simulated node
+ * runs its own instance of the droplet mesh core (droplet-mesh.c, the
+ * same code as on target) on a virtual radio with configurable topology,
+ * range, loss, bitrate and CSMA/collision model.
+ *
+ * Reported per run (and per event with -v)
+ *   - delivery ratio (nodes that got the event / nodes - 1)
+ *   - transmissions and duplicate receptions
+ *   - frames lost to duplicate filter collisions and duplicate
+ *     deliveries when entries are evicted or expire
+ *   - airtime used
+ *   - end to end latency
+ *   - forwards suppressed, held and cancelled by the forwarding strategy
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include <vscp.h>
+
+#include "droplet-mesh.h"
+#include "vscp-droplet.h"
+
+// 802.11b long preamble and MAC/vendor element overhead of an esp-now frame
+#define SIM_PHY_OVERHEAD_US 192
+#define SIM_MAC_OVERHEAD    43
+#define SIM_DIFS_US         50
+#define SIM_SLOT_US         20
+#define SIM_CW_MIN          31
+
+// Log distance path loss. RSSI at the edge of range and path loss exponent.
+#define SIM_RSSI_EDGE_DBM -90
+#define SIM_PATHLOSS_EXP  3.0
+
+typedef enum { TOPO_GRID, TOPO_LINE, TOPO_RANDOM } sim_topology_t;
+
+typedef enum { EV_ORIGINATE, EV_TX_ATTEMPT, EV_TX_END, EV_PROCESS, EV_FORWARD } sim_evtype_t;
+
+// Frame in the air or in a queue. The event index, the RSSI it was
+// received with and the forward hold state are simulator bookkeeping
+// and not part of the frame.
+typedef struct sim_frame {
+  struct sim_frame *next;
+  uint32_t event;
+  int8_t rssi;
+  bool bCancelled;
+  uint16_t len;
+  uint8_t data[DROPLET_MAX_FRAME + 2 * DROPLET_IV_LEN];
+} sim_frame_t;
+
+typedef struct {
+  uint16_t dst;  // Neighbour node index
+  float loss;    // Loss probability on link
+  int8_t rssi;   // Signal strength at neighbour (dBm)
+} sim_link_t;
+
+typedef struct {
+  double x;
+  double y;
+  uint8_t addr[DROPLET_ADDR_LEN];
+  droplet_mesh_t mesh;
+  sim_link_t *links;
+  uint16_t nLinks;
+
+  // Held forwards. Index + 1 is the tag given to the mesh core.
+  sim_frame_t **held;
+  uint16_t sizeHeld;
+
+  // Radio state
+  bool bTransmitting;
+  bool bAttemptPending;
+  uint32_t nActiveRx;
+  uint32_t rxEpoch; // Bumped every time ongoing receptions get corrupted
+  sim_frame_t *txHead;
+  sim_frame_t *txTail;
+} sim_node_t;
+
+// One transmission with the reception state at each neighbour
+typedef struct {
+  uint16_t src;
+  sim_frame_t *frame;
+  uint32_t *epoch;
+  bool *bCorrupt;
+} sim_tx_t;
+
+typedef struct {
+  uint64_t time;
+  uint64_t seq;
+  sim_evtype_t type;
+  uint16_t node;
+  void *p;
+} sim_event_t;
+
+typedef struct {
+  uint16_t src;
+  uint64_t start;
+  uint32_t nDelivered;
+  uint32_t nTx;
+  uint64_t latencySum;
+  uint64_t latencyMax;
+} sim_stat_event_t;
+
+// Simulation parameters
+static struct {
+  uint16_t nNodes;
+  sim_topology_t topology;
+  double spacing;
+  double area;
+  double range;
+  double loss;
+  double edgeLoss;
+  uint32_t bitrate; // kbit/s
+  uint8_t ttl;
+  uint16_t sizeCache;
+  uint32_t maxAge; // ms
+  bool bForward;
+  droplet_fwd_strategy_t fwdStrategy;
+  uint8_t gossipProb; // percent
+  uint8_t counterMax;
+  uint16_t backoff; // ms
+  uint16_t jitter;  // ms
+  int8_t rssiNear;  // dBm
+  int8_t rssiFar;   // dBm
+  uint32_t nEvents;
+  uint32_t interval; // us
+  uint8_t sizeData;
+  bool bEncrypt;
+  uint32_t procDelay; // us
+  bool bIdeal;
+  uint64_t seed;
+  bool bVerbose;
+  bool bCsv;
+} s_cfg = { .nNodes     = 25,
+            .topology   = TOPO_GRID,
+            .spacing    = 10,
+            .area       = 100,
+            .range      = 15,
+            .loss       = 0.05,
+            .edgeLoss   = 0.2,
+            .bitrate    = 1000,
+            .ttl        = 7,
+            .sizeCache  = DROPLET_MSG_CACHE_SIZE,
+            .maxAge     = DROPLET_MSG_CACHE_MAX_AGE,
+            .bForward   = true,
+            .gossipProb = DROPLET_FWD_GOSSIP_PROB,
+            .counterMax = DROPLET_FWD_COUNTER_MAX,
+            .backoff    = DROPLET_FWD_BACKOFF,
+            .jitter     = DROPLET_FWD_JITTER,
+            .rssiNear   = DROPLET_FWD_RSSI_NEAR,
+            .rssiFar    = DROPLET_FWD_RSSI_FAR,
+            .nEvents    = 100,
+            .interval   = 100000,
+            .sizeData   = 8,
+            .procDelay  = 1000,
+            .seed       = 1 };
+
+// Names of droplet_fwd_strategy_t values
+static const char *s_strategies[] = { "flood", "gossip", "counter", "rssi" };
+
+static sim_node_t *s_nodes;
+static sim_stat_event_t *s_events;
+static uint8_t *s_delivered; // [event * nNodes + node] delivery count
+
+static sim_event_t *s_heap;
+static size_t s_heapSize;
+static size_t s_heapCnt;
+static uint64_t s_seq;
+static uint64_t s_now;
+static uint64_t s_rng;
+
+// Totals
+static struct {
+  uint64_t nTx;
+  uint64_t nRxOk;
+  uint64_t nRxLost;
+  uint64_t nRxCollided;
+  uint64_t nDupRx;
+  uint64_t nFalseDrop;
+  uint64_t nDupDeliver;
+  uint64_t nForward;
+  uint64_t airtime; // us
+  uint32_t nLinks;
+  uint32_t diameter;
+  uint32_t nUnconnected;
+} s_tot;
+
+static uint64_t *s_latencies;
+static size_t s_cntLatencies;
+
+///////////////////////////////////////////////////////////////////////////////
+// rnd
+//
+// xorshift64*. The run is repeatable for a given seed.
+//
+
+static uint64_t
+rnd(void)
+{
+  s_rng ^= s_rng >> 12;
+  s_rng ^= s_rng << 25;
+  s_rng ^= s_rng >> 27;
+  return s_rng * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+rnd_uniform(void)
+{
+  return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// ----------------------------------------------------------------------------
+//                                Event heap
+// ----------------------------------------------------------------------------
+
+static bool
+ev_before(const sim_event_t *a, const sim_event_t *b)
+{
+  return (a->time < b->time) || ((a->time == b->time) && (a->seq < b->seq));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// schedule
+//
+
+static void
+schedule(uint64_t time, sim_evtype_t type, uint16_t node, void *p)
+{
+  if (s_heapCnt == s_heapSize) {
+    s_heapSize = s_heapSize ? 2 * s_heapSize : 1024;
+    s_heap     = realloc(s_heap, s_heapSize * sizeof(sim_event_t));
+    if (NULL == s_heap) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  sim_event_t ev = { .time = time, .seq = s_seq++, .type = type, .node = node, .p = p };
+  size_t i       = s_heapCnt++;
+  while (i && ev_before(&ev, &s_heap[(i - 1) / 2])) {
+    s_heap[i] = s_heap[(i - 1) / 2];
+    i         = (i - 1) / 2;
+  }
+  s_heap[i] = ev;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// next_event
+//
+
+static bool
+next_event(sim_event_t *pev)
+{
+  if (!s_heapCnt) {
+    return false;
+  }
+
+  *pev             = s_heap[0];
+  sim_event_t last = s_heap[--s_heapCnt];
+  size_t i         = 0;
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= s_heapCnt) {
+      break;
+    }
+    if ((child + 1 < s_heapCnt) && ev_before(&s_heap[child + 1], &s_heap[child])) {
+      child++;
+    }
+    if (!ev_before(&s_heap[child], &last)) {
+      break;
+    }
+    s_heap[i] = s_heap[child];
+    i         = child;
+  }
+  s_heap[i] = last;
+
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+//                                 Topology
+// ----------------------------------------------------------------------------
+
+///////////////////////////////////////////////////////////////////////////////
+// build_topology
+//
+
+static void
+build_topology(void)
+{
+  uint16_t cols = (uint16_t) ceil(sqrt(s_cfg.nNodes));
+
+  for (uint16_t i = 0; i < s_cfg.nNodes; i++) {
+    sim_node_t *pnode = &s_nodes[i];
+    switch (s_cfg.topology) {
+      case TOPO_GRID:
+        pnode->x = (i % cols) * s_cfg.spacing;
+        pnode->y = (i / cols) * s_cfg.spacing;
+        break;
+      case TOPO_LINE:
+        pnode->x = i * s_cfg.spacing;
+        pnode->y = 0;
+        break;
+      case TOPO_RANDOM:
+        pnode->x = rnd_uniform() * s_cfg.area;
+        pnode->y = rnd_uniform() * s_cfg.area;
+        break;
+    }
+
+    // Locally administered address with node index
+    pnode->addr[0] = 0x02;
+    pnode->addr[4] = (i >> 8) & 0xff;
+    pnode->addr[5] = i & 0xff;
+
+    droplet_mesh_config_t meshConfig = { .sizeCache      = s_cfg.sizeCache,
+                                         .maxAge         = s_cfg.maxAge,
+                                         .bForwardEnable = s_cfg.bForward,
+                                         .fwdStrategy    = s_cfg.fwdStrategy,
+                                         .gossipProb     = s_cfg.gossipProb,
+                                         .counterMax     = s_cfg.counterMax,
+                                         .backoffMax     = s_cfg.backoff,
+                                         .jitterMax      = s_cfg.jitter,
+                                         .rssiNear       = s_cfg.rssiNear,
+                                         .rssiFar        = s_cfg.rssiFar };
+    if (VSCP_ERROR_SUCCESS != droplet_mesh_init(&pnode->mesh, pnode->addr, &meshConfig)) {
+      fprintf(stderr, "Failed to initialize mesh for node %u\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (uint16_t i = 0; i < s_cfg.nNodes; i++) {
+    sim_node_t *pnode = &s_nodes[i];
+    pnode->links      = calloc(s_cfg.nNodes, sizeof(sim_link_t));
+    for (uint16_t j = 0; j < s_cfg.nNodes; j++) {
+      double d = hypot(pnode->x - s_nodes[j].x, pnode->y - s_nodes[j].y);
+      if ((i == j) || (d > s_cfg.range)) {
+        continue;
+      }
+      double loss = s_cfg.loss + s_cfg.edgeLoss * (d / s_cfg.range) * (d / s_cfg.range);
+      double rssi = SIM_RSSI_EDGE_DBM + 10 * SIM_PATHLOSS_EXP * log10(s_cfg.range / ((d < 1.0) ? 1.0 : d));
+      pnode->links[pnode->nLinks].dst  = j;
+      pnode->links[pnode->nLinks].loss = (float) ((loss > 1.0) ? 1.0 : loss);
+      pnode->links[pnode->nLinks].rssi = (int8_t) ((rssi > -1) ? -1 : lround(rssi));
+      pnode->nLinks++;
+    }
+    s_tot.nLinks += pnode->nLinks;
+  }
+
+  // Hop diameter and unconnected pairs (BFS from every node)
+  uint16_t *dist  = malloc(s_cfg.nNodes * sizeof(uint16_t));
+  uint16_t *queue = malloc(s_cfg.nNodes * sizeof(uint16_t));
+  for (uint16_t i = 0; i < s_cfg.nNodes; i++) {
+    memset(dist, 0xff, s_cfg.nNodes * sizeof(uint16_t));
+    size_t head = 0, tail = 0;
+    dist[i]       = 0;
+    queue[tail++] = i;
+    while (head < tail) {
+      uint16_t n = queue[head++];
+      for (uint16_t l = 0; l < s_nodes[n].nLinks; l++) {
+        uint16_t m = s_nodes[n].links[l].dst;
+        if (0xffff == dist[m]) {
+          dist[m]       = dist[n] + 1;
+          queue[tail++] = m;
+          if (dist[m] > s_tot.diameter) {
+            s_tot.diameter = dist[m];
+          }
+        }
+      }
+    }
+    s_tot.nUnconnected += s_cfg.nNodes - (uint32_t) tail;
+  }
+  free(dist);
+  free(queue);
+}
+
+// ----------------------------------------------------------------------------
+//                                  Radio
+// ----------------------------------------------------------------------------
+
+static uint64_t
+airtime(uint16_t len)
+{
+  return SIM_PHY_OVERHEAD_US + ((uint64_t) (len + SIM_MAC_OVERHEAD) * 8 * 1000) / s_cfg.bitrate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// enqueue_tx
+//
+
+static void
+enqueue_tx(uint16_t node, sim_frame_t *pframe)
+{
+  sim_node_t *pnode = &s_nodes[node];
+
+  pframe->next = NULL;
+  if (NULL == pnode->txTail) {
+    pnode->txHead = pframe;
+  }
+  else {
+    pnode->txTail->next = pframe;
+  }
+  pnode->txTail = pframe;
+
+  if (!pnode->bTransmitting && !pnode->bAttemptPending) {
+    pnode->bAttemptPending = true;
+    schedule(s_now + SIM_DIFS_US + (rnd() % (SIM_CW_MIN + 1)) * SIM_SLOT_US, EV_TX_ATTEMPT, node, NULL);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tx_attempt
+//
+// CSMA. Back off if we hear someone, else start sending the frame at
+// the head of the queue. Receptions at neighbours that overlap another
+// reception or their own transmission are lost.
+//
+
+static void
+tx_attempt(uint16_t node)
+{
+  sim_node_t *pnode = &s_nodes[node];
+
+  pnode->bAttemptPending = false;
+  if (pnode->bTransmitting || (NULL == pnode->txHead)) {
+    return;
+  }
+
+  if (!s_cfg.bIdeal && pnode->nActiveRx) {
+    pnode->bAttemptPending = true;
+    schedule(s_now + SIM_DIFS_US + (rnd() % (SIM_CW_MIN + 1)) * SIM_SLOT_US, EV_TX_ATTEMPT, node, NULL);
+    return;
+  }
+
+  sim_frame_t *pframe = pnode->txHead;
+  pnode->txHead       = pframe->next;
+  if (NULL == pnode->txHead) {
+    pnode->txTail = NULL;
+  }
+
+  sim_tx_t *ptx = calloc(1, sizeof(sim_tx_t));
+  ptx->src      = node;
+  ptx->frame    = pframe;
+  ptx->epoch    = calloc(pnode->nLinks ? pnode->nLinks : 1, sizeof(uint32_t));
+  ptx->bCorrupt = calloc(pnode->nLinks ? pnode->nLinks : 1, sizeof(bool));
+
+  // Half duplex, we can't receive while sending
+  pnode->bTransmitting = true;
+  pnode->rxEpoch++;
+
+  for (uint16_t l = 0; l < pnode->nLinks; l++) {
+    sim_node_t *prx = &s_nodes[pnode->links[l].dst];
+    if (prx->bTransmitting || prx->nActiveRx) {
+      ptx->bCorrupt[l] = !s_cfg.bIdeal;
+      if (!s_cfg.bIdeal) {
+        prx->rxEpoch++;
+      }
+    }
+    prx->nActiveRx++;
+    ptx->epoch[l] = prx->rxEpoch;
+  }
+
+  uint64_t t = airtime(pframe->len);
+  s_tot.airtime += t;
+  s_tot.nTx++;
+  s_events[pframe->event].nTx++;
+
+  schedule(s_now + t, EV_TX_END, node, ptx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// tx_end
+//
+
+static void
+tx_end(sim_tx_t *ptx)
+{
+  sim_node_t *pnode = &s_nodes[ptx->src];
+
+  pnode->bTransmitting = false;
+
+  for (uint16_t l = 0; l < pnode->nLinks; l++) {
+    uint16_t dst     = pnode->links[l].dst;
+    sim_node_t *prx  = &s_nodes[dst];
+    prx->nActiveRx--;
+
+    if (!s_cfg.bIdeal && (ptx->bCorrupt[l] || (ptx->epoch[l] != prx->rxEpoch))) {
+      s_tot.nRxCollided++;
+      continue;
+    }
+
+    if (rnd_uniform() < pnode->links[l].loss) {
+      s_tot.nRxLost++;
+      continue;
+    }
+
+    s_tot.nRxOk++;
+    sim_frame_t *pcopy = malloc(sizeof(sim_frame_t));
+    memcpy(pcopy, ptx->frame, sizeof(sim_frame_t));
+    pcopy->rssi = pnode->links[l].rssi;
+    schedule(s_now + s_cfg.procDelay, EV_PROCESS, dst, pcopy);
+  }
+
+  if (NULL != pnode->txHead && !pnode->bAttemptPending) {
+    pnode->bAttemptPending = true;
+    schedule(s_now + SIM_DIFS_US + (rnd() % (SIM_CW_MIN + 1)) * SIM_SLOT_US, EV_TX_ATTEMPT, ptx->src, NULL);
+  }
+
+  free(ptx->frame);
+  free(ptx->epoch);
+  free(ptx->bCorrupt);
+  free(ptx);
+}
+
+// ----------------------------------------------------------------------------
+//                                  Nodes
+// ----------------------------------------------------------------------------
+
+///////////////////////////////////////////////////////////////////////////////
+// originate
+//
+// Build a frame the way droplet_sendEvent does and queue it
+//
+
+static void
+originate(uint16_t node, uint32_t event)
+{
+  uint8_t data[DROPLET_MAX_DATA] = { 0 };
+  vscpEvent ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.vscp_class = 10; // CLASS1.MEASUREMENT
+  ev.vscp_type  = 6;  // Temperature
+  ev.sizeData   = s_cfg.sizeData;
+  ev.pdata      = data;
+
+  sim_frame_t *pframe = calloc(1, sizeof(sim_frame_t));
+  pframe->event       = event;
+  pframe->len         = DROPLET_MIN_FRAME + s_cfg.sizeData;
+  if (VSCP_ERROR_SUCCESS != droplet_evToFrame(pframe->data, pframe->len, &ev)) {
+    fprintf(stderr, "Failed to build frame\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pframe->data[DROPLET_POS_TTL]       = s_cfg.ttl;
+  pframe->data[DROPLET_POS_MAGIC]     = rnd() & 0xff;
+  pframe->data[DROPLET_POS_MAGIC + 1] = rnd() & 0xff;
+
+  // Encrypted frames are padded to the block size and carry the IV
+  if (s_cfg.bEncrypt) {
+    pframe->len = ((pframe->len + 15) & ~15) + DROPLET_IV_LEN;
+  }
+
+  droplet_mesh_remember(&s_nodes[node].mesh, pframe->data, pframe->len, (uint32_t) (s_now / 1000));
+
+  s_events[event].src   = node;
+  s_events[event].start = s_now;
+  s_delivered[(size_t) event * s_cfg.nNodes + node]++;
+
+  enqueue_tx(node, pframe);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// process
+//
+// A frame has been received and handled by the node
+//
+
+static void
+process(uint16_t node, sim_frame_t *pframe)
+{
+  sim_node_t *pnode          = &s_nodes[node];
+  sim_stat_event_t *pevstat  = &s_events[pframe->event];
+  uint8_t *pdelivered        = &s_delivered[(size_t) pframe->event * s_cfg.nNodes + node];
+  static const uint8_t bc[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+  // Tag of a free held forward entry
+  uint16_t tag = 0;
+  while ((tag < pnode->sizeHeld) && (NULL != pnode->held[tag])) {
+    tag++;
+  }
+  if (tag == pnode->sizeHeld) {
+    pnode->sizeHeld = pnode->sizeHeld ? 2 * pnode->sizeHeld : 8;
+    pnode->held     = realloc(pnode->held, pnode->sizeHeld * sizeof(sim_frame_t *));
+    memset(pnode->held + tag, 0, (pnode->sizeHeld - tag) * sizeof(sim_frame_t *));
+  }
+
+  droplet_mesh_sched_t sched = { .tag = tag + 1 };
+  uint32_t now               = (uint32_t) (s_now / 1000);
+
+  int flags = droplet_mesh_process(&pnode->mesh, pframe->data, pframe->len, bc, pframe->rssi, now, &sched);
+
+  // The hold event can't be taken off the heap so the frame is marked
+  if (flags & DROPLET_MESH_CANCEL) {
+    pnode->held[sched.cancel - 1]->bCancelled = true;
+    pnode->held[sched.cancel - 1]             = NULL;
+  }
+
+  if (flags & DROPLET_MESH_DUPLICATE) {
+    s_tot.nDupRx++;
+    if (!*pdelivered) {
+      s_tot.nFalseDrop++; // Other frame taken for this one
+    }
+    free(pframe);
+    return;
+  }
+
+  if (*pdelivered) {
+    s_tot.nDupDeliver++; // Evicted or expired from cache
+  }
+  else {
+    uint64_t latency = s_now - pevstat->start;
+    pevstat->nDelivered++;
+    pevstat->latencySum += latency;
+    if (latency > pevstat->latencyMax) {
+      pevstat->latencyMax = latency;
+    }
+    s_latencies[s_cntLatencies++] = latency;
+  }
+  if (*pdelivered < 0xff) {
+    (*pdelivered)++;
+  }
+
+  if (flags & DROPLET_MESH_FORWARD) {
+    s_tot.nForward++;
+    enqueue_tx(node, pframe);
+  }
+  else if (flags & DROPLET_MESH_DEFER) {
+    pframe->bCancelled         = false;
+    pnode->held[sched.tag - 1] = pframe;
+    schedule(s_now + (uint64_t) sched.delay * 1000, EV_FORWARD, node, pframe);
+  }
+  else {
+    free(pframe);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// forward
+//
+// Backoff or jitter for a held forward is over
+//
+
+static void
+forward(uint16_t node, sim_frame_t *pframe)
+{
+  sim_node_t *pnode = &s_nodes[node];
+
+  if (pframe->bCancelled) {
+    free(pframe);
+    return;
+  }
+
+  for (uint16_t i = 0; i < pnode->sizeHeld; i++) {
+    if (pnode->held[i] == pframe) {
+      pnode->held[i] = NULL;
+      break;
+    }
+  }
+
+  if (droplet_mesh_forward_check(&pnode->mesh, pframe->data, pframe->len, (uint32_t) (s_now / 1000))) {
+    s_tot.nForward++;
+    enqueue_tx(node, pframe);
+  }
+  else {
+    free(pframe);
+  }
+}
+
+// ----------------------------------------------------------------------------
+//                                  Report
+// ----------------------------------------------------------------------------
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// report
+//
+
+static void
+report(void)
+{
+  double sumRatio = 0;
+  double minRatio = 1.0;
+  uint32_t nFull  = 0;
+  uint32_t others = s_cfg.nNodes - 1;
+
+  for (uint32_t e = 0; e < s_cfg.nEvents; e++) {
+    double ratio = others ? (double) s_events[e].nDelivered / others : 1.0;
+    sumRatio += ratio;
+    if (ratio < minRatio) {
+      minRatio = ratio;
+    }
+    if (s_events[e].nDelivered == others) {
+      nFull++;
+    }
+    if (s_cfg.bVerbose) {
+      printf("event %u src %u delivery %.3f tx %u latency avg %.2f max %.2f ms\n",
+             e,
+             s_events[e].src,
+             ratio,
+             s_events[e].nTx,
+             s_events[e].nDelivered ? s_events[e].latencySum / 1000.0 / s_events[e].nDelivered : 0.0,
+             s_events[e].latencyMax / 1000.0);
+    }
+  }
+
+  qsort(s_latencies, s_cntLatencies, sizeof(uint64_t), cmp_u64);
+  double latAvg = 0;
+  for (size_t i = 0; i < s_cntLatencies; i++) {
+    latAvg += s_latencies[i];
+  }
+  latAvg          = s_cntLatencies ? latAvg / s_cntLatencies / 1000.0 : 0;
+  double latP50   = s_cntLatencies ? s_latencies[s_cntLatencies / 2] / 1000.0 : 0;
+  double latP95   = s_cntLatencies ? s_latencies[(s_cntLatencies * 95) / 100] / 1000.0 : 0;
+  double latMax   = s_cntLatencies ? s_latencies[s_cntLatencies - 1] / 1000.0 : 0;
+  double avgRatio = sumRatio / s_cfg.nEvents;
+
+  uint64_t nHits = 0, nEvictions = 0, nCollisions = 0, nSuppressed = 0, nDeferred = 0, nCancelled = 0;
+  for (uint16_t i = 0; i < s_cfg.nNodes; i++) {
+    nHits += s_nodes[i].mesh.nHits;
+    nEvictions += s_nodes[i].mesh.nEvictions;
+    nCollisions += s_nodes[i].mesh.nCollisions;
+    nSuppressed += s_nodes[i].mesh.nFwdSuppressed;
+    nDeferred += s_nodes[i].mesh.nFwdDeferred;
+    nCancelled += s_nodes[i].mesh.nFwdCancelled;
+  }
+  double duration = s_now / 1000.0;
+
+  if (s_cfg.bCsv) {
+    printf("nodes,links,diameter,ttl,cache,forward,strategy,jitter_ms,events,delivery_avg,delivery_min,tx,tx_per_event,"
+           "rx_lost,rx_collided,dup_rx,false_drops,dup_deliveries,cache_hits,cache_evictions,cache_collisions,"
+           "forwarded,fwd_suppressed,fwd_held,fwd_cancelled,airtime_ms,airtime_per_event_ms,"
+           "latency_avg_ms,latency_p50_ms,latency_p95_ms,latency_max_ms\n");
+    printf("%u,%u,%u,%u,%u,%d,%s,%u,%u,%.4f,%.4f,%llu,%.2f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,"
+           "%.2f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           s_cfg.nNodes,
+           s_tot.nLinks / 2,
+           s_tot.diameter,
+           s_cfg.ttl,
+           s_cfg.sizeCache,
+           s_cfg.bForward,
+           s_strategies[s_cfg.fwdStrategy],
+           s_cfg.jitter,
+           s_cfg.nEvents,
+           avgRatio,
+           minRatio,
+           (unsigned long long) s_tot.nTx,
+           (double) s_tot.nTx / s_cfg.nEvents,
+           (unsigned long long) s_tot.nRxLost,
+           (unsigned long long) s_tot.nRxCollided,
+           (unsigned long long) s_tot.nDupRx,
+           (unsigned long long) s_tot.nFalseDrop,
+           (unsigned long long) s_tot.nDupDeliver,
+           (unsigned long long) nHits,
+           (unsigned long long) nEvictions,
+           (unsigned long long) nCollisions,
+           (unsigned long long) s_tot.nForward,
+           (unsigned long long) nSuppressed,
+           (unsigned long long) nDeferred,
+           (unsigned long long) nCancelled,
+           s_tot.airtime / 1000.0,
+           s_tot.airtime / 1000.0 / s_cfg.nEvents,
+           latAvg,
+           latP50,
+           latP95,
+           latMax);
+    return;
+  }
+
+  printf("Topology    nodes %u links %u avg degree %.1f diameter %u hops unconnected pairs %u\n",
+         s_cfg.nNodes,
+         s_tot.nLinks / 2,
+         (double) s_tot.nLinks / s_cfg.nNodes,
+         s_tot.diameter,
+         s_tot.nUnconnected / 2);
+  printf("Droplet     ttl %u cache %u max age %u ms forward %s jitter %u ms\n",
+         s_cfg.ttl,
+         s_cfg.sizeCache,
+         s_cfg.maxAge,
+         s_cfg.bForward ? "yes" : "no",
+         s_cfg.jitter);
+  printf("Events      %u in %.1f ms\n", s_cfg.nEvents, duration);
+  printf("Delivery    avg %.2f%% min %.2f%% complete %u/%u\n", avgRatio * 100, minRatio * 100, nFull, s_cfg.nEvents);
+  printf("Transmit    %llu frames %.1f per event\n", (unsigned long long) s_tot.nTx, (double) s_tot.nTx / s_cfg.nEvents);
+  printf("Receive     ok %llu lost %llu collided %llu\n",
+         (unsigned long long) s_tot.nRxOk,
+         (unsigned long long) s_tot.nRxLost,
+         (unsigned long long) s_tot.nRxCollided);
+  printf("Duplicates  filtered %llu false drops %llu delivered twice %llu\n",
+         (unsigned long long) s_tot.nDupRx,
+         (unsigned long long) s_tot.nFalseDrop,
+         (unsigned long long) s_tot.nDupDeliver);
+  printf("Cache       hits %llu evictions %llu collisions %llu\n",
+         (unsigned long long) nHits,
+         (unsigned long long) nEvictions,
+         (unsigned long long) nCollisions);
+  printf("Forwarding  %s forwarded %llu suppressed %llu held %llu cancelled %llu\n",
+         s_strategies[s_cfg.fwdStrategy],
+         (unsigned long long) s_tot.nForward,
+         (unsigned long long) nSuppressed,
+         (unsigned long long) nDeferred,
+         (unsigned long long) nCancelled);
+  // Load can exceed one as nodes out of range of each other send at the same time
+  printf("Airtime     %.1f ms total %.2f ms per event load %.2f\n",
+         s_tot.airtime / 1000.0,
+         s_tot.airtime / 1000.0 / s_cfg.nEvents,
+         duration ? (s_tot.airtime / 1000.0) / duration : 0.0);
+  printf("Latency     avg %.2f p50 %.2f p95 %.2f max %.2f ms\n", latAvg, latP50, latP95, latMax);
+}
+
+// ----------------------------------------------------------------------------
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n, --nodes N         Number of nodes (default 25)\n"
+          "  -T, --topology T      grid, line or random (default grid)\n"
+          "  -d, --spacing M       Distance between nodes for grid/line (default 10 m)\n"
+          "  -a, --area M          Side of square for random topology (default 100 m)\n"
+          "  -r, --range M         Radio range (default 15 m)\n"
+          "  -l, --loss P          Frame loss probability on every link (default 0.05)\n"
+          "  -L, --edge-loss P     Extra loss at the edge of range (default 0.2)\n"
+          "  -b, --bitrate KBPS    PHY bitrate (default 1000)\n"
+          "  -t, --ttl N           Time to live for originated frames (default 7)\n"
+          "  -c, --cache N         Duplicate filter entries (default %d)\n"
+          "  -A, --max-age MS      Duplicate filter entry lifetime (default %d ms)\n"
+          "  -F, --no-forward      Disable forwarding\n"
+          "  -S, --strategy S      Forwarding strategy flood, gossip, counter or rssi (default flood)\n"
+          "  -g, --gossip-prob P   Gossip forward probability in percent (default %d)\n"
+          "  -k, --counter N       Copies heard while a forward is held that cancel it (default %d)\n"
+          "  -B, --backoff MS      Max forward backoff for counter and rssi (default %d ms)\n"
+          "  -J, --jitter MS       Max forward jitter for flood and gossip, 0 is none (default %d ms)\n"
+          "  -N, --rssi-near DBM   Senders at or above this level are not forwarded (default %d)\n"
+          "  -R, --rssi-far DBM    Senders at or below this level get the shortest backoff (default %d)\n"
+          "  -e, --events N        Number of events to originate (default 100)\n"
+          "  -i, --interval MS     Time between originated events (default 100 ms)\n"
+          "  -s, --size N          VSCP data size (default 8)\n"
+          "  -E, --encrypt         Size frames as AES encrypted\n"
+          "  -p, --proc-delay US   Receive processing time per hop (default 1000 us)\n"
+          "  -I, --ideal           No collisions (loss only)\n"
+          "  -x, --seed N          Random seed (default 1)\n"
+          "  -v, --verbose         Print a line per event\n"
+          "  -C, --csv             Print result as CSV\n",
+          name,
+          DROPLET_MSG_CACHE_SIZE,
+          DROPLET_MSG_CACHE_MAX_AGE,
+          DROPLET_FWD_GOSSIP_PROB,
+          DROPLET_FWD_COUNTER_MAX,
+          DROPLET_FWD_BACKOFF,
+          DROPLET_FWD_JITTER,
+          DROPLET_FWD_RSSI_NEAR,
+          DROPLET_FWD_RSSI_FAR);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  static const struct option longopts[] = {
+    { "nodes", required_argument, NULL, 'n' },   { "topology", required_argument, NULL, 'T' },
+    { "spacing", required_argument, NULL, 'd' }, { "area", required_argument, NULL, 'a' },
+    { "range", required_argument, NULL, 'r' },   { "loss", required_argument, NULL, 'l' },
+    { "edge-loss", required_argument, NULL, 'L' }, { "bitrate", required_argument, NULL, 'b' },
+    { "ttl", required_argument, NULL, 't' },     { "cache", required_argument, NULL, 'c' },
+    { "max-age", required_argument, NULL, 'A' },
+    { "no-forward", no_argument, NULL, 'F' },    { "strategy", required_argument, NULL, 'S' },
+    { "gossip-prob", required_argument, NULL, 'g' }, { "counter", required_argument, NULL, 'k' },
+    { "backoff", required_argument, NULL, 'B' }, { "jitter", required_argument, NULL, 'J' },
+    { "rssi-near", required_argument, NULL, 'N' },
+    { "rssi-far", required_argument, NULL, 'R' }, { "events", required_argument, NULL, 'e' },
+    { "interval", required_argument, NULL, 'i' }, { "size", required_argument, NULL, 's' },
+    { "encrypt", no_argument, NULL, 'E' },       { "proc-delay", required_argument, NULL, 'p' },
+    { "ideal", no_argument, NULL, 'I' },         { "seed", required_argument, NULL, 'x' },
+    { "verbose", no_argument, NULL, 'v' },       { "csv", no_argument, NULL, 'C' },
+    { "help", no_argument, NULL, 'h' },          { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  const char *shortopts = "n:T:d:a:r:l:L:b:t:c:A:FS:g:k:B:J:N:R:e:i:s:Ep:Ix:vCh";
+  while (-1 != (opt = getopt_long(argc, argv, shortopts, longopts, NULL))) {
+    switch (opt) {
+      case 'n':
+        s_cfg.nNodes = (uint16_t) atoi(optarg);
+        break;
+      case 'T':
+        if (!strcmp(optarg, "grid")) {
+          s_cfg.topology = TOPO_GRID;
+        }
+        else if (!strcmp(optarg, "line")) {
+          s_cfg.topology = TOPO_LINE;
+        }
+        else if (!strcmp(optarg, "random")) {
+          s_cfg.topology = TOPO_RANDOM;
+        }
+        else {
+          fprintf(stderr, "Unknown topology %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'd':
+        s_cfg.spacing = atof(optarg);
+        break;
+      case 'a':
+        s_cfg.area = atof(optarg);
+        break;
+      case 'r':
+        s_cfg.range = atof(optarg);
+        break;
+      case 'l':
+        s_cfg.loss = atof(optarg);
+        break;
+      case 'L':
+        s_cfg.edgeLoss = atof(optarg);
+        break;
+      case 'b':
+        s_cfg.bitrate = (uint32_t) atoi(optarg);
+        break;
+      case 't':
+        s_cfg.ttl = (uint8_t) atoi(optarg);
+        break;
+      case 'c':
+        s_cfg.sizeCache = (uint16_t) atoi(optarg);
+        break;
+      case 'A':
+        s_cfg.maxAge = (uint32_t) atoi(optarg);
+        break;
+      case 'F':
+        s_cfg.bForward = false;
+        break;
+      case 'S': {
+        int i;
+        for (i = 0; i < (int) (sizeof(s_strategies) / sizeof(s_strategies[0])); i++) {
+          if (!strcmp(optarg, s_strategies[i])) {
+            break;
+          }
+        }
+        if (i == (int) (sizeof(s_strategies) / sizeof(s_strategies[0]))) {
+          fprintf(stderr, "Unknown forwarding strategy %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        s_cfg.fwdStrategy = (droplet_fwd_strategy_t) i;
+      } break;
+      case 'g':
+        s_cfg.gossipProb = (uint8_t) atoi(optarg);
+        break;
+      case 'k':
+        s_cfg.counterMax = (uint8_t) atoi(optarg);
+        break;
+      case 'B':
+        s_cfg.backoff = (uint16_t) atoi(optarg);
+        break;
+      case 'J':
+        s_cfg.jitter = (uint16_t) atoi(optarg);
+        break;
+      case 'N':
+        s_cfg.rssiNear = (int8_t) atoi(optarg);
+        break;
+      case 'R':
+        s_cfg.rssiFar = (int8_t) atoi(optarg);
+        break;
+      case 'e':
+        s_cfg.nEvents = (uint32_t) atoi(optarg);
+        break;
+      case 'i':
+        s_cfg.interval = (uint32_t) (atof(optarg) * 1000);
+        break;
+      case 's':
+        s_cfg.sizeData = (uint8_t) atoi(optarg);
+        break;
+      case 'E':
+        s_cfg.bEncrypt = true;
+        break;
+      case 'p':
+        s_cfg.procDelay = (uint32_t) atoi(optarg);
+        break;
+      case 'I':
+        s_cfg.bIdeal = true;
+        break;
+      case 'x':
+        s_cfg.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'v':
+        s_cfg.bVerbose = true;
+        break;
+      case 'C':
+        s_cfg.bCsv = true;
+        break;
+      case 'h':
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ((s_cfg.nNodes < 2) || !s_cfg.nEvents || !s_cfg.sizeCache || !s_cfg.maxAge || !s_cfg.bitrate ||
+      (s_cfg.sizeData > DROPLET_MAX_DATA) || (s_cfg.range <= 0) || (s_cfg.gossipProb > 100)) {
+    fprintf(stderr, "Invalid parameters\n");
+    return EXIT_FAILURE;
+  }
+
+  esp_log_level_set("*", ESP_LOG_ERROR);
+
+  s_rng       = s_cfg.seed ? s_cfg.seed : 1;
+  s_nodes     = calloc(s_cfg.nNodes, sizeof(sim_node_t));
+  s_events    = calloc(s_cfg.nEvents, sizeof(sim_stat_event_t));
+  s_delivered = calloc((size_t) s_cfg.nEvents * s_cfg.nNodes, 1);
+  s_latencies = calloc((size_t) s_cfg.nEvents * s_cfg.nNodes, sizeof(uint64_t));
+  if ((NULL == s_nodes) || (NULL == s_events) || (NULL == s_delivered) || (NULL == s_latencies)) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  build_topology();
+
+  // Events are originated at random nodes
+  for (uint32_t e = 0; e < s_cfg.nEvents; e++) {
+    schedule((uint64_t) e * s_cfg.interval, EV_ORIGINATE, rnd() % s_cfg.nNodes, (void *) (uintptr_t) e);
+  }
+
+  sim_event_t ev;
+  while (next_event(&ev)) {
+    s_now = ev.time;
+    switch (ev.type) {
+      case EV_ORIGINATE:
+        originate(ev.node, (uint32_t) (uintptr_t) ev.p);
+        break;
+      case EV_TX_ATTEMPT:
+        tx_attempt(ev.node);
+        break;
+      case EV_TX_END:
+        tx_end((sim_tx_t *) ev.p);
+        break;
+      case EV_PROCESS:
+        process(ev.node, (sim_frame_t *) ev.p);
+        break;
+      case EV_FORWARD:
+        forward(ev.node, (sim_frame_t *) ev.p);
+        break;
+    }
+  }
+
+  report();
+
+  for (uint16_t i = 0; i < s_cfg.nNodes; i++) {
+    droplet_mesh_deinit(&s_nodes[i].mesh);
+    free(s_nodes[i].links);
+    free(s_nodes[i].held);
+  }
+  free(s_nodes);
+  free(s_events);
+  free(s_delivered);
+  free(s_latencies);
+  free(s_heap);
+
+  return EXIT_SUCCESS;
+}
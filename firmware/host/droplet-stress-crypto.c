@@ -0,0 +1,406 @@
+/**
+ * @brief           Encrypted frame round trip test
+ * @file            droplet-stress-crypto.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Sends events of every size, as single event frames and through the
+ * fragment builder (droplet-frag.c), through the encryption
+ * (droplet-crypto.c) and back through decryption, reassembly and
+ * parsing, as the send and receive paths of the stack do, for all key
+ * sizes and both header layouts. Checks that every frame can be
+ * encrypted, fits on air, passes the receive length check and that the
+ * event comes back unchanged.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+
+#include <vscp.h>
+
+#include "droplet-crypto.h"
+#include "droplet-frag.h"
+#include "vscp-droplet.h"
+
+// Source address of the frames
+static const uint8_t s_src[DROPLET_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+static droplet_crypto_key_t s_key;
+static droplet_frag_t s_frag;
+
+static long s_nErrors;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -d size    VSCP data size to check, can be repeated (default 0 to %d)\n"
+          "  -r rounds  Events per size and layout (default 8)\n"
+          "  -s seed    Random seed for event data (default 1)\n"
+          "  -h         This help\n",
+          name,
+          DROPLET_MAX_FRAG_DATA);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fail
+//
+
+static void
+fail(const char *what, uint8_t alg, uint8_t version, int sizeData)
+{
+  if (s_nErrors++ < 10) {
+    fprintf(stderr, "%s: AES-%d version %d data %d\n", what, 64 + 64 * alg, version, sizeData);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// air_frame
+//
+// Encrypt a frame as droplet_tx_enqueue does and decrypt it as the
+// receive task does. Returns the decrypted length or zero on error.
+//
+
+static size_t
+air_frame(uint8_t *rx, const uint8_t *frame, size_t len, uint8_t alg, uint8_t version, int sizeData, size_t *pAirLen)
+{
+  uint8_t tx[DROPLET_AGG_MAX_FRAME];
+  size_t n;
+
+  memcpy(tx, frame, len);
+  tx[DROPLET_POS_PKT_TYPE] = (tx[DROPLET_POS_PKT_TYPE] & 0xf0) | alg;
+
+  if (0 == (n = droplet_crypto_encrypt_key(rx, tx, len, &s_key, NULL, alg))) {
+    fail("encrypt", alg, version, sizeData);
+    return 0;
+  }
+  *pAirLen = n;
+
+  if ((n < DROPLET_COMPACT_MIN_FRAME) || (n > DROPLET_MAX_ENCRYPTED_FRAME)) {
+    fail("frame length on air", alg, version, sizeData);
+    return 0;
+  }
+
+  if (0 == (n = droplet_crypto_decrypt_key(rx, n, &s_key, alg))) {
+    fail("decrypt", alg, version, sizeData);
+    return 0;
+  }
+
+  // Padding is zeros and never more than a block
+  if ((n < len) || (n >= (len + 16)) || memcmp(rx, tx, len)) {
+    fail("decrypted frame differs", alg, version, sizeData);
+    return 0;
+  }
+
+  return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// random_event
+//
+// Header fields that change the length of the compact header are
+// picked at random, half of the events get the shortest header.
+//
+
+static void
+random_event(vscpEvent *pev, uint8_t *data, int sizeData)
+{
+  for (int i = 0; i < sizeData; i++) {
+    data[i] = (uint8_t) rand();
+  }
+
+  memset(pev, 0, sizeof(vscpEvent));
+  pev->vscp_class = 20; // CLASS1.INFORMATION
+  pev->vscp_type  = 9;  // VSCP_TYPE_INFORMATION_ON
+  pev->sizeData   = sizeData;
+  pev->pdata      = data;
+
+  if (rand() & 1) {
+    pev->head       = (uint16_t) rand();
+    pev->vscp_class = (uint16_t) (rand() % 1100);
+    pev->vscp_type  = (uint16_t) (rand() % 300);
+    pev->GUID[14]   = (rand() & 1) ? (uint8_t) rand() : 0;
+    pev->GUID[15]   = (uint8_t) rand();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// same_event
+//
+
+static bool
+same_event(const vscpEvent *pev, const vscpEvent *pevrx)
+{
+  return (pevrx->head == pev->head) && (pevrx->vscp_class == pev->vscp_class) &&
+         (pevrx->vscp_type == pev->vscp_type) && (pevrx->GUID[14] == pev->GUID[14]) &&
+         (pevrx->GUID[15] == pev->GUID[15]) && (pevrx->sizeData == pev->sizeData) &&
+         !memcmp(pevrx->pdata, pev->pdata, pev->sizeData);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// check_single
+//
+// Send one event in a single event frame, built as droplet_evToFrame
+// does, and parse it again. Also checks that the frame cut short is
+// refused. Returns the number of frames.
+//
+
+static int
+check_single(uint8_t alg, uint8_t version, int sizeData, size_t *pMin, size_t *pMinAir)
+{
+  uint8_t data[DROPLET_MAX_DATA];
+  uint8_t frame[DROPLET_MAX_FRAME];
+  uint8_t rx[DROPLET_MAX_FRAME + DROPLET_CRYPTO_HEADROOM];
+  vscpEvent ev, evrx;
+  size_t n, len, clearLen, airLen, sizeFixed;
+
+  random_event(&ev, data, sizeData);
+
+  // The compact header is only used if it is shorter
+  sizeFixed = DROPLET_MIN_FRAME - DROPLET_POS_HEAD + sizeData;
+  memset(frame, 0, sizeof(frame));
+  n = droplet_buildVscp(frame + DROPLET_POS_HEAD, sizeof(frame) - DROPLET_POS_HEAD, &ev, version);
+  if ((DROPLET_VERSION_COMPACT == version) && (!n || (n >= sizeFixed))) {
+    memset(frame, 0, sizeof(frame));
+    version = DROPLET_VERSION;
+    n       = droplet_buildVscp(frame + DROPLET_POS_HEAD, sizeof(frame) - DROPLET_POS_HEAD, &ev, version);
+  }
+  if (0 == n) {
+    fail("frame", alg, version, sizeData);
+    return 0;
+  }
+  frame[DROPLET_POS_ID]       = DROPLET_ID_MSB;
+  frame[DROPLET_POS_ID + 1]   = DROPLET_ID_LSB + version;
+  frame[DROPLET_POS_PKT_TYPE] = DROPLET_BETA_NODE << 4;
+
+  clearLen = DROPLET_POS_HEAD + n;
+  *pMin    = MIN(*pMin, clearLen);
+
+  if (0 == (len = air_frame(rx, frame, clearLen, alg, version, sizeData, &airLen))) {
+    return 0;
+  }
+  *pMinAir = MIN(*pMinAir, airLen);
+
+  if (VSCP_ERROR_SUCCESS != droplet_frameToEvView(&evrx, rx, (uint8_t) len, 1)) {
+    fail("event", alg, version, sizeData);
+  }
+  else if (!same_event(&ev, &evrx)) {
+    fail("event differs", alg, version, sizeData);
+  }
+
+  // A frame cut short inside the data is refused, not read short
+  if (sizeData && (VSCP_ERROR_SUCCESS == droplet_frameToEvView(&evrx, frame, (uint8_t) (clearLen - 1), 1))) {
+    fail("cut frame accepted", alg, version, sizeData);
+  }
+
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// check_fragmented
+//
+// Send one event as fragments and reassemble it. Returns the number of
+// fragments. The shortest fragment frame, in clear and on air, is kept
+// in *pMin and *pMinAir.
+//
+
+static int
+check_fragmented(uint8_t alg, uint8_t version, int sizeData, size_t *pMin, size_t *pMinAir)
+{
+  static uint8_t msg[DROPLET_FRAG_MAX_MSG];
+  uint8_t data[DROPLET_MAX_FRAG_DATA];
+  uint8_t frame[DROPLET_AGG_MAX_FRAME];
+  uint8_t rx[DROPLET_AGG_MAX_FRAME + DROPLET_CRYPTO_HEADROOM];
+  droplet_frag_entry_t *pentry = NULL;
+  vscpEvent ev, evrx;
+  size_t msglen, len, airLen;
+  uint16_t msgid;
+  uint8_t count;
+  int rv = DROPLET_FRAG_MORE;
+
+  // Drop what is left of an event that failed
+  droplet_frag_expire(&s_frag, UINT32_MAX);
+
+  random_event(&ev, data, sizeData);
+
+  if (0 == (msglen = droplet_frag_message(msg, sizeof(msg), &ev, version))) {
+    fail("message", alg, version, sizeData);
+    return 0;
+  }
+
+  esp_fill_random(&msgid, sizeof(msgid));
+  count = droplet_frag_count(msglen);
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (0 == (len = droplet_frag_build(frame, msg, msglen, msgid, i, DROPLET_BETA_NODE, version))) {
+      fail("fragment", alg, version, sizeData);
+      return 0;
+    }
+    *pMin = MIN(*pMin, len);
+
+    if (0 == (len = air_frame(rx, frame, len, alg, version, sizeData, &airLen))) {
+      return 0;
+    }
+    *pMinAir = MIN(*pMinAir, airLen);
+
+    rv = droplet_frag_add(&s_frag, s_src, rx, len, 0, &pentry);
+    if (((i < count - 1) && (DROPLET_FRAG_MORE != rv)) || ((i == count - 1) && (DROPLET_FRAG_DONE != rv))) {
+      fail("reassembly", alg, version, sizeData);
+      return 0;
+    }
+  }
+
+  if (VSCP_ERROR_SUCCESS != droplet_frag_event(&evrx, pentry, 1)) {
+    fail("event", alg, version, sizeData);
+  }
+  else if (!same_event(&ev, &evrx)) {
+    fail("event differs", alg, version, sizeData);
+  }
+
+  droplet_frag_release(&s_frag, pentry);
+
+  return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  int sizes[DROPLET_MAX_FRAG_DATA + 1];
+  int nSizes    = 0;
+  long nRounds  = 8;
+  unsigned seed = 1;
+  uint8_t key[DROPLET_KEY_LEN];
+
+  while (-1 != (opt = getopt(argc, argv, "d:r:s:h"))) {
+    switch (opt) {
+      case 'd':
+        if (nSizes <= DROPLET_MAX_FRAG_DATA) {
+          sizes[nSizes] = atoi(optarg);
+          if ((sizes[nSizes] < 0) || (sizes[nSizes] > DROPLET_MAX_FRAG_DATA)) {
+            fprintf(stderr, "Data size must be 0 to %d\n", DROPLET_MAX_FRAG_DATA);
+            return EXIT_FAILURE;
+          }
+          nSizes++;
+        }
+        break;
+      case 'r':
+        nRounds = atol(optarg);
+        break;
+      case 's':
+        seed = (unsigned) atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  // Every size. Compact frames with up to three bytes of data and the
+  // last fragment of 211 to 213 bytes (fixed header) are shorter than a
+  // fixed single event frame.
+  if (!nSizes) {
+    for (int i = 0; i <= DROPLET_MAX_FRAG_DATA; i++) {
+      sizes[nSizes++] = i;
+    }
+  }
+
+  if (nRounds <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  srand(seed);
+  esp_log_level_set("*", ESP_LOG_NONE); // Refused frames are expected
+  esp_fill_random(key, sizeof(key));
+  if ((VSCP_ERROR_SUCCESS != droplet_crypto_key_init(&s_key, key)) ||
+      (VSCP_ERROR_SUCCESS != droplet_frag_init(&s_frag, 1, 1000))) {
+    fprintf(stderr, "Failed to initialize\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("key     layout   events   frames  shortest  on air\n");
+
+  for (uint8_t alg = VSCP_ENCRYPTION_AES128; alg <= VSCP_ENCRYPTION_AES256; alg++) {
+    for (uint8_t version = DROPLET_VERSION; version <= DROPLET_VERSION_COMPACT; version++) {
+      long nFrames  = 0;
+      size_t minLen = SIZE_MAX, minAir = SIZE_MAX;
+      for (int i = 0; i < nSizes; i++) {
+        for (long r = 0; r < nRounds; r++) {
+          if (sizes[i] > DROPLET_MAX_DATA) {
+            nFrames += check_fragmented(alg, version, sizes[i], &minLen, &minAir);
+          }
+          else {
+            nFrames += check_single(alg, version, sizes[i], &minLen, &minAir);
+          }
+        }
+      }
+      printf("AES-%d %-7s %8ld %8ld %9zu %7zu\n",
+             64 + 64 * alg,
+             (DROPLET_VERSION == version) ? "fixed" : "compact",
+             nSizes * nRounds,
+             nFrames,
+             minLen,
+             minAir);
+    }
+  }
+
+  droplet_frag_deinit(&s_frag);
+  droplet_crypto_key_free(&s_key);
+
+  printf("%s (%ld errors)\n", s_nErrors ? "FAILED" : "OK", s_nErrors);
+
+  return s_nErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+/**
+ * @brief           Node configuration blob round trip test
+ * @file            droplet-stress-nodecfg.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Runs the configuration blob of the gateway (alpha5/main/nodecfg.c)
+ * through random configurations. Checks that a configuration comes
+ * back unchanged, that a damaged or cut short blob is never used,
+ * that a blob with a shorter image (older firmware) leaves the new
+ * fields at their defaults, that a blob with a longer image (newer
+ * firmware) is read, that a version 1 blob (the struct image) is
+ * converted and that an unknown version is refused. Reports the time
+ * to pack and unpack a blob.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vscp.h>
+
+#include "nodecfg.h"
+
+// Header layout as in nodecfg.c
+#define HDR_VERSION 4
+#define HDR_LENGTH  6
+#define HDR_CRC     8
+
+// Version 1 blobs hold the struct image up to the certificate buffer
+#define V1_VERSION   1
+#define V1_IMAGE_LEN 1130
+
+#define EXTRA_LEN 64 // Bytes appended by "newer firmware"
+
+#define MAX_FIELD 128 // Longest field in the image
+
+static node_persistent_config_t s_defaults;
+static node_persistent_config_t s_written;
+static node_persistent_config_t s_read;
+
+static uint8_t s_blob[NODECFG_BLOB_LEN + EXTRA_LEN];
+static uint8_t s_work[NODECFG_BLOB_LEN + EXTRA_LEN];
+
+// Images of the written and default configurations and of what was read
+static uint8_t s_imgWritten[NODECFG_BLOB_LEN];
+static uint8_t s_imgDefaults[NODECFG_BLOB_LEN];
+static uint8_t s_imgRead[NODECFG_BLOB_LEN];
+static size_t s_imageLen;
+
+static long s_nErrors;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -r rounds  Rounds (default 20000)\n"
+          "  -s seed    Random seed (default 1)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// fill_random
+//
+
+static void
+fill_random(void *p, size_t len)
+{
+  uint8_t *pb = (uint8_t *) p;
+
+  while (len--) {
+    *pb++ = (uint8_t) rand();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// blob_crc
+//
+// CRC-32 (0xedb88320) bit by bit, independent of the table in crc32.c
+//
+
+static uint32_t
+blob_crc(const uint8_t *blob, uint16_t length)
+{
+  uint32_t crc = 0xffffffff;
+
+  for (size_t i = 0; i < (size_t) (NODECFG_HDR_LEN + length); i++) {
+    if ((i >= HDR_CRC) && (i < NODECFG_HDR_LEN)) {
+      continue;
+    }
+    crc ^= blob[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    }
+  }
+
+  return ~crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// reseal
+//
+// Give a blob a new image length and version and a CRC that matches
+//
+
+static void
+reseal(uint8_t *blob, uint16_t length, uint16_t version)
+{
+  uint32_t crc;
+
+  memcpy(blob + HDR_VERSION, &version, 2);
+  memcpy(blob + HDR_LENGTH, &length, 2);
+  crc = blob_crc(blob, length);
+  memcpy(blob + HDR_CRC, &crc, 4);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// image_of
+//
+// Image this firmware writes for a configuration, after the header
+//
+
+static void
+image_of(uint8_t *image, const node_persistent_config_t *pcfg)
+{
+  uint8_t blob[NODECFG_BLOB_LEN];
+
+  nodecfg_pack(blob, sizeof(blob), pcfg);
+  memcpy(image, blob + NODECFG_HDR_LEN, s_imageLen);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// error
+//
+
+static void
+error(const char *what, const char *why)
+{
+  if (s_nErrors++ < 10) {
+    fprintf(stderr, "%s: %s\n", what, why);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// expect
+//
+// Unpack into a copy of the defaults and check the result code. A
+// refused blob must leave the defaults. Otherwise the image of what was
+// read must be the written image up to a field boundary between lo and
+// hi and the default image after it. Every byte of the written
+// configuration differs from the defaults, so the boundary is where the
+// images part. The boot counter and the certificate buffer are never
+// touched.
+//
+
+static void
+expect(const char *what, const uint8_t *blob, size_t len, int rcExpected, size_t lo, size_t hi)
+{
+  int rc;
+  size_t m = 0;
+
+  memcpy(&s_read, &s_defaults, sizeof(s_read));
+  rc = nodecfg_unpack(&s_read, blob, len);
+
+  if (rc != rcExpected) {
+    char why[32];
+    sprintf(why, "rc=%d expected %d", rc, rcExpected);
+    error(what, why);
+    return;
+  }
+
+  if (VSCP_ERROR_SUCCESS != rc) {
+    if (memcmp(&s_read, &s_defaults, NODECFG_IMAGE_MAX + 16)) {
+      error(what, "configuration changed");
+    }
+    return;
+  }
+
+  if ((s_read.bootCnt != s_defaults.bootCnt) ||
+      memcmp(s_read.mqttVerification, s_defaults.mqttVerification, 16)) {
+    error(what, "field that is not stored changed");
+  }
+
+  image_of(s_imgRead, &s_read);
+  while ((m < s_imageLen) && (s_imgRead[m] == s_imgWritten[m])) {
+    m++;
+  }
+
+  if ((m < lo) || (m > hi) || memcmp(s_imgRead + m, s_imgDefaults + m, s_imageLen - m)) {
+    error(what, "configuration differs");
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  long nRounds = 20000;
+  unsigned seed = 1;
+  size_t len, cut;
+  uint16_t shortLen;
+  char what[64];
+  long nDamaged = 0, nCut = 0, nV1 = 0;
+  double t0, tPack, tUnpack;
+
+  while (-1 != (opt = getopt(argc, argv, "r:s:h"))) {
+    switch (opt) {
+      case 'r':
+        nRounds = atol(optarg);
+        break;
+      case 's':
+        seed = (unsigned) atol(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (nRounds <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  srand(seed);
+
+  for (long r = 0; r < nRounds; r++) {
+
+    // The certificate buffer is not stored and must not be touched.
+    // Every stored byte is changed so it can be told from the default.
+    fill_random(&s_defaults, NODECFG_IMAGE_MAX + 16);
+    memcpy(&s_written, &s_defaults, sizeof(s_written));
+    for (size_t i = 0; i < NODECFG_IMAGE_MAX; i++) {
+      ((uint8_t *) &s_written)[i] ^= 1 + rand() % 255;
+    }
+
+    len = nodecfg_pack(s_blob, sizeof(s_blob), &s_written);
+    if ((len <= NODECFG_HDR_LEN) || (len > NODECFG_BLOB_LEN) || (0 != nodecfg_pack(s_blob, len - 1, &s_written))) {
+      if (s_nErrors++ < 10) {
+        fprintf(stderr, "pack: length %zu\n", len);
+      }
+      continue;
+    }
+    s_imageLen = len - NODECFG_HDR_LEN;
+    image_of(s_imgWritten, &s_written);
+    image_of(s_imgDefaults, &s_defaults);
+
+    // Round trip
+    expect("round trip", s_blob, len, VSCP_ERROR_SUCCESS, s_imageLen, s_imageLen);
+
+    // A bit flipped anywhere
+    memcpy(s_work, s_blob, len);
+    size_t pos = rand() % len;
+    s_work[pos] ^= 1 << (rand() % 8);
+    sprintf(what, "bit flip at %zu", pos);
+    expect(what, s_work, len, VSCP_ERROR_INVALID_FRAME, 0, 0);
+    nDamaged++;
+
+    // A run of random bytes
+    memcpy(s_work, s_blob, len);
+    pos = rand() % len;
+    for (size_t i = pos; (i < len) && (i < pos + 1 + rand() % 64); i++) {
+      s_work[i] = (uint8_t) rand();
+    }
+    if (memcmp(s_work, s_blob, len)) {
+      sprintf(what, "damage at %zu", pos);
+      expect(what, s_work, len, VSCP_ERROR_INVALID_FRAME, 0, 0);
+      nDamaged++;
+    }
+
+    // Cut short, as a write that did not finish
+    cut = rand() % len;
+    sprintf(what, "cut at %zu", cut);
+    expect(what, s_blob, cut, VSCP_ERROR_INVALID_FRAME, 0, 0);
+    nCut++;
+
+    // Older firmware, fields after the image are new
+    shortLen = rand() % s_imageLen;
+    memcpy(s_work, s_blob, len);
+    reseal(s_work, shortLen, NODECFG_VERSION);
+    sprintf(what, "image of %u bytes", shortLen);
+    expect(what,
+           s_work,
+           NODECFG_HDR_LEN + shortLen,
+           VSCP_ERROR_SUCCESS,
+           (shortLen > MAX_FIELD) ? shortLen - MAX_FIELD : 0,
+           shortLen);
+
+    // Newer firmware, fields this firmware does not know are ignored
+    memcpy(s_work, s_blob, len);
+    fill_random(s_work + len, EXTRA_LEN);
+    reseal(s_work, s_imageLen + EXTRA_LEN, NODECFG_VERSION);
+    expect("longer image", s_work, len + EXTRA_LEN, VSCP_ERROR_SUCCESS, s_imageLen, s_imageLen);
+
+    // Version 1, the struct image as it was in memory, is converted
+    memcpy(s_work, s_blob, NODECFG_HDR_LEN);
+    memcpy(s_work + NODECFG_HDR_LEN, &s_written, V1_IMAGE_LEN);
+    reseal(s_work, V1_IMAGE_LEN, V1_VERSION);
+    expect("version 1", s_work, NODECFG_HDR_LEN + V1_IMAGE_LEN, VSCP_ERROR_SUCCESS, s_imageLen, s_imageLen);
+    nV1++;
+
+    // Version 1 with a shorter image. Padding and the boot counter make
+    // it longer than the same fields in the current image.
+    shortLen = rand() % V1_IMAGE_LEN;
+    reseal(s_work, shortLen, V1_VERSION);
+    sprintf(what, "version 1 image of %u bytes", shortLen);
+    expect(what,
+           s_work,
+           NODECFG_HDR_LEN + shortLen,
+           VSCP_ERROR_SUCCESS,
+           (shortLen > 2 * MAX_FIELD) ? shortLen - 2 * MAX_FIELD : 0,
+           shortLen);
+    nV1++;
+
+    // A layout this firmware does not know
+    memcpy(s_work, s_blob, len);
+    reseal(s_work, s_imageLen, (rand() & 1) ? 0 : NODECFG_VERSION + 1 + rand() % 100);
+    expect("unknown version", s_work, len, VSCP_ERROR_NOT_SUPPORTED, 0, 0);
+  }
+
+  // Timing
+  t0 = now_sec();
+  for (long r = 0; r < nRounds; r++) {
+    s_written.bootCnt = r;
+    nodecfg_pack(s_blob, sizeof(s_blob), &s_written);
+  }
+  tPack = now_sec() - t0;
+
+  t0 = now_sec();
+  for (long r = 0; r < nRounds; r++) {
+    nodecfg_unpack(&s_read, s_blob, NODECFG_HDR_LEN + s_imageLen);
+  }
+  tUnpack = now_sec() - t0;
+
+  printf("blob %u bytes (header %u, image %u), version %u\n",
+         (unsigned) (NODECFG_HDR_LEN + s_imageLen),
+         (unsigned) NODECFG_HDR_LEN,
+         (unsigned) s_imageLen,
+         (unsigned) NODECFG_VERSION);
+  printf("%ld rounds, %ld damaged and %ld cut short blobs, %ld version 1 blobs\n", nRounds, nDamaged, nCut, nV1);
+  printf("pack %.2f us, unpack %.2f us\n", tPack * 1e6 / nRounds, tUnpack * 1e6 / nRounds);
+  printf("%s (%ld errors)\n", s_nErrors ? "FAILED" : "OK", s_nErrors);
+
+  return s_nErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
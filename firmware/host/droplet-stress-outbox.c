@@ -0,0 +1,377 @@
+/**
+ * @brief           MQTT flash outbox stress test
+ * @file            droplet-stress-outbox.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Runs the store and forward outbox of the gateway (alpha5/main/outbox.c)
+ * on a file backed partition. Each round stores a burst of messages as
+ * while the broker is away and then drains some of them as after a
+ * reconnect. Power is lost at random points (writes and erases stop
+ * part way) and the outbox is opened again from the file. Checks that
+ * messages come out in order and intact, that every stored message is
+ * either drained or counted as dropped, and reports the erase count of
+ * each sector.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include <vscp.h>
+
+#include "outbox.h"
+
+#define STRESS_MAX_BURST 200 // Messages stored per round at most
+
+/**
+ * @brief One run
+ */
+typedef struct {
+  const esp_partition_t *part;
+  outbox_t ob;
+  outbox_stats_t total;    // Statistics summed over reopens
+  int maxPayload;          // Largest payload
+  long nAttempts;          // Messages offered
+  long nStored;            // Messages the outbox took
+  long nDrained;           // Messages drained, each once
+  long nDuplicates;        // Messages drained again after a power loss
+  long nReopens;           // Power losses
+  long nPopFails;          // Drained messages not marked sent (power loss)
+  long nErrors;            // Order, content and bookkeeping errors
+  long lastSeq;            // Last message drained
+  uint8_t *stored;         // Stored flag per message
+  double tStore;           // Time spent storing
+  double tDrain;           // Time spent draining
+} stress_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -f file    Partition file (default /tmp/droplet-outbox.bin)\n"
+          "  -k kb      Partition size in KB, multiple of 4 (default 64)\n"
+          "  -r rounds  Rounds (default 2000)\n"
+          "  -p pct     Chance of a power loss in a round (default 10)\n"
+          "  -m bytes   Largest payload (default 600)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// make_message
+//
+// Topic holds the sequence number, payload a pattern from it
+//
+
+static uint16_t
+make_message(char *topic, uint8_t *payload, long seq, int maxPayload)
+{
+  uint16_t len = 4 + (seq * 7919) % (maxPayload - 3);
+
+  sprintf(topic, "vscp/outbox/%ld", seq);
+  for (uint16_t i = 0; i < len; i++) {
+    payload[i] = (uint8_t) (seq + i * 31);
+  }
+
+  return len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// reopen
+//
+// After a power loss
+//
+
+static void
+reopen(stress_t *ps)
+{
+  outbox_stats_t *pst = &ps->ob.stats;
+
+  ps->total.nStored += pst->nStored;
+  ps->total.nDrained += pst->nDrained;
+  ps->total.nDropped += pst->nDropped;
+  ps->total.nCorrupt += pst->nCorrupt;
+  ps->total.nErased += pst->nErased;
+  ps->total.nWriteErr += pst->nWriteErr;
+
+  esp_partition_posix_fail_after(ps->part, -1);
+  if (VSCP_ERROR_SUCCESS != outbox_open(&ps->ob, ps->part)) {
+    fprintf(stderr, "Failed to open outbox\n");
+    ps->nErrors++;
+  }
+  ps->nReopens++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// drain
+//
+// Drain up to nMax messages. Returns false on a power loss.
+//
+
+static bool
+drain(stress_t *ps, long nMax)
+{
+  static uint8_t buf[OUTBOX_MAX_BODY + 1];
+  static uint8_t expect[OUTBOX_MAX_BODY];
+  char topic[64];
+  outbox_msg_t msg;
+  long seq;
+  int rv;
+
+  for (long i = 0; i < nMax; i++) {
+    if (VSCP_ERROR_SUCCESS != (rv = outbox_peek(&ps->ob, &msg, buf, sizeof(buf)))) {
+      if (VSCP_ERROR_RCV_EMPTY != rv) {
+        return false;
+      }
+      break;
+    }
+
+    seq = atol(msg.topic + strlen("vscp/outbox/"));
+    if ((seq < 1) || (seq > ps->nAttempts) || !ps->stored[seq - 1] ||
+        (msg.len != make_message(topic, expect, seq, ps->maxPayload)) || strcmp(topic, msg.topic) ||
+        memcmp(expect, msg.payload, msg.len) || (1 != msg.qos) || msg.bRetain) {
+      fprintf(stderr, "Bad message %s len %u\n", msg.topic, msg.len);
+      ps->nErrors++;
+    }
+    else if (seq == ps->lastSeq) {
+      // Pop did not make it to flash before a power loss
+      ps->nDuplicates++;
+    }
+    else if (seq < ps->lastSeq) {
+      fprintf(stderr, "Message %ld drained after %ld\n", seq, ps->lastSeq);
+      ps->nErrors++;
+    }
+    else {
+      ps->lastSeq = seq;
+      ps->nDrained++;
+    }
+
+    if (VSCP_ERROR_SUCCESS != outbox_pop(&ps->ob, msg.id)) {
+      ps->nPopFails++;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// run_round
+//
+
+static void
+run_round(stress_t *ps, int lossPct)
+{
+  static uint8_t payload[OUTBOX_MAX_BODY];
+  char topic[64];
+  long nBurst = rand() % STRESS_MAX_BURST;
+  long nDrain = rand() % (2 * STRESS_MAX_BURST);
+  bool bLoss  = (rand() % 100) < lossPct;
+  bool bStore = rand() % 2;
+  double start;
+  uint16_t len;
+
+  // Power goes while storing or while draining (a drained message
+  // clears four bytes)
+  if (bLoss && bStore) {
+    esp_partition_posix_fail_after(ps->part, rand() % (nBurst * (ps->maxPayload / 2 + 40) + 100));
+  }
+
+  start = now_sec();
+  for (long i = 0; i < nBurst; i++) {
+    len = make_message(topic, payload, ++ps->nAttempts, ps->maxPayload);
+    if (VSCP_ERROR_SUCCESS != outbox_append(&ps->ob, topic, payload, len, 1, false)) {
+      ps->tStore += now_sec() - start;
+      reopen(ps);
+      return;
+    }
+    ps->stored[ps->nAttempts - 1] = 1;
+    ps->nStored++;
+  }
+  ps->tStore += now_sec() - start;
+
+  if (bLoss && !bStore) {
+    esp_partition_posix_fail_after(ps->part, rand() % (4 * nDrain + 4));
+  }
+
+  start = now_sec();
+  if (!drain(ps, nDrain)) {
+    ps->tDrain += now_sec() - start;
+    reopen(ps);
+    return;
+  }
+  ps->tDrain += now_sec() - start;
+
+  // Power was not lost after all
+  esp_partition_posix_fail_after(ps->part, -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  const char *path = "/tmp/droplet-outbox.bin";
+  int sizeKb       = 64;
+  long nRounds     = 2000;
+  int lossPct      = 10;
+  uint32_t minErase = UINT32_MAX, maxErase = 0;
+  long nLost;
+  stress_t st;
+
+  memset(&st, 0, sizeof(st));
+  st.maxPayload = 600;
+  esp_log_level_set("*", ESP_LOG_ERROR);
+
+  while (-1 != (opt = getopt(argc, argv, "f:k:r:p:m:h"))) {
+    switch (opt) {
+      case 'f':
+        path = optarg;
+        break;
+      case 'k':
+        sizeKb = atoi(optarg);
+        break;
+      case 'r':
+        nRounds = atol(optarg);
+        break;
+      case 'p':
+        lossPct = atoi(optarg);
+        break;
+      case 'm':
+        st.maxPayload = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ((sizeKb < 8) || (sizeKb % 4) || (nRounds <= 0) || (lossPct < 0) || (st.maxPayload < 8) ||
+      (st.maxPayload > (OUTBOX_MAX_BODY - 64))) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Start from an empty outbox
+  remove(path);
+  if (NULL == (st.part = esp_partition_posix_add("outbox", path, sizeKb * 1024))) {
+    fprintf(stderr, "Failed to create partition file %s\n", path);
+    return EXIT_FAILURE;
+  }
+
+  if ((NULL == (st.stored = calloc(nRounds * STRESS_MAX_BURST, 1))) ||
+      (VSCP_ERROR_SUCCESS != outbox_open(&st.ob, st.part))) {
+    fprintf(stderr, "Failed to set up\n");
+    return EXIT_FAILURE;
+  }
+
+  srand(1);
+  for (long i = 0; i < nRounds; i++) {
+    run_round(&st, lossPct);
+  }
+
+  // Reconnect for good, drain what is left
+  while (outbox_count(&st.ob)) {
+    if (!drain(&st, LONG_MAX)) {
+      reopen(&st);
+    }
+  }
+  reopen(&st);
+  st.nReopens--;
+
+  // What was stored but not drained must have been dropped. A drained
+  // message that was not marked sent can be dropped as well.
+  nLost = st.nStored - st.nDrained;
+  if ((nLost > (long) st.total.nDropped) || ((long) st.total.nDropped > (nLost + st.nPopFails))) {
+    fprintf(stderr, "%ld messages not drained, %lu counted as dropped\n", nLost, (unsigned long) st.total.nDropped);
+    st.nErrors++;
+  }
+
+  for (uint32_t i = 0; i < (uint32_t) (sizeKb / 4); i++) {
+    uint32_t n = esp_partition_posix_erase_count(st.part, i);
+    minErase   = (n < minErase) ? n : minErase;
+    maxErase   = (n > maxErase) ? n : maxErase;
+  }
+
+  printf("%d KB partition (%d sectors), %ld rounds, %d%% power loss per round\n", sizeKb, sizeKb / 4, nRounds, lossPct);
+  printf("offered    %10ld  stored     %10ld  drained  %10ld\n", st.nAttempts, st.nStored, st.nDrained);
+  printf("dropped    %10lu  duplicates %10ld  corrupt  %10lu\n",
+         (unsigned long) st.total.nDropped,
+         st.nDuplicates,
+         (unsigned long) st.total.nCorrupt);
+  printf("power loss %10ld  erases     %10lu  per sector %lu-%lu\n",
+         st.nReopens,
+         (unsigned long) st.total.nErased,
+         (unsigned long) minErase,
+         (unsigned long) maxErase);
+  printf("store %.0f msg/s, drain %.0f msg/s (file backed)\n",
+         st.tStore ? st.nStored / st.tStore : 0,
+         st.tDrain ? st.nDrained / st.tDrain : 0);
+  printf("%s (%ld errors)\n", st.nErrors ? "FAILED" : "OK", st.nErrors);
+
+  free(st.stored);
+  return st.nErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,428 @@
+/**
+ * @brief           Event ring stress test
+ * @file            droplet-stress-ring.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Runs a producer and a consumer thread against the lock free client
+ * event ring of the gateway VSCP link server (alpha5/main/eventring.c)
+ * and checks that every item is either consumed once, in order, or
+ * dropped once and counted as an overrun. The consumer can be slowed
+ * down to keep the ring full. For comparison the mutex protected queue
+ * the server used before is run the same way, with the same 10 ms mutex
+ * timeout, and its drops counted.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include <vscp.h>
+
+#include "eventring.h"
+
+/**
+ * @brief One run
+ */
+typedef struct {
+  long nItems;             // Items produced
+  int work;                // Consumer spin per item
+  int burst;               // Producer yields after this many items
+  eventring_t ring;        // Ring under test
+  QueueHandle_t queue;     // Queue under test (mutex mode)
+  SemaphoreHandle_t mutex; // Protects queue (mutex mode)
+  uint8_t *consumed;       // Consumed flag per item
+  uint8_t *dropped;        // Dropped flag per item
+  atomic_bool bDone;       // Producer is done
+  long nConsumed;          // Items consumed
+  long nDropped;           // Items dropped
+  long nTimeouts;          // Mutex timeouts (mutex mode)
+  long nErrors;            // Order, duplicate or bad item errors
+} stress_t;
+
+static volatile uint32_t s_sink;
+
+///////////////////////////////////////////////////////////////////////////////
+// usage
+//
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -n items   Items per run (default 10000000)\n"
+          "  -s slots   Ring size, power of two (default 16)\n"
+          "  -w n       Consumer spin per item, makes the ring fill up (default 0)\n"
+          "  -b n       Producer yields after n items, zero never (default 8)\n"
+          "  -m mode    newest, oldest, mutex or all (default all)\n"
+          "  -h         This help\n",
+          name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// now_sec
+//
+
+static double
+now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// drop
+//
+// Producer side bookkeeping for an item that was not delivered.
+//
+
+static void
+drop(stress_t *ps, void *item)
+{
+  long seq = (long) (uintptr_t) item;
+
+  if ((seq < 1) || (seq > ps->nItems) || ps->dropped[seq - 1]) {
+    ps->nErrors++;
+    return;
+  }
+
+  ps->dropped[seq - 1] = 1;
+  ps->nDropped++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// producer_ring
+//
+
+static void *
+producer_ring(void *arg)
+{
+  stress_t *ps = (stress_t *) arg;
+  void *dropped;
+
+  for (long seq = 1; seq <= ps->nItems; seq++) {
+    eventring_push(&ps->ring, (void *) (uintptr_t) seq, &dropped);
+    if (NULL != dropped) {
+      drop(ps, dropped);
+    }
+    if (ps->burst && !(seq % ps->burst)) {
+      sched_yield();
+    }
+  }
+
+  atomic_store(&ps->bDone, true);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// producer_mutex
+//
+// As tcpsrv_sendEventExToAllClients did before the rings.
+//
+
+static void *
+producer_mutex(void *arg)
+{
+  stress_t *ps = (stress_t *) arg;
+
+  for (long seq = 1; seq <= ps->nItems; seq++) {
+    void *item = (void *) (uintptr_t) seq;
+    if (pdTRUE == xSemaphoreTake(ps->mutex, 10 / portTICK_PERIOD_MS)) {
+      if (pdTRUE != xQueueSend(ps->queue, &item, 0)) {
+        drop(ps, item);
+      }
+      xSemaphoreGive(ps->mutex);
+    }
+    else {
+      ps->nTimeouts++;
+      drop(ps, item);
+    }
+    if (ps->burst && !(seq % ps->burst)) {
+      sched_yield();
+    }
+  }
+
+  atomic_store(&ps->bDone, true);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// consume
+//
+// Check an item. Items must come in order and only once.
+//
+
+static void
+consume(stress_t *ps, void *item, long *plast)
+{
+  long seq = (long) (uintptr_t) item;
+
+  if ((seq <= *plast) || (seq > ps->nItems) || ps->consumed[seq - 1]) {
+    ps->nErrors++;
+    return;
+  }
+
+  ps->consumed[seq - 1] = 1;
+  ps->nConsumed++;
+  *plast = seq;
+
+  for (int i = 0; i < ps->work; i++) {
+    s_sink += i;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// consumer_ring
+//
+
+static void *
+consumer_ring(void *arg)
+{
+  stress_t *ps = (stress_t *) arg;
+  long last    = 0;
+  void *item;
+
+  for (;;) {
+    bool bDone = atomic_load(&ps->bDone);
+    if (eventring_pop(&ps->ring, &item)) {
+      consume(ps, item, &last);
+    }
+    else if (bDone) {
+      break;
+    }
+    else {
+      sched_yield(); // Server task sleeps in select
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// consumer_mutex
+//
+// As vscp_link_callback_rcvloop did before the rings.
+//
+
+static void *
+consumer_mutex(void *arg)
+{
+  stress_t *ps = (stress_t *) arg;
+  long last    = 0;
+  void *item;
+
+  for (;;) {
+    bool bDone = atomic_load(&ps->bDone);
+    bool bGot  = false;
+    if (pdTRUE == xSemaphoreTake(ps->mutex, 0)) {
+      bGot = (pdTRUE == xQueueReceive(ps->queue, &item, 0));
+      xSemaphoreGive(ps->mutex);
+    }
+    if (bGot) {
+      consume(ps, item, &last);
+    }
+    else if (bDone && !uxQueueMessagesWaiting(ps->queue)) {
+      break;
+    }
+    else {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// run
+//
+// Returns 0 if every item was accounted for.
+//
+
+static int
+run(const char *mode, long nItems, uint32_t size, int work, int burst)
+{
+  bool bMutex = !strcmp(mode, "mutex");
+  pthread_t producer, consumer;
+  stress_t st;
+  double start, t;
+  long nLost = 0;
+  long nOverruns;
+
+  memset(&st, 0, sizeof(st));
+  st.nItems   = nItems;
+  st.work     = work;
+  st.burst    = burst;
+  st.consumed = calloc(nItems, 1);
+  st.dropped  = calloc(nItems, 1);
+  atomic_init(&st.bDone, false);
+  if ((NULL == st.consumed) || (NULL == st.dropped)) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  if (bMutex) {
+    st.queue = xQueueCreate(size, sizeof(void *));
+    st.mutex = xSemaphoreCreateMutex();
+    if ((NULL == st.queue) || (NULL == st.mutex)) {
+      fprintf(stderr, "Failed to create queue\n");
+      return -1;
+    }
+  }
+  else if (VSCP_ERROR_SUCCESS !=
+           eventring_init(&st.ring, size, strcmp(mode, "oldest") ? EVENTRING_DROP_NEWEST : EVENTRING_DROP_OLDEST)) {
+    fprintf(stderr, "Failed to create ring (size must be a power of two)\n");
+    return -1;
+  }
+
+  start = now_sec();
+  pthread_create(&consumer, NULL, bMutex ? consumer_mutex : consumer_ring, &st);
+  pthread_create(&producer, NULL, bMutex ? producer_mutex : producer_ring, &st);
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+  t = now_sec() - start;
+
+  for (long i = 0; i < nItems; i++) {
+    if (st.consumed[i] == st.dropped[i]) {
+      nLost++; // Neither or both
+    }
+  }
+
+  nOverruns = bMutex ? st.nDropped : (long) atomic_load(&st.ring.nOverruns);
+
+  printf("%-7s %5u %5d %11.0f %10ld %10ld %10ld %9ld %7ld %7ld %s\n",
+         mode,
+         size,
+         work,
+         nItems / t,
+         st.nConsumed,
+         st.nDropped,
+         nOverruns,
+         st.nTimeouts,
+         st.nErrors,
+         nLost,
+         (!st.nErrors && !nLost && (nOverruns == st.nDropped)) ? "ok" : "FAIL");
+
+  if (bMutex) {
+    vQueueDelete(st.queue);
+    vSemaphoreDelete(st.mutex);
+  }
+  else {
+    eventring_free(&st.ring);
+  }
+  free(st.consumed);
+  free(st.dropped);
+
+  return (!st.nErrors && !nLost && (nOverruns == st.nDropped)) ? 0 : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// main
+//
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  long nItems       = 10000000;
+  uint32_t size     = 16;
+  int work          = 0;
+  int burst         = 8;
+  const char *mode  = "all";
+  const char *all[] = { "newest", "oldest", "mutex" };
+  int rv            = 0;
+
+  while (-1 != (opt = getopt(argc, argv, "n:s:w:b:m:h"))) {
+    switch (opt) {
+      case 'n':
+        nItems = atol(optarg);
+        break;
+      case 's':
+        size = (uint32_t) atol(optarg);
+        break;
+      case 'w':
+        work = atoi(optarg);
+        break;
+      case 'b':
+        burst = atoi(optarg);
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if ((nItems <= 0) || (work < 0) || (burst < 0)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%-7s %5s %5s %11s %10s %10s %10s %9s %7s %7s\n",
+         "mode",
+         "slots",
+         "work",
+         "items/s",
+         "consumed",
+         "dropped",
+         "overruns",
+         "timeouts",
+         "errors",
+         "lost");
+
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+    if (!strcmp(mode, "all") || !strcmp(mode, all[i])) {
+      rv |= run(all[i], nItems, size, work, burst);
+    }
+  }
+
+  return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
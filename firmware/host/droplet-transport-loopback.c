@@ -0,0 +1,165 @@
+/**
+ * @brief           VSCP droplet loopback transport
+ * @file            droplet-transport-loopback.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Sent frames go to an application callback and received frames are
+ * injected by the application. Nothing leaves the process.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include "droplet-host.h"
+
+static droplet_loopback_sink_t s_sink = NULL;
+static void *s_sinkUserdata           = NULL;
+static uint8_t s_mac[DROPLET_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static uint8_t s_channel               = PRJDEF_DROPLET_CHANNEL;
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_loopback_set_sink
+//
+
+void
+droplet_loopback_set_sink(droplet_loopback_sink_t sink, void *userdata)
+{
+  s_sink         = sink;
+  s_sinkUserdata = userdata;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_loopback_set_mac
+//
+
+void
+droplet_loopback_set_mac(const uint8_t *mac)
+{
+  memcpy(s_mac, mac, DROPLET_ADDR_LEN);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_loopback_inject
+//
+
+void
+droplet_loopback_inject(const uint8_t *src_addr, int8_t rssi, const uint8_t *data, size_t len)
+{
+  wifi_pkt_rx_ctrl_t rx_ctrl;
+
+  memset(&rx_ctrl, 0, sizeof(rx_ctrl));
+  rx_ctrl.rssi      = rssi;
+  rx_ctrl.channel   = s_channel;
+  rx_ctrl.timestamp = (uint32_t) esp_timer_get_time();
+  rx_ctrl.sig_len   = (unsigned) len;
+
+  droplet_transport_recv(src_addr, s_mac, &rx_ctrl, data, (int) len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// loopback_init
+//
+
+static esp_err_t
+loopback_init(const droplet_config_t *config)
+{
+  if (config->channel) {
+    s_channel = config->channel;
+  }
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// loopback_send
+//
+
+static esp_err_t
+loopback_send(const uint8_t *dest_addr, const uint8_t *data, size_t len)
+{
+  if (NULL != s_sink) {
+    s_sink(dest_addr, data, len, s_sinkUserdata);
+  }
+  droplet_transport_send_cb(dest_addr, true);
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// loopback_get_mac
+//
+
+static esp_err_t
+loopback_get_mac(uint8_t *mac)
+{
+  memcpy(mac, s_mac, DROPLET_ADDR_LEN);
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// loopback_get_channel
+//
+
+static esp_err_t
+loopback_get_channel(uint8_t *channel)
+{
+  *channel = s_channel;
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// loopback_set_channel
+//
+
+static esp_err_t
+loopback_set_channel(uint8_t channel)
+{
+  s_channel = channel;
+  return ESP_OK;
+}
+
+const droplet_transport_t g_droplet_transport_loopback = {
+  .name        = "loopback",
+  .init        = loopback_init,
+  .send        = loopback_send,
+  .get_mac     = loopback_get_mac,
+  .get_channel = loopback_get_channel,
+  .set_channel = loopback_set_channel,
+};
@@ -0,0 +1,340 @@
+/**
+ * @brief           VSCP droplet UDP multicast transport
+ * @file            droplet-transport-udp.c
+ * @author          Ake Hedman, The VSCP Project, www.vscp.org
+ *
+ * Every droplet frame is sent as one multicast datagram
+ *
+ *   | dest addr (6) | src addr (6) | channel (1) | droplet frame |
+ *
+ * All nodes joined to the group get the frame just as all nodes in
+ * radio range get an esp-now broadcast.
+ *
+ *********************************************************************/
+
+/* ******************************************************************************
+ * VSCP (Very Simple Control Protocol)
+ * http://www.vscp.org
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2000-2023 Ake Hedman, the VSCP project <info@vscp.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *  This file is part of VSCP - Very Simple Control Protocol
+ *  http://www.vscp.org
+ *
+ * ******************************************************************************
+ */
+
+#include "vscp-compiler.h"
+#include "vscp-projdefs.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "droplet-host.h"
+
+static const char *TAG = "droplet-udp";
+
+#define UDP_HDR_LEN (2 * DROPLET_ADDR_LEN + 1)
+
+static char s_group[INET_ADDRSTRLEN] = DROPLET_UDP_DEFAULT_GROUP;
+static uint16_t s_port               = DROPLET_UDP_DEFAULT_PORT;
+static uint8_t s_mac[DROPLET_ADDR_LEN];
+static bool s_bMacSet   = false;
+static uint8_t s_channel = PRJDEF_DROPLET_CHANNEL;
+
+static int s_sock = -1;
+static struct sockaddr_in s_groupAddr;
+static pthread_t s_rxThread;
+static volatile bool s_bRun = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// droplet_transport_udp_config
+//
+
+esp_err_t
+droplet_transport_udp_config(const char *group, uint16_t port, const uint8_t *mac)
+{
+  if (s_sock >= 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (NULL != group) {
+    if (strlen(group) >= sizeof(s_group)) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(s_group, group);
+  }
+
+  if (port) {
+    s_port = port;
+  }
+
+  if (NULL != mac) {
+    memcpy(s_mac, mac, DROPLET_ADDR_LEN);
+    s_bMacSet = true;
+  }
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_rx_thread
+//
+
+static void *
+udp_rx_thread(void *arg)
+{
+  uint8_t buf[UDP_HDR_LEN + DROPLET_MAX_AIR_FRAME];
+
+  (void) arg;
+
+  while (s_bRun) {
+    ssize_t n = recv(s_sock, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if ((EINTR == errno) || (EAGAIN == errno)) {
+        continue;
+      }
+      if (s_bRun) {
+        ESP_LOGE(TAG, "recv failed errno=%d", errno);
+      }
+      break;
+    }
+
+    if (n <= UDP_HDR_LEN) {
+      continue;
+    }
+
+    const uint8_t *dest = buf;
+    const uint8_t *src  = buf + DROPLET_ADDR_LEN;
+
+    // Our own frames come back as multicast loop is on
+    if (!memcmp(src, s_mac, DROPLET_ADDR_LEN)) {
+      continue;
+    }
+
+    // Only broadcast and frames to us are received (as esp-now does)
+    if (!DROPLET_ADDR_IS_BROADCAST(dest) && memcmp(dest, s_mac, DROPLET_ADDR_LEN)) {
+      continue;
+    }
+
+    wifi_pkt_rx_ctrl_t rx_ctrl;
+    memset(&rx_ctrl, 0, sizeof(rx_ctrl));
+    rx_ctrl.rssi      = -40;
+    rx_ctrl.channel   = buf[2 * DROPLET_ADDR_LEN];
+    rx_ctrl.timestamp = (uint32_t) esp_timer_get_time();
+    rx_ctrl.sig_len   = (unsigned) (n - UDP_HDR_LEN);
+
+    droplet_transport_recv(src, dest, &rx_ctrl, buf + UDP_HDR_LEN, (int) (n - UDP_HDR_LEN));
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_init
+//
+
+static esp_err_t
+udp_init(const droplet_config_t *config)
+{
+  int on = 1;
+  struct sockaddr_in addr;
+  struct ip_mreq mreq;
+
+  if (config->channel) {
+    s_channel = config->channel;
+  }
+
+  if (!s_bMacSet) {
+    esp_fill_random(s_mac, DROPLET_ADDR_LEN);
+    s_mac[0] = (s_mac[0] & 0xfc) | 0x02; // Locally administered, unicast
+  }
+
+  memset(&s_groupAddr, 0, sizeof(s_groupAddr));
+  s_groupAddr.sin_family = AF_INET;
+  s_groupAddr.sin_port   = htons(s_port);
+  if (1 != inet_pton(AF_INET, s_group, &s_groupAddr.sin_addr)) {
+    ESP_LOGE(TAG, "Invalid multicast group %s", s_group);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if ((s_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    ESP_LOGE(TAG, "Failed to create socket errno=%d", errno);
+    return ESP_FAIL;
+  }
+
+  setsockopt(s_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+  setsockopt(s_sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(s_port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(s_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    ESP_LOGE(TAG, "Failed to bind port %u errno=%d", s_port, errno);
+    goto ERROR;
+  }
+
+  mreq.imr_multiaddr        = s_groupAddr.sin_addr;
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (setsockopt(s_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+    ESP_LOGE(TAG, "Failed to join group %s errno=%d", s_group, errno);
+    goto ERROR;
+  }
+
+  // Other nodes on the same machine must see our frames
+  unsigned char loop = 1;
+  unsigned char ttl  = 1;
+  setsockopt(s_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  setsockopt(s_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+  s_bRun = true;
+  if (0 != pthread_create(&s_rxThread, NULL, udp_rx_thread, NULL)) {
+    s_bRun = false;
+    goto ERROR;
+  }
+
+  ESP_LOGI(TAG, "UDP transport on %s:%u mac " MACSTR, s_group, s_port, MAC2STR(s_mac));
+
+  return ESP_OK;
+
+ERROR:
+  close(s_sock);
+  s_sock = -1;
+  return ESP_FAIL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_deinit
+//
+
+static esp_err_t
+udp_deinit(void)
+{
+  if (s_sock < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  s_bRun = false;
+  shutdown(s_sock, SHUT_RDWR);
+  close(s_sock);
+  pthread_join(s_rxThread, NULL);
+  s_sock = -1;
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_send
+//
+// Send confirmation is given right away as there is no link level ack.
+//
+
+static esp_err_t
+udp_send(const uint8_t *dest_addr, const uint8_t *data, size_t len)
+{
+  uint8_t buf[UDP_HDR_LEN + DROPLET_MAX_AIR_FRAME];
+
+  if ((NULL == dest_addr) || (NULL == data)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (len > (sizeof(buf) - UDP_HDR_LEN)) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  if (s_sock < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  memcpy(buf, dest_addr, DROPLET_ADDR_LEN);
+  memcpy(buf + DROPLET_ADDR_LEN, s_mac, DROPLET_ADDR_LEN);
+  buf[2 * DROPLET_ADDR_LEN] = s_channel;
+  memcpy(buf + UDP_HDR_LEN, data, len);
+
+  if (sendto(s_sock, buf, UDP_HDR_LEN + len, 0, (struct sockaddr *) &s_groupAddr, sizeof(s_groupAddr)) < 0) {
+    ESP_LOGE(TAG, "sendto failed errno=%d", errno);
+    droplet_transport_send_cb(dest_addr, false);
+    return ESP_FAIL;
+  }
+
+  droplet_transport_send_cb(dest_addr, true);
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_get_mac
+//
+
+static esp_err_t
+udp_get_mac(uint8_t *mac)
+{
+  memcpy(mac, s_mac, DROPLET_ADDR_LEN);
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_get_channel
+//
+
+static esp_err_t
+udp_get_channel(uint8_t *channel)
+{
+  *channel = s_channel;
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// udp_set_channel
+//
+
+static esp_err_t
+udp_set_channel(uint8_t channel)
+{
+  s_channel = channel;
+  return ESP_OK;
+}
+
+const droplet_transport_t g_droplet_transport_udp = {
+  .name        = "udp",
+  .init        = udp_init,
+  .deinit      = udp_deinit,
+  .send        = udp_send,
+  .get_mac     = udp_get_mac,
+  .get_channel = udp_get_channel,
+  .set_channel = udp_set_channel,
+};
@@ -0,0 +1,265 @@
+/**
+ * @brief           ESP-IDF flash partitions on POSIX
+ * @file            esp-partition-posix.c
+ *
+ * File backed partitions with NOR flash rules, erase counters and
+ * fault injection for host builds.
+ *
+ *********************************************************************/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#define POSIX_PARTITION_MAX 4
+
+typedef struct {
+  esp_partition_t part; // First so the public pointer is this entry
+  int fd;
+  long failAfter;       // Bytes left before writes fail, negative for no limit
+  uint32_t *pEraseCnt;  // Erases per sector
+} posix_partition_t;
+
+static posix_partition_t s_partitions[POSIX_PARTITION_MAX];
+static int s_nPartitions;
+
+static const char *TAG = "partition";
+
+///////////////////////////////////////////////////////////////////////////////
+// posix_partition_get
+//
+
+static posix_partition_t *
+posix_partition_get(const esp_partition_t *partition)
+{
+  for (int i = 0; i < s_nPartitions; i++) {
+    if (&s_partitions[i].part == partition) {
+      return &s_partitions[i];
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// posix_partition_check
+//
+
+static posix_partition_t *
+posix_partition_check(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  posix_partition_t *pp = posix_partition_get(partition);
+
+  if ((NULL == pp) || (offset > pp->part.size) || (size > (pp->part.size - offset))) {
+    return NULL;
+  }
+
+  return pp;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_posix_add
+//
+
+const esp_partition_t *
+esp_partition_posix_add(const char *label, const char *path, uint32_t size)
+{
+  posix_partition_t *pp;
+  struct stat st;
+  uint8_t erased[SPI_FLASH_SEC_SIZE];
+
+  if ((NULL == label) || (NULL == path) || !size || (size % SPI_FLASH_SEC_SIZE) ||
+      (s_nPartitions >= POSIX_PARTITION_MAX)) {
+    return NULL;
+  }
+
+  pp = &s_partitions[s_nPartitions];
+  memset(pp, 0, sizeof(posix_partition_t));
+
+  if (-1 == (pp->fd = open(path, O_RDWR | O_CREAT, 0644))) {
+    ESP_LOGE(TAG, "Failed to open %s", path);
+    return NULL;
+  }
+
+  // A new (or resized) file starts erased
+  if ((0 != fstat(pp->fd, &st)) || (st.st_size != (off_t) size)) {
+    memset(erased, 0xff, sizeof(erased));
+    if (0 != ftruncate(pp->fd, 0)) {
+      close(pp->fd);
+      return NULL;
+    }
+    for (uint32_t pos = 0; pos < size; pos += SPI_FLASH_SEC_SIZE) {
+      if (sizeof(erased) != pwrite(pp->fd, erased, sizeof(erased), pos)) {
+        close(pp->fd);
+        return NULL;
+      }
+    }
+  }
+
+  if (NULL == (pp->pEraseCnt = calloc(size / SPI_FLASH_SEC_SIZE, sizeof(uint32_t)))) {
+    close(pp->fd);
+    return NULL;
+  }
+
+  pp->part.type       = ESP_PARTITION_TYPE_DATA;
+  pp->part.subtype    = ESP_PARTITION_SUBTYPE_ANY;
+  pp->part.size       = size;
+  pp->part.erase_size = SPI_FLASH_SEC_SIZE;
+  pp->failAfter       = -1;
+  strncpy(pp->part.label, label, sizeof(pp->part.label) - 1);
+  s_nPartitions++;
+
+  return &pp->part;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_posix_fail_after
+//
+
+void
+esp_partition_posix_fail_after(const esp_partition_t *partition, long nBytes)
+{
+  posix_partition_t *pp = posix_partition_get(partition);
+
+  if (NULL != pp) {
+    pp->failAfter = nBytes;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_posix_erase_count
+//
+
+uint32_t
+esp_partition_posix_erase_count(const esp_partition_t *partition, uint32_t sector)
+{
+  posix_partition_t *pp = posix_partition_get(partition);
+
+  if ((NULL == pp) || (sector >= (pp->part.size / SPI_FLASH_SEC_SIZE))) {
+    return 0;
+  }
+
+  return pp->pEraseCnt[sector];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_find_first
+//
+
+const esp_partition_t *
+esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+  for (int i = 0; i < s_nPartitions; i++) {
+    esp_partition_t *p = &s_partitions[i].part;
+    if (((ESP_PARTITION_TYPE_ANY == type) || (p->type == type)) &&
+        ((ESP_PARTITION_SUBTYPE_ANY == subtype) || (p->subtype == subtype)) &&
+        ((NULL == label) || !strncmp(p->label, label, sizeof(p->label)))) {
+      return p;
+    }
+  }
+
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_read
+//
+
+esp_err_t
+esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  posix_partition_t *pp = posix_partition_check(partition, src_offset, size);
+
+  if ((NULL == pp) || (NULL == dst)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if ((ssize_t) size != pread(pp->fd, dst, size, src_offset)) {
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_write
+//
+// Bits can only go from one to zero, as on flash
+//
+
+esp_err_t
+esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+  posix_partition_t *pp = posix_partition_check(partition, dst_offset, size);
+  const uint8_t *psrc   = (const uint8_t *) src;
+  uint8_t buf[256];
+  size_t n;
+  bool bFail = false;
+
+  if ((NULL == pp) || (NULL == src)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if ((pp->failAfter >= 0) && ((size_t) pp->failAfter < size)) {
+    size  = pp->failAfter;
+    bFail = true;
+  }
+  if (pp->failAfter >= 0) {
+    pp->failAfter -= size;
+  }
+
+  while (size) {
+    n = (size < sizeof(buf)) ? size : sizeof(buf);
+    if ((ssize_t) n != pread(pp->fd, buf, n, dst_offset)) {
+      return ESP_FAIL;
+    }
+    for (size_t i = 0; i < n; i++) {
+      buf[i] &= psrc[i];
+    }
+    if ((ssize_t) n != pwrite(pp->fd, buf, n, dst_offset)) {
+      return ESP_FAIL;
+    }
+    psrc += n;
+    dst_offset += n;
+    size -= n;
+  }
+
+  return bFail ? ESP_FAIL : ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_partition_erase_range
+//
+
+esp_err_t
+esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  posix_partition_t *pp = posix_partition_check(partition, offset, size);
+  uint8_t erased[SPI_FLASH_SEC_SIZE];
+
+  if ((NULL == pp) || (offset % SPI_FLASH_SEC_SIZE) || (size % SPI_FLASH_SEC_SIZE)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(erased, 0xff, sizeof(erased));
+  for (; size; offset += SPI_FLASH_SEC_SIZE, size -= SPI_FLASH_SEC_SIZE) {
+    if (0 == pp->failAfter) {
+      return ESP_FAIL;
+    }
+    if (pp->failAfter > 0) {
+      pp->failAfter--;
+    }
+    if (sizeof(erased) != pwrite(pp->fd, erased, sizeof(erased), offset)) {
+      return ESP_FAIL;
+    }
+    pp->pEraseCnt[offset / SPI_FLASH_SEC_SIZE]++;
+  }
+
+  return ESP_OK;
+}
@@ -0,0 +1,198 @@
+/**
+ * @brief           ESP-IDF system functions on POSIX
+ * @file            esp-posix.c
+ *
+ * Logging, time, random numbers and error names for host builds.
+ *
+ *********************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+esp_log_level_t g_esp_log_level = ESP_LOG_INFO;
+
+static int64_t s_start_time = -1;
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_err_to_name
+//
+
+const char *
+esp_err_to_name(esp_err_t code)
+{
+  switch (code) {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_FAIL:
+      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+      return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+      return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+      return "ESP_ERR_TIMEOUT";
+    default:
+      return "UNKNOWN ERROR";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_timer_get_time
+//
+
+int64_t
+esp_timer_get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  int64_t now = (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  if (s_start_time < 0) {
+    s_start_time = now;
+  }
+  return now - s_start_time;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_log_level_set
+//
+
+void
+esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+  (void) tag;
+  g_esp_log_level = level;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_log_timestamp
+//
+
+uint32_t
+esp_log_timestamp(void)
+{
+  return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_log_write
+//
+
+void
+esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  (void) level;
+  (void) tag;
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_log_buffer_hexdump
+//
+
+void
+esp_log_buffer_hexdump(const char *tag, const void *buffer, uint16_t len, esp_log_level_t level)
+{
+  const uint8_t *p = (const uint8_t *) buffer;
+
+  if (g_esp_log_level < level) {
+    return;
+  }
+
+  for (uint16_t i = 0; i < len; i += 16) {
+    char line[80];
+    int n = snprintf(line, sizeof(line), "%p ", (void *) (p + i));
+    for (uint16_t j = i; (j < i + 16) && (j < len); j++) {
+      n += snprintf(line + n, sizeof(line) - n, "%02x ", p[j]);
+    }
+    fprintf(stderr, "%s: %s\n", tag, line);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_log_buffer_hex
+//
+
+void
+esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t len)
+{
+  esp_log_buffer_hexdump(tag, buffer, len, ESP_LOG_INFO);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_fill_random
+//
+
+void
+esp_fill_random(void *buf, size_t len)
+{
+  uint8_t *p = (uint8_t *) buf;
+  while (len) {
+    ssize_t n = getrandom(p, len, 0);
+    if (n <= 0) {
+      // Should not happen but never leave the buffer unset
+      for (; len; len--) {
+        *p++ = (uint8_t) rand();
+      }
+      return;
+    }
+    p += n;
+    len -= (size_t) n;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_random
+//
+
+uint32_t
+esp_random(void)
+{
+  uint32_t rnd;
+  esp_fill_random(&rnd, sizeof(rnd));
+  return rnd;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_get_free_heap_size
+//
+// Not meaningful on a host
+//
+
+uint32_t
+esp_get_free_heap_size(void)
+{
+  return UINT32_MAX;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// esp_restart
+//
+
+void
+esp_restart(void)
+{
+  fprintf(stderr, "esp_restart() called, exiting\n");
+  exit(EXIT_FAILURE);
+}
@@ -0,0 +1,604 @@
+/**
+ * @brief           FreeRTOS API subset on POSIX threads
+ * @file            freertos-posix.c
+ *
+ * Enough of tasks, queues, semaphores and event groups to run the
+ * droplet core on a host. Ticks are milliseconds.
+ *
+ *********************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *arg;
+};
+
+struct host_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t count;
+  UBaseType_t head; // Next item to read
+  uint8_t *items;
+};
+
+struct host_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+struct host_event_group {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  EventBits_t bits;
+};
+
+static __thread struct host_task *s_current_task;
+
+///////////////////////////////////////////////////////////////////////////////
+// deadline_from_ticks
+//
+// Absolute CLOCK_MONOTONIC deadline for a tick timeout
+//
+
+static void
+deadline_from_ticks(struct timespec *ts, TickType_t ticks)
+{
+  clock_gettime(CLOCK_MONOTONIC, ts);
+  ts->tv_sec += ticks / 1000;
+  ts->tv_nsec += (long) (ticks % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// cond_init
+//
+
+static void
+cond_init(pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// cond_wait_ticks
+//
+// Wait on condition with FreeRTOS timeout semantics. Returns
+// ETIMEDOUT when the timeout expired.
+//
+
+static int
+cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline, TickType_t ticks)
+{
+  if (portMAX_DELAY == ticks) {
+    return pthread_cond_wait(cond, mutex);
+  }
+  if (0 == ticks) {
+    return ETIMEDOUT;
+  }
+  return pthread_cond_timedwait(cond, mutex, deadline);
+}
+
+// ----------------------------------------------------------------------------
+//                                   Tasks
+// ----------------------------------------------------------------------------
+
+static void *
+task_trampoline(void *arg)
+{
+  struct host_task *ptask = (struct host_task *) arg;
+  s_current_task          = ptask;
+  ptask->fn(ptask->arg);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xTaskCreate
+//
+
+BaseType_t
+xTaskCreate(TaskFunction_t pxTaskCode,
+            const char *pcName,
+            uint32_t usStackDepth,
+            void *pvParameters,
+            UBaseType_t uxPriority,
+            TaskHandle_t *pxCreatedTask)
+{
+  (void) pcName;
+  (void) usStackDepth;
+  (void) uxPriority;
+
+  struct host_task *ptask = calloc(1, sizeof(struct host_task));
+  if (NULL == ptask) {
+    return pdFAIL;
+  }
+
+  ptask->fn  = pxTaskCode;
+  ptask->arg = pvParameters;
+
+  if (0 != pthread_create(&ptask->thread, NULL, task_trampoline, ptask)) {
+    free(ptask);
+    return pdFAIL;
+  }
+  pthread_detach(ptask->thread);
+
+  if (NULL != pxCreatedTask) {
+    *pxCreatedTask = ptask;
+  }
+
+  return pdPASS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vTaskDelete
+//
+// Only deleting the calling task (NULL or own handle) is supported.
+// The task record is leaked for other handles as a thread can't be
+// stopped safely from the outside.
+//
+
+void
+vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+  if ((NULL == xTaskToDelete) || (xTaskToDelete == s_current_task)) {
+    free(s_current_task);
+    s_current_task = NULL;
+    pthread_exit(NULL);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vTaskDelay
+//
+
+void
+vTaskDelay(TickType_t xTicksToDelay)
+{
+  struct timespec ts;
+  ts.tv_sec  = xTicksToDelay / 1000;
+  ts.tv_nsec = (long) (xTicksToDelay % 1000) * 1000000L;
+  while ((-1 == nanosleep(&ts, &ts)) && (EINTR == errno))
+    ;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xTaskGetTickCount
+//
+
+TickType_t
+xTaskGetTickCount(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (TickType_t) ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000L);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xTaskGetCurrentTaskHandle
+//
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle(void)
+{
+  return s_current_task;
+}
+
+// ----------------------------------------------------------------------------
+//                                   Queues
+// ----------------------------------------------------------------------------
+
+///////////////////////////////////////////////////////////////////////////////
+// xQueueCreate
+//
+
+QueueHandle_t
+xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+  if (!uxQueueLength || !uxItemSize) {
+    return NULL;
+  }
+
+  struct host_queue *pq = calloc(1, sizeof(struct host_queue));
+  if (NULL == pq) {
+    return NULL;
+  }
+
+  pq->items = malloc((size_t) uxQueueLength * uxItemSize);
+  if (NULL == pq->items) {
+    free(pq);
+    return NULL;
+  }
+
+  pq->length   = uxQueueLength;
+  pq->itemSize = uxItemSize;
+  pthread_mutex_init(&pq->mutex, NULL);
+  cond_init(&pq->notEmpty);
+  cond_init(&pq->notFull);
+
+  return pq;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vQueueDelete
+//
+
+void
+vQueueDelete(QueueHandle_t xQueue)
+{
+  if (NULL == xQueue) {
+    return;
+  }
+  pthread_cond_destroy(&xQueue->notEmpty);
+  pthread_cond_destroy(&xQueue->notFull);
+  pthread_mutex_destroy(&xQueue->mutex);
+  free(xQueue->items);
+  free(xQueue);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// queue_send
+//
+
+static BaseType_t
+queue_send(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait, bool bFront)
+{
+  struct timespec deadline;
+  deadline_from_ticks(&deadline, xTicksToWait);
+
+  pthread_mutex_lock(&xQueue->mutex);
+  while (xQueue->count == xQueue->length) {
+    if (ETIMEDOUT == cond_wait_ticks(&xQueue->notFull, &xQueue->mutex, &deadline, xTicksToWait)) {
+      pthread_mutex_unlock(&xQueue->mutex);
+      return errQUEUE_FULL;
+    }
+  }
+
+  UBaseType_t pos;
+  if (bFront) {
+    xQueue->head = (xQueue->head + xQueue->length - 1) % xQueue->length;
+    pos          = xQueue->head;
+  }
+  else {
+    pos = (xQueue->head + xQueue->count) % xQueue->length;
+  }
+  memcpy(xQueue->items + (size_t) pos * xQueue->itemSize, pvItemToQueue, xQueue->itemSize);
+  xQueue->count++;
+
+  pthread_cond_signal(&xQueue->notEmpty);
+  pthread_mutex_unlock(&xQueue->mutex);
+
+  return pdPASS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xQueueSend
+//
+
+BaseType_t
+xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+  return queue_send(xQueue, pvItemToQueue, xTicksToWait, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xQueueSendToFront
+//
+
+BaseType_t
+xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+  return queue_send(xQueue, pvItemToQueue, xTicksToWait, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xQueueReceive
+//
+
+BaseType_t
+xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+  struct timespec deadline;
+  deadline_from_ticks(&deadline, xTicksToWait);
+
+  pthread_mutex_lock(&xQueue->mutex);
+  while (0 == xQueue->count) {
+    if (ETIMEDOUT == cond_wait_ticks(&xQueue->notEmpty, &xQueue->mutex, &deadline, xTicksToWait)) {
+      pthread_mutex_unlock(&xQueue->mutex);
+      return pdFALSE;
+    }
+  }
+
+  memcpy(pvBuffer, xQueue->items + (size_t) xQueue->head * xQueue->itemSize, xQueue->itemSize);
+  xQueue->head = (xQueue->head + 1) % xQueue->length;
+  xQueue->count--;
+
+  pthread_cond_signal(&xQueue->notFull);
+  pthread_mutex_unlock(&xQueue->mutex);
+
+  return pdTRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xQueueReset
+//
+
+BaseType_t
+xQueueReset(QueueHandle_t xQueue)
+{
+  pthread_mutex_lock(&xQueue->mutex);
+  xQueue->count = 0;
+  xQueue->head  = 0;
+  pthread_cond_broadcast(&xQueue->notFull);
+  pthread_mutex_unlock(&xQueue->mutex);
+  return pdPASS;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// uxQueueMessagesWaiting
+//
+
+UBaseType_t
+uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+  pthread_mutex_lock(&xQueue->mutex);
+  UBaseType_t cnt = xQueue->count;
+  pthread_mutex_unlock(&xQueue->mutex);
+  return cnt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// uxQueueSpacesAvailable
+//
+
+UBaseType_t
+uxQueueSpacesAvailable(QueueHandle_t xQueue)
+{
+  pthread_mutex_lock(&xQueue->mutex);
+  UBaseType_t cnt = xQueue->length - xQueue->count;
+  pthread_mutex_unlock(&xQueue->mutex);
+  return cnt;
+}
+
+// ----------------------------------------------------------------------------
+//                                 Semaphores
+// ----------------------------------------------------------------------------
+
+///////////////////////////////////////////////////////////////////////////////
+// xSemaphoreCreateCounting
+//
+
+SemaphoreHandle_t
+xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+  struct host_semaphore *psem = calloc(1, sizeof(struct host_semaphore));
+  if (NULL == psem) {
+    return NULL;
+  }
+
+  psem->count = uxInitialCount;
+  psem->max   = uxMaxCount;
+  pthread_mutex_init(&psem->mutex, NULL);
+  cond_init(&psem->cond);
+
+  return psem;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xSemaphoreCreateMutex
+//
+// A mutex starts out given. Priority inheritance and recursion is not
+// emulated.
+//
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void)
+{
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xSemaphoreCreateBinary
+//
+
+SemaphoreHandle_t
+xSemaphoreCreateBinary(void)
+{
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vSemaphoreDelete
+//
+
+void
+vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+  if (NULL == xSemaphore) {
+    return;
+  }
+  pthread_cond_destroy(&xSemaphore->cond);
+  pthread_mutex_destroy(&xSemaphore->mutex);
+  free(xSemaphore);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xSemaphoreTake
+//
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+  struct timespec deadline;
+  deadline_from_ticks(&deadline, xBlockTime);
+
+  pthread_mutex_lock(&xSemaphore->mutex);
+  while (0 == xSemaphore->count) {
+    if (ETIMEDOUT == cond_wait_ticks(&xSemaphore->cond, &xSemaphore->mutex, &deadline, xBlockTime)) {
+      pthread_mutex_unlock(&xSemaphore->mutex);
+      return pdFALSE;
+    }
+  }
+  xSemaphore->count--;
+  pthread_mutex_unlock(&xSemaphore->mutex);
+
+  return pdTRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xSemaphoreGive
+//
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+  BaseType_t rv = pdFALSE;
+
+  pthread_mutex_lock(&xSemaphore->mutex);
+  if (xSemaphore->count < xSemaphore->max) {
+    xSemaphore->count++;
+    pthread_cond_signal(&xSemaphore->cond);
+    rv = pdTRUE;
+  }
+  pthread_mutex_unlock(&xSemaphore->mutex);
+
+  return rv;
+}
+
+// ----------------------------------------------------------------------------
+//                                Event groups
+// ----------------------------------------------------------------------------
+
+///////////////////////////////////////////////////////////////////////////////
+// xEventGroupCreate
+//
+
+EventGroupHandle_t
+xEventGroupCreate(void)
+{
+  struct host_event_group *peg = calloc(1, sizeof(struct host_event_group));
+  if (NULL == peg) {
+    return NULL;
+  }
+
+  pthread_mutex_init(&peg->mutex, NULL);
+  cond_init(&peg->cond);
+
+  return peg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// vEventGroupDelete
+//
+
+void
+vEventGroupDelete(EventGroupHandle_t xEventGroup)
+{
+  if (NULL == xEventGroup) {
+    return;
+  }
+  pthread_cond_destroy(&xEventGroup->cond);
+  pthread_mutex_destroy(&xEventGroup->mutex);
+  free(xEventGroup);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xEventGroupSetBits
+//
+
+EventBits_t
+xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+  pthread_mutex_lock(&xEventGroup->mutex);
+  xEventGroup->bits |= uxBitsToSet;
+  EventBits_t bits = xEventGroup->bits;
+  pthread_cond_broadcast(&xEventGroup->cond);
+  pthread_mutex_unlock(&xEventGroup->mutex);
+  return bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xEventGroupClearBits
+//
+// Returns the bits as they were before clearing as FreeRTOS does.
+//
+
+EventBits_t
+xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+  pthread_mutex_lock(&xEventGroup->mutex);
+  EventBits_t bits = xEventGroup->bits;
+  xEventGroup->bits &= ~uxBitsToClear;
+  pthread_mutex_unlock(&xEventGroup->mutex);
+  return bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xEventGroupGetBits
+//
+
+EventBits_t
+xEventGroupGetBits(EventGroupHandle_t xEventGroup)
+{
+  pthread_mutex_lock(&xEventGroup->mutex);
+  EventBits_t bits = xEventGroup->bits;
+  pthread_mutex_unlock(&xEventGroup->mutex);
+  return bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// xEventGroupWaitBits
+//
+
+EventBits_t
+xEventGroupWaitBits(EventGroupHandle_t xEventGroup,
+                    const EventBits_t uxBitsToWaitFor,
+                    const BaseType_t xClearOnExit,
+                    const BaseType_t xWaitForAllBits,
+                    TickType_t xTicksToWait)
+{
+  struct timespec deadline;
+  deadline_from_ticks(&deadline, xTicksToWait);
+
+  pthread_mutex_lock(&xEventGroup->mutex);
+  for (;;) {
+    EventBits_t match = xEventGroup->bits & uxBitsToWaitFor;
+    if (xWaitForAllBits ? (match == uxBitsToWaitFor) : (0 != match)) {
+      EventBits_t bits = xEventGroup->bits;
+      if (xClearOnExit) {
+        xEventGroup->bits &= ~uxBitsToWaitFor;
+      }
+      pthread_mutex_unlock(&xEventGroup->mutex);
+      return bits;
+    }
+    if (ETIMEDOUT == cond_wait_ticks(&xEventGroup->cond, &xEventGroup->mutex, &deadline, xTicksToWait)) {
+      break;
+    }
+  }
+
+  EventBits_t bits = xEventGroup->bits;
+  pthread_mutex_unlock(&xEventGroup->mutex);
+  return bits;
+}
@@ -0,0 +1,32 @@
+/**
+ * @brief           ESP-IDF check macros for host builds
+ * @file            esp_check.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_CHECK_H
+#define HOST_ESP_CHECK_H
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#define ESP_RETURN_ON_ERROR(x, log_tag, format, ...)                                                                   \
+  do {                                                                                                                 \
+    esp_err_t err_rc_ = (x);                                                                                           \
+    if (ESP_OK != err_rc_) {                                                                                           \
+      ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);                                     \
+      return err_rc_;                                                                                                  \
+    }                                                                                                                  \
+  } while (0)
+
+#define ESP_RETURN_ON_FALSE(a, err_code, log_tag, format, ...)                                                         \
+  do {                                                                                                                 \
+    if (!(a)) {                                                                                                        \
+      ESP_LOGE(log_tag, "%s(%d): " format, __FUNCTION__, __LINE__, ##__VA_ARGS__);                                     \
+      return err_code;                                                                                                 \
+    }                                                                                                                  \
+  } while (0)
+
+#endif
@@ -0,0 +1,69 @@
+/**
+ * @brief           ESP-IDF logging for host builds
+ * @file            esp_log.h
+ *
+ * Log lines go to stderr. The level is global, per tag levels are
+ * not supported.
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+extern esp_log_level_t g_esp_log_level;
+
+void
+esp_log_level_set(const char *tag, esp_log_level_t level);
+
+uint32_t
+esp_log_timestamp(void);
+
+void
+esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+  __attribute__((format(printf, 3, 4)));
+
+void
+esp_log_buffer_hexdump(const char *tag, const void *buffer, uint16_t len, esp_log_level_t level);
+
+void
+esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t len);
+
+#define ESP_LOG_LEVEL(level, letter, tag, format, ...)                                                                 \
+  do {                                                                                                                 \
+    if (g_esp_log_level >= (level)) {                                                                                  \
+      esp_log_write((level), (tag), letter " (%u) %s: " format "\n", esp_log_timestamp(), (tag), ##__VA_ARGS__);       \
+    }                                                                                                                  \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buffer, buff_len, level) esp_log_buffer_hexdump((tag), (buffer), (buff_len), (level))
+#define ESP_LOG_BUFFER_HEX(tag, buffer, buff_len)            esp_log_buffer_hex((tag), (buffer), (buff_len))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @brief           ESP-IDF MAC helpers for host builds
+ * @file            esp_mac.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_MAC_H
+#define HOST_ESP_MAC_H
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define MACSTR     "%02x:%02x:%02x:%02x:%02x:%02x"
+
+#endif
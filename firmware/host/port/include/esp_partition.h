@@ -0,0 +1,103 @@
+/**
+ * @brief           ESP-IDF flash partitions for host builds
+ * @file            esp_partition.h
+ *
+ * Partitions are backed by files and behave like NOR flash. Erase
+ * sets 0xff in whole sectors and write can only clear bits. Files are
+ * bound to a label with esp_partition_posix_add.
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_PARTITION_H
+#define HOST_ESP_PARTITION_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP  = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+  ESP_PARTITION_TYPE_ANY  = 0xff,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+  ESP_PARTITION_SUBTYPE_ANY      = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+  void *flash_chip;
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  uint32_t address;
+  uint32_t size;
+  uint32_t erase_size;
+  char label[17];
+  bool encrypted;
+  bool readonly;
+} esp_partition_t;
+
+const esp_partition_t *
+esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+
+esp_err_t
+esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+
+esp_err_t
+esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+
+esp_err_t
+esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+/**
+ * @brief Add a data partition backed by a file (host only)
+ *
+ * The file is created erased if it does not exist or has another size.
+ *
+ * @param label Partition label
+ * @param path File
+ * @param size Partition size, a multiple of SPI_FLASH_SEC_SIZE
+ * @return The partition or NULL on failure
+ */
+const esp_partition_t *
+esp_partition_posix_add(const char *label, const char *path, uint32_t size);
+
+/**
+ * @brief Fail writes and erases after a number of bytes (host only)
+ *
+ * Simulates power loss. The write that runs out is done in part and
+ * fails, and so does everything after it until the limit is set again.
+ * A negative limit turns this off.
+ *
+ * @param partition Partition
+ * @param nBytes Bytes that can still be written, an erase counts as one
+ */
+void
+esp_partition_posix_fail_after(const esp_partition_t *partition, long nBytes);
+
+/**
+ * @brief Times a sector has been erased (host only)
+ *
+ * @param partition Partition
+ * @param sector Sector index in partition
+ * @return Erase count
+ */
+uint32_t
+esp_partition_posix_erase_count(const esp_partition_t *partition, uint32_t sector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * @brief           ESP-IDF random numbers for host builds
+ * @file            esp_random.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_RANDOM_H
+#define HOST_ESP_RANDOM_H
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t
+esp_random(void);
+
+void
+esp_fill_random(void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+/**
+ * @brief           ESP-IDF system functions for host builds
+ * @file            esp_system.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t
+esp_get_free_heap_size(void);
+
+void
+esp_restart(void) __attribute__((noreturn));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
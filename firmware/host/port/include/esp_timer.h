@@ -0,0 +1,28 @@
+/**
+ * @brief           ESP-IDF timer for host builds
+ * @file            esp_timer.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Microseconds since start (CLOCK_MONOTONIC)
+ */
+int64_t
+esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
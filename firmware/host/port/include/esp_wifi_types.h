@@ -0,0 +1,32 @@
+/**
+ * @brief           ESP-IDF wifi types for host builds
+ * @file            esp_wifi_types.h
+ *
+ * Only the receive control structure handed to the droplet core
+ * by a transport is defined.
+ *
+ *********************************************************************/
+
+#ifndef HOST_ESP_WIFI_TYPES_H
+#define HOST_ESP_WIFI_TYPES_H
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef struct {
+  signed rssi : 8;
+  unsigned rate : 5;
+  unsigned : 1;
+  unsigned sig_mode : 2;
+  unsigned channel : 4;
+  unsigned secondary_channel : 4;
+  unsigned timestamp : 32;
+  signed noise_floor : 8;
+  unsigned sig_len : 12;
+  unsigned rx_state : 8;
+} wifi_pkt_rx_ctrl_t;
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @brief           FreeRTOS API subset for host builds
+ * @file            FreeRTOS.h
+ *
+ * Only what the droplet stack and its tools use is here. Tasks are
+ * POSIX threads and ticks are milliseconds.
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_bit_defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE  ((BaseType_t) 1)
+#define pdFAIL  (pdFALSE)
+#define pdPASS  (pdTRUE)
+
+#define configTICK_RATE_HZ   ((TickType_t) CONFIG_FREERTOS_HZ)
+#define portMAX_DELAY        ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS   ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t) (((TickType_t) (xTimeInMs) * configTICK_RATE_HZ) / (TickType_t) 1000U))
+
+#define errQUEUE_FULL ((BaseType_t) 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
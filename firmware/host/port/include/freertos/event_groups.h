@@ -0,0 +1,47 @@
+/**
+ * @brief           FreeRTOS event group API subset for host builds
+ * @file            event_groups.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_EVENT_GROUPS_H
+#define HOST_FREERTOS_EVENT_GROUPS_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_event_group *EventGroupHandle_t;
+typedef TickType_t EventBits_t;
+
+EventGroupHandle_t
+xEventGroupCreate(void);
+
+void
+vEventGroupDelete(EventGroupHandle_t xEventGroup);
+
+EventBits_t
+xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet);
+
+EventBits_t
+xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear);
+
+EventBits_t
+xEventGroupGetBits(EventGroupHandle_t xEventGroup);
+
+EventBits_t
+xEventGroupWaitBits(EventGroupHandle_t xEventGroup,
+                    const EventBits_t uxBitsToWaitFor,
+                    const BaseType_t xClearOnExit,
+                    const BaseType_t xWaitForAllBits,
+                    TickType_t xTicksToWait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @brief           FreeRTOS queue API subset for host builds
+ * @file            queue.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_queue *QueueHandle_t;
+
+QueueHandle_t
+xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+
+void
+vQueueDelete(QueueHandle_t xQueue);
+
+BaseType_t
+xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+
+BaseType_t
+xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+
+BaseType_t
+xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+
+BaseType_t
+xQueueReset(QueueHandle_t xQueue);
+
+UBaseType_t
+uxQueueMessagesWaiting(QueueHandle_t xQueue);
+
+UBaseType_t
+uxQueueSpacesAvailable(QueueHandle_t xQueue);
+
+#define xQueueSendToBack(xQueue, pvItemToQueue, xTicksToWait) xQueueSend((xQueue), (pvItemToQueue), (xTicksToWait))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
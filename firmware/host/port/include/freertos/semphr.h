@@ -0,0 +1,42 @@
+/**
+ * @brief           FreeRTOS semaphore API subset for host builds
+ * @file            semphr.h
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_semaphore *SemaphoreHandle_t;
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void);
+
+SemaphoreHandle_t
+xSemaphoreCreateBinary(void);
+
+SemaphoreHandle_t
+xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount);
+
+void
+vSemaphoreDelete(SemaphoreHandle_t xSemaphore);
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
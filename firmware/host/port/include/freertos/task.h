@@ -0,0 +1,48 @@
+/**
+ * @brief           FreeRTOS task API subset for host builds
+ * @file            task.h
+ *
+ * Tasks are detached POSIX threads. Priorities and stack sizes are
+ * accepted but ignored.
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t
+xTaskCreate(TaskFunction_t pxTaskCode,
+            const char *pcName,
+            uint32_t usStackDepth,
+            void *pvParameters,
+            UBaseType_t uxPriority,
+            TaskHandle_t *pxCreatedTask);
+
+void
+vTaskDelete(TaskHandle_t xTaskToDelete);
+
+void
+vTaskDelay(TickType_t xTicksToDelay);
+
+TickType_t
+xTaskGetTickCount(void);
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+/**
+ * @brief           FreeRTOS timer API for host builds
+ * @file            timers.h
+ *
+ * Included by the droplet code but no timer functions are used.
+ *
+ *********************************************************************/
+
+#ifndef HOST_FREERTOS_TIMERS_H
+#define HOST_FREERTOS_TIMERS_H
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#endif
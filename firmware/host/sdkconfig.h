@@ -0,0 +1,17 @@
+/*
+  sdkconfig.h
+
+  Configuration values normally generated by menuconfig that the
+  droplet code depends on. Used for host builds only.
+*/
+
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+// Tick rate. One tick is one millisecond on the host.
+#define CONFIG_FREERTOS_HZ 1000
+
+// Number of dynamic WiFi TX buffers (limits frames in transit)
+#define CONFIG_ESP32_WIFI_DYNAMIC_TX_BUFFER_NUM 32
+
+#endif
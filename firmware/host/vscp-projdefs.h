@@ -0,0 +1,31 @@
+/*
+  projdefs.h
+
+  Project definitions for the host (POSIX) build of the droplet stack.
+*/
+
+#ifndef _VSCP_PROJDEFS_H_
+#define _VSCP_PROJDEFS_H_
+
+// ----------------------------------------------------------------------------
+//                        VSCP helper lib defines
+// ----------------------------------------------------------------------------
+
+#define VSCP_FWHLP_CRYPTO_SUPPORT // AES crypto support
+
+// ----------------------------------------------------------------------------
+
+// Node type for this node
+#define PRJDEF_NODE_TYPE VSCP_DROPLET_BETA
+
+// 16-bit nickname for node
+#define PRJDEF_NODE_NICKNAME 0
+
+// Channel used for droplet traffic. Carried in the host transports
+// so the adjacent channel filter works as on target.
+#define PRJDEF_DROPLET_CHANNEL 1
+
+// Interface for peers. Not used by the host transports.
+#define PRJDEF_DROPLET_WIFI_IF 0
+
+#endif // _VSCP_PROJDEFS_H_